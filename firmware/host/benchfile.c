@@ -0,0 +1,342 @@
+//*	What the file transfer benchmarks share.
+//	----------------------------------------
+//
+//	ymbench and zmbench both run a transfer protocol on the simulated
+//	board, with the console on a pty and a stand-in for the host
+//	program, a child process, on the other end of it.  Here is what
+//	they have in common:
+//
+//	  1)  The card: a fresh volume on an image file, with the test
+//	      file on it, whose bytes come from BenchPattern so that what
+//	      arrives can be checked wherever it lands.
+//	  2)  One run: make the pty, start the stand-in, put the board's
+//	      console on the pty, run the board's end and time it, then
+//	      hang up and collect the stand-in's exit status.
+//	  3)  The stand-in's input, read through a buffer, with a
+//	      timeout so that a board that's stopped answering doesn't
+//	      hang the child.
+//
+//	What's done with a run--whether it passed and how it's shown--is
+//	up to the bench.
+//
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pty.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "globals.h"
+#include "filedef.h"
+#include "ff.h"
+#include "diskio.h"
+#include "usbserial.h"
+#include "pertsim.h"
+#include "simboard.h"
+#include "benchfile.h"
+
+#define HOST_TIMEOUT	20000		// msec, stand-in's wait
+
+FILE
+  *BenchReport;
+
+static pid_t
+  Child;			// the host end
+
+//  The stand-in's input.
+
+static uint8_t
+  InBuf[ 8192];
+static int
+  InLen,
+  InPos;
+
+//  Prototypes.
+
+static void HostGone( void);
+
+//	BenchStart - Set up the report and the card.
+//	--------------------------------------------
+//
+//	Makes a volume on the card image at Image (Megabytes, if it has
+//	to be made) and puts Size bytes of the test file on it as Name.
+//	Any failure ends the run with exit status 2.
+//
+
+void BenchStart( const char *Image, uint32_t Megabytes, const char *Name,
+  uint32_t Size)
+{
+
+  static uint8_t
+    work[ FF_MAX_SS * 8];
+
+  if ( !(BenchReport = fdopen( dup( 1), "w")))
+    exit( 2);
+  setvbuf( stdout, NULL, _IOFBF, BUFSIZ);	// the console; raw data
+
+  if ( !SimBoardDisk( Image, Megabytes) ||
+    f_mkfs( "", 0, work, sizeof( work)) != FR_OK ||
+    f_mount( &SDfs, "", 1) != FR_OK)
+  {
+    fprintf( stderr, "Can't make a volume on the card image.\n");
+    exit( 2);
+  }
+  strcpy( CurrentPath, "/");
+  if ( !BenchMakeFile( Name, Size))
+  {
+    fprintf( stderr, "Can't write %s on the card.\n", Name);
+    exit( 2);
+  }
+  SimBoardAtEnd( HostGone);
+  return;
+} // BenchStart
+
+//	BenchRun - One transfer.
+//	------------------------
+//
+//	Host runs in the child, on the pty's master side; Board runs
+//	here, with the console on the slave side.  Both get Flags.
+//
+
+void BenchRun( int (*Host)( int Fd, int Flags),
+  XERR_CODE (*Board)( int Flags), int Flags, BENCH_RESULT *Result)
+{
+
+  struct termios
+    tio;
+  struct timespec
+    start,
+    end;
+  uint64_t
+    began;
+  int
+    master,
+    slave,
+    null,
+    status;
+
+  memset( &tio, 0, sizeof( tio));
+  cfmakeraw( &tio);
+  if ( openpty( &master, &slave, NULL, &tio, NULL) < 0)
+  {
+    fprintf( stderr, "Can't make a pty.\n");
+    exit( 2);
+  }
+  fflush( BenchReport);
+
+  if ( (Child = fork()) == 0)
+  {
+    close( slave);
+    InLen = InPos = 0;
+    _exit( Host( master, Flags));
+  }
+  close( master);
+
+//  The board's console is the pty now.
+
+  fflush( stdout);
+  dup2( slave, 0);
+  dup2( slave, 1);
+  close( slave);
+  USClear();
+
+  clock_gettime( CLOCK_MONOTONIC, &start);
+  began = SimTime();
+  Result->Xerr = Board( Flags);
+  fflush( stdout);
+  Result->Secs = (double) (SimTime() - began) / SIM_CPU_HZ;
+  clock_gettime( CLOCK_MONOTONIC, &end);
+  Result->Real = (end.tv_sec - start.tv_sec) +
+    (end.tv_nsec - start.tv_nsec) / 1e9;
+
+//  Hang up, leaving the console on /dev/null, so the next pty's not
+//  given 0 or 1.
+
+  null = open( "/dev/null", O_RDWR);
+  dup2( null, 0);
+  dup2( null, 1);
+  close( null);
+  waitpid( Child, &status, 0);
+  Result->Host = WIFEXITED( status) ? WEXITSTATUS( status) : -1;
+  return;
+} // BenchRun
+
+//	BenchMakeFile - Write the test file on the card.
+//	------------------------------------------------
+//
+
+bool BenchMakeFile( const char *Name, uint32_t Size)
+{
+
+  FIL
+    cf;
+  UINT
+    wc;
+  uint32_t
+    pos,
+    n,
+    i;
+  bool
+    ok;
+
+  if ( f_open( &cf, Name, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK)
+    return false;
+  ok = true;
+  for ( pos = 0; ok && pos < Size; pos += n)
+  {
+    n = Size - pos < TAPE_BUFFER_SIZE ? Size - pos : TAPE_BUFFER_SIZE;
+    disk_claim( TapeBuffer, n);		// card may still own it
+    for ( i = 0; i < n; i++)
+      TapeBuffer[ i] = BenchPattern( pos + i);
+    ok = f_write( &cf, TapeBuffer, n, &wc) == FR_OK && wc == n;
+  }
+  return f_close( &cf) == FR_OK && ok;
+} // BenchMakeFile
+
+//	BenchCheckFile - See that the card has Size bytes of the test file.
+//	-------------------------------------------------------------------
+//
+
+bool BenchCheckFile( const char *Name, uint32_t Size)
+{
+
+  FIL
+    cf;
+  UINT
+    rc;
+  uint32_t
+    pos,
+    i;
+  bool
+    ok;
+
+  if ( f_open( &cf, Name, FA_READ) != FR_OK)
+    return false;
+  ok = f_size( &cf) == Size;
+  for ( pos = 0; ok && pos < Size; pos += rc)
+  {
+    if ( f_read( &cf, TapeBuffer, TAPE_BUFFER_SIZE, &rc) != FR_OK || !rc)
+      ok = false;
+    for ( i = 0; ok && i < rc; i++)
+      ok = TapeBuffer[ i] == BenchPattern( pos + i);
+  }
+  f_close( &cf);
+  return ok;
+} // BenchCheckFile
+
+//	BenchPattern - What the test file has at Offset.
+//	------------------------------------------------
+//
+//	Every byte value turns up, so everything that a protocol has to
+//	escape is.
+//
+
+uint8_t BenchPattern( uint32_t Offset)
+{
+  return (uint8_t) (Offset * 7 + (Offset >> 10));
+} // BenchPattern
+
+//*	The stand-in's input.
+//	=====================
+
+//	BenchGetChar - Get a character, or -1 if none comes.
+//	----------------------------------------------------
+//
+
+int BenchGetChar( int Fd)
+{
+
+  struct pollfd
+    pfd = { Fd, POLLIN, 0 };
+
+  if ( InPos == InLen)
+  {
+    if ( poll( &pfd, 1, HOST_TIMEOUT) <= 0 ||
+      (InLen = (int) read( Fd, InBuf, sizeof( InBuf))) <= 0)
+    {
+      InLen = InPos = 0;
+      return -1;
+    }
+    InPos = 0;
+  }
+  return InBuf[ InPos++];
+} // BenchGetChar
+
+//	BenchGetAll - Get Count bytes; false if they don't all come.
+//	------------------------------------------------------------
+//
+
+bool BenchGetAll( int Fd, uint8_t *Buf, int Count)
+{
+
+  int
+    c;
+
+  while ( Count-- > 0)
+  {
+    if ( (c = BenchGetChar( Fd)) < 0)
+      return false;
+    *Buf++ = (uint8_t) c;
+  }
+  return true;
+} // BenchGetAll
+
+//	BenchPeekChar - The next character, left there; -1 if none yet.
+//	----------------------------------------------------------------
+//
+//	Doesn't wait.  -1 also if the board has hung up.
+//
+
+int BenchPeekChar( int Fd)
+{
+
+  struct pollfd
+    pfd = { Fd, POLLIN, 0 };
+
+  if ( InPos == InLen)
+  {
+    if ( poll( &pfd, 1, 0) <= 0 ||
+      (InLen = (int) read( Fd, InBuf, sizeof( InBuf))) <= 0)
+    {
+      InLen = InPos = 0;
+      return -1;
+    }
+    InPos = 0;
+  }
+  return InBuf[ InPos];
+} // BenchPeekChar
+
+//	BenchDropInput - Forget whatever's buffered.
+//	--------------------------------------------
+//
+
+void BenchDropInput( void)
+{
+
+  InPos = InLen;
+  return;
+} // BenchDropInput
+
+//	HostGone - The stand-in closed the pty on us.
+//	---------------------------------------------
+//
+
+static void HostGone( void)
+{
+
+  int
+    status;
+
+  waitpid( Child, &status, 0);
+  fprintf( BenchReport, "The host end quit at step %d.\n",
+    WIFEXITED( status) ? WEXITSTATUS( status) : -1);
+  fflush( BenchReport);
+  _exit( 1);
+} // HostGone
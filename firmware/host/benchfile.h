@@ -0,0 +1,41 @@
+#ifndef _BENCHFILE_INC
+#define _BENCHFILE_INC
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "ymodem.h"
+
+//  What ymbench and zmbench share: a card with a test file on it, and
+//  one transfer run with the board's console on a pty and a stand-in
+//  for the host program on the other end; see benchfile.c.
+
+//  How one run went.
+
+typedef struct
+{
+  XERR_CODE Xerr;		// what the board's end returned
+  int Host;			// the stand-in's exit status, or -1
+  double Secs;			// simulated time taken
+  double Real;			// ... and real time
+} BENCH_RESULT;
+
+extern FILE *BenchReport;	// stdout, before the pty took it over
+
+void BenchStart( const char *Image, uint32_t Megabytes, const char *Name,
+  uint32_t Size);
+void BenchRun( int (*Host)( int Fd, int Flags),
+  XERR_CODE (*Board)( int Flags), int Flags, BENCH_RESULT *Result);
+bool BenchMakeFile( const char *Name, uint32_t Size);
+bool BenchCheckFile( const char *Name, uint32_t Size);
+uint8_t BenchPattern( uint32_t Offset);
+
+//  The stand-in's input, buffered.
+
+int BenchGetChar( int Fd);
+bool BenchGetAll( int Fd, uint8_t *Buf, int Count);
+int BenchPeekChar( int Fd);
+void BenchDropInput( void);
+
+#endif
@@ -0,0 +1,170 @@
+//*	CRC-16 kernel benchmark.
+//	------------------------
+//
+//	Times the real CRC16Add (src/crc16.c), four bytes at a time,
+//	against the byte-at-a-time table walk it replaced, over YMODEM
+//	blocks and over the short runs the input queue hands GetBlock.
+//	First, though, it checks the new kernel against a CRC worked out
+//	a bit at a time: every length up to 64 at every alignment, and a
+//	block carried on across runs of every size.
+//
+//	These are host times, so they show the ratio rather than what
+//	the board gets; the exit status says whether the CRCs agreed.
+//
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "crc16.h"
+
+#define BLOCK		1024		// a YMODEM block
+#define TOTAL		(64 * 1024 * 1024)	// bytes per timing
+#define RUN		64		// a USB packet's worth
+
+static uint8_t
+  Data[ BLOCK + 8];
+static uint16_t
+  Table[256];
+
+//  Prototypes.
+
+static bool Check( void);
+static double Time( bool New, int Length);
+static uint16_t Walk( uint16_t Crc, const uint8_t *Buf, int Count);
+static uint16_t Bitwise( uint16_t Crc, const uint8_t *Buf, int Count);
+
+int main( void)
+{
+
+  double
+    oldRate,
+    newRate;
+  int
+    i,
+    length;
+
+  for ( i = 0; i < (int) sizeof( Data); i++)
+    Data[ i] = (uint8_t) (i * 7 + (i >> 3));
+  for ( i = 0; i < 256; i++)
+  {
+    uint8_t
+      b = (uint8_t) i;
+
+    Table[ i] = Bitwise( 0, &b, 1);
+  }
+
+  if ( !Check())
+  {
+    printf( "CRC16Add disagrees with the bitwise CRC.\n");
+    return 1;
+  }
+  printf( "CRC16Add agrees with the bitwise CRC.\n\n");
+
+  for ( length = RUN; length <= BLOCK; length *= 4)
+  {
+    oldRate = Time( false, length);
+    newRate = Time( true, length);
+    printf( "  %4d-byte runs: table walk %7.1f MB/sec, sliced %7.1f MB/sec"
+      " (%.2fx)\n", length, oldRate, newRate, newRate / oldRate);
+  }
+  return 0;
+} // main
+
+//	Check - Compare CRC16Add with the bitwise CRC.
+//	----------------------------------------------
+//
+
+static bool Check( void)
+{
+
+  uint16_t
+    crc;
+  int
+    length,
+    offset,
+    run,
+    done;
+
+  for ( offset = 0; offset < 8; offset++)
+    for ( length = 0; length <= 64; length++)
+      if ( CRC16Add( 0, Data + offset, (uint16_t) length) !=
+        Bitwise( 0, Data + offset, length))
+        return false;
+
+  for ( run = 1; run <= 67; run++)
+  {
+    crc = 0;
+    for ( done = 0; done < BLOCK; done += run)
+      crc = CRC16Add( crc, Data + done,
+        (uint16_t) (BLOCK - done < run ? BLOCK - done : run));
+    if ( crc != Bitwise( 0, Data, BLOCK) || crc != CRC16( Data, BLOCK))
+      return false;
+  }
+  return true;
+} // Check
+
+//	Time - MB/sec for one kernel, Length bytes at a time.
+//	-----------------------------------------------------
+//
+
+static double Time( bool New, int Length)
+{
+
+  struct timespec
+    start,
+    end;
+  volatile uint16_t
+    sink;
+  uint16_t
+    crc;
+  long
+    i;
+  double
+    secs;
+
+  crc = 0;
+  clock_gettime( CLOCK_MONOTONIC, &start);
+  for ( i = 0; i < TOTAL / Length; i++)
+    crc = New ? CRC16Add( crc, Data, (uint16_t) Length) :
+      Walk( crc, Data, Length);
+  clock_gettime( CLOCK_MONOTONIC, &end);
+  sink = crc;
+  (void) sink;
+  secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+  return TOTAL / secs / (1024 * 1024);
+} // Time
+
+//	Walk - The old kernel: a table lookup per byte.
+//	-----------------------------------------------
+//
+
+static uint16_t Walk( uint16_t Crc, const uint8_t *Buf, int Count)
+{
+
+  while ( Count--)
+    Crc = (uint16_t) (Crc << 8) ^ Table[ ((Crc >> 8) ^ *Buf++) & 255];
+  return Crc;
+} // Walk
+
+//	Bitwise - CRC-16/XMODEM, a bit at a time.
+//	-----------------------------------------
+//
+
+static uint16_t Bitwise( uint16_t Crc, const uint8_t *Buf, int Count)
+{
+
+  int
+    i;
+
+  while ( Count--)
+  {
+    Crc ^= (uint16_t) (*Buf++ << 8);
+    for ( i = 0; i < 8; i++)
+      Crc = (Crc & 0x8000) ? (uint16_t) ((Crc << 1) ^ 0x1021) :
+        (uint16_t) (Crc << 1);
+  }
+  return Crc;
+} // Bitwise
@@ -0,0 +1,45 @@
+#ifndef _HOST_GPIO_INC
+#define _HOST_GPIO_INC
+
+//  Host stand-in for libopencm3 GPIO, for the pin definitions in
+//  gpiodef.h.  Port "addresses" are just indices.  There are no
+//  functions; the host build reaches the board through the port
+//  layer (pertport.h, host/simport.c).
+
+#include <stdint.h>
+
+#define GPIOA	0
+#define GPIOB	1
+#define GPIOC	2
+#define GPIOD	3
+#define GPIOE	4
+
+#define GPIO0	(1 << 0)
+#define GPIO1	(1 << 1)
+#define GPIO2	(1 << 2)
+#define GPIO3	(1 << 3)
+#define GPIO4	(1 << 4)
+#define GPIO5	(1 << 5)
+#define GPIO6	(1 << 6)
+#define GPIO7	(1 << 7)
+#define GPIO8	(1 << 8)
+#define GPIO9	(1 << 9)
+#define GPIO10	(1 << 10)
+#define GPIO11	(1 << 11)
+#define GPIO12	(1 << 12)
+#define GPIO13	(1 << 13)
+#define GPIO14	(1 << 14)
+#define GPIO15	(1 << 15)
+
+#define GPIO_MODE_INPUT		0
+#define GPIO_MODE_OUTPUT	1
+#define GPIO_MODE_AF		2
+#define GPIO_MODE_ANALOG	3
+
+#define GPIO_PUPD_NONE		0
+#define GPIO_PUPD_PULLUP	1
+#define GPIO_PUPD_PULLDOWN	2
+
+#define GPIO_AF1		1
+
+#endif
@@ -0,0 +1,450 @@
+//*	USB disk check.
+//	---------------
+//
+//	Runs the mass storage code (src/mscbot.c) against a card image,
+//	the way USBDISK runs it on the board, with this program in the
+//	USB host's place: CBWs and data go in a packet at a time, data
+//	and CSWs come back the same way, and MscService is called
+//	between packets just as the board's loop calls it.  The card is
+//	simboard.c's, so a buffer handed back before its write is done
+//	shows up as bad data.
+//
+//	The commands are the ones a host sends to mount, read, write and
+//	eject a disk, plus the usual ways of getting things wrong.  Each
+//	check is reported; the exit status says whether any failed.
+//
+//	Usage: mscsim [card image]	(made, 16 MB, if it doesn't exist)
+//
+
+#define MAIN
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "globals.h"
+#include "ff.h"
+#include "diskio.h"
+#include "mscbot.h"
+#include "pertsim.h"
+#include "simboard.h"
+
+#define CARD_MB		16
+#define SPIN_LIMIT	100000		// calls before we call it hung
+#define MAX_SECTORS	256		// in one command here
+
+#define CBW_LENGTH	31
+#define CSW_LENGTH	13
+
+static uint8_t
+  Data[ MAX_SECTORS * MSC_SECTOR_SIZE],	// the host's
+  Expect[ MAX_SECTORS * MSC_SECTOR_SIZE];
+static uint32_t
+  Tag,
+  Residue;				// from the last CSW
+static int
+  Failures;
+
+//  Prototypes.
+
+static int Run( const uint8_t *Cb, int CbLength, bool In, uint32_t Length,
+                uint8_t *Buf, uint32_t *Got);
+static bool SendPacket( const uint8_t *Packet, int Length);
+static int TakePacket( uint8_t *Packet);
+static int Simple( uint8_t Op);
+static int Rw( uint8_t Op, uint32_t Lba, uint32_t Count, uint8_t *Buf);
+static uint8_t Sense( void);
+static void Pattern( uint8_t *Buf, uint32_t Lba, uint32_t Count, int Seed);
+static void Check( const char *What, bool Ok);
+static uint32_t GetBE32( const uint8_t *Where);
+static void PutLE32( uint8_t *Where, uint32_t What);
+static void PutBE32( uint8_t *Where, uint32_t What);
+
+int main( int argc, char *argv[])
+{
+
+  uint8_t
+    cb[ 16];
+  uint32_t
+    sectors,
+    last,
+    got,
+    lba;
+  LBA_t
+    count;
+  int
+    st,
+    i;
+
+  if ( !SimBoardDisk( argc > 1 ? argv[1] : "mscsim.img", CARD_MB) ||
+    disk_ioctl( 0, GET_SECTOR_COUNT, &count) != RES_OK)
+  {
+    fprintf( stderr, "Can't open the card image.\n");
+    return 2;
+  }
+  sectors = (uint32_t) count;
+  MscStart( TapeBuffer, TAPE_BUFFER_SIZE, sectors);
+
+//  What a host does on plugging in.
+
+  memset( cb, 0, sizeof( cb));
+  cb[0] = 0x12;				// INQUIRY
+  cb[4] = 36;
+  st = Run( cb, 6, true, 36, Data, &got);
+  Check( "INQUIRY", st == 0 && got == 36 && Data[0] == 0 &&
+    (Data[1] & 0x80) && !memcmp( Data + 8, "Pertec", 6));
+
+  cb[4] = 5;				// short allocation
+  st = Run( cb, 6, true, 36, Data, &got);
+  Check( "INQUIRY, 5 byte allocation", st == 0 && got == 5 &&
+    Residue == 31);
+
+  Check( "TEST UNIT READY", Simple( 0x00) == 0);
+
+  memset( cb, 0, sizeof( cb));
+  cb[0] = 0x25;				// READ CAPACITY(10)
+  st = Run( cb, 10, true, 8, Data, &got);
+  last = GetBE32( Data);
+  Check( "READ CAPACITY", st == 0 && got == 8 && last == sectors - 1 &&
+    GetBE32( Data + 4) == MSC_SECTOR_SIZE);
+
+  memset( cb, 0, sizeof( cb));
+  cb[0] = 0x1A;				// MODE SENSE(6), all pages
+  cb[2] = 0x3F;
+  cb[4] = 192;
+  st = Run( cb, 6, true, 192, Data, &got);
+  Check( "MODE SENSE, write cache reported", st == 0 && got == 24 &&
+    Data[0] == 23 && Data[4] == 0x08 && (Data[6] & 0x04));
+
+  memset( cb, 0, sizeof( cb));
+  cb[0] = 0x23;				// READ FORMAT CAPACITIES
+  cb[8] = 252;
+  st = Run( cb, 10, true, 252, Data, &got);
+  Check( "READ FORMAT CAPACITIES", st == 0 && got == 12 &&
+    GetBE32( Data + 4) == sectors);
+
+//  Writes of all sizes, across chunk boundaries, then read back both
+//  through the disk and straight off the card.
+
+  lba = 100;
+  for ( i = 1; i <= MAX_SECTORS; i = i * 2 + 1)
+  {
+    Pattern( Expect, lba, (uint32_t) i, 1);
+    if ( Rw( 0x2A, lba, (uint32_t) i, Expect) != 0)
+      break;
+    if ( Rw( 0x28, lba, (uint32_t) i, Data) != 0 ||
+      memcmp( Data, Expect, (size_t) i * MSC_SECTOR_SIZE))
+      break;
+    lba += (uint32_t) i;
+  } // for each size
+  Check( "WRITE then READ, 1 to 255 sectors", i > MAX_SECTORS);
+
+  Check( "SYNCHRONIZE CACHE", Simple( 0x35) == 0);
+  Pattern( Expect, lba - 255, 255, 1);
+  Check( "Data on the card", disk_read( 0, Data, lba - 255, 255) == RES_OK &&
+    !memcmp( Data, Expect, 255 * MSC_SECTOR_SIZE));
+
+//  A host reading straight through: every READ after the first
+//  starts on the read-ahead.
+
+  Pattern( Expect, 2000, MAX_SECTORS, 2);
+  Rw( 0x2A, 2000, MAX_SECTORS, Expect);
+  Pattern( Expect, 2000 + MAX_SECTORS, MAX_SECTORS, 3);
+  Rw( 0x2A, 2000 + MAX_SECTORS, MAX_SECTORS, Expect);
+  for ( i = 0; i < 2 * MAX_SECTORS / 64; i++)
+  {
+    Pattern( Expect, 2000 + i * 64, 64, (i < MAX_SECTORS / 64) ? 2 : 3);
+    if ( Rw( 0x28, 2000 + i * 64, 64, Data) != 0 ||
+      memcmp( Data, Expect, 64 * MSC_SECTOR_SIZE))
+      break;
+  }
+  Check( "Sequential READs", i == 2 * MAX_SECTORS / 64);
+
+//  The read-ahead mustn't survive a write to what it holds.
+
+  Rw( 0x28, 2000, 64, Data);		// read-ahead is now 2064...
+  Pattern( Expect, 2064, 8, 4);
+  Rw( 0x2A, 2064, 8, Expect);
+  Check( "READ after WRITE over the read-ahead",
+    Rw( 0x28, 2064, 8, Data) == 0 && !memcmp( Data, Expect, 8 * 512));
+
+//  Reading to the last sector, and past it.
+
+  Pattern( Expect, last - 3, 4, 5);
+  Rw( 0x2A, last - 3, 4, Expect);
+  Check( "READ of the last sectors", Rw( 0x28, last - 3, 4, Data) == 0 &&
+    !memcmp( Data, Expect, 4 * 512));
+  Check( "READ past the end", Rw( 0x28, last, 2, Data) == 1 &&
+    Sense() == 0x05);
+
+//  Host and device disagreeing.
+
+  memset( cb, 0, sizeof( cb));
+  cb[0] = 0x28;				// READ(10) of 1, host wants 2
+  cb[8] = 1;
+  st = Run( cb, 10, true, 2 * MSC_SECTOR_SIZE, Data, &got);
+  Check( "READ, host length wrong", st == 2);
+
+  memset( cb, 0, sizeof( cb));
+  cb[0] = 0xC7;				// nothing we know
+  st = Run( cb, 10, true, 512, Data, &got);
+  Check( "Unknown command", st == 1 && got == 0 && Residue == 512 &&
+    Sense() == 0x05);
+
+  memset( cb, 0, sizeof( cb));
+  cb[0] = 0xC8;				// ... with data from the host
+  st = Run( cb, 10, false, 1024, Data, &got);
+  Check( "Unknown command with data out", st == 1 && Residue == 1024);
+
+  memset( Data, 0, CBW_LENGTH);		// a CBW that isn't
+  SendPacket( Data, CBW_LENGTH);
+  Check( "Bad CBW ignored", Simple( 0x00) == 0);
+
+//  Reset in the middle of a READ.
+
+  memset( cb, 0, sizeof( cb));
+  cb[0] = 0x28;
+  cb[8] = 128;
+  PutLE32( Data, 0x43425355);
+  PutLE32( Data + 4, ++Tag);
+  PutLE32( Data + 8, 128 * MSC_SECTOR_SIZE);
+  Data[12] = 0x80;
+  Data[13] = 0;
+  Data[14] = 10;
+  memcpy( Data + 15, cb, 16);
+  SendPacket( Data, CBW_LENGTH);
+  for ( i = 0; i < 10; i++)
+    TakePacket( Data);
+  MscReset();
+  Check( "Mass storage reset", Simple( 0x00) == 0);
+
+//  And done.
+
+  memset( cb, 0, sizeof( cb));
+  cb[0] = 0x1B;				// START STOP UNIT, eject
+  cb[4] = 0x02;
+  Check( "Eject", Run( cb, 6, false, 0, NULL, &got) == 0 && MscEjected());
+  Check( "Not ready after eject", Simple( 0x00) == 1 && Sense() == 0x02);
+  Check( "Card synced", MscStop());
+
+  printf( "\n%s, %.3f sec simulated card time\n",
+    Failures ? "FAILED" : "All passed", (double) SimTime() / SIM_CPU_HZ);
+  return Failures ? 1 : 0;
+} // main
+
+//	Run - Do one command.
+//	---------------------
+//
+//	Length bytes of data to or from Buf; *Got is set to the number
+//	of bytes the device sent.  Returns the CSW status, or -1 if the
+//	transport went wrong.
+//
+
+static int Run( const uint8_t *Cb, int CbLength, bool In, uint32_t Length,
+                uint8_t *Buf, uint32_t *Got)
+{
+
+  uint8_t
+    packet[ MSC_PACKET_SIZE];
+  uint32_t
+    done;
+  int
+    n;
+
+  memset( packet, 0, sizeof( packet));
+  PutLE32( packet, 0x43425355);
+  PutLE32( packet + 4, ++Tag);
+  PutLE32( packet + 8, Length);
+  packet[12] = In ? 0x80 : 0;
+  packet[14] = (uint8_t) CbLength;
+  memcpy( packet + 15, Cb, (size_t) CbLength);
+  if ( !SendPacket( packet, CBW_LENGTH))
+    return -1;
+
+  *Got = 0;
+  for ( done = 0; done < Length; done += (uint32_t) n)
+  {
+    if ( In)
+    {
+      if ( (n = TakePacket( Buf + done)) < 0)
+        return -1;
+      *Got += (uint32_t) n;
+      if ( n < MSC_PACKET_SIZE)
+        break;			// short packet ends it
+    }
+    else
+    {
+      n = (Length - done < MSC_PACKET_SIZE) ? (int) (Length - done) :
+        MSC_PACKET_SIZE;
+      if ( !SendPacket( Buf ? Buf + done : packet, n))
+        return -1;
+    }
+  } // data phase
+
+  if ( TakePacket( packet) != CSW_LENGTH || packet[0] != 'U' ||
+    packet[3] != 'S' || packet[4] != (uint8_t) Tag)
+    return -1;
+  Residue = packet[8] | (packet[9] << 8) | (packet[10] << 16) |
+    ((uint32_t) packet[11] << 24);
+  return packet[12];
+} // Run
+
+//	SendPacket - An OUT packet, when the device will take it.
+//	---------------------------------------------------------
+//
+
+static bool SendPacket( const uint8_t *Packet, int Length)
+{
+
+  int
+    spin;
+
+  for ( spin = 0; !MscCanReceive(); spin++)
+  {
+    if ( spin > SPIN_LIMIT)
+      return false;
+    MscService();
+  }
+  MscReceive( Packet, Length);
+  return true;
+} // SendPacket
+
+//	TakePacket - The next IN packet.
+//	--------------------------------
+//
+//	Returns its length, or -1 if none comes.
+//
+
+static int TakePacket( uint8_t *Packet)
+{
+
+  int
+    spin,
+    n;
+
+  for ( spin = 0; (n = MscTransmit( Packet)) < 0; spin++)
+  {
+    if ( spin > SPIN_LIMIT)
+      return -1;
+    MscService();
+  }
+  return n;
+} // TakePacket
+
+//	Simple - A command with no data.
+//	--------------------------------
+//
+
+static int Simple( uint8_t Op)
+{
+
+  uint8_t
+    cb[ 10];
+  uint32_t
+    got;
+
+  memset( cb, 0, sizeof( cb));
+  cb[0] = Op;
+  return Run( cb, (Op < 0x20) ? 6 : 10, false, 0, NULL, &got);
+} // Simple
+
+//	Rw - READ(10) or WRITE(10).
+//	---------------------------
+//
+
+static int Rw( uint8_t Op, uint32_t Lba, uint32_t Count, uint8_t *Buf)
+{
+
+  uint8_t
+    cb[ 10];
+  uint32_t
+    got;
+
+  memset( cb, 0, sizeof( cb));
+  cb[0] = Op;
+  PutBE32( cb + 2, Lba);
+  cb[7] = (uint8_t) (Count >> 8);
+  cb[8] = (uint8_t) Count;
+  return Run( cb, 10, Op == 0x28, Count * MSC_SECTOR_SIZE, Buf, &got);
+} // Rw
+
+//	Sense - REQUEST SENSE; returns the sense key.
+//	---------------------------------------------
+//
+
+static uint8_t Sense( void)
+{
+
+  uint8_t
+    cb[ 6],
+    sense[ 18];
+  uint32_t
+    got;
+
+  memset( cb, 0, sizeof( cb));
+  cb[0] = 0x03;
+  cb[4] = sizeof( sense);
+  if ( Run( cb, 6, true, sizeof( sense), sense, &got) != 0 || got < 3)
+    return 0xFF;
+  return sense[2] & 0x0F;
+} // Sense
+
+//	Pattern - Data that says where it belongs.
+//	------------------------------------------
+//
+
+static void Pattern( uint8_t *Buf, uint32_t Lba, uint32_t Count, int Seed)
+{
+
+  uint32_t
+    i;
+
+  for ( i = 0; i < Count * MSC_SECTOR_SIZE; i++)
+    Buf[ i] = (uint8_t) ((Lba + i / MSC_SECTOR_SIZE) * 7 + i * 13 + Seed);
+  return;
+} // Pattern
+
+//	Check - Report a check.
+//	-----------------------
+//
+
+static void Check( const char *What, bool Ok)
+{
+
+  printf( "  %-40s %s\n", What, Ok ? "ok" : "FAILED");
+  if ( !Ok)
+    Failures++;
+  return;
+} // Check
+
+//	Byte order helpers.
+//	-------------------
+//
+
+static uint32_t GetBE32( const uint8_t *Where)
+{
+
+  return ((uint32_t) Where[0] << 24) | (Where[1] << 16) |
+    (Where[2] << 8) | Where[3];
+} // GetBE32
+
+static void PutLE32( uint8_t *Where, uint32_t What)
+{
+
+  Where[0] = (uint8_t) What;
+  Where[1] = (uint8_t) (What >> 8);
+  Where[2] = (uint8_t) (What >> 16);
+  Where[3] = (uint8_t) (What >> 24);
+  return;
+} // PutLE32
+
+static void PutBE32( uint8_t *Where, uint32_t What)
+{
+
+  Where[0] = (uint8_t) (What >> 24);
+  Where[1] = (uint8_t) (What >> 16);
+  Where[2] = (uint8_t) (What >> 8);
+  Where[3] = (uint8_t) What;
+  return;
+} // PutBE32
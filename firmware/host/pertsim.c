@@ -0,0 +1,1379 @@
+//*	Simulated Pertec formatter.
+//	---------------------------
+//
+//	Just enough of a formatter, a drive and our interface board to
+//	run the tape driver on a host: command latches, the two status
+//	registers, the read and write data latches with their
+//	RDAVAIL/WREMPTY handshakes, the timer/DMA read engine of
+//	tapexfer.c and the EXTI line that drives its write engine.
+//
+//	The tape is either a reel of records, loaded from and saved to a
+//	.TAP file, or (for the transfer benchmark) an endless run of
+//	same-length blocks whose data is a pattern that can be checked
+//	with SimPattern.  Forward and reverse reads, block skips, file
+//	spacing, writes, file marks, rewind and unload are modeled.  Past
+//	the last record, the tape is blank.  Records flagged as bad in the
+//	.TAP file read with a hard error; other hard and corrected errors
+//	can be injected at random.
+//
+//	Motion is timed from the drive's speed, density and inter-record
+//	gap.  A start/stop drive crosses the gap on every command.  A
+//	streaming drive that gets its next command before the gap has
+//	gone by keeps moving; otherwise it has to reposition first.  A
+//	GO that arrives while the formatter is still winding down from
+//	the last block starts the next one right away.
+//
+//	Reading, the formatter presents one character every 1/(ips * bpi)
+//	seconds during the data phase and has a single character of
+//	buffering.  If a character arrives while the previous one still
+//	hasn't been acknowledged, it's counted as an overrun and the
+//	block ends with a hard error, as a real formatter would report it.
+//	Skips and spaces move the same way, but present nothing.
+//
+//	Writing, the formatter takes the character in its buffer at the
+//	same rate.  If the buffer is empty when it's wanted, that's an
+//	underrun: the block is cut short with a hard error.  ILWD is
+//	sampled on each write strobe; the character strobed with ILWD
+//	set is the last one of the block.  The last block written is kept
+//	for checking.
+//
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libopencm3/stm32/gpio.h>
+
+#include "gpiodef.h"
+#include "pertbits.h"
+#include "tap.h"
+#include "pertsim.h"
+
+#define NEVER	UINT64_MAX
+
+//  Read engine timing, in cycles.  Latency covers the input filter,
+//  resynchronization, the TACK compare and DMA arbitration.  The
+//  engine can't be retriggered until its one-pulse cycle is over.
+
+#define ENGINE_LATENCY	12
+#define ENGINE_CYCLE	(40 + ENGINE_LATENCY)
+
+//  Interrupt entry and exit, in cycles (stacking, vector fetch,
+//  unstacking).
+
+#define IRQ_ENTRY	12
+#define IRQ_EXIT	10
+
+//  Time from the end of the data phase until the formatter drops
+//  IFBY.
+
+#define STOP_USEC	20
+
+//  Length of a file mark, in characters, and how far the formatter
+//  looks at blank tape before giving up, in mils.
+
+#define MARK_CHARS	4
+#define BLANK_MILS	(25 * 12 * 1000)
+
+//  Rewind speed, inches/second, and the EOT marker's distance from
+//  the end of the reel, in feet.
+
+#define REWIND_IPS	200
+#define EOT_FEET	25
+
+//  Largest block we keep when writing.
+
+#define RECORD_MAX	65536
+
+//  Formatter phases.
+
+typedef enum
+{
+  F_IDLE,			// not busy
+  F_START,			// IFBY, getting up to speed, crossing gap
+  F_DATA,			// IDBY, characters moving
+  F_STOP,			// IFBY, block done
+  F_REWIND			// IRWD
+} F_PHASE;
+
+//  What the current command does.
+
+typedef enum
+{
+  OP_READ,			// read a block
+  OP_SKIP,			// skip a block
+  OP_SPACE,			// space to a file mark
+  OP_WRITE,			// write a block
+  OP_NONE			// no block: blank tape, BOT or a file mark
+} F_OP;
+
+//  A record on the reel: its .TAP header (0 for a file mark) and
+//  where its data is.
+
+typedef struct
+{
+  uint32_t Header;
+  uint32_t Offset;
+} SIM_RECORD;
+
+SIM_STATS
+  SimStats;
+
+static SIM_DRIVE
+  Drive = { 125, 6250, 300, 0, 0 };	// a typical GCR drive
+
+static uint64_t
+  Now,				// current time
+  NextIrq,			// next simulated interrupt
+  PhaseAt,			// time of next phase event
+  DataStart,			// start of the current data phase
+  IdleSince,			// when the formatter last went idle
+  EngineAckAt,			// when the engine acknowledges
+  EngineFreeAt;			// when the engine can retrigger
+
+static uint32_t
+  IrqPeriod,			// cycles between interrupts (0 = none)
+  IrqLength,			// cycles each interrupt takes
+  Block,			// records between BOT and the head
+  Mils,				// ... and how far that is
+  EotMils,			// where the EOT marker is
+  HardRate,			// injected errors per million blocks
+  SoftRate,
+  Random;			// error injection generator
+
+static int
+  BlockLength,			// length of every block, without a reel
+  Length,			// length of the current block
+  Index,			// next character in the block
+  EngineLen,			// engine buffer length
+  EngineCount,			// bytes stored by the engine
+  RecordLen;			// length of block being written
+
+static uint8_t
+  *EngineBuf,			// engine buffer
+  *Data,			// data of the current block, NULL = pattern
+  CmdPort,			// command register bus (GPIOC)
+  Cmd0,				// latched command 0, positive
+  Cmd1,				// latched command 1, positive
+  DataPort,			// data register bus (GPIOE low)
+  Holding,			// read data latch, positive
+  WriteLatch,			// write data latch, positive
+  Flags,			// IFMK, IHER, ICER, positive
+  Record[ RECORD_MAX];		// block being written
+
+static uint16_t
+  Ctrl;				// control register (GPIOD)
+
+static SIM_RECORD
+  *Reel;			// records on the reel, NULL = pattern tape
+static uint32_t
+  ReelCount,			// records on the reel
+  ReelMax,			// ... room for
+  ReelUsed,			// data bytes on the reel
+  ReelSize;			// ... room for
+static uint8_t
+  *ReelData;			// data of all of them
+
+static F_OP
+  Op;
+
+static int
+  Ips;				// speed of the current command
+
+static bool
+  Online,			// drive is ready
+  HighSpeed,			// running at Drive.HighIps
+  Protected,			// no write ring
+  Stopped,			// tape is standing still
+  Reverse,			// current command moves backward
+  Writing,			// current command is a write
+  Ending,			// last character is on its way
+  RdAvail,			// a character is in the read latch
+  WrFull,			// a character is in the write latch
+  WrLast,			// ... and it was strobed with ILWD
+  RecordLwd,			// last write ended by ILWD
+  EngineArmed,			// read engine trigger enabled
+  EnginePending,		// engine has a cycle scheduled
+  ExtiLevel,			// PE12 as last seen (true = high)
+  ExtiEnabled,			// EXTI12 unmasked
+  ExtiPending,			// EXTI12 pending
+  InIsr;			// running the EXTI handler
+
+static void
+  (*ExtiHandler)( void);	// EXTI15_10 handler
+
+static F_PHASE
+  Phase;
+
+//  Prototypes.
+
+static void Advance( uint64_t Target);
+static bool IrqReady( void);
+static void PhaseEvent( void);
+static void ReadEvent( void);
+static void WriteEvent( void);
+static void EndData( void);
+static void EngineEvent( void);
+static void StartCommand( void);
+static void StartData( void);
+static void SpaceData( void);
+static void Rewind( void);
+static void Strobe( void);
+static void CheckExti( void);
+static uint8_t Status0( void);
+static uint8_t Status1( void);
+static uint64_t CharTime( int Count);
+static uint64_t MilsTime( uint32_t Distance);
+static uint32_t BlockMils( uint32_t Header);
+static void Inject( void);
+static void Truncate( void);
+static bool AddRecord( uint32_t Header, const uint8_t *Buf);
+
+//	SimReset - Power-on state.
+//	--------------------------
+//
+//	The reel, if any, stays mounted and is rewound.
+//
+
+void SimReset( void)
+{
+
+  memset( &SimStats, 0, sizeof( SimStats));
+  Now = 0;
+  NextIrq = IrqPeriod;
+  IdleSince = 0;
+  Block = 0;
+  Mils = 0;
+  Phase = F_IDLE;
+  Ctrl = 0xffff;
+  CmdPort = 0xff;
+  Cmd0 = Cmd1 = 0;
+  DataPort = 0xff;
+  Holding = WriteLatch = 0;
+  Flags = 0;
+  RecordLen = 0;
+  Online = Stopped = true;
+  HighSpeed = false;
+  Ips = Drive.Ips;
+  Writing = Ending = Reverse = false;
+  RdAvail = WrFull = WrLast = RecordLwd = false;
+  EngineArmed = EnginePending = false;
+  EngineFreeAt = 0;
+  ExtiLevel = true;
+  ExtiEnabled = ExtiPending = InIsr = false;
+  if ( BlockLength == 0 && !Reel)
+    BlockLength = 8192;
+  if ( EotMils == 0)
+    SimSetReel( 2400, Protected);
+  return;
+} // SimReset
+
+//	SimSetDrive - Set speed, density, gap and repositioning time.
+//	-------------------------------------------------------------
+//
+
+void SimSetDrive( const SIM_DRIVE *What)
+{
+
+  Drive = *What;
+  Ips = Drive.Ips;
+  return;
+} // SimSetDrive
+
+//	SimSetBlocks - Use an endless tape of same-length blocks.
+//	---------------------------------------------------------
+//
+//	Zero means tapemarks.  Any reel is dismounted.
+//
+
+void SimSetBlocks( int Len)
+{
+
+  free( Reel);
+  free( ReelData);
+  Reel = NULL;
+  ReelData = NULL;
+  ReelCount = ReelMax = ReelUsed = ReelSize = 0;
+  BlockLength = Len;
+  return;
+} // SimSetBlocks
+
+//	SimSetReel - Set reel length and write protection.
+//	--------------------------------------------------
+//
+
+void SimSetReel( int Feet, bool Protect)
+{
+
+  EotMils = (uint32_t) (Feet - EOT_FEET) * 12 * 1000;
+  Protected = Protect;
+  return;
+} // SimSetReel
+
+//	SimSetErrors - Inject errors at random.
+//	---------------------------------------
+//
+//	Rates are per million blocks read or written.
+//
+
+void SimSetErrors( uint32_t HardPpm, uint32_t SoftPpm, uint32_t Seed)
+{
+
+  HardRate = HardPpm;
+  SoftRate = SoftPpm;
+  Random = Seed ? Seed : 1;
+  return;
+} // SimSetErrors
+
+//	SimBlankTape - Mount a blank reel.
+//	----------------------------------
+//
+
+void SimBlankTape( void)
+{
+
+  SimSetBlocks( 0);
+  ReelMax = 1024;
+  ReelSize = 1 << 20;
+  Reel = malloc( ReelMax * sizeof( SIM_RECORD));
+  ReelData = malloc( ReelSize);
+  Block = 0;
+  Mils = 0;
+  return;
+} // SimBlankTape
+
+//	SimMakeTape - Mount a reel of pattern blocks.
+//	---------------------------------------------
+//
+//	Each file is Blocks blocks of Len bytes followed by a file
+//	mark; a second file mark after the last file ends the tape.
+//	Block n holds SimPattern( n, ...), counting file marks.
+//
+
+void SimMakeTape( int Files, int Blocks, int Len)
+{
+
+  int
+    f, b, i;
+
+  SimBlankTape();
+  if ( Len > RECORD_MAX)
+    Len = RECORD_MAX;
+  for ( f = 0; f < Files; f++)
+  {
+    for ( b = 0; b < Blocks; b++)
+    {
+      for ( i = 0; i < Len; i++)
+        Record[ i] = SimPattern( ReelCount, i);
+      AddRecord( (uint32_t) Len, Record);
+    } // for each block
+    AddRecord( TAP_FILEMARK, NULL);
+  } // for each file
+  AddRecord( TAP_FILEMARK, NULL);
+  return;
+} // SimMakeTape
+
+//	SimLoadTape - Mount a reel from a .TAP file.
+//	--------------------------------------------
+//
+//	Reading stops at end of medium.  Erase gaps are dropped.
+//	Returns false if the file can't be read or doesn't make sense.
+//
+
+bool SimLoadTape( const char *Path)
+{
+
+  FILE
+    *tf;
+  uint32_t
+    header,
+    trailer,
+    len;
+  bool
+    ok;
+
+  if ( !(tf = fopen( Path, "rb")))
+    return false;
+
+  SimBlankTape();
+  ok = true;
+  while ( ok && fread( &header, sizeof( header), 1, tf) == 1)
+  {
+    if ( header == TAP_EOM)
+      break;
+    if ( header == TAP_ERASE_GAP)
+      continue;
+
+    len = header & TAP_LENGTH_MASK;
+    if ( len > RECORD_MAX)
+      ok = false;
+    else if ( len && (fread( Record, 1, len, tf) != len ||
+      fread( &trailer, sizeof( trailer), 1, tf) != 1 ||
+      trailer != header))
+      ok = false;
+    else
+      ok = AddRecord( header, Record);
+  } // while records
+
+  fclose( tf);
+  return ok;
+} // SimLoadTape
+
+//	SimSaveTape - Write the reel to a .TAP file.
+//	--------------------------------------------
+//
+
+bool SimSaveTape( const char *Path)
+{
+
+  FILE
+    *tf;
+  uint32_t
+    i,
+    header,
+    len;
+  bool
+    ok;
+
+  if ( !Reel || !(tf = fopen( Path, "wb")))
+    return false;
+
+  ok = true;
+  for ( i = 0; i < ReelCount && ok; i++)
+  {
+    header = Reel[ i].Header;
+    len = header & TAP_LENGTH_MASK;
+    ok = fwrite( &header, sizeof( header), 1, tf) == 1;
+    if ( ok && len)
+      ok = fwrite( ReelData + Reel[ i].Offset, 1, len, tf) == len &&
+        fwrite( &header, sizeof( header), 1, tf) == 1;
+  } // for each record
+
+  header = TAP_EOM;
+  if ( ok)
+    ok = fwrite( &header, sizeof( header), 1, tf) == 1;
+  if ( fclose( tf))
+    ok = false;
+  return ok;
+} // SimSaveTape
+
+//	SimTapeRecords - Records on the reel, file marks included.
+//	----------------------------------------------------------
+//
+
+uint32_t SimTapeRecords( void)
+{
+  return ReelCount;
+} // SimTapeRecords
+
+//	SimSetInterruptLoad - Steal CPU time periodically.
+//	--------------------------------------------------
+//
+//	Every PeriodUsec microseconds, the CPU is taken away for
+//	LengthCycles cycles, as a lower-priority interrupt handler
+//	would.  The formatter, the DMA engine and the EXTI handler
+//	carry on regardless.
+//
+
+void SimSetInterruptLoad( uint32_t PeriodUsec, uint32_t LengthCycles)
+{
+
+  IrqPeriod = SIM_USEC( PeriodUsec);
+  IrqLength = LengthCycles;
+  NextIrq = Now + IrqPeriod;
+  return;
+} // SimSetInterruptLoad
+
+//	SimTime - Current time, in cycles.
+//	----------------------------------
+//
+
+uint64_t SimTime( void)
+{
+  return Now;
+} // SimTime
+
+//	SimCharge - Let the CPU spend some cycles.
+//	------------------------------------------
+//
+//	If the EXTI line goes pending along the way, its handler runs
+//	right then, and the rest of the cycles are spent after it.
+//
+
+void SimCharge( uint32_t Cycles)
+{
+
+  uint64_t
+    target,
+    start;
+
+  target = Now + Cycles;
+  while ( !InIsr && IrqPeriod && target >= NextIrq)
+  {
+    target += IrqLength;
+    NextIrq += IrqPeriod;
+  } // interrupts taken
+
+  while ( true)
+  {
+    Advance( target);
+    if ( !IrqReady())
+      break;
+
+    start = Now;
+    ExtiPending = false;
+    InIsr = true;
+    SimCharge( IRQ_ENTRY);
+    ExtiHandler();
+    SimCharge( IRQ_EXIT);
+    InIsr = false;
+    SimStats.IsrCycles += Now - start;
+    target += Now - start;		// thread code was held up
+  } // while handling interrupts
+  return;
+} // SimCharge
+
+//	SimWriteControl - New value on the control register.
+//	----------------------------------------------------
+//
+//	Rewind and unload happen as soon as they're latched; everything
+//	else waits for GO.
+//
+
+void SimWriteControl( uint16_t Pins)
+{
+
+  uint16_t
+    falling,
+    rising;
+  uint8_t
+    was;
+
+  falling = Ctrl & ~Pins;
+  rising = ~Ctrl & Pins;
+  Ctrl = Pins;
+
+  if ( falling & PCTRL_TACK)
+    RdAvail = false;			// CPU took the character
+
+  if ( rising & PCTRL_LBUF)
+    Strobe();				// write data strobe
+
+  if ( rising & PCTRL_CSEL0)
+  {
+    was = Cmd1;
+    Cmd1 = ~CmdPort;
+    if ( (Cmd1 & (PC_IRWU >> 8)) && !(was & (PC_IRWU >> 8)) &&
+      Online && (Phase == F_IDLE))
+    {
+      Rewind();
+      Online = false;			// and off it comes
+    }
+  } // command 1 latched
+
+  if ( rising & PCTRL_CSEL1)
+  {
+    was = Cmd0;
+    Cmd0 = ~CmdPort;
+    if ( (Cmd0 & PC_IREW) && !(was & PC_IREW) &&
+      Online && (Phase == F_IDLE))
+      Rewind();
+    else if ( (Cmd0 & PC_IGO) && !(was & PC_IGO) &&
+      (Phase == F_IDLE || Phase == F_STOP))
+      StartCommand();
+  } // command 0 latched
+  CheckExti();
+  return;
+} // SimWriteControl
+
+//	SimWriteCommand - New value on the command register bus.
+//	--------------------------------------------------------
+//
+
+void SimWriteCommand( uint8_t Value)
+{
+  CmdPort = Value;
+} // SimWriteCommand
+
+//	SimWriteData - New value on the data register bus.
+//	--------------------------------------------------
+//
+
+void SimWriteData( uint8_t Value)
+{
+  DataPort = Value;
+} // SimWriteData
+
+//	SimReadPortE - Data register and selected status register.
+//	----------------------------------------------------------
+//
+//	Everything on the port is negative-true.
+//
+
+uint16_t SimReadPortE( void)
+{
+
+  uint8_t
+    ss;
+
+  if ( Ctrl & PCTRL_SSEL)
+    ss = Status1();
+  else
+    ss = Status0();
+  return (uint16_t) ((uint8_t) ~ss << 8) | (uint8_t) ~Holding;
+} // SimReadPortE
+
+//	SimEngineSetup - Point the read engine at a buffer.
+//	---------------------------------------------------
+//
+
+void SimEngineSetup( uint8_t *Buf, int Buflen)
+{
+
+  EngineBuf = Buf;
+  EngineLen = Buflen;
+  EngineCount = 0;
+  EngineArmed = false;
+  return;
+} // SimEngineSetup
+
+//	SimEngineEnable - Turn the RDAVAIL trigger on or off.
+//	-----------------------------------------------------
+//
+
+void SimEngineEnable( bool On)
+{
+
+  EngineArmed = On;
+
+//  A character already waiting gets a cycle started by hand.
+
+  if ( On && RdAvail && !EnginePending && (Now >= EngineFreeAt))
+  {
+    EnginePending = true;
+    EngineAckAt = Now + ENGINE_LATENCY;
+    EngineFreeAt = Now + ENGINE_CYCLE;
+  }
+  return;
+} // SimEngineEnable
+
+//	SimEngineCount - Bytes stored by the engine so far.
+//	---------------------------------------------------
+//
+
+int SimEngineCount( void)
+{
+  return EngineCount;
+} // SimEngineCount
+
+//	SimEngineDisarm - Let the last cycle finish and stop.
+//	-----------------------------------------------------
+//
+
+int SimEngineDisarm( void)
+{
+
+  if ( EngineFreeAt > Now)
+    Advance( EngineFreeAt);
+  EngineArmed = false;
+  return EngineCount;
+} // SimEngineDisarm
+
+//	SimExtiHandler - Say who services EXTI line 12.
+//	-----------------------------------------------
+//
+
+void SimExtiHandler( void (*Handler)( void))
+{
+  ExtiHandler = Handler;
+} // SimExtiHandler
+
+//	SimExtiEnable - Mask or unmask EXTI line 12.
+//	--------------------------------------------
+//
+
+void SimExtiEnable( bool On)
+{
+
+  ExtiEnabled = On;
+  if ( !On)
+    ExtiPending = false;
+  return;
+} // SimExtiEnable
+
+//	SimExtiSoftware - Software interrupt event on line 12.
+//	------------------------------------------------------
+//
+
+void SimExtiSoftware( void)
+{
+
+  if ( ExtiEnabled)
+    ExtiPending = true;
+  return;
+} // SimExtiSoftware
+
+//	SimLastRecord - The last block written.
+//	---------------------------------------
+//
+//	Returns its length; *Lwd says whether it ended with ILWD rather
+//	than an underrun.
+//
+
+int SimLastRecord( uint8_t **Buf, bool *Lwd)
+{
+
+  *Buf = Record;
+  *Lwd = RecordLwd;
+  return RecordLen;
+} // SimLastRecord
+
+//	SimPattern - Expected data.
+//	---------------------------
+//
+
+uint8_t SimPattern( uint32_t Blk, int Pos)
+{
+  return (uint8_t) (Blk * 7 + Pos * 13 + (Pos >> 8));
+} // SimPattern
+
+//*	Local routines.
+//	===============
+
+//	Advance - Run the formatter up to the given time.
+//	-------------------------------------------------
+//
+//	Stops early if the EXTI handler needs to run.
+//
+
+static void Advance( uint64_t Target)
+{
+
+  uint64_t
+    next;
+
+  while ( !IrqReady())
+  {
+    next = NEVER;
+    if ( EnginePending)
+      next = EngineAckAt;
+    if ( (Phase != F_IDLE) && (PhaseAt < next))
+      next = PhaseAt;
+    if ( next > Target)
+    {
+      Now = Target;
+      break;
+    }
+
+    Now = next;
+    if ( EnginePending && (EngineAckAt == next))
+      EngineEvent();
+    else
+      PhaseEvent();
+  } // while events to process
+  return;
+} // Advance
+
+//	IrqReady - True if the EXTI handler should run now.
+//	---------------------------------------------------
+//
+
+static bool IrqReady( void)
+{
+  return ExtiPending && ExtiEnabled && !InIsr && ExtiHandler;
+} // IrqReady
+
+//	PhaseEvent - Next thing the formatter does.
+//	-------------------------------------------
+//
+
+static void PhaseEvent( void)
+{
+
+  switch( Phase)
+  {
+    case F_START:
+      StartData();			// IDBY on
+      break;
+
+    case F_DATA:
+      if ( Ending)
+        EndData();
+      else if ( Writing)
+        WriteEvent();
+      else
+        ReadEvent();
+      break;
+
+    case F_STOP:
+    case F_REWIND:
+      Phase = F_IDLE;			// IFBY or IRWD off
+      Writing = false;
+      IdleSince = Now;
+      break;
+
+    default:
+      break;
+  } // switch
+  CheckExti();
+  return;
+} // PhaseEvent
+
+//	ReadEvent - Present the next character.
+//	---------------------------------------
+//
+//	Backward, the block comes off the tape last character first.
+//
+
+static void ReadEvent( void)
+{
+
+  int
+    pos;
+
+  if ( RdAvail)
+  {
+    SimStats.Overruns++;		// previous one never taken
+    Flags |= PS0_IHER;
+  }
+  pos = Reverse ? Length - 1 - Index : Index;
+  Holding = Data ? Data[ pos] : SimPattern( Block, pos);
+  RdAvail = true;
+  Index++;
+  SimStats.Bytes++;
+
+  if ( EngineArmed && !EnginePending && (Now >= EngineFreeAt))
+  {
+    EnginePending = true;
+    EngineAckAt = Now + ENGINE_LATENCY;
+    EngineFreeAt = Now + ENGINE_CYCLE;
+  } // engine triggered
+
+  if ( Index == Length)
+    Ending = true;
+  PhaseAt = DataStart + CharTime( Index + 1);
+  return;
+} // ReadEvent
+
+//	WriteEvent - Take the next character.
+//	-------------------------------------
+//
+
+static void WriteEvent( void)
+{
+
+  if ( !WrFull)
+  {
+    SimStats.Underruns++;		// nothing to write
+    Flags |= PS0_IHER;
+    EndData();
+    return;
+  }
+
+  if ( RecordLen < RECORD_MAX)
+    Record[ RecordLen++] = WriteLatch;
+  WrFull = false;
+  Index++;
+  SimStats.Bytes++;
+
+  if ( WrLast)
+  {
+    RecordLwd = true;
+    Ending = true;
+  }
+  PhaseAt = DataStart + CharTime( Index + 1);
+  return;
+} // WriteEvent
+
+//	EndData - Drop IDBY.
+//	--------------------
+//
+//	The head is now past the block.  A block written goes on the
+//	reel in place of everything from here on.
+//
+
+static void EndData( void)
+{
+
+  uint32_t
+    header;
+
+  SimStats.DataCycles += Now - DataStart;
+  Phase = F_STOP;
+  PhaseAt = Now + SIM_USEC( STOP_USEC);
+  if ( Op == OP_NONE || Op == OP_SPACE)
+    return;
+
+  SimStats.Blocks++;
+  Inject();
+
+  if ( Writing)
+  {
+    header = (uint32_t) RecordLen;
+    if ( Flags & PS0_IHER)
+      header |= TAP_ERROR_FLAG;
+    if ( Reel)
+    {
+      Truncate();
+      AddRecord( header, Record);
+    }
+    Mils += BlockMils( header);
+    Block++;
+  }
+  else if ( !Reverse)
+  {
+    Mils += BlockMils( Reel ? Reel[ Block].Header : (uint32_t) Length);
+    Block++;
+  }
+  return;
+} // EndData
+
+//	EngineEvent - The read engine takes a character.
+//	------------------------------------------------
+//
+//	What lands in memory is what's on the bus: negative-true.
+//
+
+static void EngineEvent( void)
+{
+
+  EnginePending = false;
+  RdAvail = false;
+  if ( EngineCount < EngineLen)
+    EngineBuf[ EngineCount++] = ~Holding;
+  return;
+} // EngineEvent
+
+//	StartCommand - GO has been latched.
+//	-----------------------------------
+//
+//	Sort out what's to be done and get the tape moving.  A file mark
+//	is written right away; there's no data phase for it.
+//
+
+static void StartCommand( void)
+{
+
+  uint64_t
+    start,
+    idle;
+
+  if ( !Online)
+    return;
+
+  Flags = 0;
+  Reverse = (Cmd0 & PC_IREV) != 0;
+  Writing = (Cmd0 & PC_IWRT) != 0;
+  WrFull = WrLast = Ending = false;
+  Data = NULL;
+
+//  A dual-speed drive takes the speed from PC_IHSP, and only streams
+//  at the high one.
+
+  HighSpeed = Drive.HighIps && (Cmd1 & (PC_IHSP >> 8));
+  Ips = HighSpeed ? Drive.HighIps : Drive.Ips;
+
+//  Crossing the gap.  A streaming drive that's still coasting only
+//  has the rest of it to go; one that's gone past has to back up
+//  first.
+
+  start = MilsTime( Drive.GapMils);
+  if ( Drive.RepoMsec && (HighSpeed || !Drive.HighIps) &&
+    Phase == F_IDLE && !Stopped)
+  {
+    idle = Now - IdleSince;
+    if ( idle < start)
+      start -= idle;
+    else
+    {
+      SimStats.Repositions++;
+      start += SIM_USEC( (uint64_t) Drive.RepoMsec * 1000);
+    }
+  } // if streaming
+  Stopped = false;
+  Phase = F_START;
+  PhaseAt = Now + start;
+
+  if ( Writing)
+  {
+    Op = OP_WRITE;
+    RecordLen = 0;
+    RecordLwd = false;
+    if ( Protected)
+    {
+      Flags |= PS0_IHER;		// no ring, no write
+      Writing = false;
+      Op = OP_NONE;
+      Phase = F_STOP;
+      PhaseAt = Now + SIM_USEC( STOP_USEC);
+    }
+    else if ( Cmd1 & (PC_IWFM >> 8))
+    {
+      if ( Reel)
+      {
+        Truncate();
+        AddRecord( TAP_FILEMARK, NULL);
+      }
+      Mils += BlockMils( TAP_FILEMARK);
+      Block++;
+      Writing = false;
+      Op = OP_NONE;
+      Phase = F_STOP;			// no data phase
+      PhaseAt += CharTime( MARK_CHARS);
+    }
+    return;
+  } // if writing
+
+  if ( Cmd1 & (PC_IWFM >> 8))
+    Op = OP_SPACE;
+  else if ( Cmd1 & (PC_IERASE >> 8))
+    Op = OP_SKIP;
+  else
+    Op = OP_READ;
+
+//  Backing into BOT ends the command with nothing done.  Going
+//  forward off the end of what's recorded, we read blank tape
+//  until we give up.
+
+  if ( Reverse && Block == 0)
+  {
+    Op = OP_NONE;
+    Phase = F_STOP;
+    PhaseAt = Now + SIM_USEC( STOP_USEC);
+  }
+  else if ( !Reverse && Reel && Block >= ReelCount)
+  {
+    Op = OP_NONE;
+    PhaseAt += MilsTime( BLANK_MILS);
+  }
+  return;
+} // StartCommand
+
+//	StartData - The head has reached the block.
+//	-------------------------------------------
+//
+//	Reads present its characters; skips just take as long.
+//
+
+static void StartData( void)
+{
+
+  uint32_t
+    header;
+
+  Phase = F_DATA;
+  DataStart = Now;
+  Index = 0;
+  Ending = false;
+
+  if ( Writing)
+  {
+    PhaseAt = Now + CharTime( 1);	// first one's due
+    return;
+  }
+
+  if ( Op == OP_NONE)
+  {
+    Ending = true;			// blank tape
+    PhaseAt = Now + CharTime( 1);
+    return;
+  }
+
+  if ( Op == OP_SPACE)
+  {
+    SpaceData();
+    return;
+  }
+
+  if ( Reverse)
+  {
+    Block--;
+    Mils -= BlockMils( Reel ? Reel[ Block].Header : (uint32_t) BlockLength);
+  }
+  header = Reel ? Reel[ Block].Header : (uint32_t) BlockLength;
+  Length = header & TAP_LENGTH_MASK;
+  if ( Reel)
+    Data = ReelData + Reel[ Block].Offset;
+
+  if ( header == TAP_FILEMARK)
+  {
+    Flags |= PS0_IFMK;
+    Ending = true;
+    PhaseAt = Now + CharTime( MARK_CHARS);
+  }
+  else if ( Op == OP_SKIP)
+  {
+    Ending = true;
+    PhaseAt = Now + CharTime( Length);
+  }
+  else
+    PhaseAt = Now + CharTime( 1);
+
+  if ( header & TAP_ERROR_FLAG)
+    Flags |= PS0_IHER;			// it was bad when imaged
+  return;
+} // StartData
+
+//	SpaceData - Pass whole blocks until one is a file mark.
+//	-------------------------------------------------------
+//
+//	Going forward, we also stop at the end of what's recorded;
+//	backward, at BOT.  The file mark is passed over.
+//
+
+static void SpaceData( void)
+{
+
+  uint32_t
+    header;
+  uint64_t
+    span;
+
+  span = CharTime( 1);
+  while ( true)
+  {
+    if ( Reverse)
+    {
+      if ( Block == 0)
+        break;
+      Block--;
+    }
+    else if ( Reel && Block >= ReelCount)
+      break;
+
+    header = Reel ? Reel[ Block].Header : (uint32_t) BlockLength;
+    span += MilsTime( BlockMils( header));
+    if ( Reverse)
+      Mils -= BlockMils( header);
+    else
+    {
+      Mils += BlockMils( header);
+      Block++;
+    }
+    if ( header == TAP_FILEMARK)
+    {
+      Flags |= PS0_IFMK;
+      break;
+    }
+  } // while not at a file mark
+
+  Ending = true;
+  PhaseAt = Now + span;
+  return;
+} // SpaceData
+
+//	Rewind - Back to the load point.
+//	--------------------------------
+//
+
+static void Rewind( void)
+{
+
+  Phase = F_REWIND;
+  PhaseAt = Now + (uint64_t) Mils * SIM_CPU_HZ / 1000 / REWIND_IPS +
+    SIM_USEC( 1000);
+  Block = 0;
+  Mils = 0;
+  Stopped = true;
+  return;
+} // Rewind
+
+//	Strobe - LBUF has gone high.
+//	----------------------------
+//
+
+static void Strobe( void)
+{
+
+  if ( !Writing || (Phase != F_START && Phase != F_DATA) || Ending)
+    return;
+  if ( WrFull)
+    SimStats.Overruns++;		// overwrote one not yet taken
+  WriteLatch = ~DataPort;
+  WrFull = true;
+  WrLast = (Cmd0 & PC_ILWD) != 0;
+  return;
+} // Strobe
+
+//	CheckExti - Look for a falling edge on PE12.
+//	--------------------------------------------
+//
+
+static void CheckExti( void)
+{
+
+  bool
+    level;
+
+  level = (Ctrl & PCTRL_SSEL) || !(Status0() & PS0_WREMPTY);
+  if ( ExtiLevel && !level && ExtiEnabled)
+    ExtiPending = true;
+  ExtiLevel = level;
+  return;
+} // CheckExti
+
+//	Status0 - Status register 0, positive.
+//	--------------------------------------
+//
+
+static uint8_t Status0( void)
+{
+
+  uint8_t
+    ss;
+
+  ss = Flags;
+  if ( Phase == F_DATA)
+    ss |= PS0_IDBY;
+  if ( HighSpeed)
+    ss |= PS0_ISPEED;
+  if ( RdAvail)
+    ss |= PS0_RDAVAIL;
+  if ( Writing && !WrFull && (Phase == F_START || Phase == F_DATA))
+    ss |= PS0_WREMPTY;
+  return ss;
+} // Status0
+
+//	Status1 - Status register 1, positive, in the low byte.
+//	-------------------------------------------------------
+//
+
+static uint8_t Status1( void)
+{
+
+  uint16_t
+    ss;
+
+  if ( !Online)
+    return 0;
+
+  ss = PS1_IONL;
+  if ( Phase == F_REWIND)
+    ss |= PS1_IRWD;
+  else
+    ss |= PS1_IRDY;
+  if ( Phase != F_IDLE && Phase != F_REWIND)
+    ss |= PS1_IFBY;
+  if ( Phase == F_IDLE && Block == 0)
+    ss |= PS1_ILDP;
+  if ( Protected)
+    ss |= PS1_IFPT;
+  if ( Mils >= EotMils)
+    ss |= PS1_EOT;
+  return (uint8_t) (ss >> 8);
+} // Status1
+
+//	CharTime - Time for some number of characters.
+//	----------------------------------------------
+//
+
+static uint64_t CharTime( int Count)
+{
+  return (uint64_t) Count * SIM_CPU_HZ / ((uint64_t) Ips * Drive.Bpi);
+} // CharTime
+
+//	MilsTime - Time to move some distance, in thousandths of an inch.
+//	-----------------------------------------------------------------
+//
+
+static uint64_t MilsTime( uint32_t Distance)
+{
+  return (uint64_t) Distance * SIM_CPU_HZ / 1000 / Ips;
+} // MilsTime
+
+//	BlockMils - Tape taken by a record and its gap, in mils.
+//	--------------------------------------------------------
+//
+
+static uint32_t BlockMils( uint32_t Header)
+{
+
+  uint32_t
+    count;
+
+  count = Header ? Header & TAP_LENGTH_MASK : MARK_CHARS;
+  return Drive.GapMils + (uint32_t) ((uint64_t) count * 1000 / Drive.Bpi);
+} // BlockMils
+
+//	Inject - Maybe add a random error to the current block.
+//	-------------------------------------------------------
+//
+
+static void Inject( void)
+{
+
+  uint32_t
+    draw;
+
+  if ( !HardRate && !SoftRate)
+    return;
+
+  Random ^= Random << 13;		// xorshift32
+  Random ^= Random >> 17;
+  Random ^= Random << 5;
+  draw = Random % 1000000;
+  if ( draw < HardRate)
+  {
+    Flags |= PS0_IHER;
+    SimStats.HardErrors++;
+  }
+  else if ( draw < HardRate + SoftRate)
+  {
+    Flags |= PS0_ICER;
+    SimStats.SoftErrors++;
+  }
+  return;
+} // Inject
+
+//	Truncate - Writing here loses everything after.
+//	-----------------------------------------------
+//
+
+static void Truncate( void)
+{
+
+  if ( Block >= ReelCount)
+    return;
+  ReelCount = Block;
+  ReelUsed = Reel[ Block].Offset;
+  return;
+} // Truncate
+
+//	AddRecord - Put a record at the end of the reel.
+//	------------------------------------------------
+//
+
+static bool AddRecord( uint32_t Header, const uint8_t *Buf)
+{
+
+  uint32_t
+    len;
+  void
+    *more;
+
+  len = Header & TAP_LENGTH_MASK;
+  if ( ReelCount == ReelMax)
+  {
+    if ( !(more = realloc( Reel, 2 * ReelMax * sizeof( SIM_RECORD))))
+      return false;
+    Reel = more;
+    ReelMax *= 2;
+  }
+  while ( ReelUsed + len > ReelSize)
+  {
+    if ( !(more = realloc( ReelData, 2 * ReelSize)))
+      return false;
+    ReelData = more;
+    ReelSize *= 2;
+  }
+
+  Reel[ ReelCount].Header = Header;
+  Reel[ ReelCount].Offset = ReelUsed;
+  if ( len)
+    memcpy( ReelData + ReelUsed, Buf, len);
+  ReelUsed += len;
+  ReelCount++;
+  return true;
+} // AddRecord
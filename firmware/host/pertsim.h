@@ -0,0 +1,103 @@
+#ifndef _PERTSIM_INC
+#define _PERTSIM_INC
+
+#include <stdint.h>
+#include <stdbool.h>
+
+//  Cycle-approximate model of a Pertec formatter, a tape drive and
+//  our interface board, for running the tape driver on a host.
+//
+//  Time is kept in CPU cycles of a 168 MHz STM32F407.  The code
+//  under test "spends" cycles through the port layer stand-ins in
+//  simport.c; the formatter model catches up to the current time
+//  whenever it's looked at.
+
+#define SIM_CPU_HZ	168000000
+
+//  Approximate cost, in cycles, of one call to a libopencm3 GPIO
+//  routine (call, AHB1 access, return and a share of the loop
+//  around it).
+
+#define SIM_GPIO_CYCLES	10
+
+#define SIM_USEC(x)	((uint64_t) (x) * (SIM_CPU_HZ / 1000000))
+
+//  Drive description.
+
+typedef struct
+{
+  int Ips;			// tape speed, inches/second
+  int Bpi;			// density, characters/inch
+  int GapMils;			// inter-record gap, thousandths of an inch
+  int RepoMsec;			// streaming drive: time to reposition
+				// (0 = start/stop drive)
+  int HighIps;			// dual-speed drive: speed on PC_IHSP,
+				// streaming there, start/stop at Ips
+				// (0 = one speed only)
+} SIM_DRIVE;
+
+//  Statistics, reset by SimReset.
+
+typedef struct
+{
+  uint32_t Blocks;		// blocks read or written
+  uint64_t Bytes;		// bytes presented or accepted
+  uint32_t Overruns;		// bytes lost to a late TACK or strobe
+  uint32_t Underruns;		// write data late
+  uint64_t DataCycles;		// cycles spent with IDBY asserted
+  uint64_t EngineCycles;	// CPU cycles spent setting up engines
+  uint64_t IsrCycles;		// CPU cycles in the EXTI handler
+  uint32_t Repositions;		// streaming drive had to back up
+  uint32_t HardErrors;		// injected errors
+  uint32_t SoftErrors;
+} SIM_STATS;
+
+extern SIM_STATS SimStats;
+
+//  Set-up.
+
+void SimReset( void);
+void SimSetDrive( const SIM_DRIVE *Drive);
+void SimSetBlocks( int Len);
+void SimSetReel( int Feet, bool Protect);
+void SimSetErrors( uint32_t HardPpm, uint32_t SoftPpm, uint32_t Seed);
+void SimSetInterruptLoad( uint32_t PeriodUsec, uint32_t LengthCycles);
+uint64_t SimTime( void);
+
+//  The reel.  Without one, the tape is an endless run of blocks of
+//  the length given to SimSetBlocks.
+
+void SimBlankTape( void);
+void SimMakeTape( int Files, int Blocks, int Len);
+bool SimLoadTape( const char *Path);
+bool SimSaveTape( const char *Path);
+uint32_t SimTapeRecords( void);
+
+//  Register level, from simport.c.
+
+void SimCharge( uint32_t Cycles);
+void SimWriteControl( uint16_t Pins);
+void SimWriteCommand( uint8_t Value);
+void SimWriteData( uint8_t Value);
+uint16_t SimReadPortE( void);
+
+//  The hardware read engine, from simxfer.c.
+
+void SimEngineSetup( uint8_t *Buf, int Buflen);
+void SimEngineEnable( bool On);
+int SimEngineCount( void);
+int SimEngineDisarm( void);
+
+//  EXTI line 12 (WREMPTY), for the write engine in simxfer.c.
+
+void SimExtiHandler( void (*Handler)( void));
+void SimExtiEnable( bool On);
+void SimExtiSoftware( void);
+
+//  Expected content of byte Pos of block Block, and what was
+//  written last.
+
+uint8_t SimPattern( uint32_t Block, int Pos);
+int SimLastRecord( uint8_t **Buf, bool *Lwd);
+
+#endif
@@ -0,0 +1,720 @@
+//*	The rest of the board, for the host build.
+//	------------------------------------------
+//
+//	Stand-ins for what the tape utilities use besides the Pertec
+//	interface:
+//
+//	  1)  The USB serial port, on stdin/stdout.  Output costs the CPU
+//	      about what polled CDC writes do.  From a pipe or file, input
+//	      is all there already and none of it is a keypress, so
+//	      USCharReady never sees any.  From a terminal or pty, it's
+//	      what has come in, and input that answers something we sent
+//	      arrives a USB round trip after it.  End of input ends the
+//	      run.  The USB data interface, if it's wanted, is a file
+//	      descriptor the caller opened: a socket to tapestream, say.
+//	  2)  The SD card, as an image file.  Each transfer takes a fixed
+//	      command overhead plus the time to move the data at the card
+//	      rate.  Reads are waited out.  Writes are write-behind, as in
+//	      diskio.c: the next disk operation waits for them.  A write
+//	      from the caller's buffer reaches the image only when it's
+//	      done, so a buffer reused too early shows up as bad data.
+//	  3)  The real-time and microsecond clocks, which keep simulated
+//	      time.
+//	  4)  ShowBuffer from miscsubs.c.
+//
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <poll.h>
+
+#include "globals.h"
+#include "comm.h"
+#include "usbserial.h"
+#include "ff.h"
+#include "diskio.h"
+#include "sdiosubs.h"
+#include "rtcsubs.h"
+#include "miscsubs.h"
+#include "pertsim.h"
+#include "simboard.h"
+
+//  Serial output: queueing a character and its share of the work of
+//  sending a 64-byte CDC packet, about 80 cycles.
+
+#define SERIAL_CYCLES	80
+
+//  The data interface moves bytes without cooking or checking them:
+//  about a quarter of the work.
+
+#define DATA_CYCLES	20
+
+//  Console input: how much is taken from the host at a time, how long
+//  after we send something the host's answer can be here (a frame
+//  each way, and the host program's turn), and how long a loop that
+//  does nothing but look for input waits between looks.
+
+#define INPUT_SIZE	4096
+#define ROUND_TRIP_USEC	1000
+#define IDLE_USEC	1000
+
+//  SD command overhead, in microseconds: a command (or a stop and the
+//  wait for the card to program), or setting up the data path again
+//  to carry on an open write stream.
+
+#define SD_COMMAND_USEC	150
+#define SD_STREAM_USEC	20
+
+#define SECTOR_SIZE	512
+
+static FILE
+  *Disk;			// card image
+static uint32_t
+  DiskSectors,			// its size
+  DiskRate = 4000;		// KB/second
+static void
+  (*AtEnd)( void);		// called at end of input
+static uint64_t
+  DiskBusy;			// transfer in progress until then
+static const BYTE
+  *OwnedBuf;			// caller's buffer in use, or NULL
+static UINT
+  OwnedCount;			// ... sectors
+static LBA_t
+  OwnedSector,			// ... where to
+  StreamNext;			// next sector of the open write stream
+static bool
+  OwnedRead,			// ... being read into, already filled
+  StreamOpen;			// writes are streaming
+static int
+  DataFd = -1;			// USB data interface, or -1
+static uint8_t
+  InBuf[ INPUT_SIZE];		// console input not yet taken
+static int
+  InPos,
+  InLen,
+  Interactive = -1;		// input's a terminal or pty
+static uint64_t
+  AnswerDue,			// the host's answer can't come before
+  EarlyAnswer,			// ... or, to something sent a while ago
+  LastLook = ~0ULL;		// nothing came in when we looked then
+
+//  Prototypes.
+
+static uint64_t DiskTime( UINT Count, bool Command);
+static uint64_t StreamTime( LBA_t Sector, UINT Count);
+static void StreamClose( void);
+static bool WaitWrite( void);
+static int FillInput( bool Wait);
+static void Sent( void);
+static void SyncClock( void);
+
+//	SimBoardDisk - Attach the card image.
+//	-------------------------------------
+//
+//	A new image is created at the size given (in MB) and left
+//	unformatted.  Returns false if that can't be done.
+//
+
+bool SimBoardDisk( const char *Path, uint32_t Megabytes)
+{
+
+  long
+    size;
+
+  if ( !(Disk = fopen( Path, "r+b")))
+  {
+    if ( !(Disk = fopen( Path, "w+b")))
+      return false;
+    size = (long) Megabytes << 20;
+    if ( fseek( Disk, size - 1, SEEK_SET) || fputc( 0, Disk) == EOF)
+      return false;
+  } // if new image
+
+  fseek( Disk, 0, SEEK_END);
+  DiskSectors = (uint32_t) (ftell( Disk) / SECTOR_SIZE);
+  return DiskSectors != 0;
+} // SimBoardDisk
+
+//	SimBoardDiskRate - Set the card's transfer rate, KB/second.
+//	-----------------------------------------------------------
+//
+
+void SimBoardDiskRate( uint32_t KBytes)
+{
+  DiskRate = KBytes ? KBytes : 1;
+} // SimBoardDiskRate
+
+//	SimBoardAtEnd - Say what to do when input runs out.
+//	---------------------------------------------------
+//
+
+void SimBoardAtEnd( void (*Handler)( void))
+{
+  AtEnd = Handler;
+} // SimBoardAtEnd
+
+//	SimBoardData - Attach the USB data interface.
+//	---------------------------------------------
+//
+//	The host is taken to have attached it for the whole run.
+//
+
+void SimBoardData( int Fd)
+{
+  DataFd = Fd;
+} // SimBoardData
+
+//*	USB serial.
+//	===========
+
+int USInit( void)
+{
+  return 0;
+} // USInit
+
+void USClear( void)
+{
+
+  InPos = InLen = 0;
+  return;
+} // USClear
+
+int USPutchar( char What)
+{
+
+  Sent();
+  if ( What != '\r')
+    putchar( What);
+  return What;
+} // USPutchar
+
+void USFlush( void)
+{
+
+  return;				// stdout's flushed when idle
+} // USFlush
+
+int USWritechar( char What)
+{
+
+  Sent();
+  putchar( What);			// raw, as it is on the board
+  return What;
+} // USWritechar
+
+int USGetchar( void)
+{
+
+  FillInput( true);
+  return InBuf[ InPos++];
+} // USGetchar
+
+//  A loop that does nothing between looks is waiting on the host, so
+//  the second look in a row that finds nothing lets some time go by,
+//  real and simulated; the clock ticks on for timeouts.
+
+int USCharReady( void)
+{
+
+  if ( Interactive < 0)
+    Interactive = isatty( 0);
+  if ( Interactive && FillInput( false))
+    return 1;
+
+  if ( SimTime() == LastLook)
+  {
+    fflush( stdout);
+    if ( Interactive)
+    {
+      struct pollfd
+        pfd = { 0, POLLIN, 0 };
+
+      poll( &pfd, 1, IDLE_USEC / 1000);
+    }
+    SimCharge( (uint32_t) SIM_USEC( IDLE_USEC));
+  } // if idle
+  LastLook = SimTime();
+  SyncClock();
+  return 0;
+} // USCharReady
+
+//  Input's a pipe or pty that may not have it all yet, so this one
+//  waits for the full Count.
+
+int USReadBlock( uint8_t *What, int Count)
+{
+
+  int
+    i;
+
+  for ( i = 0; i < Count; i++)
+    What[ i] = (uint8_t) USGetchar();
+  return Count;
+} // USReadBlock
+
+//  Peeking waits for some input, as the rest of input does.
+
+int USPeekInput( uint8_t **Where)
+{
+
+  FillInput( true);
+  *Where = InBuf + InPos;
+  return InLen - InPos;
+} // USPeekInput
+
+void USSkipInput( int Count)
+{
+
+  if ( Count > 0)
+    InPos += Count < InLen - InPos ? Count : InLen - InPos;
+  return;
+} // USSkipInput
+
+void USPuts( char *What)
+{
+
+  while ( *What)
+    USPutchar( *What++);
+  return;
+} // USPuts
+
+int USWriteBlock( uint8_t *What, int Count)
+{
+
+  int
+    i;
+
+  for ( i = 0; i < Count; i++)
+    USWritechar( (char) What[ i]);
+  return Count;
+} // USWriteBlock
+
+bool USDataAttached( void)
+{
+  return DataFd >= 0;
+} // USDataAttached
+
+int USDataWrite( uint8_t *What, int Count)
+{
+
+  int
+    done,
+    n;
+
+  SimCharge( DATA_CYCLES * (uint32_t) Count);
+  fflush( stdout);			// keep the console in step
+  for ( done = 0; done < Count; done += n)
+    if ( (n = (int) write( DataFd, What + done, Count - done)) <= 0)
+      break;
+  return done;				// short if the host's gone
+} // USDataWrite
+
+//  As with USReadBlock, this waits for the full Count; the host
+//  closing the link ends the run.
+
+int USDataRead( uint8_t *What, int Count)
+{
+
+  int
+    done,
+    n;
+
+  SimCharge( DATA_CYCLES * (uint32_t) Count);
+  for ( done = 0; done < Count; done += n)
+    if ( (n = (int) read( DataFd, What + done, Count - done)) <= 0)
+    {
+      fflush( stdout);
+      if ( AtEnd)
+        AtEnd();
+      exit( 0);
+    }
+  return Count;
+} // USDataRead
+
+//  No USB disk here; host/mscsim.c drives mscbot.c directly.
+
+bool USDiskMode( bool On)
+{
+  (void) On;
+  return false;
+} // USDiskMode
+
+void USDiskPoll( void)
+{
+} // USDiskPoll
+
+//	FillInput - Get console input from the host if we're out.
+//	---------------------------------------------------------
+//
+//	Wait says whether to wait for it.  Returns how much input there
+//	is; end of input ends the run.
+//
+
+static int FillInput( bool Wait)
+{
+
+  struct pollfd
+    pfd = { 0, POLLIN, 0 };
+  int
+    n;
+
+  if ( InPos < InLen)
+    return InLen - InPos;
+
+  if ( Interactive < 0)
+    Interactive = isatty( 0);
+  fflush( stdout);			// what we sent, the host has
+  if ( !Wait && poll( &pfd, 1, 0) <= 0)
+    return 0;
+  if ( (n = (int) read( 0, InBuf, sizeof( InBuf))) <= 0)
+  {
+    if ( AtEnd)
+      AtEnd();
+    exit( 0);
+  }
+  InPos = 0;
+  InLen = n;
+
+//  An answer waits out the round trip.  What's found there without
+//  waiting may answer something sent a while ago (a streaming
+//  sender's ZACK), so that need only be a round trip after the first
+//  thing sent since we last heard.  Taking it costs about what
+//  sending it does.
+
+  if ( Wait && Interactive && AnswerDue > SimTime())
+    SimCharge( (uint32_t) (AnswerDue - SimTime()));
+  else if ( Interactive && EarlyAnswer > SimTime())
+    SimCharge( (uint32_t) (EarlyAnswer - SimTime()));
+  AnswerDue = EarlyAnswer = 0;
+  SimCharge( SERIAL_CYCLES * (uint32_t) n);
+  SyncClock();
+  return n;
+} // FillInput
+
+//	Sent - Account for a character sent to the host.
+//	------------------------------------------------
+//
+
+static void Sent( void)
+{
+
+  SimCharge( SERIAL_CYCLES);
+  AnswerDue = SimTime() + SIM_USEC( ROUND_TRIP_USEC);
+  if ( !EarlyAnswer)
+    EarlyAnswer = AnswerDue;
+  return;
+} // Sent
+
+//	SyncClock - Bring the millisecond tick up to simulated time.
+//	------------------------------------------------------------
+//
+
+static void SyncClock( void)
+{
+  Milliseconds = (uint32_t) (SimTime() / (SIM_CPU_HZ / 1000));
+} // SyncClock
+
+//*	SD card.
+//	========
+
+SD_ERROR SD_Init( void)
+{
+  return Disk ? SD_ERR_SUCCESS : SD_ERR_NO_CARD;
+} // SD_Init
+
+uint32_t SD_GetCardSize( void)
+{
+  return DiskSectors;
+} // SD_GetCardSize
+
+uint32_t SD_GetClock( void)
+{
+  return Disk ? 24000 : 0;
+} // SD_GetClock
+
+DSTATUS disk_status( BYTE pdrv)
+{
+
+  (void) pdrv;
+  return Disk ? 0 : STA_NOINIT;
+} // disk_status
+
+DSTATUS disk_initialize( BYTE pdrv)
+{
+
+  (void) pdrv;
+  WaitWrite();
+  StreamClose();
+  return Disk ? 0 : STA_NOINIT;
+} // disk_initialize
+
+DRESULT disk_read( BYTE pdrv, BYTE *buff, LBA_t sector, UINT count)
+{
+
+  (void) pdrv;
+  if ( !WaitWrite())
+    return RES_ERROR;
+  StreamClose();
+  SimCharge( DiskTime( count, true));
+  if ( fseek( Disk, (long) sector * SECTOR_SIZE, SEEK_SET) ||
+    fread( buff, SECTOR_SIZE, count, Disk) != count)
+    return RES_ERROR;
+  return RES_OK;
+} // disk_read
+
+DRESULT disk_read_start( BYTE pdrv, BYTE *buff, LBA_t sector, UINT count)
+{
+
+  if ( ((uintptr_t) buff & 3) || count == 0)
+    return disk_read( pdrv, buff, sector, count);
+  if ( !WaitWrite())
+    return RES_ERROR;
+  StreamClose();
+  if ( fseek( Disk, (long) sector * SECTOR_SIZE, SEEK_SET) ||
+    fread( buff, SECTOR_SIZE, count, Disk) != count)
+    return RES_ERROR;
+  OwnedBuf = buff;
+  OwnedCount = count;
+  OwnedRead = true;
+  DiskBusy = SimTime() + DiskTime( count, true);
+  return RES_OK;
+} // disk_read_start
+
+DRESULT disk_write( BYTE pdrv, const BYTE *buff, LBA_t sector, UINT count)
+{
+
+  (void) pdrv;
+  if ( !WaitWrite())
+    return RES_ERROR;
+
+//  Single sectors and misaligned buffers are copied, one by one.
+
+  if ( count == 1 || ((uintptr_t) buff & 3))
+  {
+    while ( count--)
+    {
+      if ( !WaitWrite() ||
+        fseek( Disk, (long) sector * SECTOR_SIZE, SEEK_SET) ||
+        fwrite( buff, SECTOR_SIZE, 1, Disk) != 1)
+        return RES_ERROR;
+      DiskBusy = SimTime() + StreamTime( sector, 1);
+      sector++;
+      buff += SECTOR_SIZE;
+    } // for each sector
+    return RES_OK;
+  } // if copied
+
+  OwnedBuf = buff;
+  OwnedCount = count;
+  OwnedSector = sector;
+  OwnedRead = false;
+  DiskBusy = SimTime() + StreamTime( sector, count);
+  return RES_OK;
+} // disk_write
+
+DRESULT disk_claim( const void *Buf, UINT Len)
+{
+
+  const BYTE
+    *start;
+
+  start = (const BYTE *) Buf;
+  if ( OwnedBuf && start < OwnedBuf + OwnedCount * SECTOR_SIZE &&
+    OwnedBuf < start + Len && !WaitWrite())
+    return RES_ERROR;
+  return RES_OK;
+} // disk_claim
+
+DRESULT disk_ioctl( BYTE pdrv, BYTE cmd, void *buff)
+{
+
+  (void) pdrv;
+  switch ( cmd)
+  {
+    case GET_SECTOR_COUNT:
+      *((LBA_t *) buff) = DiskSectors;
+      return RES_OK;
+
+    case CTRL_SYNC:
+      if ( !WaitWrite())
+        return RES_ERROR;
+      StreamClose();
+      fflush( Disk);
+      return RES_OK;
+
+    case GET_SECTOR_SIZE:
+      *((WORD *) buff) = SECTOR_SIZE;
+      return RES_OK;
+
+    case GET_BLOCK_SIZE:
+      *((DWORD *) buff) = 1;
+      return RES_OK;
+
+    default:
+      break;
+  } // switch
+  return RES_PARERR;
+} // disk_ioctl
+
+DWORD get_fattime( void)
+{
+  return GetRTCDOSTime();
+} // get_fattime
+
+//	DiskTime - How long a card transfer takes, in cycles.
+//	-----------------------------------------------------
+//
+
+static uint64_t DiskTime( UINT Count, bool Command)
+{
+
+  return SIM_USEC( Command ? SD_COMMAND_USEC : SD_STREAM_USEC) +
+    (uint64_t) Count * SECTOR_SIZE * SIM_CPU_HZ / 1024 / DiskRate;
+} // DiskTime
+
+//	StreamTime - How long a streamed write takes, in cycles.
+//	--------------------------------------------------------
+//
+//	As SD_StreamWrite does it: a write that follows on from the last
+//	carries on the open stream; any other closes it and opens a new
+//	one.
+//
+
+static uint64_t StreamTime( LBA_t Sector, UINT Count)
+{
+
+  bool
+    open;
+
+  open = !StreamOpen || Sector != StreamNext;
+  if ( open)
+  {
+    StreamClose();
+    StreamOpen = true;
+  }
+  StreamNext = Sector + Count;
+  return DiskTime( Count, open);
+} // StreamTime
+
+//	StreamClose - Stop an open write stream.
+//	----------------------------------------
+//
+
+static void StreamClose( void)
+{
+
+  if ( StreamOpen)
+  {
+    StreamOpen = false;
+    SimCharge( SIM_USEC( SD_COMMAND_USEC));
+  }
+  return;
+} // StreamClose
+
+//	WaitWrite - Wait out a write in progress.
+//	-----------------------------------------
+//
+//	A write from the caller's buffer goes to the image now.  Returns
+//	false if that fails.
+//
+
+static bool WaitWrite( void)
+{
+
+  bool
+    ok;
+
+  if ( SimTime() < DiskBusy)
+    SimCharge( (uint32_t) (DiskBusy - SimTime()));
+
+  ok = true;
+  if ( OwnedBuf && !OwnedRead)
+  {
+    ok = !fseek( Disk, (long) OwnedSector * SECTOR_SIZE, SEEK_SET) &&
+      fwrite( OwnedBuf, SECTOR_SIZE, OwnedCount, Disk) == OwnedCount;
+  }
+  OwnedBuf = NULL;
+  return ok;
+} // WaitWrite
+
+//*	Real-time clock.
+//	================
+//
+//	Simulated time, starting at midnight, January 1, 2024.
+
+void InitializeRTC( void)
+{
+  return;
+} // InitializeRTC
+
+void ShowRTCTime( void)
+{
+
+  uint64_t
+    usec;
+
+  usec = SimTime() / (SIM_CPU_HZ / 1000000);
+  Uprintf( "Time: %02d:%02d:%02d.%06d\n",
+    (int) (usec / 3600000000ULL),
+    (int) (usec / 60000000 % 60),
+    (int) (usec / 1000000 % 60),
+    (int) (usec % 1000000));
+  return;
+} // ShowRTCTime
+
+uint32_t Microseconds( void)
+{
+  return (uint32_t) (SimTime() / (SIM_CPU_HZ / 1000000));
+} // Microseconds
+
+void ShowRTCDate( void)
+{
+  Uprintf( "Date: 01/01/2024\n");
+} // ShowRTCDate
+
+void SetRTCTime( void)
+{
+  Uprintf( "The simulated clock can't be set.\n");
+} // SetRTCTime
+
+uint32_t GetRTCDOSTime( void)
+{
+
+  uint32_t
+    sec;
+
+  sec = (uint32_t) (SimTime() / SIM_CPU_HZ);
+  return ((2024 - 1980) << 25) | (1 << 21) | (1 << 16) |
+    ((sec / 3600 % 24) << 11) | ((sec / 60 % 60) << 5) | (sec % 60 / 2);
+} // GetRTCDOSTime
+
+//*	Odds and ends.
+//	==============
+
+//  ShowBuffer - Display buffer contents.
+//  -------------------------------------
+//
+
+void ShowBuffer( uint8_t *Buf, int Buflen)
+{
+
+  int
+    base,
+    i, j;
+
+  for ( i = 0; i < Buflen/16; i++)
+  {
+    base = 16*i;
+    Uprintf( "%04x: ", base);
+    for ( j = 0; j < 16; j++)
+      Uprintf( "%02x ", Buf[j+base]);
+    Uprintf("  ");
+    for ( j = 0; j < 16; j++)
+      Uprintf( "%c", isprint( Buf[j+base]) ? Buf[j+base] : '.');
+    Uprintf( "\n");
+  } // for each line
+} // ShowBuffer
@@ -0,0 +1,15 @@
+#ifndef _SIMBOARD_INC
+#define _SIMBOARD_INC
+
+#include <stdint.h>
+#include <stdbool.h>
+
+//  Host stand-ins for the serial port, SD card and clock; see
+//  simboard.c.
+
+bool SimBoardDisk( const char *Path, uint32_t Megabytes);
+void SimBoardDiskRate( uint32_t KBytes);
+void SimBoardAtEnd( void (*Handler)( void));
+void SimBoardData( int Fd);
+
+#endif
@@ -0,0 +1,121 @@
+//*	Port layer for the host build.
+//	------------------------------
+//
+//	The routines of pertport.h, routed to the formatter model in
+//	pertsim.c.  Each register access costs the CPU SIM_GPIO_CYCLES,
+//	what the libopencm3 call behind it does on the target;
+//	PertDelay costs what Delay would.
+//
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "pertport.h"
+#include "pertsim.h"
+
+static uint16_t
+  Ctrl = 0xffff;		// control register latch
+static uint8_t
+  Cmd = 0xff;			// command register bus
+
+void PertCtrlSet( uint16_t Pins)
+{
+
+  SimCharge( SIM_GPIO_CYCLES);
+  Ctrl |= Pins;
+  SimWriteControl( Ctrl);
+  return;
+} // PertCtrlSet
+
+void PertCtrlClear( uint16_t Pins)
+{
+
+  SimCharge( SIM_GPIO_CYCLES);
+  Ctrl &= ~Pins;
+  SimWriteControl( Ctrl);
+  return;
+} // PertCtrlClear
+
+void PertCmdSet( uint8_t Bits)
+{
+
+  SimCharge( SIM_GPIO_CYCLES);
+  Cmd |= Bits;
+  SimWriteCommand( Cmd);
+  return;
+} // PertCmdSet
+
+void PertCmdClear( uint8_t Bits)
+{
+
+  SimCharge( SIM_GPIO_CYCLES);
+  Cmd &= ~Bits;
+  SimWriteCommand( Cmd);
+  return;
+} // PertCmdClear
+
+uint8_t PertStatus( void)
+{
+
+  SimCharge( SIM_GPIO_CYCLES);
+  return (uint8_t) (SimReadPortE() >> 8);
+} // PertStatus
+
+uint8_t PertDataRead( void)
+{
+
+  SimCharge( SIM_GPIO_CYCLES);
+  return (uint8_t) SimReadPortE();
+} // PertDataRead
+
+void PertDataWrite( uint16_t Value)
+{
+
+  SimCharge( SIM_GPIO_CYCLES);
+  SimWriteData( (uint8_t) Value);
+  return;
+} // PertDataWrite
+
+void PertDataIn( void)
+{
+  SimCharge( SIM_GPIO_CYCLES);
+} // PertDataIn
+
+void PertDataOut( void)
+{
+  SimCharge( SIM_GPIO_CYCLES);
+} // PertDataOut
+
+//  Delay for a specific number of half-microseconds.
+//  -------------------------------------------------
+//
+//  Plus a little for setting up TIM6.
+
+void PertDelay( uint16_t Howmuch)
+{
+  SimCharge( Howmuch * (SIM_CPU_HZ / 2000000) + 4 * SIM_GPIO_CYCLES);
+} // PertDelay
+
+//  The cycle counter is simulated time; reading it is a load from
+//  the private peripheral bus.
+
+void PertCyclesStart( void)
+{
+  return;
+} // PertCyclesStart
+
+uint32_t PertCycles( void)
+{
+
+  SimCharge( 2);
+  return (uint32_t) SimTime();
+} // PertCycles
+
+//  The millisecond tick, from the same clock.
+
+uint32_t PertMsec( void)
+{
+
+  SimCharge( 2);
+  return (uint32_t) (SimTime() / (SIM_CPU_HZ / 1000));
+} // PertMsec
@@ -0,0 +1,159 @@
+//*	Host stand-in for the transfer engines of tapexfer.c.
+//	-----------------------------------------------------
+//
+//	The timer and DMA streams are modeled in pertsim.c.  What's
+//	charged to the CPU here is the register traffic of setting up
+//	and taking down the engine, plus inverting the buffer after.
+//	Those are the costs the benchmark reports as the engine's.
+//
+//	The write engine is the same code as on the target, except that
+//	it goes through the port layer (which makes it look a little
+//	slower than it is: one BSRR write becomes two calls here and
+//	there) and its handler is registered with the model in place of
+//	the EXTI vector.
+//
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "pertport.h"
+#include "pertbits.h"
+#include "tapexfer.h"
+#include "pertsim.h"
+
+//  About 30 register writes to arm three streams and the timer;
+//  about 10 to take them down.
+
+#define ARM_CYCLES	(30 * SIM_GPIO_CYCLES)
+#define DISARM_CYCLES	(10 * SIM_GPIO_CYCLES)
+
+static uint8_t
+  *WritePtr;			// next byte to go
+static int
+  WriteLeft,			// bytes not yet strobed
+  WriteLength;			// length of the block
+static uint8_t
+  LastWord;			// command 0 with ILWD
+
+static void Charge( uint32_t Cycles);
+static void WriteIsr( void);
+static void WriteNext( void);
+static void LatchLastWord( void);
+
+void XferInit( void)
+{
+  SimExtiHandler( WriteIsr);
+} // XferInit
+
+void XferReadSetup( uint8_t *Buf, int Buflen)
+{
+
+  if ( Buflen > XFER_MAX_COUNT)
+    Buflen = XFER_MAX_COUNT;
+  Charge( ARM_CYCLES);
+  SimEngineSetup( Buf, Buflen);
+  return;
+} // XferReadSetup
+
+void XferReadEnable( bool On)
+{
+
+  SimCharge( (On ? 3 : 1) * SIM_GPIO_CYCLES);	// part of the status wait
+  SimEngineEnable( On);
+  return;
+} // XferReadEnable
+
+int XferReadCount( void)
+{
+  return SimEngineCount();
+} // XferReadCount
+
+int XferReadStop( void)
+{
+
+  int
+    count;
+
+  count = SimEngineDisarm();
+  Charge( DISARM_CYCLES + count);	// inverting: ~1 cycle/byte
+  return count;
+} // XferReadStop
+
+void XferWriteSetup( uint8_t *Buf, int Buflen, uint8_t LastWordCmd)
+{
+
+  SimExtiEnable( false);
+  WritePtr = Buf;
+  WriteLength = WriteLeft = Buflen;
+  LastWord = LastWordCmd;
+  Charge( 4 * SIM_GPIO_CYCLES);
+
+  if ( Buflen == 1)
+    LatchLastWord();
+  WriteNext();
+  return;
+} // XferWriteSetup
+
+void XferWriteEnable( bool On)
+{
+
+  SimCharge( 3 * SIM_GPIO_CYCLES);
+  SimExtiEnable( On);
+  if ( On && !(PertStatus() & PS0_WREMPTY))
+    SimExtiSoftware();
+  return;
+} // XferWriteEnable
+
+int XferWriteCount( void)
+{
+  return WriteLength - WriteLeft;
+} // XferWriteCount
+
+int XferWriteStop( void)
+{
+
+  SimExtiEnable( false);
+  PertCtrlSet( PCTRL_TACK | PCTRL_LBUF);
+  return XferWriteCount();
+} // XferWriteStop
+
+static void WriteIsr( void)
+{
+
+  if ( !(PertStatus() & PS0_WREMPTY))
+    WriteNext();
+  return;
+} // WriteIsr
+
+static void WriteNext( void)
+{
+
+  if ( WriteLeft == 0)
+    return;
+
+  PertCtrlClear( PCTRL_TACK | PCTRL_LBUF);
+  PertDataWrite( (uint8_t) ~*WritePtr++);
+  PertCtrlSet( PCTRL_TACK | PCTRL_LBUF);
+
+  if ( --WriteLeft == 1)
+    LatchLastWord();
+  return;
+} // WriteNext
+
+static void LatchLastWord( void)
+{
+
+  PertCmdSet( PCMD_BIT);
+  PertCmdClear( LastWord);
+  PertCtrlClear( PCTRL_CSEL1);
+  PertCtrlSet( PCTRL_CSEL1);
+  return;
+} // LatchLastWord
+
+static void Charge( uint32_t Cycles)
+{
+
+  SimStats.EngineCycles += Cycles;
+  SimCharge( Cycles);
+  return;
+} // Charge
@@ -0,0 +1,234 @@
+//*	Tape speed selection benchmark.
+//	-------------------------------
+//
+//	Runs the real TapeRead, SkipBlock and SpaceFile
+//	(src/tapedriver.c) against a simulated dual-speed drive (pertsim.c):
+//	start/stop at its low speed, streaming at its high one, where a
+//	command that comes after the drive has coasted through the gap
+//	costs a reposition.  Each operation is run with the speed held
+//	low, held high and left to SPEED_AUTO, and we report blocks per
+//	second of simulated time.
+//
+//	Reads are tried with the next one issued at once and with the
+//	host away for a while after each block, as when the card is
+//	slow or someone is reading blocks by hand.  Every operation's
+//	PS0_ISPEED is checked against the speed asked for; a drive with
+//	one speed is run last, to show the check catching it.  The exit
+//	status says whether every block came through and every speed
+//	matched on the dual-speed drive.
+//
+
+#define MAIN
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "globals.h"
+#include "tapedriver.h"
+#include "pertsim.h"
+
+//  The drives: 25 ips start/stop, 100 ips streaming with a 300 msec
+//  reposition, 1600 bpi; and the same drive without the high speed.
+
+static const SIM_DRIVE
+  Dual = { 25, 1600, 600, 300, 100 },
+  Single = { 25, 1600, 600, 300, 0 };
+
+static const int
+  Lengths[] = { 80, 512, 2048, 8192, 32768 };
+
+#define LENGTH_COUNT (sizeof( Lengths) / sizeof( Lengths[0]))
+
+//  The host's time between blocks, usec.
+
+typedef struct
+{
+  char *Name;
+  uint32_t Usec;
+} HOST_DELAY;
+
+static const HOST_DELAY
+  Delays[] =
+{
+  { "at once", 0 },
+  { "20 msec", 20000 }
+};
+
+#define DELAY_COUNT (sizeof( Delays) / sizeof( Delays[0]))
+
+#define READ_BLOCKS	40		// blocks per read case
+#define SKIP_BLOCKS	40		// ... per skip case
+#define SPACE_FILES	4		// files per space case
+#define SPACE_BLOCKS	50		// ... of this many blocks
+
+typedef enum
+{
+  RUN_READ,
+  RUN_SKIP,
+  RUN_SPACE
+} RUN_KIND;
+
+typedef struct
+{
+  double Rate;			// blocks/second
+  int Bad;			// operations that failed
+  int Misses;			// ... or ran at the wrong speed
+  int High;			// ... ran at high speed
+  int Ops;			// operations
+} RESULT;
+
+//  Prototypes.
+
+static bool Row( const SIM_DRIVE *Drive, char *What, RUN_KIND Kind,
+                 int Length, const HOST_DELAY *Delay);
+static RESULT Run( const SIM_DRIVE *Drive, RUN_KIND Kind, int Speed,
+                   int Length, const HOST_DELAY *Delay);
+static void Tally( RESULT *Res, unsigned int Status);
+
+int main( void)
+{
+
+  unsigned int
+    l, d;
+  bool
+    good;
+
+  printf( "Dual-speed drive: %d/%d ips, %d bpi, %d mil gap,"
+    " %d msec reposition\n", Dual.Ips, Dual.HighIps, Dual.Bpi,
+    Dual.GapMils, Dual.RepoMsec);
+  printf( "\nBlocks/sec        Length  Host       %8s %8s %8s"
+    "  Auto high  Misses\n", "Low", "High", "Auto");
+
+  good = true;
+  for ( d = 0; d < DELAY_COUNT; d++)
+    for ( l = 0; l < LENGTH_COUNT; l++)
+      good &= Row( &Dual, "Read", RUN_READ, Lengths[ l], &Delays[ d]);
+  for ( l = 0; l < LENGTH_COUNT; l++)
+    good &= Row( &Dual, "Skip", RUN_SKIP, Lengths[ l], &Delays[ 0]);
+  good &= Row( &Dual, "Space", RUN_SPACE, 8192, &Delays[ 0]);
+
+  printf( "\nOne-speed drive, %d ips; high speed asked for but never"
+    " seen:\n", Single.Ips);
+  Row( &Single, "Read", RUN_READ, 8192, &Delays[ 0]);
+  Row( &Single, "Space", RUN_SPACE, 8192, &Delays[ 0]);
+
+  printf( good ? "\nAll blocks read, all speeds as asked.\n" :
+    "\nSome blocks failed or went at the wrong speed.\n");
+  return good ? 0 : 1;
+} // main
+
+//	Row - One operation at each speed setting.
+//	------------------------------------------
+//
+//	Returns true if nothing failed or went at the wrong speed.
+//
+
+static bool Row( const SIM_DRIVE *Drive, char *What, RUN_KIND Kind,
+                 int Length, const HOST_DELAY *Delay)
+{
+
+  RESULT
+    res[ 3];
+  int
+    speed,
+    misses;
+  bool
+    good;
+
+  good = true;
+  misses = 0;
+  for ( speed = SPEED_LOW; speed <= SPEED_AUTO; speed++)
+  {
+    res[ speed] = Run( Drive, Kind, speed, Length, Delay);
+    misses += res[ speed].Misses;
+    if ( res[ speed].Bad || res[ speed].Misses)
+      good = false;
+  }
+  printf( "%-16s %7d  %-8s %8.1f %8.1f %8.1f  %4d/%-4d %6d%s\n",
+    What, Length, Delay->Name, res[ SPEED_LOW].Rate,
+    res[ SPEED_HIGH].Rate, res[ SPEED_AUTO].Rate,
+    res[ SPEED_AUTO].High, res[ SPEED_AUTO].Ops, misses,
+    (res[ 0].Bad | res[ 1].Bad | res[ 2].Bad) ? "  FAILED" : "");
+  return good;
+} // Row
+
+//	Run - One operation at one speed setting.
+//	-----------------------------------------
+//
+
+static RESULT Run( const SIM_DRIVE *Drive, RUN_KIND Kind, int Speed,
+                   int Length, const HOST_DELAY *Delay)
+{
+
+  RESULT
+    res = { 0 };
+  uint64_t
+    start;
+  int
+    blocks,
+    i,
+    got;
+  unsigned int
+    stat;
+
+  SimSetDrive( Drive);
+  if ( Kind == RUN_SPACE)
+    SimMakeTape( SPACE_FILES, SPACE_BLOCKS, Length);
+  else
+    SimSetBlocks( Length);
+  SimReset();
+  TapeInit();
+  TapeSpeed = Speed;
+
+  start = SimTime();
+  switch( Kind)
+  {
+    case RUN_READ:
+      blocks = READ_BLOCKS;
+      for ( i = 0; i < blocks; i++)
+      {
+        stat = TapeRead( TapeBuffer, TAPE_BUFFER_SIZE, &got);
+        if ( got != Length)
+          stat |= TSTAT_LENGTH;
+        Tally( &res, stat);
+        SimCharge( (uint32_t) SIM_USEC( Delay->Usec));
+      }
+      break;
+
+    case RUN_SKIP:
+      blocks = SKIP_BLOCKS;
+      for ( i = 0; i < blocks; i++)
+        Tally( &res, SkipBlock( 1));
+      break;
+
+    default:
+      blocks = SPACE_FILES * SPACE_BLOCKS;
+      for ( i = 0; i < SPACE_FILES; i++)
+        Tally( &res, SpaceFile( 1) & ~TSTAT_TAPEMARK);
+      break;
+  } // switch
+  res.Rate = (double) blocks * SIM_CPU_HZ / (SimTime() - start);
+  return res;
+} // Run
+
+//	Tally - Count one operation's outcome and speed.
+//	------------------------------------------------
+//
+
+static void Tally( RESULT *Res, unsigned int Status)
+{
+
+  TAPE_SPEED
+    speed;
+
+  TapeOpSpeed( &speed);
+  Res->Ops++;
+  if ( Status != TSTAT_NOERR)
+    Res->Bad++;
+  if ( speed.Asked != speed.Ran)
+    Res->Misses++;
+  if ( speed.Ran)
+    Res->High++;
+  return;
+} // Tally
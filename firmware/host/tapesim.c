@@ -0,0 +1,404 @@
+//*	Tape utility on a simulated drive.
+//	----------------------------------
+//
+//	The real command processor, tape utilities, tape driver and FatFs,
+//	built for the host and run against the formatter model in
+//	pertsim.c.  Commands come from stdin, just as they'd be typed at
+//	the console; at end of input, the run ends with a summary of
+//	simulated time and tape activity.
+//
+//	The tape is a blank reel, a reel of pattern blocks or a .TAP
+//	file.  The SD card is an image file holding a FAT volume; host
+//	files can be copied onto it before the run and back off it
+//	after, so that an image can be written to tape (WRITE) or one
+//	made from tape (READ) and compared.
+//
+//	Usage: tapesim [options] < commands
+//
+//	  -t file	mount .TAP file
+//	  -n f,b,l	mount f files of b blocks of l bytes
+//	  -o file	save the reel as a .TAP file at the end
+//	  -p		no write ring
+//	  -d i,b,g[,r[,h]] drive: ips, bpi, gap in mils, reposition msec,
+//			high speed ips
+//	  -l feet	reel length
+//	  -e h,s[,seed]	inject hard/corrected errors, per million blocks
+//	  -u usec,cyc	interrupt load: every usec, take cyc cycles
+//	  -x P|D	transfer engine
+//	  -c file	SD card image (made, 64 MB, if it doesn't exist)
+//	  -k KB/sec	SD card rate
+//	  -f file	copy host file to the card first
+//	  -g file	copy card file to the host after
+//	  -a fd		USB data interface on file descriptor fd
+//
+
+#define MAIN
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "globals.h"
+#include "filedef.h"
+#include "diskio.h"
+#include "comm.h"
+#include "cli.h"
+#include "filesub.h"
+#include "tapedriver.h"
+#include "pertsim.h"
+#include "simboard.h"
+
+#define CARD_MB		64		// size of a new card image
+#define MAX_COPIES	8		// files in or out
+
+static char
+  *SavePath,			// where to save the reel
+  *CardIn[ MAX_COPIES],		// host files to put on the card
+  *CardOut[ MAX_COPIES];	// card files to bring back
+static int
+  CardInCount,
+  CardOutCount;
+
+//  Prototypes.
+
+static void Usage( void);
+static bool Mount( const char *Path);
+static bool CopyIn( const char *Name);
+static bool CopyOut( const char *Name);
+static const char *BaseName( const char *Path);
+static void Finish( void);
+
+int main( int argc, char *argv[])
+{
+
+  SIM_DRIVE
+    drive = { 125, 6250, 300, 0, 0 };
+  char
+    *card,
+    *tape;
+  int
+    opt,
+    feet,
+    mode,
+    files, blocks, len,
+    i;
+  unsigned int
+    hard, soft, seed,
+    period, cycles;
+  bool
+    protect;
+
+  card = "sdcard.img";
+  tape = NULL;
+  feet = 2400;
+  mode = XFER_DMA;
+  files = 0;
+  protect = false;
+  SimBlankTape();
+
+  while ( (opt = getopt( argc, argv, "t:n:o:pd:l:e:u:x:c:k:f:g:a:")) != -1)
+  {
+    switch( opt)
+    {
+      case 't':
+        tape = optarg;
+        break;
+
+      case 'n':
+        blocks = len = 0;
+        if ( sscanf( optarg, "%d,%d,%d", &files, &blocks, &len) != 3)
+          Usage();
+        break;
+
+      case 'o':
+        SavePath = optarg;
+        break;
+
+      case 'p':
+        protect = true;
+        break;
+
+      case 'd':
+        if ( sscanf( optarg, "%d,%d,%d,%d,%d", &drive.Ips, &drive.Bpi,
+          &drive.GapMils, &drive.RepoMsec, &drive.HighIps) < 3 ||
+          drive.Ips <= 0 || drive.Bpi <= 0)
+          Usage();
+        break;
+
+      case 'l':
+        feet = atoi( optarg);
+        break;
+
+      case 'e':
+        seed = 1;
+        if ( sscanf( optarg, "%u,%u,%u", &hard, &soft, &seed) < 2)
+          Usage();
+        SimSetErrors( hard, soft, seed);
+        break;
+
+      case 'u':
+        if ( sscanf( optarg, "%u,%u", &period, &cycles) != 2)
+          Usage();
+        SimSetInterruptLoad( period, cycles);
+        break;
+
+      case 'x':
+        mode = (*optarg == 'P' || *optarg == 'p') ? XFER_POLLED : XFER_DMA;
+        break;
+
+      case 'c':
+        card = optarg;
+        break;
+
+      case 'k':
+        SimBoardDiskRate( (uint32_t) atoi( optarg));
+        break;
+
+      case 'f':
+        if ( CardInCount < MAX_COPIES)
+          CardIn[ CardInCount++] = optarg;
+        break;
+
+      case 'g':
+        if ( CardOutCount < MAX_COPIES)
+          CardOut[ CardOutCount++] = optarg;
+        break;
+
+      case 'a':
+        SimBoardData( atoi( optarg));
+        break;
+
+      default:
+        Usage();
+    } // switch
+  } // while options
+
+//  Mount the tape.
+
+  if ( tape && !SimLoadTape( tape))
+  {
+    fprintf( stderr, "Can't load %s as a .TAP image.\n", tape);
+    return 1;
+  }
+  if ( files)
+    SimMakeTape( files, blocks, len);
+  SimSetDrive( &drive);
+  SimSetReel( feet, protect);
+  SimReset();
+
+//  Get the card ready.
+
+  if ( !Mount( card))
+    return 1;
+  for ( i = 0; i < CardInCount; i++)
+    if ( !CopyIn( CardIn[ i]))
+      return 1;
+
+//  Run on a pty (tapestream -x), the end of input is the pty closing,
+//  which hangs us up; carry on to Finish, or -o and -g never happen.
+
+  signal( SIGHUP, SIG_IGN);
+  TapeInit();
+  TapeXferMode = mode;
+  SimBoardAtEnd( Finish);
+  ProcessCommand();			// never comes back
+  return 0;
+} // main
+
+//	Usage - Explain and quit.
+//	-------------------------
+//
+
+static void Usage( void)
+{
+
+  fprintf( stderr,
+    "Usage: tapesim [options] < commands\n"
+    "  -t file        mount .TAP file\n"
+    "  -n f,b,l       mount f files of b blocks of l bytes\n"
+    "  -o file        save the reel as a .TAP file at the end\n"
+    "  -p             no write ring\n"
+    "  -d i,b,g[,r[,h]] drive: ips, bpi, gap mils, reposition msec,"
+    " high ips\n"
+    "  -l feet        reel length\n"
+    "  -e h,s[,seed]  inject hard/corrected errors per million blocks\n"
+    "  -u usec,cyc    interrupt load: every usec, take cyc cycles\n"
+    "  -x P|D         transfer engine\n"
+    "  -c file        SD card image\n"
+    "  -k KB/sec      SD card rate\n"
+    "  -f file        copy host file to the card first\n"
+    "  -g file        copy card file to the host after\n"
+    "  -a fd          USB data interface on file descriptor fd\n");
+  exit( 2);
+} // Usage
+
+//	Mount - Attach the card image and mount its volume.
+//	---------------------------------------------------
+//
+//	A card without a file system gets one.
+//
+
+static bool Mount( const char *Path)
+{
+
+  static uint8_t
+    work[ FF_MAX_SS * 8];
+  FRESULT
+    fres;
+
+  if ( !SimBoardDisk( Path, CARD_MB))
+  {
+    fprintf( stderr, "Can't open card image %s.\n", Path);
+    return false;
+  }
+
+  fres = f_mount( &SDfs, "", 1);
+  if ( fres == FR_NO_FILESYSTEM)
+  {
+    if ( (fres = f_mkfs( "", 0, work, sizeof( work))) == FR_OK)
+      fres = f_mount( &SDfs, "", 1);
+  }
+  if ( fres != FR_OK)
+  {
+    fprintf( stderr, "Can't mount %s. Error = %d\n", Path, fres);
+    return false;
+  }
+  strcpy( CurrentPath, "/");
+  return true;
+} // Mount
+
+//	CopyIn - Copy a host file to the card's root.
+//	---------------------------------------------
+//
+
+static bool CopyIn( const char *Name)
+{
+
+  FILE
+    *hf;
+  FIL
+    cf;
+  UINT
+    wc;
+  size_t
+    n;
+  bool
+    ok;
+
+  if ( !(hf = fopen( Name, "rb")))
+  {
+    fprintf( stderr, "Can't open %s.\n", Name);
+    return false;
+  }
+  if ( f_open( &cf, BaseName( Name), FA_CREATE_ALWAYS | FA_WRITE) != FR_OK)
+  {
+    fclose( hf);
+    fprintf( stderr, "Can't create %s on the card.\n", BaseName( Name));
+    return false;
+  }
+
+  ok = true;
+  while ( ok)
+  {
+    disk_claim( TapeBuffer, TAPE_BUFFER_SIZE);	// card may still own it
+    if ( (n = fread( TapeBuffer, 1, TAPE_BUFFER_SIZE, hf)) == 0)
+      break;
+    ok = f_write( &cf, TapeBuffer, (UINT) n, &wc) == FR_OK && wc == n;
+  } // while copying
+  f_close( &cf);
+  fclose( hf);
+  if ( !ok)
+    fprintf( stderr, "Card full copying %s.\n", Name);
+  return ok;
+} // CopyIn
+
+//	CopyOut - Copy a file from the card's root to the host.
+//	-------------------------------------------------------
+//
+
+static bool CopyOut( const char *Name)
+{
+
+  FILE
+    *hf;
+  FIL
+    cf;
+  UINT
+    rc;
+  bool
+    ok;
+
+  if ( f_open( &cf, BaseName( Name), FA_READ) != FR_OK)
+  {
+    fprintf( stderr, "No %s on the card.\n", BaseName( Name));
+    return false;
+  }
+  if ( !(hf = fopen( Name, "wb")))
+  {
+    f_close( &cf);
+    fprintf( stderr, "Can't create %s.\n", Name);
+    return false;
+  }
+
+  ok = true;
+  while ( ok && f_read( &cf, TapeBuffer, TAPE_BUFFER_SIZE, &rc) == FR_OK &&
+    rc > 0)
+    ok = fwrite( TapeBuffer, 1, rc, hf) == rc;
+  f_close( &cf);
+  if ( fclose( hf))
+    ok = false;
+  return ok;
+} // CopyOut
+
+//	BaseName - File name without the host directory.
+//	------------------------------------------------
+//
+
+static const char *BaseName( const char *Path)
+{
+
+  const char
+    *slash;
+
+  slash = strrchr( Path, '/');
+  return slash ? slash + 1 : Path;
+} // BaseName
+
+//	Finish - Input's done; wrap up and report.
+//	------------------------------------------
+//
+//	Time and rates are simulated.  The tape rate is over the whole
+//	run, so it counts everything that kept the drive waiting.
+//
+
+static void Finish( void)
+{
+
+  double
+    secs;
+  int
+    i;
+
+  for ( i = 0; i < CardOutCount; i++)
+    CopyOut( CardOut[ i]);
+  f_mount( 0, "", 0);
+  if ( SavePath && !SimSaveTape( SavePath))
+    fprintf( stderr, "Can't save the reel as %s.\n", SavePath);
+
+  secs = (double) SimTime() / SIM_CPU_HZ;
+  printf( "\n\nSimulated time %.3f sec\n", secs);
+  printf( "%u blocks, %llu bytes, %.1f KB/sec\n", SimStats.Blocks,
+    (unsigned long long) SimStats.Bytes,
+    secs > 0 ? SimStats.Bytes / secs / 1024.0 : 0.0);
+  printf( "Data phases %.3f sec, %u repositions\n",
+    (double) SimStats.DataCycles / SIM_CPU_HZ, SimStats.Repositions);
+  printf( "%u overruns, %u underruns, %u+%u errors injected\n",
+    SimStats.Overruns, SimStats.Underruns,
+    SimStats.HardErrors, SimStats.SoftErrors);
+  printf( "%u records on the reel\n", SimTapeRecords());
+  return;
+} // Finish
@@ -0,0 +1,1053 @@
+//*	Stream a tape image between the controller and a .TAP file.
+//	-----------------------------------------------------------
+//
+//	Sends STREAM to the controller's console, takes the image that
+//	comes back (framed as in inc/tapestream.h) and writes it to a
+//	.TAP file; everything else the controller says goes to stderr.
+//	Each record's trailer is checked against its header on the way.
+//	^C sends ESC, which makes the controller end the image early.
+//
+//	With -w, it's the other way: STREAMW, then the .TAP file is sent
+//	to be written to tape, and the controller's status for each
+//	record is checked as it comes back.  If a record fails, or on
+//	^C, the image is ended there with an EOM.
+//
+//	The controller is a serial device--the board shows up as
+//	/dev/ttyACMx--or, with -x, a command run on a pseudo-terminal.
+//	tapesim makes a stand-in for the board that way:
+//
+//	  tapestream -x "tapesim -n 3,50,8192" out.tap
+//	  tapestream -w -x "tapesim -o out.tap" in.tap
+//
+//	"make streamcheck" runs that round trip and compares the reels.
+//
+//	With -u, the image goes over the board's USB data interface
+//	instead of the console, found through the console's device and
+//	driven with usbfs; the console still shows progress meanwhile.
+//	With -x, the data interface is a socket on the command's file
+//	descriptor 3:
+//
+//	  tapestream -u -x "tapesim -a 3 -n 3,50,8192" out.tap
+//
+//	Usage: tapestream [-n] [-w] [-u] [-x command | device] file.tap
+//
+//	  -n		don't rewind before or after
+//	  -w		write file.tap to tape
+//	  -u		use the USB data interface
+//	  -x command	run command on a pty as the controller
+//
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <poll.h>
+#include <pty.h>
+#include <signal.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <linux/usbdevice_fs.h>
+
+#include "tap.h"
+#include "tapedriver.h"
+#include "tapestream.h"
+
+#define WAIT_MSEC	60000		// longest quiet spell (a rewind)
+#define PROMPT_MSEC	5000		// wait for the prompt at the end
+#define LATE_MSEC	500		// data behind the console's prompt
+#define URB_SIZE	16384		// most per usbfs transfer
+
+//  The image link is the console itself, a socket (-u with -x) or a
+//  usbfs device (-u).
+
+enum { LINK_CONSOLE, LINK_SOCKET, LINK_USB };
+
+static int
+  Link = -1,			// controller's console
+  Data = -1,			// image link, unless it's the console
+  DataKind = LINK_CONSOLE;
+static pid_t
+  Child;			// ... if we started it
+static volatile sig_atomic_t
+  Interrupted;			// ^C hit
+
+//  Image bytes in, and the block going out.
+
+static uint8_t
+  InBuf[ 65536];
+static size_t
+  InHave,
+  InTaken;
+static const uint8_t
+  *OutNext;
+static size_t
+  OutLeft;
+
+//  usbfs transfers: one IN always waiting, and one OUT at a time.
+
+static struct usbdevfs_urb
+  InUrb,
+  OutUrb;
+static uint8_t
+  UrbBuf[ URB_SIZE];
+static bool
+  OutBusy;
+
+//  Console text, and where it is: after a command, the prompt isn't
+//  looked for until the command's echo has gone by.
+
+static const char
+  *Echo;
+static size_t
+  EchoLen,
+  EchoGot;
+static int
+  LastShown;
+static bool
+  AtPrompt;
+
+//  Prototypes.
+
+static void Usage( void);
+static bool OpenDevice( const char *Path);
+static bool OpenDataInterface( const char *Path);
+static void CloseDataInterface( void);
+static bool RunCommand( const char *Command);
+static int Pump( int Msec);
+static bool PumpUsb( void);
+static int DataNext( int Msec);
+static bool DataSend( const void *Buf, size_t Count);
+static bool GetWord( uint32_t *Word);
+static void Show( int C);
+static void OnInterrupt( int Sig);
+static void ShowRest( void);
+static bool WaitForStart( const char *Command, const char *Start,
+  int StartLen);
+static int ReceiveImage( const char *Path, bool NoRewind);
+static int SendImage( const char *Path, bool NoRewind);
+
+int main( int argc, char *argv[])
+{
+
+  char
+    *command;
+  int
+    opt,
+    result;
+  bool
+    noRewind,
+    toTape,
+    useData;
+
+  command = NULL;
+  noRewind = toTape = useData = false;
+  while ( (opt = getopt( argc, argv, "nwux:")) != -1)
+  {
+    switch( opt)
+    {
+      case 'n':
+        noRewind = true;
+        break;
+
+      case 'w':
+        toTape = true;
+        break;
+
+      case 'u':
+        useData = true;
+        break;
+
+      case 'x':
+        command = optarg;
+        break;
+
+      default:
+        Usage();
+    } // switch
+  } // while options
+  if ( argc - optind != (command ? 1 : 2))
+    Usage();
+
+  if ( useData)
+    DataKind = command ? LINK_SOCKET : LINK_USB;
+  if ( command)
+  {
+    if ( !RunCommand( command))
+      return 1;
+  }
+  else
+  {
+    if ( !OpenDevice( argv[ optind]) ||
+      (useData && !OpenDataInterface( argv[ optind])))
+      return 1;
+    optind++;
+  }
+  signal( SIGINT, OnInterrupt);
+
+  if ( toTape)
+    result = SendImage( argv[ optind], noRewind);
+  else
+    result = ReceiveImage( argv[ optind], noRewind);
+
+  CloseDataInterface();
+  close( Link);
+  if ( Child > 0)
+    waitpid( Child, NULL, 0);
+  return result;
+} // main
+
+//	ReceiveImage - STREAM: take the image from tape into a file.
+//	------------------------------------------------------------
+//
+//	Returns the exit status.
+//
+
+static int ReceiveImage( const char *Path, bool NoRewind)
+{
+
+  FILE
+    *out;
+  uint8_t
+    data[ 65536];
+  uint32_t
+    header,
+    trailer,
+    length,
+    i;
+  unsigned long
+    records,
+    files,
+    bytes;
+  int
+    c;
+  bool
+    ok;
+
+  if ( !(out = fopen( Path, "wb")))
+  {
+    fprintf( stderr, "Can't create %s.\n", Path);
+    return 1;
+  }
+
+//  Ask for the image, and pass along whatever comes before it.
+
+  if ( !WaitForStart( NoRewind ? "STREAM N" : "STREAM", STREAM_START,
+    STREAM_START_LEN))
+  {
+    fclose( out);
+    return 1;
+  }
+
+//  The image: records up to the EOM.
+
+  records = files = bytes = 0;
+  ok = false;
+  while ( GetWord( &header))
+  {
+    fwrite( &header, sizeof( header), 1, out);
+    if ( header == TAP_EOM)
+    {
+      ok = true;
+      break;
+    }
+    if ( header == TAP_FILEMARK)
+    {
+      files++;
+      continue;
+    }
+
+    length = header & TAP_LENGTH_MASK;
+    if ( length > sizeof( data))
+    {
+      fprintf( stderr, "\nRecord %lu is %u bytes--too long.\n", records,
+        length);
+      break;
+    }
+    for ( i = 0; i < length; i++)
+    {
+      if ( (c = DataNext( WAIT_MSEC)) < 0)
+        break;
+      data[ i] = (uint8_t) c;
+    }
+    if ( i < length || !GetWord( &trailer))
+      break;
+    if ( trailer != header)
+    {
+      fprintf( stderr, "\nRecord %lu: trailer %08x doesn't match "
+        "header %08x.\n", records, trailer, header);
+      break;
+    }
+    fwrite( data, 1, length, out);
+    fwrite( &trailer, sizeof( trailer), 1, out);
+    records++;
+    bytes += length;
+  } // while records
+
+  if ( fclose( out))
+    ok = false;
+  if ( ok)
+    ShowRest();
+  else
+    fprintf( stderr, "\nThe image ended early.\n");
+
+  fprintf( stderr, "\n%lu records, %lu bytes, %lu tapemarks to %s.\n",
+    records, bytes, files, Path);
+  return ok ? 0 : 1;
+} // ReceiveImage
+
+//	SendImage - STREAMW: write a .TAP file to tape.
+//	-----------------------------------------------
+//
+//	Each record goes out whole, and then whatever status has come
+//	back is looked at; the link holds us off while the controller's
+//	buffer is full.  Once a record fails, or on ^C, or at a record
+//	that doesn't make sense, the next thing sent is the EOM; the
+//	controller answers the records it had in hand and then sends
+//	STREAM_END.
+//
+
+static int SendImage( const char *Path, bool NoRewind)
+{
+
+  static uint8_t
+    out[ 4 + 65536 + 4];	// record being sent
+  FILE
+    *in;
+  uint32_t
+    header,
+    trailer,
+    length,
+    eom;
+  size_t
+    have;
+  unsigned long
+    records,			// records sent
+    answered,			// ... and statuses back
+    written,
+    skipped,
+    corrected,
+    files,
+    bytes;
+  int
+    lo,
+    hi,
+    status;
+  bool
+    ending,			// EOM sent
+    ok;
+
+  if ( !(in = fopen( Path, "rb")))
+  {
+    fprintf( stderr, "Can't open %s.\n", Path);
+    return 1;
+  }
+  if ( !WaitForStart( NoRewind ? "STREAMW N" : "STREAMW", STREAM_WRITE,
+    STREAM_WRITE_LEN))
+  {
+    fclose( in);
+    return 1;
+  }
+
+  records = answered = written = skipped = corrected = files = bytes = 0;
+  lo = hi = 0;
+  ending = false;
+  ok = true;
+  eom = TAP_EOM;
+
+  while ( true)
+  {
+
+//  Send the next record, or the EOM.
+
+    have = 0;
+    if ( !ok || Interrupted ||
+      fread( &header, sizeof( header), 1, in) != 1 || header == TAP_EOM)
+      ending = true;
+    else
+    {
+      length = header & TAP_LENGTH_MASK;
+      memcpy( out, &header, sizeof( header));
+      have = sizeof( header);
+      if ( header != TAP_FILEMARK)
+      {
+        if ( length > sizeof( out) - 8 ||
+          fread( out + 4, 1, length, in) != length ||
+          fread( &trailer, sizeof( trailer), 1, in) != 1 ||
+          trailer != header)
+        {
+          fprintf( stderr, "\n%s is corrupt at record %lu.\n", Path,
+            records + 1);
+          ok = false;
+          ending = true;
+          have = 0;
+        }
+        else
+        {
+          memcpy( out + 4 + length, &trailer, sizeof( trailer));
+          have += length + sizeof( trailer);
+          bytes += length;
+        }
+      }
+      else
+        files++;
+      if ( have)
+        records++;
+    } // if another record
+    if ( ending)
+    {
+      memcpy( out, &eom, sizeof( eom));
+      have = sizeof( eom);
+    }
+    if ( !DataSend( out, have))
+    {
+      fprintf( stderr, "\nThe controller stopped taking the image.\n");
+      ok = false;
+      break;
+    }
+
+//  Look at the status that's come back.  Once the EOM's gone, wait
+//  for the rest.
+
+    while ( ending || InTaken + 1 < InHave)
+    {
+      if ( (lo = DataNext( WAIT_MSEC)) < 0 || (hi = DataNext( WAIT_MSEC)) < 0)
+        break;
+      status = lo | (hi << 8);
+      if ( status == STREAM_END)
+        break;
+      answered++;
+      if ( status == STREAM_SKIPPED)
+        skipped++;
+      else if ( status & ~TSTAT_CORRERR)
+      {
+        fprintf( stderr, "\nRecord %lu: tape status %02x.\n", answered,
+          status);
+        ok = false;
+      }
+      else
+      {
+        written++;
+        if ( status & TSTAT_CORRERR)
+          corrected++;
+      }
+    } // while there's status
+    if ( ending)
+    {
+      if ( lo < 0 || hi < 0)
+      {
+        fprintf( stderr, "\nThe controller stopped answering.\n");
+        ok = false;
+      }
+      break;
+    } // if that was the end
+  } // while sending
+
+  fclose( in);
+  if ( Interrupted)
+  {
+    fprintf( stderr, "\nStopped early.\n");
+    ok = false;
+  }
+  ShowRest();
+  if ( answered != records)
+  {
+    fprintf( stderr, "\n%lu records sent, only %lu answered.\n", records,
+      answered);
+    ok = false;
+  }
+
+  fprintf( stderr, "\n%lu records written (%lu corrected), %lu skipped; "
+    "%lu bytes, %lu tapemarks from %s.\n", written, corrected, skipped,
+    bytes, files, Path);
+  return ok ? 0 : 1;
+} // SendImage
+
+//	WaitForStart - Send a command and wait for its start marker.
+//	------------------------------------------------------------
+//
+//	What the controller says first goes to stderr.  If its prompt
+//	comes back after the command's echo, the command failed.
+//
+
+static bool WaitForStart( const char *Command, const char *Start,
+  int StartLen)
+{
+
+  char
+    line[ 32];
+  size_t
+    len;
+  int
+    c,
+    i,
+    matched;
+
+  len = strlen( Command);
+  snprintf( line, sizeof( line), "%s\r", Command);
+  if ( write( Link, line, len + 1) != (ssize_t) (len + 1))
+  {
+    fprintf( stderr, "Can't write to the controller.\n");
+    return false;
+  }
+  Echo = Command;
+  EchoLen = len;
+  EchoGot = 0;
+  AtPrompt = false;
+
+  matched = 0;
+  while ( matched < StartLen)
+  {
+    if ( (c = DataNext( WAIT_MSEC)) < 0)
+    {
+      if ( !AtPrompt)
+        fprintf( stderr, "\nNo answer from the controller.");
+      fprintf( stderr, "\n");
+      return false;
+    }
+    if ( c == Start[ matched])
+    {
+      matched++;
+      continue;
+    }
+
+//  Not the marker after all.  On the console, it's text.
+
+    for ( i = 0; i < matched && DataKind == LINK_CONSOLE; i++)
+      Show( Start[ i]);
+    matched = (c == Start[ 0]);
+    if ( !matched && DataKind == LINK_CONSOLE)
+      Show( c);
+    if ( AtPrompt)
+    {
+      fprintf( stderr, "\n");
+      return false;			// back at the prompt
+    }
+  } // look for the start
+  return true;
+} // WaitForStart
+
+//	Usage - Explain and quit.
+//	-------------------------
+//
+
+static void Usage( void)
+{
+
+  fprintf( stderr,
+    "Usage: tapestream [-n] [-w] [-u] [-x command | device] file.tap\n"
+    "  -n             don't rewind\n"
+    "  -w             write file.tap to tape\n"
+    "  -u             use the USB data interface\n"
+    "  -x command     run command on a pty as the controller\n");
+  exit( 2);
+} // Usage
+
+//	OpenDevice - Open the controller's serial device, raw.
+//	------------------------------------------------------
+//
+
+static bool OpenDevice( const char *Path)
+{
+
+  struct termios
+    tio;
+
+  if ( (Link = open( Path, O_RDWR | O_NOCTTY)) < 0)
+  {
+    fprintf( stderr, "Can't open %s: %s\n", Path, strerror( errno));
+    return false;
+  }
+  if ( tcgetattr( Link, &tio) == 0)
+  {
+    cfmakeraw( &tio);
+    tcsetattr( Link, TCSANOW, &tio);
+  }
+  tcflush( Link, TCIOFLUSH);
+  fcntl( Link, F_SETFL, fcntl( Link, F_GETFL) | O_NONBLOCK);
+  return true;
+} // OpenDevice
+
+//	OpenDataInterface - Claim the board's data interface.
+//	-----------------------------------------------------
+//
+//	The console's tty is an interface of the board's USB device;
+//	sysfs says which one, and the data interface is on the same
+//	device.  Once it's claimed, DATA_REQ_ATTACH tells the board to
+//	use it, and a read is left waiting on its IN endpoint.
+//
+
+static bool OpenDataInterface( const char *Path)
+{
+
+  struct usbdevfs_ctrltransfer
+    ctrl;
+  char
+    tty[ PATH_MAX],
+    sys[ PATH_MAX],
+    dev[ 64],
+    name[ PATH_MAX + 16];
+  FILE
+    *f;
+  unsigned int
+    bus,
+    num,
+    iface;
+
+  if ( !realpath( Path, tty))
+    snprintf( tty, sizeof( tty), "%s", Path);
+  snprintf( name, sizeof( name), "/sys/class/tty/%s/device", basename( tty));
+  if ( !realpath( name, sys))
+  {
+    fprintf( stderr, "%s isn't a USB device.\n", Path);
+    return false;
+  }
+
+//  sys is the console's interface; its parent is the device.
+
+  bus = num = 0;
+  dirname( sys);
+  snprintf( name, sizeof( name), "%s/busnum", sys);
+  if ( (f = fopen( name, "r")))
+  {
+    if ( fscanf( f, "%u", &bus) != 1)
+      bus = 0;
+    fclose( f);
+  }
+  snprintf( name, sizeof( name), "%s/devnum", sys);
+  if ( (f = fopen( name, "r")))
+  {
+    if ( fscanf( f, "%u", &num) != 1)
+      num = 0;
+    fclose( f);
+  }
+  snprintf( dev, sizeof( dev), "/dev/bus/usb/%03u/%03u", bus, num);
+  if ( !bus || (Data = open( dev, O_RDWR)) < 0)
+  {
+    fprintf( stderr, "Can't open %s: %s\n", dev, strerror( errno));
+    return false;
+  }
+
+  iface = DATA_INTERFACE;
+  if ( ioctl( Data, USBDEVFS_CLAIMINTERFACE, &iface) < 0)
+  {
+    fprintf( stderr, "Can't claim the data interface: %s\n",
+      strerror( errno));
+    return false;
+  }
+  memset( &ctrl, 0, sizeof( ctrl));
+  ctrl.bRequestType = 0x41;		// vendor, interface, to device
+  ctrl.bRequest = DATA_REQ_ATTACH;
+  ctrl.wValue = 1;
+  ctrl.wIndex = DATA_INTERFACE;
+  ctrl.timeout = 1000;
+  if ( ioctl( Data, USBDEVFS_CONTROL, &ctrl) < 0)
+  {
+    fprintf( stderr, "The board won't attach the data interface: %s\n",
+      strerror( errno));
+    return false;
+  }
+
+  memset( &InUrb, 0, sizeof( InUrb));
+  InUrb.type = USBDEVFS_URB_TYPE_BULK;
+  InUrb.endpoint = DATA_IN_EP;
+  InUrb.buffer = UrbBuf;
+  InUrb.buffer_length = sizeof( UrbBuf);
+  if ( ioctl( Data, USBDEVFS_SUBMITURB, &InUrb) < 0)
+  {
+    fprintf( stderr, "Can't read the data interface: %s\n",
+      strerror( errno));
+    return false;
+  }
+  return true;
+} // OpenDataInterface
+
+//	CloseDataInterface - Give the data interface back.
+//	--------------------------------------------------
+//
+
+static void CloseDataInterface( void)
+{
+
+  struct usbdevfs_ctrltransfer
+    ctrl;
+  struct usbdevfs_urb
+    *urb;
+  unsigned int
+    iface;
+  bool
+    inBusy;
+
+  if ( Data < 0)
+    return;
+  if ( DataKind == LINK_USB)
+  {
+    inBusy = true;
+    ioctl( Data, USBDEVFS_DISCARDURB, &InUrb);
+    if ( OutBusy)
+      ioctl( Data, USBDEVFS_DISCARDURB, &OutUrb);
+    while ( (inBusy || OutBusy) && ioctl( Data, USBDEVFS_REAPURB, &urb) == 0)
+    {
+      if ( urb == &InUrb)
+        inBusy = false;
+      else if ( urb == &OutUrb)
+        OutBusy = false;
+    } // until both are back
+    memset( &ctrl, 0, sizeof( ctrl));
+    ctrl.bRequestType = 0x41;
+    ctrl.bRequest = DATA_REQ_ATTACH;
+    ctrl.wValue = 0;
+    ctrl.wIndex = DATA_INTERFACE;
+    ctrl.timeout = 1000;
+    ioctl( Data, USBDEVFS_CONTROL, &ctrl);
+    iface = DATA_INTERFACE;
+    ioctl( Data, USBDEVFS_RELEASEINTERFACE, &iface);
+  } // if usbfs
+  close( Data);
+  Data = -1;
+  return;
+} // CloseDataInterface
+
+//	RunCommand - Start a stand-in controller on a raw pty.
+//	------------------------------------------------------
+//
+//	With the data interface, it gets a socket as descriptor 3.
+//	Closing the pty is how the command learns its input is done, and
+//	that hangs it up; SIGHUP is ignored, so the shell and what it
+//	runs carry on to the end (tapesim -o saves the reel then) and
+//	main's waitpid waits for all of it.
+//
+
+static bool RunCommand( const char *Command)
+{
+
+  struct termios
+    tio;
+  int
+    pair[ 2];
+
+  if ( DataKind == LINK_SOCKET &&
+    socketpair( AF_UNIX, SOCK_STREAM, 0, pair) < 0)
+  {
+    fprintf( stderr, "Can't make a socket: %s\n", strerror( errno));
+    return false;
+  }
+
+  memset( &tio, 0, sizeof( tio));
+  cfmakeraw( &tio);
+  if ( (Child = forkpty( &Link, NULL, &tio, NULL)) < 0)
+  {
+    fprintf( stderr, "Can't make a pty: %s\n", strerror( errno));
+    return false;
+  }
+  if ( Child == 0)
+  {
+    if ( DataKind == LINK_SOCKET)
+    {
+      close( pair[ 0]);
+      if ( pair[ 1] != 3)
+      {
+        dup2( pair[ 1], 3);
+        close( pair[ 1]);
+      }
+    }
+    signal( SIGHUP, SIG_IGN);
+    execl( "/bin/sh", "sh", "-c", Command, (char *) NULL);
+    _exit( 127);
+  }
+
+  if ( DataKind == LINK_SOCKET)
+  {
+    close( pair[ 1]);
+    Data = pair[ 0];
+    fcntl( Data, F_SETFL, fcntl( Data, F_GETFL) | O_NONBLOCK);
+  }
+  fcntl( Link, F_SETFL, fcntl( Link, F_GETFL) | O_NONBLOCK);
+  return true;
+} // RunCommand
+
+//	Pump - Move whatever's ready, waiting up to Msec for something.
+//	---------------------------------------------------------------
+//
+//	Image bytes go into InBuf, and the block at OutNext goes out.
+//	With a separate image link, console text goes straight to stderr.
+//	A pending ^C is sent on as ESC.  Returns 1 if anything moved, 0
+//	if nothing did in Msec, or -1 if a link is gone.
+//
+
+static int Pump( int Msec)
+{
+
+  struct pollfd
+    pfd[ 2];
+  uint8_t
+    text[ 4096];
+  ssize_t
+    n;
+  int
+    count,
+    link,
+    i;
+  bool
+    moved;
+
+  if ( Interrupted)
+  {
+    Interrupted = 0;
+    if ( write( Link, "\033", 1) != 1)
+      return -1;
+  }
+  if ( InTaken == InHave)
+    InTaken = InHave = 0;
+
+  link = (DataKind == LINK_CONSOLE) ? Link : Data;
+  pfd[ 0].fd = link;
+  pfd[ 0].events = POLLIN | (OutLeft ? POLLOUT : 0);
+  if ( DataKind == LINK_USB)
+    pfd[ 0].events = POLLOUT;		// usbfs: a transfer's done
+  count = 1;
+  if ( link != Link)
+  {
+    pfd[ 1].fd = Link;
+    pfd[ 1].events = POLLIN;
+    count = 2;
+  }
+
+  n = poll( pfd, count, Msec);
+  if ( n < 0)
+    return (errno == EINTR) ? 1 : -1;
+  if ( n == 0)
+    return 0;
+  moved = false;
+
+//  The image link.
+
+  if ( DataKind == LINK_USB)
+  {
+    if ( pfd[ 0].revents & POLLOUT)
+    {
+      if ( !PumpUsb())
+        return -1;
+      moved = true;
+    }
+  }
+  else
+  {
+    if ( (pfd[ 0].revents & (POLLIN | POLLHUP)) && InHave < sizeof( InBuf))
+    {
+      n = read( link, InBuf + InHave, sizeof( InBuf) - InHave);
+      if ( n > 0)
+      {
+        InHave += n;
+        moved = true;
+      }
+      else if ( n == 0 || (errno != EAGAIN && errno != EINTR))
+        return -1;			// EOF, or EIO when a pty child exits
+    }
+    if ( (pfd[ 0].revents & POLLOUT) && OutLeft)
+    {
+      n = write( link, OutNext, OutLeft);
+      if ( n > 0)
+      {
+        OutNext += n;
+        OutLeft -= n;
+        moved = true;
+      }
+    }
+    if ( !moved && (pfd[ 0].revents & (POLLERR | POLLNVAL)))
+      return -1;
+  } // if a file descriptor
+
+//  The console, when it's just text.
+
+  if ( count > 1 && (pfd[ 1].revents & (POLLIN | POLLHUP)))
+  {
+    n = read( Link, text, sizeof( text));
+    if ( n > 0)
+    {
+      for ( i = 0; i < n; i++)
+        Show( text[ i]);
+      moved = true;
+    }
+    else if ( n == 0 || (errno != EAGAIN && errno != EINTR))
+      return -1;
+  }
+  return moved ? 1 : 0;
+} // Pump
+
+//	PumpUsb - Reap finished usbfs transfers and start new ones.
+//	-----------------------------------------------------------
+//
+
+static bool PumpUsb( void)
+{
+
+  struct usbdevfs_urb
+    *urb;
+
+  while ( ioctl( Data, USBDEVFS_REAPURBNDELAY, &urb) == 0)
+  {
+    if ( urb == &OutUrb)
+    {
+      OutBusy = false;
+      if ( urb->status != 0)
+        return false;
+      OutNext += urb->actual_length;
+      OutLeft -= urb->actual_length;
+    }
+    else if ( urb == &InUrb)
+    {
+      if ( urb->status != 0 ||
+        (size_t) urb->actual_length > sizeof( InBuf) - InHave)
+        return false;
+      memcpy( InBuf + InHave, UrbBuf, urb->actual_length);
+      InHave += urb->actual_length;
+      if ( ioctl( Data, USBDEVFS_SUBMITURB, &InUrb) < 0)
+        return false;
+    }
+  } // while transfers are done
+
+  if ( OutLeft && !OutBusy)
+  {
+    memset( &OutUrb, 0, sizeof( OutUrb));
+    OutUrb.type = USBDEVFS_URB_TYPE_BULK;
+    OutUrb.endpoint = DATA_OUT_EP;
+    OutUrb.buffer = (void *) OutNext;
+    OutUrb.buffer_length = OutLeft > URB_SIZE ? URB_SIZE : (int) OutLeft;
+    if ( ioctl( Data, USBDEVFS_SUBMITURB, &OutUrb) < 0)
+      return false;
+    OutBusy = true;
+  }
+  return true;
+} // PumpUsb
+
+//	DataNext - Next byte of the image link.
+//	---------------------------------------
+//
+//	Returns -1 at end of file, after Msec of quiet, or once the
+//	console's back at its prompt and the image link has gone quiet.
+//
+
+static int DataNext( int Msec)
+{
+
+  int
+    n;
+
+  while ( InTaken == InHave)
+  {
+    if ( AtPrompt && DataKind != LINK_CONSOLE)
+      Msec = LATE_MSEC;
+    if ( (n = Pump( Msec)) < 0)
+      return -1;
+    if ( n == 0)
+      return -1;
+  } // while nothing buffered
+  return InBuf[ InTaken++];
+} // DataNext
+
+//	DataSend - Send a block on the image link.
+//	------------------------------------------
+//
+//	Keeps taking image bytes and console text while it waits, so
+//	neither side holds up the other.
+//
+
+static bool DataSend( const void *Buf, size_t Count)
+{
+
+  OutNext = (const uint8_t *) Buf;
+  OutLeft = Count;
+  if ( DataKind == LINK_USB && !PumpUsb())
+    return false;
+  while ( OutLeft)
+    if ( Pump( WAIT_MSEC) <= 0)
+      return false;
+  return true;
+} // DataSend
+
+//	GetWord - Read a little-endian 32-bit header or trailer.
+//	--------------------------------------------------------
+//
+
+static bool GetWord( uint32_t *Word)
+{
+
+  int
+    i,
+    c;
+
+  *Word = 0;
+  for ( i = 0; i < 4; i++)
+  {
+    if ( (c = DataNext( WAIT_MSEC)) < 0)
+      return false;
+    *Word |= (uint32_t) c << (8 * i);
+  }
+  return true;
+} // GetWord
+
+//	Show - Pass on a character of console text.
+//	-------------------------------------------
+//
+//	Notes when it's the prompt, once the command's echo is past.
+//
+
+static void Show( int C)
+{
+
+  fputc( C, stderr);
+  if ( EchoGot < EchoLen)
+  {
+    EchoGot = (C == Echo[ EchoGot]) ? EchoGot + 1 : (C == Echo[ 0]);
+    AtPrompt = false;
+  }
+  else
+    AtPrompt = (LastShown == '?' && C == ' ');
+  LastShown = C;
+  return;
+} // Show
+
+//	OnInterrupt - ^C: ask the controller to stop.
+//	---------------------------------------------
+//
+
+static void OnInterrupt( int Sig)
+{
+
+  (void) Sig;
+  Interrupted = 1;
+} // OnInterrupt
+
+//	ShowRest - Pass on what the controller says after the image.
+//	------------------------------------------------------------
+//
+//	Up to its next prompt.
+//
+
+static void ShowRest( void)
+{
+
+  int
+    c;
+
+  while ( !AtPrompt)
+  {
+    if ( DataKind == LINK_CONSOLE)
+    {
+      if ( (c = DataNext( PROMPT_MSEC)) < 0)
+        break;
+      Show( c);
+    }
+    else if ( Pump( PROMPT_MSEC) <= 0)
+      break;
+  } // until the prompt
+  return;
+} // ShowRest
@@ -0,0 +1,338 @@
+//*	Polled vs. hardware-paced tape transfer benchmark.
+//	--------------------------------------------------
+//
+//	Runs the real TapeRead and TapeWrite (src/tapedriver.c) against
+//	the simulated formatter in pertsim.c, with both transfer engines,
+//	over a range of drive speeds and densities.  Each case is run
+//	with no other activity and with a periodic interrupt load
+//	standing in for USB servicing.
+//
+//	For each case we report whether the blocks came through intact,
+//	how many the driver itself flagged as late (it should catch every
+//	one that lost data), the data rate and how many CPU cycles per
+//	byte the transfer kept for itself.  Writes are also checked for ILWD placement:
+//	every block must end on its own last byte, by ILWD, whatever
+//	its length.  Finally, the highest character rate each engine
+//	sustains without losing data is found by bisection.
+//
+
+#define MAIN
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "globals.h"
+#include "tapedriver.h"
+#include "pertsim.h"
+
+//  Drives to try, all start/stop.
+
+static const SIM_DRIVE Drives[] =
+{
+  { .Ips =  25, .Bpi = 1600, .GapMils = 600 },
+  { .Ips =  75, .Bpi = 1600, .GapMils = 600 },
+  { .Ips = 125, .Bpi = 1600, .GapMils = 600 },
+  { .Ips =  75, .Bpi = 6250, .GapMils = 300 },
+  { .Ips = 125, .Bpi = 6250, .GapMils = 300 },
+  { .Ips = 200, .Bpi = 6250, .GapMils = 300 }
+};
+
+#define DRIVE_COUNT (sizeof( Drives) / sizeof( Drives[0]))
+
+//  Interrupt loads: period in usec, length in cycles.
+
+typedef struct
+{
+  char *Name;
+  uint32_t Period;
+  uint32_t Length;
+} LOAD;
+
+static const LOAD Loads[] =
+{
+  { "idle", 0, 0 },
+  { "25us/ms", 1000, SIM_USEC( 25) }
+};
+
+#define LOAD_COUNT (sizeof( Loads) / sizeof( Loads[0]))
+
+#define BLOCK_LENGTH	8192
+#define BLOCK_COUNT	8
+
+typedef struct
+{
+  int Bad;			// blocks with errors or bad data
+  int Late;			// blocks the driver flagged as late
+  double Rate;			// KB/second during data phase
+  double CpuPerByte;		// CPU cycles/byte tied up
+  uint32_t Lost;		// overruns plus underruns
+} RESULT;
+
+typedef RESULT (*RUNNER)( const SIM_DRIVE *Drive, int Mode,
+                          const LOAD *Load, int Count, int Length);
+
+//  Prototypes.
+
+static void Table( char *What, RUNNER Run);
+static void Start( const SIM_DRIVE *Drive, int Mode, const LOAD *Load,
+                   int Length);
+static RESULT Finish( int Mode);
+static RESULT RunRead( const SIM_DRIVE *Drive, int Mode, const LOAD *Load,
+                       int Count, int Length);
+static RESULT RunWrite( const SIM_DRIVE *Drive, int Mode, const LOAD *Load,
+                        int Count, int Length);
+static double MaxRate( RUNNER Run, int Mode, const LOAD *Load);
+static char *EngineName( int Mode);
+
+int main( void)
+{
+
+  unsigned int
+    l;
+  int
+    mode,
+    len;
+  RESULT
+    res;
+
+  printf( "%d blocks of %d bytes per case\n", BLOCK_COUNT, BLOCK_LENGTH);
+  Table( "Read", RunRead);
+  Table( "Write", RunWrite);
+
+  printf( "\nILWD placement, 125 ips 6250 bpi:\n");
+  for ( mode = XFER_POLLED; mode <= XFER_DMA; mode++)
+  {
+    printf( "  %-7s", EngineName( mode));
+    for ( len = 1; len <= 6; len++)
+    {
+      res = RunWrite( &Drives[ 4], mode, &Loads[ 0], 3, len);
+      printf( " %d:%s", len, res.Bad ? "FAIL" : "ok");
+    }
+    printf( "\n");
+  } // for each engine
+
+  printf( "\nHighest loss-free character rate:\n");
+  for ( l = 0; l < LOAD_COUNT; l++)
+    for ( mode = XFER_POLLED; mode <= XFER_DMA; mode++)
+      printf( "  %-8s %-7s read %8.1f KB/sec  write %8.1f KB/sec\n",
+        Loads[ l].Name, EngineName( mode),
+        MaxRate( RunRead, mode, &Loads[ l]),
+        MaxRate( RunWrite, mode, &Loads[ l]));
+  return 0;
+} // main
+
+//	Table - Run every drive, load and engine.
+//	-----------------------------------------
+//
+
+static void Table( char *What, RUNNER Run)
+{
+
+  unsigned int
+    d, l;
+  int
+    mode;
+  RESULT
+    res;
+  char
+    name[ 32];
+
+  printf( "\n%-16s %-8s %-7s %5s %5s %6s %9s %8s\n",
+    What, "Load", "Engine", "Bad", "Late", "Lost", "KB/sec", "Cyc/byte");
+
+  for ( d = 0; d < DRIVE_COUNT; d++)
+    for ( l = 0; l < LOAD_COUNT; l++)
+      for ( mode = XFER_POLLED; mode <= XFER_DMA; mode++)
+      {
+        res = Run( &Drives[ d], mode, &Loads[ l],
+                BLOCK_COUNT, BLOCK_LENGTH);
+        snprintf( name, sizeof( name), "%d ips %d bpi",
+          Drives[ d].Ips, Drives[ d].Bpi);
+        printf( "%-16s %-8s %-7s %5d %5d %6u %9.1f %8.1f\n",
+          name, Loads[ l].Name, EngineName( mode),
+          res.Bad, res.Late, res.Lost, res.Rate, res.CpuPerByte);
+      } // for each case
+  return;
+} // Table
+
+//	Start - Reset everything for a case.
+//	------------------------------------
+//
+
+static void Start( const SIM_DRIVE *Drive, int Mode, const LOAD *Load,
+                   int Length)
+{
+
+  SimSetDrive( Drive);
+  SimSetBlocks( Length);
+  SimReset();
+  SimSetInterruptLoad( Load->Period, Load->Length);
+  TapeInit();
+  TapeXferMode = Mode;
+  return;
+} // Start
+
+//	Finish - Collect the statistics for a case.
+//	-------------------------------------------
+//
+//	With the polled engine, the CPU is tied up for the whole data
+//	phase.  Otherwise, it's only what the engine costs.
+//
+
+static RESULT Finish( int Mode)
+{
+
+  RESULT
+    res = { 0 };
+
+  res.Lost = SimStats.Overruns + SimStats.Underruns;
+  if ( SimStats.DataCycles)
+    res.Rate = (double) SimStats.Bytes * SIM_CPU_HZ /
+      SimStats.DataCycles / 1024.0;
+  if ( SimStats.Bytes)
+    res.CpuPerByte = (double) (Mode == XFER_DMA ?
+      SimStats.EngineCycles + SimStats.IsrCycles :
+      SimStats.DataCycles) / SimStats.Bytes;
+  return res;
+} // Finish
+
+//	RunRead - Read some blocks and check them.
+//	------------------------------------------
+//
+
+static RESULT RunRead( const SIM_DRIVE *Drive, int Mode, const LOAD *Load,
+                       int Count, int Length)
+{
+
+  RESULT
+    res;
+  int
+    bad,
+    late,
+    blk, i,
+    got;
+  unsigned int
+    stat;
+  TAPE_TIMING
+    timing;
+
+  Start( Drive, Mode, Load, Length);
+  bad = late = 0;
+  for ( blk = 0; blk < Count; blk++)
+  {
+    stat = TapeRead( TapeBuffer, TAPE_BUFFER_SIZE, &got);
+    TapeBlockTiming( &timing);
+    if ( timing.Late)
+      late++;
+    if ( stat != TSTAT_NOERR || got != Length)
+    {
+      bad++;
+      continue;
+    }
+    for ( i = 0; i < got; i++)
+      if ( TapeBuffer[ i] != SimPattern( blk, i))
+      {
+        bad++;
+        break;
+      }
+  } // for each block
+
+  res = Finish( Mode);
+  res.Bad = bad;
+  res.Late = late;
+  return res;
+} // RunRead
+
+//	RunWrite - Write some blocks and check what the formatter got.
+//	--------------------------------------------------------------
+//
+
+static RESULT RunWrite( const SIM_DRIVE *Drive, int Mode, const LOAD *Load,
+                        int Count, int Length)
+{
+
+  RESULT
+    res;
+  int
+    bad,
+    late,
+    blk, i,
+    got;
+  unsigned int
+    stat;
+  uint8_t
+    *rec;
+  bool
+    lwd;
+  TAPE_TIMING
+    timing;
+
+  Start( Drive, Mode, Load, Length);
+  bad = late = 0;
+  for ( blk = 0; blk < Count; blk++)
+  {
+    for ( i = 0; i < Length; i++)
+      TapeBuffer[ i] = SimPattern( blk, i);
+    stat = TapeWrite( TapeBuffer, Length);
+    TapeBlockTiming( &timing);
+    if ( timing.Late)
+      late++;
+    got = SimLastRecord( &rec, &lwd);
+    if ( stat != TSTAT_NOERR || got != Length || !lwd)
+    {
+      bad++;
+      continue;
+    }
+    for ( i = 0; i < got; i++)
+      if ( rec[ i] != SimPattern( blk, i))
+      {
+        bad++;
+        break;
+      }
+  } // for each block
+
+  res = Finish( Mode);
+  res.Bad = bad;
+  res.Late = late;
+  return res;
+} // RunWrite
+
+//	MaxRate - Find the fastest clean character rate.
+//	------------------------------------------------
+//
+//	Density is varied at a fixed 125 ips.
+//
+
+static double MaxRate( RUNNER Run, int Mode, const LOAD *Load)
+{
+
+  SIM_DRIVE
+    drive = { .Ips = 125, .GapMils = 300 };	// Bpi varies
+  int
+    lo, hi;
+  RESULT
+    res;
+
+  lo = 8;				// 1 KB/sec, surely fine
+  hi = 400000;				// 50 MB/sec, surely not
+  while ( hi - lo > 1)
+  {
+    drive.Bpi = (lo + hi) / 2;
+    res = Run( &drive, Mode, Load, 4, 4096);
+    if ( res.Bad || res.Lost)
+      hi = drive.Bpi;
+    else
+      lo = drive.Bpi;
+  } // bisect
+  return 125.0 * lo / 1024.0;
+} // MaxRate
+
+//	EngineName - What to call a transfer mode.
+//	------------------------------------------
+//
+
+static char *EngineName( int Mode)
+{
+  return Mode == XFER_DMA ? "engine" : "polled";
+} // EngineName
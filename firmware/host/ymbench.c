@@ -0,0 +1,358 @@
+//*	YMODEM and YMODEM-g benchmark.
+//	------------------------------
+//
+//	Runs the real SendYmodem and ReceiveYmodem (src/ymodem.c) on the
+//	simulated board, with the console on a pty and a stand-in for
+//	sz/rz on the other end of it, a child process that speaks the
+//	protocol the way they do.  A file of a few MB goes each way,
+//	first with the stand-in offering YMODEM-g, then with one that
+//	knows only YMODEM, so both the streaming and the fallback are
+//	tried.
+//
+//	The board's time is simulated (simboard.c): console input and
+//	output cost what they do over USB CDC, an answer from the host
+//	comes a round trip after what it answers, and the card takes
+//	its time.  For each case we report whether the data came through
+//	intact, the simulated rate and the real time taken; the exit
+//	status says whether everything did.  Receiving with YMODEM
+//	includes the seconds spent asking for YMODEM-g first.
+//
+//	The card, the pty and the timing of a run are in benchfile.c,
+//	shared with zmbench.
+//
+//	Usage: ymbench [card image]	(made, 32 MB, if it doesn't exist)
+//
+
+#define MAIN
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "globals.h"
+#include "filedef.h"
+#include "ff.h"
+#include "ymodem.h"
+#include "benchfile.h"
+
+#define CARD_MB		32
+#define FILE_SIZE	(4 * 1024 * 1024 + 300)	// not a whole block
+#define SEND_NAME	"YMSEND.DAT"		// on the card, to send
+#define RECEIVE_NAME	"YMRECV.DAT"		// sent to the card
+
+#define SOH		0x01
+#define STX		0x02
+#define EOT		0x04
+#define ACK		0x06
+#define NAK		0x15
+#define CAN		0x18
+
+static int
+  Failures;
+
+//  Prototypes.
+
+static void Run( bool BoardSends, bool Streaming);
+static XERR_CODE BoardSend( int Streaming);
+static XERR_CODE BoardReceive( int Streaming);
+static int HostReceive( int Fd, int Streaming);
+static int HostSend( int Fd, int Streaming);
+static bool GetBlock( int Fd, uint8_t *Block, int *Length, int *Number);
+static void PutBlock( int Fd, int Number, const uint8_t *Data, int Length);
+static void PutChar( int Fd, uint8_t What);
+static uint16_t Crc( const uint8_t *Buf, int Count);
+
+int main( int argc, char *argv[])
+{
+
+  BenchStart( argc > 1 ? argv[1] : "ymbench.img", CARD_MB, SEND_NAME,
+    FILE_SIZE);
+  fprintf( BenchReport, "%d bytes each way; simulated board, real time:\n\n",
+    FILE_SIZE);
+  Run( true, true);
+  Run( true, false);
+  Run( false, true);
+  Run( false, false);
+
+  fprintf( BenchReport, "\n%s\n", Failures ? "FAILED" : "All passed");
+  return Failures ? 1 : 0;
+} // main
+
+//	Run - One transfer, one way, one protocol.
+//	------------------------------------------
+//
+//	BoardSends says which way; Streaming whether the stand-in knows
+//	YMODEM-g.
+//
+
+static void Run( bool BoardSends, bool Streaming)
+{
+
+  BENCH_RESULT
+    r;
+  bool
+    ok;
+
+  if ( !BoardSends)
+    f_unlink( RECEIVE_NAME);
+  BenchRun( BoardSends ? HostReceive : HostSend,
+    BoardSends ? BoardSend : BoardReceive, Streaming, &r);
+  ok = r.Xerr == XERR_SUCCESS && r.Host == 0 &&
+    (BoardSends || BenchCheckFile( RECEIVE_NAME, FILE_SIZE));
+  if ( !ok)
+    Failures++;
+
+  fprintf( BenchReport, "  %-7s %-8s %-6s %8.3f sec %7.1f KB/sec %6.2f sec"
+    " real  (error %d, host %d)\n",
+    BoardSends ? "send" : "receive", Streaming ? "YMODEM-g" : "YMODEM",
+    ok ? "ok" : "FAILED", r.Secs, r.Secs > 0 ? FILE_SIZE / r.Secs / 1024 :
+    0.0, r.Real, (int) r.Xerr, r.Host);
+  return;
+} // Run
+
+//	BoardSend, BoardReceive - The board's end.
+//	------------------------------------------
+//
+
+static XERR_CODE BoardSend( int Streaming)
+{
+  return SendYmodem( SEND_NAME);
+} // BoardSend
+
+static XERR_CODE BoardReceive( int Streaming)
+{
+  return ReceiveYmodem();
+} // BoardReceive
+
+//*	The host end.
+//	=============
+//
+//	These run in the child, on the pty's master side, and exit with
+//	0 if all went well; otherwise with the step that failed.
+
+//	HostReceive - The rz stand-in.
+//	------------------------------
+//
+//	Asks with 'G' if it streams, 'C' if not, and checks what comes.
+//
+
+static int HostReceive( int Fd, int Streaming)
+{
+
+  static uint8_t
+    block[ 1024];
+  uint32_t
+    size,
+    got,
+    i;
+  int
+    length,
+    number,
+    next,
+    n,
+    c;
+
+  PutChar( Fd, Streaming ? 'G' : 'C');
+  length = 128;
+  if ( BenchGetChar( Fd) != SOH || !GetBlock( Fd, block, &length, &number) ||
+    number != 0 || !block[0])
+    return 1;
+  if ( strcmp( (char *) block, SEND_NAME))
+    return 2;
+  size = (uint32_t) strtoul( (char *) block + strlen( (char *) block) + 1,
+    NULL, 10);
+  if ( size != FILE_SIZE)
+    return 3;
+  if ( !Streaming)
+    PutChar( Fd, ACK);
+  PutChar( Fd, Streaming ? 'G' : 'C');
+
+//  The data, up to EOT.
+
+  for ( got = 0, next = 1; ; next++)
+  {
+    if ( (c = BenchGetChar( Fd)) == EOT)
+      break;
+    if ( c != STX && c != SOH)
+      return 4;
+    length = c == STX ? 1024 : 128;
+    if ( !GetBlock( Fd, block, &length, &number))
+      return 5;
+    if ( number != (next & 0xff))
+      return 6;
+    n = size - got < (uint32_t) length ? (int) (size - got) : length;
+    for ( i = 0; i < (uint32_t) n; i++)
+      if ( block[ i] != BenchPattern( got + i))
+        return 7;
+    got += n;
+    if ( !Streaming)
+      PutChar( Fd, ACK);
+  } // for each block
+  if ( got != size)
+    return 8;
+
+  if ( !Streaming)
+  { // NAK the first EOT
+    PutChar( Fd, NAK);
+    if ( BenchGetChar( Fd) != EOT)
+      return 9;
+  }
+  PutChar( Fd, ACK);
+  PutChar( Fd, Streaming ? 'G' : 'C');
+
+//  No more files.
+
+  length = 128;
+  if ( BenchGetChar( Fd) != SOH || !GetBlock( Fd, block, &length, &number) ||
+    number != 0 || block[0])
+    return 10;
+  PutChar( Fd, ACK);
+  return 0;
+} // HostReceive
+
+//	HostSend - The sz stand-in.
+//	---------------------------
+//
+//	Streams if it's asked to with 'G' and knows how; if not, waits
+//	for a 'C'.
+//
+
+static int HostSend( int Fd, int Streaming)
+{
+
+  static uint8_t
+    block[ 1024];
+  uint32_t
+    sent,
+    i;
+  int
+    number,
+    c;
+
+  while ( (c = BenchGetChar( Fd)) != 'C' && !(Streaming && c == 'G'))
+    if ( c < 0)
+      return 1;
+  Streaming = c == 'G';
+
+  memset( block, 0, 128);
+  strcpy( (char *) block, RECEIVE_NAME);
+  sprintf( (char *) block + strlen( RECEIVE_NAME) + 1, "%d", FILE_SIZE);
+  PutBlock( Fd, 0, block, 128);
+  if ( !Streaming && BenchGetChar( Fd) != ACK)
+    return 2;
+  if ( BenchGetChar( Fd) != (Streaming ? 'G' : 'C'))
+    return 3;
+
+  for ( sent = 0, number = 1; sent < FILE_SIZE; sent += 1024, number++)
+  {
+    for ( i = 0; i < 1024; i++)
+      block[ i] = sent + i < FILE_SIZE ? BenchPattern( sent + i) : 0x1A;
+    PutBlock( Fd, number, block, 1024);
+    if ( !Streaming && BenchGetChar( Fd) != ACK)
+      return 4;
+  } // for each block
+
+  PutChar( Fd, EOT);
+  if ( !Streaming)
+  {
+    if ( BenchGetChar( Fd) != NAK)
+      return 5;
+    PutChar( Fd, EOT);
+  }
+  if ( BenchGetChar( Fd) != ACK ||
+    BenchGetChar( Fd) != (Streaming ? 'G' : 'C'))
+    return 6;
+
+  memset( block, 0, 128);
+  PutBlock( Fd, 0, block, 128);
+  if ( BenchGetChar( Fd) != ACK)
+    return 7;
+  return 0;
+} // HostSend
+
+//	GetBlock - Read the rest of a block, its header byte taken.
+//	-----------------------------------------------------------
+//
+//	Length is what the header said.  Returns false if the block's
+//	number or CRC is wrong.
+//
+
+static bool GetBlock( int Fd, uint8_t *Block, int *Length, int *Number)
+{
+
+  uint8_t
+    head[ 2],
+    crc[ 2];
+
+  if ( !BenchGetAll( Fd, head, 2) || (head[0] ^ head[1]) != 0xFF ||
+    !BenchGetAll( Fd, Block, *Length) || !BenchGetAll( Fd, crc, 2))
+    return false;
+  *Number = head[0];
+  return Crc( Block, *Length) == ((crc[0] << 8) | crc[1]);
+} // GetBlock
+
+//	PutBlock - Send a block.
+//	------------------------
+//
+
+static void PutBlock( int Fd, int Number, const uint8_t *Data, int Length)
+{
+
+  uint8_t
+    packet[ 3 + 1024 + 2];
+  uint16_t
+    crc;
+
+  packet[0] = Length == 1024 ? STX : SOH;
+  packet[1] = (uint8_t) Number;
+  packet[2] = (uint8_t) ~Number;
+  memcpy( packet + 3, Data, Length);
+  crc = Crc( Data, Length);
+  packet[ 3 + Length] = (uint8_t) (crc >> 8);
+  packet[ 4 + Length] = (uint8_t) crc;
+  if ( write( Fd, packet, 5 + Length) != 5 + Length)
+    _exit( 20);
+  return;
+} // PutBlock
+
+//	PutChar - Send a character.
+//	---------------------------
+//
+
+static void PutChar( int Fd, uint8_t What)
+{
+
+  if ( write( Fd, &What, 1) != 1)
+    _exit( 21);
+  return;
+} // PutChar
+
+//	Crc - CRC-16/XMODEM, a bit at a time.
+//	-------------------------------------
+//
+//	Worked out here rather than with crc16.c's table, so that the
+//	two check each other.
+//
+
+static uint16_t Crc( const uint8_t *Buf, int Count)
+{
+
+  uint16_t
+    crc;
+  int
+    i;
+
+  crc = 0;
+  while ( Count--)
+  {
+    crc ^= (uint16_t) (*Buf++ << 8);
+    for ( i = 0; i < 8; i++)
+      crc = (crc & 0x8000) ? (uint16_t) ((crc << 1) ^ 0x1021) :
+        (uint16_t) (crc << 1);
+  }
+  return crc;
+} // Crc
+
@@ -0,0 +1,928 @@
+//*	ZMODEM benchmark.
+//	-----------------
+//
+//	Runs the real SendZmodem and ReceiveZmodem (src/zmodem.c) on the
+//	simulated board, with the console on a pty and a stand-in for
+//	lrzsz's sz/rz on the other end of it, a child process that
+//	speaks the protocol the way they do.  A file of a few MB goes
+//	each way:
+//
+//	  - streaming with 32-bit CRCs, and again with 16-bit ones;
+//	  - to the board, asking for ZACKs as it goes, as sz -w does;
+//	  - with one subpacket going bad on the way (the board sending,
+//	    the stand-in asks for it again; the board receiving, the
+//	    stand-in spoils one), so the ZRPOS recovery is tried;
+//	  - cut off with CANs 90% of the way through, then sent again
+//	    asking to resume, which should move only the last 10%.
+//
+//	The board's time is simulated (simboard.c), and the card, pty and
+//	timing come from benchfile.c, as in ymbench.  For each case we
+//	report whether the data came through intact, the simulated rate,
+//	how many bytes of file data went over the line and the real time
+//	taken; the exit status says whether everything did.
+//
+//	Usage: zmbench [card image]	(made, 32 MB, if it doesn't exist)
+//
+
+#define MAIN
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "globals.h"
+#include "filedef.h"
+#include "ff.h"
+#include "zmodem.h"
+#include "benchfile.h"
+
+#define CARD_MB		32
+#define FILE_SIZE	(4 * 1024 * 1024 + 300)	// not a whole subpacket
+#define SEND_NAME	"ZMSEND.DAT"		// on the card, to send
+#define RECEIVE_NAME	"ZMRECV.DAT"		// sent to the card
+#define HOST_TIMEOUT	20000			// msec, stand-in's wait
+#define GLITCH_AT	(1024 * 1024)		// where a subpacket goes bad
+#define CRASH_AT	(FILE_SIZE / 10 * 9)	// where the line drops
+#define SUBPACKET	1024
+#define ACK_INTERVAL	(8 * 1024)		// sz -w: a ZCRCQ this often
+#define RESUME_SLACK	(64 * 1024)		// resending allowed
+
+//  What a case asks of the stand-in.
+
+#define HOST_CRC16	0x01		// 16-bit CRCs only
+#define HOST_GLITCH	0x02		// one subpacket goes bad
+#define HOST_CRASH	0x04		// cancel at CRASH_AT
+#define HOST_RESUME	0x08		// carry on from the crash
+#define HOST_WINDOW	0x10		// sending, ask for ZACKs
+
+//  ZMODEM, as much as the stand-in needs.
+
+#define ZPAD		'*'
+#define ZDLE		0x18
+#define ZBIN		'A'
+#define ZHEX		'B'
+#define ZBIN32		'C'
+#define XON		0x11
+#define XOFF		0x13
+
+#define ZRQINIT		0
+#define ZRINIT		1
+#define ZACK		3
+#define ZFILE		4
+#define ZFIN		8
+#define ZRPOS		9
+#define ZDATA		10
+#define ZEOF		11
+
+#define ZCRCE		'h'
+#define ZCRCG		'i'
+#define ZCRCQ		'j'
+#define ZCRCW		'k'
+#define ZRUB0		'l'
+#define ZRUB1		'm'
+
+#define CANFDX		0x01
+#define CANOVIO		0x02
+#define CANFC32		0x20
+#define ZCBIN		1
+#define ZCRESUM		3
+
+#define FRAME		0x100		// or'd with a subpacket end
+
+//  What the stand-in tells the parent, in memory they share.
+
+typedef struct
+{
+  uint32_t
+    moved,			// file data sent or taken
+    have;			// how far the crash got
+} HOST_NOTE;
+
+static int
+  Failures;
+static HOST_NOTE
+  *Note;
+
+//  Whether the stand-in's using 32-bit CRCs.
+
+static bool
+  Crc32Mode;
+
+//  Prototypes.
+
+static void Run( const char *Title, bool BoardSends, int Flags);
+static XERR_CODE BoardSend( int Flags);
+static XERR_CODE BoardReceive( int Flags);
+static int HostReceive( int Fd, int Flags);
+static int HostSend( int Fd, int Flags);
+static int GetHeader( int Fd, uint8_t *Hdr);
+static int GetSub( int Fd, uint8_t *Buf, int Max, int *Length);
+static int GetEscaped( int Fd);
+static void PutHex( int Fd, int Type, uint32_t Pos);
+static void PutBin( int Fd, int Type, const uint8_t *Hdr);
+static void PutSub( int Fd, const uint8_t *Buf, int Length, int End,
+  bool Spoil);
+static void PutEscaped( uint8_t **Out, uint8_t What);
+static void PutAll( int Fd, const uint8_t *Buf, int Count);
+static void PutCancel( int Fd);
+static void Drain( int Fd);
+static bool Waiting( int Fd);
+static void SetPos( uint8_t *Hdr, uint32_t Pos);
+static uint32_t GetPos( const uint8_t *Hdr);
+static uint16_t Crc16( uint16_t Crc, const uint8_t *Buf, int Count);
+static uint32_t Crc32( uint32_t Crc, const uint8_t *Buf, int Count);
+
+int main( int argc, char *argv[])
+{
+
+  Note = mmap( NULL, sizeof( HOST_NOTE), PROT_READ | PROT_WRITE,
+    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if ( Note == MAP_FAILED)
+    return 2;
+  BenchStart( argc > 1 ? argv[1] : "zmbench.img", CARD_MB, SEND_NAME,
+    FILE_SIZE);
+  fprintf( BenchReport, "%d bytes each way; simulated board, real time:\n\n",
+    FILE_SIZE);
+  Run( "CRC-32", true, 0);
+  Run( "CRC-16", true, HOST_CRC16);
+  Run( "bad subpacket", true, HOST_GLITCH);
+  Run( "cut off", true, HOST_CRASH);
+  Run( "resumed", true, HOST_RESUME);
+  Run( "CRC-32", false, 0);
+  Run( "CRC-16", false, HOST_CRC16);
+  Run( "windowed", false, HOST_WINDOW);
+  Run( "bad subpacket", false, HOST_GLITCH);
+  Run( "cut off", false, HOST_CRASH);
+  Run( "resumed", false, HOST_RESUME);
+
+  fprintf( BenchReport, "\n%s\n", Failures ? "FAILED" : "All passed");
+  return Failures ? 1 : 0;
+} // main
+
+//	Run - One transfer, one way.
+//	----------------------------
+//
+//	BoardSends says which way; Flags what the stand-in does.  A cut
+//	off transfer should leave the board saying so, and the part of
+//	the file that arrived intact; the resumed one should finish it
+//	without sending the rest again.
+//
+
+static void Run( const char *Title, bool BoardSends, int Flags)
+{
+
+  BENCH_RESULT
+    r;
+  FILINFO
+    info;
+  bool
+    ok;
+
+  if ( !BoardSends && !(Flags & HOST_RESUME))
+    f_unlink( RECEIVE_NAME);
+  Note->moved = 0;
+  BenchRun( BoardSends ? HostReceive : HostSend,
+    BoardSends ? BoardSend : BoardReceive, Flags, &r);
+
+  ok = r.Host == 0;
+  if ( Flags & HOST_CRASH)
+  { // should have stopped, with what came so far kept
+    ok = ok && r.Xerr == XERR_ABORT;
+    if ( !BoardSends)
+      ok = ok && f_stat( RECEIVE_NAME, &info) == FR_OK &&
+        info.fsize > 0 && info.fsize <= Note->have &&
+        BenchCheckFile( RECEIVE_NAME, (uint32_t) info.fsize);
+  }
+  else
+  {
+    ok = ok && r.Xerr == XERR_SUCCESS &&
+      (BoardSends || BenchCheckFile( RECEIVE_NAME, FILE_SIZE));
+    if ( Flags & HOST_RESUME)
+      ok = ok && Note->moved <= FILE_SIZE - CRASH_AT + RESUME_SLACK;
+  }
+  if ( !ok)
+    Failures++;
+
+  fprintf( BenchReport, "  %-7s %-13s %-6s %8.3f sec %7.1f KB/sec %8u moved"
+    " %6.2f sec real  (error %d, host %d)\n",
+    BoardSends ? "send" : "receive", Title, ok ? "ok" : "FAILED", r.Secs,
+    r.Secs > 0 ? Note->moved / r.Secs / 1024 : 0.0, Note->moved, r.Real,
+    (int) r.Xerr, r.Host);
+  return;
+} // Run
+
+//	BoardSend, BoardReceive - The board's end.
+//	------------------------------------------
+//
+
+static XERR_CODE BoardSend( int Flags)
+{
+  return SendZmodem( SEND_NAME, (Flags & HOST_RESUME) != 0);
+} // BoardSend
+
+static XERR_CODE BoardReceive( int Flags)
+{
+  return ReceiveZmodem( false);
+} // BoardReceive
+
+//*	The host end.
+//	=============
+//
+//	These run in the child, on the pty's master side, and exit with
+//	0 if all went well; otherwise with the step that failed.
+
+//	HostReceive - The rz stand-in.
+//	------------------------------
+//
+//	Checks what comes against the pattern, ACKs as asked.
+//
+
+static int HostReceive( int Fd, int Flags)
+{
+
+  static uint8_t
+    data[ 8192 + 1];
+  uint8_t
+    hdr[4];
+  uint32_t
+    size,
+    got;
+  int
+    type,
+    end,
+    length,
+    i;
+  bool
+    glitched;
+
+//  The board wakes us with "rz" and a ZRQINIT.
+
+  while ( (type = GetHeader( Fd, hdr)) != ZRQINIT)
+    if ( type < 0)
+      return 1;
+  memset( hdr, 0, sizeof( hdr));
+  hdr[3] = CANFDX | CANOVIO | ((Flags & HOST_CRC16) ? 0 : CANFC32);
+  PutHex( Fd, ZRINIT, GetPos( hdr));
+
+  while ( (type = GetHeader( Fd, hdr)) == ZRQINIT)
+    ;
+  if ( type != ZFILE || GetSub( Fd, data, 8192, &length) != ZCRCW)
+    return 2;
+  if ( Crc32Mode == ((Flags & HOST_CRC16) != 0))
+    return 3;				// wrong CRC
+  data[ length] = 0;
+  if ( strcmp( (char *) data, SEND_NAME))
+    return 4;
+  size = (uint32_t) strtoul( (char *) data + strlen( (char *) data) + 1,
+    NULL, 10);
+  if ( size != FILE_SIZE)
+    return 5;
+  if ( (hdr[3] == ZCRESUM) != ((Flags & HOST_RESUME) != 0))
+    return 6;
+
+//  Ask for the data from where we are: the start, or where the last
+//  try was cut off.
+
+  got = (Flags & HOST_RESUME) ? Note->have : 0;
+  PutHex( Fd, ZRPOS, got);
+  glitched = false;
+
+  while ( true)
+  {
+    type = GetHeader( Fd, hdr);
+    if ( type == ZEOF && GetPos( hdr) == got)
+      break;
+    if ( type != ZDATA || GetPos( hdr) != got)
+      return 7;
+
+    do
+    {
+      if ( (end = GetSub( Fd, data, 8192, &length)) < 0)
+        return 8;
+      for ( i = 0; i < length; i++)
+        if ( data[ i] != BenchPattern( got + i))
+          return 9;
+
+      if ( (Flags & HOST_GLITCH) && !glitched && got + length > GLITCH_AT)
+      { // say it came in bad
+        glitched = true;
+        PutHex( Fd, ZRPOS, got);
+        break;
+      }
+      got += length;
+      Note->moved += length;
+      if ( (Flags & HOST_CRASH) && got >= CRASH_AT)
+      { // the line drops
+        Note->have = got;
+        PutCancel( Fd);
+        Drain( Fd);
+        return 0;
+      }
+      if ( end == ZCRCQ || end == ZCRCW)
+        PutHex( Fd, ZACK, got);
+    } while ( end == ZCRCG || end == ZCRCQ);
+  } // while frames come
+  if ( got != size)
+    return 10;
+
+//  That's the file.  The board has nothing more, says it's finished
+//  and signs off.
+
+  memset( hdr, 0, sizeof( hdr));
+  hdr[3] = CANFDX | CANOVIO | ((Flags & HOST_CRC16) ? 0 : CANFC32);
+  PutHex( Fd, ZRINIT, GetPos( hdr));
+  if ( GetHeader( Fd, hdr) != ZFIN)
+    return 11;
+  PutHex( Fd, ZFIN, 0);
+  if ( BenchGetChar( Fd) != 'O' || BenchGetChar( Fd) != 'O')
+    return 12;
+  return 0;
+} // HostReceive
+
+//	HostSend - The sz stand-in.
+//	---------------------------
+//
+//	Streams, going back when it's sent a ZRPOS.  Like sz, it asks for
+//	ZACKs only if it's windowed, and even then doesn't wait for them.
+//
+
+static int HostSend( int Fd, int Flags)
+{
+
+  static uint8_t
+    data[ SUBPACKET];
+  uint8_t
+    hdr[4];
+  char
+    info[ 64];
+  uint32_t
+    pos,
+    i;
+  int
+    type,
+    length,
+    end;
+  bool
+    glitched,
+    spoil;
+
+  PutAll( Fd, (const uint8_t *) "rz\r", 3);
+  PutHex( Fd, ZRQINIT, 0);
+  while ( (type = GetHeader( Fd, hdr)) != ZRINIT)
+    if ( type < 0)
+      return 1;
+  if ( !(hdr[3] & CANFC32))
+    return 2;
+  Crc32Mode = !(Flags & HOST_CRC16);
+
+  memset( info, 0, sizeof( info));
+  strcpy( info, RECEIVE_NAME);
+  length = (int) strlen( RECEIVE_NAME) + 1;
+  length += sprintf( info + length, "%d 0 0", FILE_SIZE) + 1;
+  memset( hdr, 0, sizeof( hdr));
+  hdr[3] = (Flags & HOST_RESUME) ? ZCRESUM : ZCBIN;
+  PutBin( Fd, ZFILE, hdr);
+  PutSub( Fd, (uint8_t *) info, length, ZCRCW, false);
+
+  while ( (type = GetHeader( Fd, hdr)) == ZRINIT)
+    ;				// the one for our ZRQINIT
+  if ( type != ZRPOS)
+    return 3;
+  pos = GetPos( hdr);
+  if ( (Flags & HOST_RESUME) ? pos == 0 || pos > Note->have : pos != 0)
+    return 4;
+  glitched = false;
+
+//  The data, until the board has it all.
+
+  while ( true)
+  {
+    SetPos( hdr, pos);
+    PutBin( Fd, ZDATA, hdr);
+    type = -1;
+    while ( pos < FILE_SIZE)
+    {
+      length = FILE_SIZE - pos < SUBPACKET ? FILE_SIZE - pos : SUBPACKET;
+      for ( i = 0; i < (uint32_t) length; i++)
+        data[ i] = BenchPattern( pos + i);
+      end = pos + length >= FILE_SIZE ? ZCRCE :
+        (Flags & HOST_WINDOW) && (pos + length) % ACK_INTERVAL == 0 ?
+        ZCRCQ : ZCRCG;
+      spoil = (Flags & HOST_GLITCH) && !glitched && pos + length > GLITCH_AT;
+      if ( spoil)
+        glitched = true;
+      PutSub( Fd, data, length, end, spoil);
+      pos += length;
+      Note->moved += length;
+
+      if ( (Flags & HOST_CRASH) && pos >= CRASH_AT)
+      { // the line drops
+        Note->have = pos;
+        PutCancel( Fd);
+        Drain( Fd);
+        return 0;
+      }
+
+//  Anything from the board?  A ZRPOS sends us back.
+
+      while ( end != ZCRCE && Waiting( Fd))
+      {
+        if ( (type = GetHeader( Fd, hdr)) == ZRPOS)
+          break;
+        if ( type != ZACK)
+          return 5;
+      }
+      if ( type == ZRPOS)
+        break;
+    } // while data to send
+
+    if ( type != ZRPOS)
+    { // all sent
+      SetPos( hdr, pos);
+      PutBin( Fd, ZEOF, hdr);
+      while ( (type = GetHeader( Fd, hdr)) == ZACK)
+        ;
+      if ( type == ZRINIT)
+        break;
+      if ( type != ZRPOS)
+        return 6;
+    }
+    pos = GetPos( hdr);			// go back
+    if ( pos > FILE_SIZE)
+      return 7;
+  } // while sending
+
+  PutHex( Fd, ZFIN, 0);
+  if ( GetHeader( Fd, hdr) != ZFIN)
+    return 8;
+  PutAll( Fd, (const uint8_t *) "OO", 2);
+  Drain( Fd);				// till the board's read it
+  return 0;
+} // HostSend
+
+//	GetHeader - Wait for a header.
+//	------------------------------
+//
+//	Skips anything that isn't one.  Returns the frame type with the
+//	four header bytes in Hdr, or -1.  Sets Crc32Mode from the kind
+//	of header, as the data that follows it uses the same.
+//
+
+static int GetHeader( int Fd, uint8_t *Hdr)
+{
+
+  uint8_t
+    buf[9];
+  uint32_t
+    crc;
+  int
+    c,
+    i,
+    n,
+    type;
+
+  while ( true)
+  {
+    if ( (c = BenchGetChar( Fd)) < 0)
+      return -1;
+    if ( c != ZPAD)
+      continue;
+    while ( (c = BenchGetChar( Fd)) == ZPAD)
+      ;
+    if ( c != ZDLE)
+      continue;
+    type = BenchGetChar( Fd);
+    if ( type == ZHEX || type == ZBIN || type == ZBIN32)
+      break;
+  } // while looking
+
+  if ( type == ZHEX)
+  {
+    for ( i = 0; i < 7; i++)
+    {
+      char
+        digits[3];
+
+      if ( (digits[0] = (char) BenchGetChar( Fd)) < 0 ||
+        (digits[1] = (char) BenchGetChar( Fd)) < 0)
+        return -1;
+      digits[2] = 0;
+      buf[i] = (uint8_t) strtoul( digits, NULL, 16);
+    }
+    if ( Crc16( 0, buf, 7))
+      return -1;
+    BenchGetChar( Fd);			// CR
+    BenchGetChar( Fd);			// LF
+    Crc32Mode = false;
+  }
+  else
+  {
+    n = type == ZBIN32 ? 9 : 7;
+    for ( i = 0; i < n; i++)
+    {
+      if ( (c = GetEscaped( Fd)) < 0 || (c & FRAME))
+        return -1;
+      buf[i] = (uint8_t) c;
+    }
+    if ( type == ZBIN32)
+    {
+      crc = (uint32_t) buf[5] | ((uint32_t) buf[6] << 8) |
+        ((uint32_t) buf[7] << 16) | ((uint32_t) buf[8] << 24);
+      if ( Crc32( 0, buf, 5) != crc)
+        return -1;
+    }
+    else if ( Crc16( 0, buf, 7))
+      return -1;
+    Crc32Mode = type == ZBIN32;
+  }
+  memcpy( Hdr, buf + 1, 4);
+  return buf[0];
+} // GetHeader
+
+//	GetSub - Receive a data subpacket.
+//	----------------------------------
+//
+//	Returns what ended it, or -1 if it's bad.
+//
+
+static int GetSub( int Fd, uint8_t *Buf, int Max, int *Length)
+{
+
+  uint8_t
+    crcBuf[4];
+  uint32_t
+    crc;
+  int
+    got,
+    c,
+    end,
+    i,
+    n;
+
+  for ( got = 0; ; got++)
+  {
+    if ( (c = GetEscaped( Fd)) < 0)
+      return -1;
+    if ( c & FRAME)
+      break;
+    if ( got >= Max)
+      return -1;
+    Buf[ got] = (uint8_t) c;
+  }
+  end = c & 0xff;
+  n = Crc32Mode ? 4 : 2;
+  for ( i = 0; i < n; i++)
+  {
+    if ( (c = GetEscaped( Fd)) < 0 || (c & FRAME))
+      return -1;
+    crcBuf[i] = (uint8_t) c;
+  }
+
+  Buf[ got] = (uint8_t) end;
+  if ( Crc32Mode)
+  {
+    crc = (uint32_t) crcBuf[0] | ((uint32_t) crcBuf[1] << 8) |
+      ((uint32_t) crcBuf[2] << 16) | ((uint32_t) crcBuf[3] << 24);
+    if ( Crc32( 0, Buf, got + 1) != crc)
+      return -1;
+  }
+  else if ( Crc16( Crc16( 0, Buf, got + 1), crcBuf, 2))
+    return -1;
+  *Length = got;
+  return end;
+} // GetSub
+
+//	GetEscaped - Next character, with ZDLE escapes undone.
+//	------------------------------------------------------
+//
+//	Returns FRAME with the end of a subpacket, or -1.
+//
+
+static int GetEscaped( int Fd)
+{
+
+  int
+    c;
+
+  do
+  {
+    if ( (c = BenchGetChar( Fd)) < 0)
+      return -1;
+  } while ( (c & 0x7f) == XON || (c & 0x7f) == XOFF);
+  if ( c != ZDLE)
+    return c;
+
+  switch ( c = BenchGetChar( Fd))
+  {
+    case ZCRCE:
+    case ZCRCG:
+    case ZCRCQ:
+    case ZCRCW:
+      return FRAME | c;
+
+    case ZRUB0:
+      return 0x7f;
+
+    case ZRUB1:
+      return 0xff;
+
+    default:
+      return c >= 0 && (c & 0x60) == 0x40 ? c ^ 0x40 : -1;
+  }
+} // GetEscaped
+
+//	PutHex - Send a hex header with a position (or flags) in it.
+//	------------------------------------------------------------
+//
+
+static void PutHex( int Fd, int Type, uint32_t Pos)
+{
+
+  uint8_t
+    buf[7];
+  char
+    out[32];
+  uint16_t
+    crc;
+  int
+    n,
+    i;
+
+  buf[0] = (uint8_t) Type;
+  SetPos( buf + 1, Pos);
+  crc = Crc16( 0, buf, 5);
+  buf[5] = (uint8_t) (crc >> 8);
+  buf[6] = (uint8_t) crc;
+
+  n = sprintf( out, "**%cB", ZDLE);
+  for ( i = 0; i < 7; i++)
+    n += sprintf( out + n, "%02x", buf[i]);
+  out[ n++] = '\r';
+  out[ n++] = (char) ('\n' | 0x80);
+  if ( Type != ZFIN && Type != ZACK)
+    out[ n++] = XON;
+  PutAll( Fd, (uint8_t *) out, n);
+  return;
+} // PutHex
+
+//	PutBin - Send a binary header.
+//	------------------------------
+//
+//	With a 32-bit CRC in Crc32Mode.
+//
+
+static void PutBin( int Fd, int Type, const uint8_t *Hdr)
+{
+
+  uint8_t
+    buf[5],
+    out[ 3 + 9 * 2],
+    *p;
+  uint32_t
+    crc;
+  int
+    i;
+
+  buf[0] = (uint8_t) Type;
+  memcpy( buf + 1, Hdr, 4);
+  p = out;
+  *p++ = ZPAD;
+  *p++ = ZDLE;
+  *p++ = Crc32Mode ? ZBIN32 : ZBIN;
+  for ( i = 0; i < 5; i++)
+    PutEscaped( &p, buf[i]);
+  if ( Crc32Mode)
+  {
+    crc = Crc32( 0, buf, 5);
+    for ( i = 0; i < 4; i++, crc >>= 8)
+      PutEscaped( &p, (uint8_t) crc);
+  }
+  else
+  {
+    crc = Crc16( 0, buf, 5);
+    PutEscaped( &p, (uint8_t) (crc >> 8));
+    PutEscaped( &p, (uint8_t) crc);
+  }
+  PutAll( Fd, out, (int) (p - out));
+  return;
+} // PutBin
+
+//	PutSub - Send a data subpacket.
+//	-------------------------------
+//
+//	Spoil sends it with a bad CRC.
+//
+
+static void PutSub( int Fd, const uint8_t *Buf, int Length, int End,
+  bool Spoil)
+{
+
+  static uint8_t
+    out[ 2 * SUBPACKET + 16];
+  uint8_t
+    *p,
+    end;
+  uint32_t
+    crc;
+  int
+    i;
+
+  end = (uint8_t) End;
+  p = out;
+  for ( i = 0; i < Length; i++)
+    PutEscaped( &p, Buf[i]);
+  *p++ = ZDLE;
+  *p++ = end;
+  if ( Crc32Mode)
+  {
+    crc = Crc32( Crc32( 0, Buf, Length), &end, 1) ^ (Spoil ? 1 : 0);
+    for ( i = 0; i < 4; i++, crc >>= 8)
+      PutEscaped( &p, (uint8_t) crc);
+  }
+  else
+  {
+    crc = Crc16( Crc16( 0, Buf, Length), &end, 1) ^ (Spoil ? 1 : 0);
+    PutEscaped( &p, (uint8_t) (crc >> 8));
+    PutEscaped( &p, (uint8_t) crc);
+  }
+  if ( End == ZCRCW)
+    *p++ = XON;
+  PutAll( Fd, out, (int) (p - out));
+  return;
+} // PutSub
+
+//	PutEscaped - Stage a character, escaped if it has to be.
+//	--------------------------------------------------------
+//
+//	lrzsz escapes a few more than these; the board mustn't care.
+//
+
+static void PutEscaped( uint8_t **Out, uint8_t What)
+{
+
+  switch ( What)
+  {
+    case ZDLE:
+    case 0x10:
+    case 0x90:
+    case XON:
+    case XON | 0x80:
+    case XOFF:
+    case XOFF | 0x80:
+      *(*Out)++ = ZDLE;
+      What ^= 0x40;
+      break;
+
+    case 0x7f:
+      *(*Out)++ = ZDLE;
+      What = ZRUB0;
+      break;
+
+    case 0xff:
+      *(*Out)++ = ZDLE;
+      What = ZRUB1;
+      break;
+
+    default:
+      break;
+  } // switch
+  *(*Out)++ = What;
+  return;
+} // PutEscaped
+
+//	PutAll - Send Count bytes.
+//	--------------------------
+//
+
+static void PutAll( int Fd, const uint8_t *Buf, int Count)
+{
+
+  int
+    n;
+
+  while ( Count > 0)
+  {
+    if ( (n = (int) write( Fd, Buf, Count)) <= 0)
+      _exit( 20);
+    Buf += n;
+    Count -= n;
+  }
+  return;
+} // PutAll
+
+//	PutCancel - Give up, the way sz and rz do.
+//	------------------------------------------
+//
+
+static void PutCancel( int Fd)
+{
+
+  static const uint8_t
+    cancel[] = { ZDLE, ZDLE, ZDLE, ZDLE, ZDLE, ZDLE, ZDLE, ZDLE,
+      '\b', '\b', '\b', '\b', '\b', '\b', '\b', '\b' };
+
+  PutAll( Fd, cancel, sizeof( cancel));
+  return;
+} // PutCancel
+
+//	Drain - Take whatever the board sends until it hangs up.
+//	--------------------------------------------------------
+//
+
+static void Drain( int Fd)
+{
+
+  while ( BenchGetChar( Fd) >= 0)
+    BenchDropInput();
+  return;
+} // Drain
+
+//	Waiting - True if a header's coming.
+//	------------------------------------
+//
+//	Drops anything that can't start one, like the XON after a hex
+//	header.
+//
+
+static bool Waiting( int Fd)
+{
+
+  int
+    c;
+
+  while ( (c = BenchPeekChar( Fd)) >= 0)
+  {
+    if ( c == ZPAD)
+      return true;
+    BenchGetChar( Fd);
+  }
+  return false;				// nothing yet, or hung up
+} // Waiting
+
+//	SetPos, GetPos - File position in a header.
+//	-------------------------------------------
+//
+
+static void SetPos( uint8_t *Hdr, uint32_t Pos)
+{
+
+  Hdr[0] = (uint8_t) Pos;
+  Hdr[1] = (uint8_t) (Pos >> 8);
+  Hdr[2] = (uint8_t) (Pos >> 16);
+  Hdr[3] = (uint8_t) (Pos >> 24);
+  return;
+} // SetPos
+
+static uint32_t GetPos( const uint8_t *Hdr)
+{
+  return (uint32_t) Hdr[0] | ((uint32_t) Hdr[1] << 8) |
+    ((uint32_t) Hdr[2] << 16) | ((uint32_t) Hdr[3] << 24);
+} // GetPos
+
+//	Crc16 - CRC-16/XMODEM, a bit at a time.
+//	---------------------------------------
+//
+//	Worked out here rather than with crc16.c's and crc32.c's tables,
+//	so that the two check each other.
+//
+
+static uint16_t Crc16( uint16_t Crc, const uint8_t *Buf, int Count)
+{
+
+  int
+    i;
+
+  while ( Count--)
+  {
+    Crc ^= (uint16_t) (*Buf++ << 8);
+    for ( i = 0; i < 8; i++)
+      Crc = (Crc & 0x8000) ? (uint16_t) ((Crc << 1) ^ 0x1021) :
+        (uint16_t) (Crc << 1);
+  }
+  return Crc;
+} // Crc16
+
+//	Crc32 - CRC-32 as zlib has it, a bit at a time.
+//	-----------------------------------------------
+//
+
+static uint32_t Crc32( uint32_t Crc, const uint8_t *Buf, int Count)
+{
+
+  int
+    i;
+
+  Crc = ~Crc;
+  while ( Count--)
+  {
+    Crc ^= *Buf++;
+    for ( i = 0; i < 8; i++)
+      Crc = (Crc & 1) ? (Crc >> 1) ^ 0xEDB88320 : Crc >> 1;
+  }
+  return ~Crc;
+} // Crc32
+
@@ -1,10 +1,11 @@
 //  CRC16 computation.
 
 #ifndef _crc16_included_
-#define crc16_included
+#define _crc16_included_
 
 #include <stdint.h>
 
 uint16_t CRC16 (void *Buf, uint16_t Count);
+uint16_t CRC16Add( uint16_t Crc, const void *Buf, uint16_t Count);
 
 #endif
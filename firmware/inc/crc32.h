@@ -0,0 +1,10 @@
+//  CRC32 computation.
+
+#ifndef _crc32_included_
+#define _crc32_included_
+
+#include <stdint.h>
+
+uint32_t CRC32( uint32_t Crc, const void *Buf, uint32_t Count);
+
+#endif
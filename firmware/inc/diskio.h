@@ -36,6 +36,8 @@ DRESULT disk_write (BYTE pdrv, const BYTE* buff, LBA_t sector, UINT count);
 #if _USE_IOCTL
 DRESULT disk_ioctl (BYTE pdrv, BYTE cmd, void* buff);
 #endif
+DRESULT disk_read_start (BYTE pdrv, BYTE* buff, LBA_t sector, UINT count);
+DRESULT disk_claim (const void* buff, UINT len);
 
 /* Disk Status Bits (DSTATUS) */
 
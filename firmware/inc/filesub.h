@@ -10,4 +10,8 @@ void ShowFiles( char *args[]);
 void DeleteFile( char *args[]);
 void SendFile( char *args[]);
 void GetFile( char *args[]);
+void ZSendFile( char *args[]);
+void ZGetFile( char *args[]);
+void SDBench( char *args[]);		// measure card speed
+void UsbDisk( char *args[]);		// card as a USB disk
 #endif
@@ -42,5 +42,10 @@ SCOPE bool
 SCOPE uint16_t
   TapeAddress;			// address of tape drive
 
+SCOPE int
+  TapeXferMode;			// XFER_POLLED or XFER_DMA
+SCOPE int
+  TapeSpeed;			// SPEED_LOW, SPEED_HIGH or SPEED_AUTO
+
 #undef SCOPE
 #endif
@@ -102,6 +102,20 @@
 #define PSTAT_BIT	0xff00		// 8 bits (high order)
 #define PSTAT_INIT	_IN_NONE	// always input
 
+// RDAVAIL (status 0, bit 3) appears on PE11 while SSEL is low.  PE11
+// is also TIM1_CH2, so the DMA read engine uses it as a timer trigger.
+
+#define PRDAV_GPIO	GPIOE		// Read data available
+#define PRDAV_BIT	GPIO11
+#define PRDAV_AF	GPIO_AF1	// TIM1_CH2
+
+// WREMPTY (status 0, bit 4) is on PE12.  No timer can capture that pin,
+// so the write engine takes it as an EXTI line instead.
+
+#define PWREM_GPIO	GPIOE		// Write buffer empty
+#define PWREM_BIT	GPIO12
+#define PWREM_EXTI	EXTI12
+
 //  Initialization macros.
 
 #define GPIO_INIT(x) SetupGPIO( x##_GPIO, x##_BIT, x##_INIT)
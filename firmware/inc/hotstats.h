@@ -0,0 +1,68 @@
+//*  Hot-path timing probes.
+//
+//	Built in only when HOT_STATS is defined ("make STATS=1"); without
+//	it, every probe below compiles to nothing.  Times are in CPU
+//	cycles, from the DWT cycle counter (simulated time on the host).
+//
+
+#ifndef _hotstats_included_
+#define _hotstats_included_
+
+#include <stdint.h>
+
+//  What's timed.
+
+typedef enum
+{
+  STAT_GO_IFBY = 0,	// GO until the formatter is busy
+  STAT_IFBY_IDBY,	// formatter busy until the data phase
+  STAT_BYTE,		// data phase, per byte
+  STAT_MOTION,		// a motion command, start to finish
+  STAT_TAPE_READ,	// TapeRead, start to finish
+  STAT_TAPE_WRITE,	// TapeWrite, start to finish
+  STAT_CARD_READ,	// disk_read: what f_read asks of the card
+  STAT_CARD_WRITE,	// disk_write: what f_write asks of the card
+  STAT_SD_COMMIT,	// SD_WaitComplete: waiting out a card transfer
+  STAT_CONSOLE,		// USPuts
+  STAT_PROBES		// how many
+} STAT_PROBE;
+
+#define STAT_BUCKETS 32		// bucket n holds times of 2^(n-1) to 2^n-1
+
+//  What each probe has seen.
+
+typedef struct
+{
+  uint32_t
+    Count,			// samples
+    Min,			// ... least and greatest, per unit
+    Max,
+    Hist[ STAT_BUCKETS];	// ... by power of two, per unit
+  uint64_t
+    Cycles,			// total time
+    Units;			// ... spread over this many units
+} STAT_ENTRY;
+
+#ifdef HOT_STATS
+extern const char * const StatNames[ STAT_PROBES];
+
+void StatInit( void);			// start the cycle counter
+uint32_t StatCycles( void);
+void StatAdd( STAT_PROBE Probe, uint32_t Cycles, uint32_t Units);
+void StatTake( STAT_ENTRY *Copy);	// copy them all, start over
+
+//  STAT_TIMER declares a start time, STAT_MARK sets it; STAT_SINCE
+//  records the time from there to now, STAT_SINCE_PER the same
+//  spread over Units (bytes, say).
+
+#define STAT_TIMER(t) uint32_t t
+#define STAT_MARK(t) ((t) = StatCycles())
+#define STAT_SINCE(p,t) StatAdd( (p), StatCycles() - (t), 1)
+#define STAT_SINCE_PER(p,t,n) StatAdd( (p), StatCycles() - (t), (n))
+#else
+#define STAT_TIMER(t)
+#define STAT_MARK(t)
+#define STAT_SINCE(p,t)
+#define STAT_SINCE_PER(p,t,n)
+#endif
+#endif
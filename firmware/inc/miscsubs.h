@@ -8,5 +8,6 @@ void ShowBuffer( uint8_t *Buf, int Buflen);
 void DelaySetup (void);
 void Delay(uint16_t Howmuch);
 void SetupSysTick( void);
+uint32_t Microseconds( void);
 
 #endif // _MISCSUBS_DEFINED
\ No newline at end of file
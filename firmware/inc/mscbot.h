@@ -0,0 +1,47 @@
+#ifndef _MSCBOT_INC
+#define _MSCBOT_INC
+
+#include <stdint.h>
+#include <stdbool.h>
+
+//  USB mass storage, bulk-only transport, SCSI transparent command
+//  set: the card as a disk the host can mount.  See mscbot.c.
+//
+//  The transport hands over packets and nothing else, so the same
+//  code runs under the USB driver on the board and under a host
+//  test against a card image:
+//
+//	MscReceive	an OUT packet has arrived
+//	MscCanReceive	true if there's room for the next one; if not,
+//			hold the OUT endpoint off (NAK)
+//	MscTransmit	next IN packet, if there is one
+//	MscService	foreground: commands and card I/O
+//
+//  MscReceive and MscTransmit may run at interrupt level;
+//  MscService must not.
+
+#define MSC_PACKET_SIZE	64		// bulk packet
+#define MSC_SECTOR_SIZE	512
+
+//  Interface class, subclass and protocol.
+
+#define MSC_CLASS	0x08		// mass storage
+#define MSC_SUBCLASS	0x06		// SCSI transparent
+#define MSC_PROTOCOL	0x50		// bulk-only
+
+//  Class requests.
+
+#define MSC_REQ_RESET	0xFF		// bulk-only mass storage reset
+#define MSC_REQ_MAX_LUN	0xFE		// get max LUN
+
+void MscStart( uint8_t *Buffer, uint32_t Size, uint32_t Count);
+bool MscStop( void);
+void MscReset( void);
+void MscReceive( const uint8_t *Packet, int Length);
+bool MscCanReceive( void);
+int MscTransmit( uint8_t *Packet);
+void MscService( void);
+bool MscIdle( void);
+bool MscEjected( void);
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef _PERTPORT_INC
+#define _PERTPORT_INC
+
+#include <stdint.h>
+
+//  Pertec port layer.
+//
+//  Everything the tape driver does to the interface board goes
+//  through here: the data, status, command and control registers,
+//  and the short waits between touching them.  Values are what's on
+//  the pins, which is to say negative-true.  PertCycles reads the CPU
+//  cycle counter, so that the transfer loops can time themselves;
+//  PertMsec is the millisecond tick (globals.h), for deadlines.
+//
+//  On the board, these are just the libopencm3 calls.  The host
+//  build (HOST defined) gets them from host/simport.c, which talks
+//  to the simulated formatter instead.
+
+#include <libopencm3/stm32/gpio.h>
+
+#include "gpiodef.h"
+
+#ifndef HOST
+
+#include <libopencm3/cm3/dwt.h>
+
+#include "miscsubs.h"
+
+#define PertCtrlSet(x)		gpio_set( PCTRL_GPIO, (x))
+#define PertCtrlClear(x)	gpio_clear( PCTRL_GPIO, (x))
+#define PertCmdSet(x)		gpio_set( PCMD_GPIO, (x))
+#define PertCmdClear(x)		gpio_clear( PCMD_GPIO, (x))
+#define PertStatus()		((uint8_t) (gpio_port_read( PSTAT_GPIO) >> 8))
+#define PertDataRead()		((uint8_t) gpio_port_read( PDATA_GPIO))
+#define PertDataWrite(x)	gpio_port_write( PDATA_GPIO, (x))
+#define PertDataIn()		G_INPUT( PDATA)
+#define PertDataOut()		G_OUTPUT( PDATA)
+#define PertDelay(x)		Delay( x)
+#define PertCyclesStart()	dwt_enable_cycle_counter()
+#define PertCycles()		DWT_CYCCNT
+#define PertMsec()		Milliseconds
+
+#else
+
+void PertCtrlSet( uint16_t Pins);	// control register bits high
+void PertCtrlClear( uint16_t Pins);	// ... low
+void PertCmdSet( uint8_t Bits);		// command register bus bits high
+void PertCmdClear( uint8_t Bits);	// ... low
+uint8_t PertStatus( void);		// selected status register
+uint8_t PertDataRead( void);		// data register
+void PertDataWrite( uint16_t Value);	// ... and out
+void PertDataIn( void);			// data register direction
+void PertDataOut( void);
+void PertDelay( uint16_t Howmuch);	// half-microseconds
+void PertCyclesStart( void);		// start the cycle counter
+uint32_t PertCycles( void);		// ... and read it
+uint32_t PertMsec( void);		// milliseconds since reset
+
+#endif
+
+#endif
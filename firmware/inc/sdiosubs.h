@@ -25,9 +25,12 @@ typedef enum _sdioerrors_
 void SD_Reset(bool Power);
 SD_ERROR SD_Init(void);
 uint32_t SD_GetCardSize( void);
+uint32_t SD_GetClock( void);
 SD_ERROR SD_ReadBlocks( void *Buf, uint32_t Sector, uint32_t Count);
 SD_ERROR SD_WriteBlocks( void *Buf, uint32_t Sector, uint32_t Count);
 SD_ERROR SD_WaitComplete( void);
+SD_ERROR SD_StreamWrite( void *Buf, uint32_t Sector, uint32_t Count);
+void SD_StreamClose( void);
 
 
 #endif //__SDIOSUBS_H
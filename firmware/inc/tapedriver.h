@@ -6,6 +6,7 @@
 
 //  Tape Status values:
 
+#define TSTAT_TIMEOUT	0x100	// Formatter stopped answering
 #define TSTAT_OFFLINE   0x80	// Drive is offline
 #define TSTAT_HARDERR   0x40	// Formatter detected a hard error
 #define TSTAT_CORRERR   0x20	// Formatter corrected an error
@@ -16,11 +17,94 @@
 #define TSTAT_PROTECT	0x01	// Tape is write protected
 #define TSTAT_NOERR     0x00	// No error detected
 
+//  Data transfer engines (TapeXferMode).  XFER_DMA is named for its
+//  reads, which TIM1 paces and DMA2 moves.  Its writes use no DMA:
+//  WREMPTY has no timer input to trigger one, so the WREMPTY
+//  interrupt (EXTI12) feeds each byte instead (see tapexfer.c).
+//  Either way the formatter sets the pace, not the CPU.
+
+#define XFER_POLLED	0	// CPU polls and strobes every byte
+#define XFER_DMA	1	// Hardware paced: DMA reads, interrupt writes
+
+//  Speed selection (TapeSpeed), by PC_IHSP on each command:
+
+#define SPEED_LOW	0	// Everything at low speed
+#define SPEED_HIGH	1	// Everything at high speed
+#define SPEED_AUTO	2	// High for spacing and streaming reads
+
+//  What the last operation asked for, and what the drive said it ran
+//  at (PS0_ISPEED) once the formatter went busy.  A drive with one
+//  speed never says high.
+
+typedef struct
+{
+  bool Asked;			// PC_IHSP sent
+  bool Ran;			// PS0_ISPEED seen
+} TAPE_SPEED;
+
+//  How the CPU kept up during the last block's data phase, with the
+//  polled engine; all zero with the DMA engine, whose TACK and strobe
+//  timing is the hardware's.  Times are in CPU cycles.  WorstWait is
+//  the longest any byte may have waited for its TACK (reading) or the
+//  empty buffer for its strobe (writing); CharTime is the drive's
+//  character time, as the block itself showed it.  A block is Late
+//  when less than TIMING_MARGIN_PCT of a character time was left in
+//  hand: at 100 percent, the formatter has moved on to the next byte.
+
+#define TIMING_MARGIN_PCT 25
+
+typedef struct
+{
+  uint32_t WorstWait;		// longest wait for the CPU
+  uint32_t CharTime;		// drive's character time
+  bool Late;			// margin not kept
+} TAPE_TIMING;
+
+//  Where an operation begun by one of the TapeStart routines has got
+//  to; TapePoll moves it along.  Each state has a deadline, so a
+//  formatter that stops answering ends the operation with
+//  TSTAT_TIMEOUT rather than hanging.
+
+typedef enum
+{
+  TAPE_IDLE = 0,	// nothing going on
+  TAPE_GO,		// command issued, waiting for formatter busy
+  TAPE_WAIT_DATA,	// formatter busy, waiting for the data phase
+  TAPE_DATA,		// data phase
+  TAPE_WAIT_END,	// waiting for formatter busy to drop
+  TAPE_REWINDING,	// rewinding
+  TAPE_DONE		// finished; TapeResult has the status
+} TAPE_STATE;
+
+//  A change in the tape status, as TapeStatus found it.  Msec is when
+//  that read was, not when the line changed: the status is only read
+//  when something asks for it.  TapeEdges hands over the last
+//  TAPE_EDGE_LOG.
+
+#define TAPE_EDGE_LOG 32
+
+typedef struct
+{
+  uint32_t Msec;		// PertMsec when seen
+  uint16_t Was;			// status before
+  uint16_t Now;			// ... and after
+} TAPE_EDGE;
+
 //  Global prototypes
 
 
+unsigned int TapeStartRead( uint8_t *Buf, int Buflen);
+unsigned int TapeStartWrite( uint8_t *Buf, int Buflen);
+unsigned int TapeStartSkip( int Dir);
+unsigned int TapeStartSpace( int Dir);
+unsigned int TapeStartRewind( void);
+TAPE_STATE TapePoll( void);
+unsigned int TapeResult( int *BytesRead);
+unsigned int TapeWait( int *BytesRead);
 unsigned int TapeRead( uint8_t *Buf, int Buflen, int *BytesRead);
 unsigned int TapeWrite( uint8_t *Buf, int Buflen);
+void TapeBlockTiming( TAPE_TIMING *Timing);
+void TapeOpSpeed( TAPE_SPEED *Speed);
 unsigned int SkipBlock( int Dir);
 unsigned int SpaceFile( int Dir);
 unsigned int TapeRewind( void);
@@ -33,6 +117,8 @@ bool IsTapeOnline( void);
 bool IsTapeEOT(void);
 bool IsTapeProtected( void);
 uint16_t TapeStatus( void);
+uint16_t TapeStatusRecent( void);
+int TapeEdges( TAPE_EDGE *Copy);
 void IssueTapeCommand( uint16_t What);
 
 #endif
@@ -0,0 +1,55 @@
+#ifndef _TAPESTREAM_INC
+#define _TAPESTREAM_INC
+
+//  Framing for STREAM, which sends a tape image to the host over the
+//  console link instead of writing it to the card.
+//
+//  After the command echo and any messages, the controller sends
+//  STREAM_START, then the image byte for byte as it would go into a
+//  .TAP file: header, data, trailer for each block, a lone header
+//  for a tapemark, and a TAP_EOM header to end it--even when the
+//  operator aborts with ESC.  Console text resumes after the EOM.
+//
+//  Flow control is the link's own: when the host doesn't read, the
+//  controller's output backs up and the drive waits between blocks.
+//
+//  The image goes over the console link unless the host has claimed
+//  the USB data interface (vendor-specific, interface DATA_INTERFACE)
+//  and sent it DATA_REQ_ATTACH with wValue 1; then the framing below
+//  is the same, but it's all on the data interface's bulk endpoints
+//  and the console carries the usual progress text and takes ESC.
+
+#define STREAM_START "\002TAPSTREAM\002"
+#define STREAM_START_LEN 11
+
+//  STREAMW goes the other way: the host sends an image and it's
+//  written to tape as it comes, with no copy on the card.
+//
+//  Once the tape is ready, the controller sends STREAM_WRITE and
+//  the host sends the image as a .TAP file, ending with a TAP_EOM
+//  header.  For every block or tapemark it takes, the controller
+//  answers with a 16-bit little-endian status: the TSTAT bits from
+//  writing it, or STREAM_SKIPPED if it wasn't written because one
+//  before it failed.  Anything but TSTAT_NOERR or TSTAT_CORRERR is a
+//  failure; the host should then finish the record it's sending and
+//  send the EOM.  After the EOM--or at once, if the image doesn't
+//  make sense--the controller sends STREAM_END and console text
+//  resumes.
+//
+//  The host needn't wait for status before sending more; the link
+//  holds it off while the records ahead of the tape fill the buffer.
+
+#define STREAM_WRITE "\002TAPWRITE\002"
+#define STREAM_WRITE_LEN 10
+
+#define STREAM_SKIPPED	0xFFFF		// record not written
+#define STREAM_END	0xFFFE		// no more status; text follows
+
+//  The data interface.
+
+#define DATA_INTERFACE	2		// interface number
+#define DATA_OUT_EP	0x02		// host to controller
+#define DATA_IN_EP	0x81		// controller to host
+#define DATA_REQ_ATTACH	1		// vendor request; wValue 1 = on
+
+#endif
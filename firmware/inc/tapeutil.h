@@ -16,7 +16,14 @@ void CmdSkip( char *args[]);
 void CmdSpace( char *args[]);
 void CmdTapeDebug( char *args[]);
 void CmdCreateImage( char *args[]);
+void CmdStreamImage( char *args[]);
 void CmdWriteImage( char *args[]);
+void CmdStreamWrite( char *args[]);
 void CmdSet1600( char *args[]);
 void CmdSet6250( char *args[]);
+void CmdSetXfer( char *args[]);
+void CmdSetSpeed( char *args[]);
+void CmdShowStats( char *args[]);
+void CmdTune( char *args[]);
+void CmdEdges( char *args[]);
 #endif
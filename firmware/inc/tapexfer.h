@@ -0,0 +1,27 @@
+#ifndef _TAPEXFER_INC
+#define _TAPEXFER_INC
+
+#include <stdint.h>
+#include <stdbool.h>
+
+//  Hardware data transfer engines for the Pertec data register.
+//  See tapexfer.c for the timer, DMA and interrupt assignments.
+
+//  The DMA count register is 16 bits, so that's the most we can
+//  move in a single block.
+
+#define XFER_MAX_COUNT 65535
+
+//  Global prototypes
+
+void XferInit( void);
+void XferReadSetup( uint8_t *Buf, int Buflen);
+void XferReadEnable( bool On);
+int XferReadCount( void);
+int XferReadStop( void);
+void XferWriteSetup( uint8_t *Buf, int Buflen, uint8_t LastWordCmd);
+void XferWriteEnable( bool On);
+int XferWriteCount( void);
+int XferWriteStop( void);
+
+#endif
@@ -7,9 +7,21 @@ int USInit( void);  		// initialize
 void USClear( void);		// clear buffer contents
 int USPutchar( char);   	// put a character
 int USWritechar( char);		// "raw" write character
+void USFlush( void);		// start queued output
 int USGetchar( void);   	// get a character
 int USCharReady( void); 	// test if character ready
+int USReadBlock( uint8_t *What, int Count);	// take waiting input
+int USPeekInput( uint8_t **Where);		// waiting input, in place
+void USSkipInput( int Count);			// ... and take it
 void USPuts( char *What);	// put string
 int USWriteBlock( uint8_t *What, int Count);	// write a block of data
 
+//  The image data interface (USB only).
+
+bool USDataAttached( void);			// host is using it
+int USDataWrite( uint8_t *What, int Count);	// send a block
+int USDataRead( uint8_t *What, int Count);	// take waiting input
+bool USDiskMode( bool On);			// data interface a disk?
+void USDiskPoll( void);				// keep the disk moving
+
 #endif
@@ -4,6 +4,8 @@
 #ifndef _ymodem_included_
 #define _ymodem_included_
 
+#include <stdint.h>
+
 // Error code returns.
 
 typedef enum 
@@ -14,12 +16,15 @@ typedef enum
   XERR_TIMEOUT,		// conversation timed out
   XERR_ABORT,		// CAN received
   XERR_CORRUPT,		// Data corrupted error
-  XERR_ENDFILE		// End of file (not really an error)
+  XERR_ENDFILE,		// End of file (not really an error)
+  XERR_WRITE,		// card write failed (full?)
+  XERR_READ		// card read failed
 } XERR_CODE;
 
 
 XERR_CODE SendYmodem ( char *FileName);
 XERR_CODE ReceiveYmodem( void);
+int BuildFileList( char *Pattern, uint8_t *RetBuf, int RetSize);
 
 #endif
 
@@ -0,0 +1,14 @@
+//*  ZMODEM definitions.
+//
+
+#ifndef _zmodem_included_
+#define _zmodem_included_
+
+#include <stdbool.h>
+
+#include "ymodem.h"		// for the XERR_ codes
+
+XERR_CODE SendZmodem( char *FileSpec, bool Resume);
+XERR_CODE ReceiveZmodem( bool Resume);
+
+#endif
@@ -44,13 +44,23 @@ static const COMMAND_LIST Commands[] =
  { "MKDIR",	"Make a directory",		MakeDir		},  // filesub
  { "PUT",	"Send YMODEM (file name)",	SendFile	},  // filesub
  { "GET",	"Get a remote file",		GetFile		},  // filesub
+ { "ZPUT",	"Send ZMODEM (file name) [R]=resume",	ZSendFile	},  // filesub
+ { "ZGET",	"Get by ZMODEM [R]=resume",	ZGetFile	},  // filesub
+ { "SDBENCH",	"Measure SD card speed [MB]",	SDBench		},  // filesub
+ { "USBDISK",	"Let the host use the SD card as a USB disk", UsbDisk },  // filesub
  { "STATUS",	"Show detailed tape status",	CmdShowStatus  	},  // tapeutil
  { "REWIND",	"Rewind tape",			CmdRewindTape	},  // tapeutil
  { "READ",    	
-   "Read tape to image <file> [N] = no rewind",	CmdCreateImage  },  // tapeutil
+   "Read tape to image <file> [N] = no rewind [MB] = size estimate",
+						CmdCreateImage  },  // tapeutil
+
+ { "STREAM",	
+   "Read tape, send image to host [N] = no rewind", CmdStreamImage },  // tapeutil
 
  { "WRITE",	
    "Write tape from <file> [N] = no rewind", 	CmdWriteImage	},  // tapeutil
+ { "STREAMW",	
+   "Write tape from image sent by host [N] = no rewind", CmdStreamWrite },  // tapeutil
  { "DUMP",	"Read and display tape block",	CmdReadForward  },  // tapeutil
  { "INIT",	"Initialize tape interace",	CmdInitTape	},  // tapeutil
  { "ADDRESS",	
@@ -63,6 +73,14 @@ static const COMMAND_LIST Commands[] =
  { "STOP",	
    "Set stop: # of filemarks [E if error] ", 	CmdSetStop	},  // tapeutil
  { "DEBUG",	"Set command register [value]",	CmdTapeDebug	},  // tapeutil
+ { "XFER",	
+   "Set transfer engine: P = polled, D = DMA",	CmdSetXfer	},  // tapeutil
+ { "SPEED",	
+   "Set tape speed: L = low, H = high, A = auto", CmdSetSpeed	},  // tapeutil
+ { "STATS",	"Show and reset timing probes",	CmdShowStats	},  // tapeutil
+ { "TUNE",	
+   "Time polled reads [n blocks], pick engine",	CmdTune		},  // tapeutil
+ { "EDGES",	"Show recent tape status changes", CmdEdges	},  // tapeutil
 
 // { "SETPE",	"Set 1600 PE mode",		CmdSet1600	},  // tapeutil
 // { "SETGCR",	"Set 6250 GCR mode",		CmdSet6250	},  // tapeutil
@@ -95,7 +113,7 @@ bool ProcessCommand( void)
     Uprintf( "? ");		// prompt     
     Ugets( (char *) Buffer, 256);
     cmd = strtok( (char *) Buffer, CMD_DELIMS);	// get command name
-    if (! *cmd)
+    if ( !cmd || !*cmd)
       continue;			// ignore null entries
   
 //  Fold the command to uppercase.
@@ -51,12 +51,13 @@ int Ucharavail( void)
 //  Uputchar - Write a Single Character
 //  -----------------------------------
 //
-//  Just an alias for USPutchar
+//  Just an alias for USPutchar, but sent at once.
 //
 
 void Uputchar( unsigned char What)
 {
   USPutchar( What);
+  USFlush();
   return;
 } // Uputchar
 
@@ -74,6 +75,7 @@ void Uputs( char *What)
 
   while( (c = *What++))
     USPutchar( c);
+  USFlush();			// one kick for the lot
 
 } // Uputs
 
@@ -160,6 +162,7 @@ void Uprintf( char *Form,...)
     } // switch
   } // for each character
   va_end( argp);
+  USFlush();			// one kick for the lot
   return;
 } // Uprintf
 
@@ -5,6 +5,9 @@
 
 
 //      Y/Xmodem CRC16 Computation.
+//
+//	A byte at a time with crc16tab, or four at a time with the
+//	slicing tables made from it.
 
 static const uint16_t crc16tab[256] = 
 {
@@ -42,6 +45,20 @@ static const uint16_t crc16tab[256] =
   0x6e17, 0x7e36, 0x4e55, 0x5e74, 0x2e93, 0x3eb2, 0x0ed1, 0x1ef0
 };
 
+//	Slice[k][b] is the CRC of byte b followed by k zero bytes, so
+//	that four bytes can be folded in with four independent lookups
+//	rather than a chain of four.  Built on first use, in RAM, where
+//	a lookup doesn't wait on flash.
+
+#define SLICES	4
+
+static uint16_t
+  Slice[ SLICES][256];
+static bool
+  SliceBuilt;
+
+static void BuildSlices( void);
+
 //*  Compute CCITT CRC-16 of a Buffer.
 //   ---------------------------------
 //
@@ -54,14 +71,59 @@ static const uint16_t crc16tab[256] =
 
 uint16_t CRC16(void *Buf, uint16_t Count)
 {
-  uint16_t 
-    k,
-    crc;
-  uint8_t
+  return CRC16Add( 0, Buf, Count);
+} // CRC16
+
+//*  Add to a CCITT CRC-16.
+//   ----------------------
+//
+//	Carries Crc on over Count more bytes, for a CRC taken over
+//	data that isn't all in one place.
+//
+
+uint16_t CRC16Add( uint16_t Crc, const void *Buf, uint16_t Count)
+{
+  const uint8_t
     *bptr = Buf;
 
-  crc = 0;			// clear initial counter  
-  for (k = 0; k < Count; k++)
-    crc = (crc << 8) ^ crc16tab[ ((crc >> 8) ^ *bptr++) & 255];
-  return crc;
-} // CRC16
+  if ( !SliceBuilt)
+    BuildSlices();
+
+//  The CRC's two bytes go in with the first two of each four.
+
+  for ( ; Count >= SLICES; Count -= SLICES, bptr += SLICES)
+    Crc = Slice[3][ (Crc >> 8) ^ bptr[0]] ^
+      Slice[2][ (Crc & 255) ^ bptr[1]] ^
+      Slice[1][ bptr[2]] ^ Slice[0][ bptr[3]];
+
+  while ( Count--)
+    Crc = (Crc << 8) ^ crc16tab[ ((Crc >> 8) ^ *bptr++) & 255];
+  return Crc;
+} // CRC16Add
+
+//	BuildSlices - Make the slicing tables.
+//	--------------------------------------
+//
+//	Each is the one before carried through a zero byte.
+//
+
+static void BuildSlices( void)
+{
+  int
+    b,
+    k;
+  uint16_t
+    v;
+
+  for ( b = 0; b < 256; b++)
+  {
+    Slice[0][b] = crc16tab[b];
+    for ( k = 1; k < SLICES; k++)
+    {
+      v = Slice[k-1][b];
+      Slice[k][b] = (uint16_t) (v << 8) ^ crc16tab[ v >> 8];
+    }
+  }
+  SliceBuilt = true;
+  return;
+} // BuildSlices
@@ -19,6 +19,7 @@
 #include "rtcsubs.h"
 #include "globals.h"
 #include "comm.h"
+#include "hotstats.h"
 
 // Definitions of physical drive number for each drive 
 
@@ -35,6 +36,99 @@ static uint8_t  __attribute__ ((aligned(4)))
 
 #define IS_MISALIGNED(x) (((uint32_t)(x)) & 0x03)	// nonzero if not on 32-bit boundary
 
+//	Writes are write-behind: disk_write returns as soon as the DMA is
+//	started, and the next disk operation, CTRL_SYNC or disk_claim
+//	waits for it.  An error is reported by the next operation.
+//
+//	Single sectors--mostly FatFs's own window and file buffers, which
+//	it may change right after--are copied to WriteBuf and posted from
+//	there.  Longer aligned writes go straight from the caller's
+//	buffer, which the card owns until the write is done; anyone
+//	reusing such a buffer must call disk_claim first.
+//
+//	disk_read_start reads the same way, for those reading the card by
+//	sector number: it returns once the DMA is started, and the card
+//	owns the buffer until disk_claim.
+//
+//	All writes go through the SD write stream, so a run of writes to
+//	consecutive sectors--a file being laid down cluster after
+//	cluster--costs one CMD25 instead of a command and a stop per
+//	write.  Reads and writes elsewhere close the stream; so does
+//	CTRL_SYNC, which FatFs issues when a file is synced or closed.
+
+static uint8_t  __attribute__ ((aligned(4)))
+  WriteBuf[ BLOCK_SIZE];
+
+static bool
+  WritePending,		// a write (or a started read) is in progress
+  WriteFailed;		// ... and it didn't work
+static const BYTE
+  *OwnedBuf;		// caller's buffer it's using, or NULL
+static UINT
+  OwnedLen;		// ... and its length
+
+//  Prototypes.
+
+static void WaitWrite( void);
+static DRESULT WriteResult( void);
+
+//* WaitWrite - Wait for a write in progress.
+//  -----------------------------------------
+//
+
+static void WaitWrite( void)
+{
+
+  if ( WritePending)
+  {
+    if ( SD_WaitComplete() != SD_ERR_SUCCESS)
+      WriteFailed = true;
+    WritePending = false;
+    OwnedBuf = NULL;
+  }
+  return;
+} // WaitWrite
+
+//* WriteResult - Finish the last write and report how it went.
+//  -----------------------------------------------------------
+//
+
+static DRESULT WriteResult( void)
+{
+
+  WaitWrite();
+  if ( WriteFailed)
+  {
+    WriteFailed = false;
+    return RES_ERROR;
+  }
+  return RES_OK;
+} // WriteResult
+
+//* disk_claim - Take a buffer back from a transfer in progress.
+//  ------------------------------------------------------------
+//
+//	Waits if the card may still be using any of Len bytes at Buf.
+//	Returns RES_ERROR if that transfer failed; the next operation
+//	says so too.
+//
+
+DRESULT disk_claim( const void *Buf, UINT Len)
+{
+
+  const BYTE
+    *start;
+
+  start = (const BYTE *) Buf;
+  if ( OwnedBuf && start < OwnedBuf + OwnedLen && OwnedBuf < start + Len)
+  {
+    WaitWrite();
+    if ( WriteFailed)
+      return RES_ERROR;
+  }
+  return RES_OK;
+} // disk_claim
+
 //* disk_status - Get Disk Status.
 //  ------------------------------
 //
@@ -57,6 +151,8 @@ DSTATUS disk_initialize (BYTE pdrv)
 
   (void) pdrv;
 
+  WaitWrite();
+  SD_StreamClose();
   if ( SD_GetCardSize())
     return RES_OK;        // say the card's already initialized.
 
@@ -76,14 +172,17 @@ DRESULT disk_read (BYTE pdrv, BYTE *buff, LBA_t sector, UINT count)
 {
 
   SD_ERROR sdstat;
+  STAT_TIMER( start);
 
   (void) pdrv;
+  STAT_MARK( start);
   
 //  Misaligned block reads are performed a sector at a time.
 //
 //  Aligned block reads are performed a block at a time.
 
-  SD_WaitComplete();		// clear any pending writes
+  if ( WriteResult() != RES_OK)	// clear any pending writes
+    return RES_ERROR;
 
   if ( IS_MISALIGNED( buff))
   {
@@ -102,6 +201,7 @@ DRESULT disk_read (BYTE pdrv, BYTE *buff, LBA_t sector, UINT count)
     sdstat = SD_ReadBlocks( buff, sector, count);
     SD_WaitComplete();
   } //  aligned buffers
+  STAT_SINCE( STAT_CARD_READ, start);
   
   if (sdstat != SD_ERR_SUCCESS )
     return RES_ERROR;
@@ -109,6 +209,33 @@ DRESULT disk_read (BYTE pdrv, BYTE *buff, LBA_t sector, UINT count)
     return RES_OK;
 } // disk_read
 
+//* disk_read_start - Start reading sector(s).
+//  ------------------------------------------
+//
+//	As disk_read, but the card fills buff behind our back; see
+//	above.  A misaligned buffer is read at once, the slow way.
+//
+
+DRESULT disk_read_start (BYTE pdrv, BYTE *buff, LBA_t sector, UINT count)
+{
+
+  if ( IS_MISALIGNED( buff) || count == 0)
+    return disk_read( pdrv, buff, sector, count);
+
+  if ( WriteResult() != RES_OK)	// clear any pending writes
+    return RES_ERROR;
+
+  if ( SD_ReadBlocks( buff, sector, count) != SD_ERR_SUCCESS)
+  {
+    SD_WaitComplete();
+    return RES_ERROR;
+  }
+  WritePending = true;
+  OwnedBuf = buff;
+  OwnedLen = count * BLOCK_SIZE;
+  return RES_OK;
+} // disk_read_start
+
 //* disk_write - Write Sectors.
 //  ---------------------------
 //
@@ -119,33 +246,43 @@ DRESULT  disk_write (BYTE pdrv, const BYTE *buff, LBA_t sector, UINT count)
 
   SD_ERROR 
     sdstat;               // status
+  STAT_TIMER( start);
 
   (void) pdrv;
+  STAT_MARK( start);
 
-//	Misaligned buffers are write+wait single sectors.
-//	Aligned buffers post the write and return immediately.  An
-//	SD_WaitComplete is issued before any other disk operation is
-//	performed.
+//	Single sectors and misaligned buffers go a sector at a time
+//	through WriteBuf; the last one is left in progress.  Longer
+//	aligned writes are posted from the caller's buffer.
 
+  if ( WriteResult() != RES_OK)
+    return RES_ERROR;
 
-  SD_WaitComplete();
-  if ( IS_MISALIGNED( buff))
+  sdstat = SD_ERR_SUCCESS;
+  if ( count == 1 || IS_MISALIGNED( buff))
   {
     while( count--)
     {  
-      memcpy( DiskBuf, buff, BLOCK_SIZE);
-      if ( (sdstat = SD_WriteBlocks( DiskBuf, sector, 1)) )
+      WaitWrite();
+      memcpy( WriteBuf, buff, BLOCK_SIZE);
+      if ( (sdstat = SD_StreamWrite( WriteBuf, sector, 1)) )
         break;
-      SD_WaitComplete();
+      WritePending = true;
       sector++;
       buff += BLOCK_SIZE;
     } // do every sector
   } // handle problems
   else
   {  // aligned buffers, no problem
-    sdstat = SD_WriteBlocks( (void *) buff, sector, count);
-    SD_WaitComplete();
+    if ( (sdstat = SD_StreamWrite( (void *) buff, sector, count))
+      == SD_ERR_SUCCESS)
+    {
+      WritePending = true;
+      OwnedBuf = buff;
+      OwnedLen = count * BLOCK_SIZE;
+    }
   } // aligned buffers
+  STAT_SINCE( STAT_CARD_WRITE, start);
   
   if (sdstat != SD_ERR_SUCCESS)
     return RES_ERROR;
@@ -169,7 +306,9 @@ DRESULT disk_ioctl (BYTE pdrv, BYTE cmd, void *buff)
       return RES_OK;
           
     case CTRL_SYNC:
-      SD_WaitComplete();
+      if ( WriteResult() != RES_OK)
+        return RES_ERROR;
+      SD_StreamClose();		// get the last of it programmed
       return RES_OK;
 
     case GET_SECTOR_SIZE:
@@ -1,5 +1,6 @@
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 
@@ -10,7 +11,12 @@
 #include "globals.h"
 #include "filesub.h"
 #include "sdiosubs.h"
+#include "diskio.h"
+#include "miscsubs.h"
 #include "ymodem.h"
+#include "zmodem.h"
+#include "usbserial.h"
+#include "mscbot.h"
 
 //	MountSD - Initialize and mount SD card.
 //	---------------------------------------
@@ -208,20 +214,16 @@ void DeleteFile( char *args[])
   return;
 } // DeleteFile
 
-//*	GetFile - Get File via YMODEM.
-//	------------------------------
+//	ShowTransfer - Say how a file transfer went.
+//	--------------------------------------------
+//
+//	Name is what was being sent, if we were sending.
 //
 
-void GetFile( char *args[])
+static void ShowTransfer( XERR_CODE Result, bool Sending, char *Name)
 {
 
-  int yresult;
-
-  (void) args;
-
-  Uprintf( "\nReady to receive ymodem...");
-    
-  switch ( (yresult = ReceiveYmodem()) )
+  switch ( Result)
   {
   
     case XERR_MOUNT_ERROR:
@@ -229,17 +231,33 @@ void GetFile( char *args[])
       break;
     
     case XERR_NO_FILE:
-      Uprintf( "\nFile %s could not be created.\n", args[0]);
+      if ( Sending)
+        Uprintf( "\nFile %s not found.\n", Name);
+      else
+        Uprintf( "\nFile could not be created.\n");
       break;
     
     case XERR_TIMEOUT:
-      Uprintf( "\nTime-out exceeded waiting for sender.\n");
+      Uprintf( "\nTime-out exceeded waiting for %s.\n",
+        Sending ? "receiver" : "sender");
       break;
     
     case XERR_ABORT:
       Uprintf( "\nTransfer cancelled.\n");
       break;
 
+    case XERR_CORRUPT:
+      Uprintf( "\nToo many errors; transfer abandoned.\n");
+      break;
+
+    case XERR_WRITE:
+      Uprintf( "\nCould not write to the SD card.\n");
+      break;
+
+    case XERR_READ:
+      Uprintf( "\nCould not read the SD card.\n");
+      break;
+
     case XERR_SUCCESS:
        Uprintf( "\nFile transferred.\n");
        break;
@@ -248,8 +266,22 @@ void GetFile( char *args[])
       Uprintf( "\nUnknown error!\n");
       break;
   
-  } // case on result of send
+  } // case on result of transfer
   
+  return;
+} // ShowTransfer
+
+//*	GetFile - Get File via YMODEM.
+//	------------------------------
+//
+
+void GetFile( char *args[])
+{
+
+  (void) args;
+
+  Uprintf( "\nReady to receive ymodem...");
+  ShowTransfer( ReceiveYmodem(), false, NULL);
   return;
 } // GetFile
 
@@ -262,8 +294,6 @@ void GetFile( char *args[])
 void SendFile( char *args[])
 {
 
-  int yresult;
-
   if ( !args[0])
   { // no argument
     Uprintf( "Error - the file name must be specified.\n");
@@ -271,35 +301,190 @@ void SendFile( char *args[])
   }
   
   Uprintf( "\nReady to send ymodem %s...", args[0]);
-    
-  switch ( (yresult = SendYmodem( args[0]))  )
+  ShowTransfer( SendYmodem( args[0]), true, args[0]);
+  return;
+} // SendFile
+
+//*	ZGetFile - Get files via ZMODEM.
+//	--------------------------------
+//
+//	R = resume: carry on with any file we have the start of, as if
+//	the sender had asked to.
+//
+
+void ZGetFile( char *args[])
+{
+
+  bool
+    resume;
+
+  resume = args[0] && toupper( *args[0]) == 'R';
+  Uprintf( "\nReady to receive zmodem...");
+  ShowTransfer( ReceiveZmodem( resume), false, NULL);
+  return;
+} // ZGetFile
+
+//*	ZSendFile - Send files via ZMODEM.
+//	----------------------------------
+//
+//	R = resume: ask the receiver to carry on with what it has.
+//
+
+void ZSendFile( char *args[])
+{
+
+  bool
+    resume;
+
+  if ( !args[0])
+  { // no argument
+    Uprintf( "Error - the file name must be specified.\n");
+    return;
+  }
+
+  resume = args[1] && toupper( *args[1]) == 'R';
+  Uprintf( "\nReady to send zmodem %s...", args[0]);
+  ShowTransfer( SendZmodem( args[0], resume), true, args[0]);
+  return;
+} // ZSendFile
+
+//*	SDBench - Measure SD card throughput.
+//	-------------------------------------
+//
+//	Writes a scratch file of the given number of megabytes (4 if
+//	not given) in TAPE_BUFFER_SIZE pieces, reads it back and deletes
+//	it.  The rates are through FatFs, as an image copy would see them.
+//
+
+#define BENCH_FILE "SDBENCH.TMP"
+#define BENCH_DEFAULT_MB 4
+
+void SDBench( char *args[])
+{
+
+  FRESULT
+    fres;
+  FIL
+    tf;
+  UINT
+    count;
+  uint32_t
+    megabytes,
+    chunks,
+    i,
+    start,
+    writeTime,		// usec
+    readTime;
+
+  megabytes = args[0] ? atoi( args[0]) : 0;
+  if ( !megabytes)
+    megabytes = BENCH_DEFAULT_MB;
+  chunks = megabytes * ((1024 * 1024) / TAPE_BUFFER_SIZE);
+
+  disk_claim( TapeBuffer, TAPE_BUFFER_SIZE);	// card may still own it
+  for ( i = 0; i < TAPE_BUFFER_SIZE; i++)
+    TapeBuffer[ i] = (uint8_t) i;
+
+  if ( (fres = f_open( &tf, BENCH_FILE, FA_CREATE_ALWAYS | FA_WRITE)) != FR_OK)
   {
-  
-    case XERR_MOUNT_ERROR:
-      Uprintf( "\nCould not mount SD card files.\n");
-      break;
-    
-    case XERR_NO_FILE:
-      Uprintf( "\nFile %s not found.\n", args[0]);
-      break;
-    
-    case XERR_TIMEOUT:
-      Uprintf( "\nTime-out exceeded waiting for receiver.\n");
+    Uprintf( "\nError in creating file. Error = %d\n", fres);
+    return;
+  }
+  start = Microseconds();
+  for ( i = 0; i < chunks; i++)
+  {
+    if ( (fres = f_write( &tf, TapeBuffer, TAPE_BUFFER_SIZE, &count)) != FR_OK ||
+      count != TAPE_BUFFER_SIZE)
       break;
-    
-    case XERR_ABORT:
-      Uprintf( "\nTransfer cancelled.\n");
+  } // write the file
+  if ( fres == FR_OK)
+    fres = f_sync( &tf);
+  writeTime = Microseconds() - start;
+  f_close( &tf);
+  if ( fres != FR_OK || i != chunks)
+  {
+    Uprintf( "\nError writing file. Error = %d\n", fres);
+    f_unlink( BENCH_FILE);
+    return;
+  }
+
+  f_open( &tf, BENCH_FILE, FA_READ);
+  start = Microseconds();
+  for ( i = 0; i < chunks; i++)
+  {
+    if ( (fres = f_read( &tf, TapeBuffer, TAPE_BUFFER_SIZE, &count)) != FR_OK ||
+      count != TAPE_BUFFER_SIZE)
       break;
+  } // read it back
+  readTime = Microseconds() - start;
+  f_close( &tf);
+  f_unlink( BENCH_FILE);
+  if ( fres != FR_OK || i != chunks)
+  {
+    Uprintf( "\nError reading file. Error = %d\n", fres);
+    return;
+  }
 
-    case XERR_SUCCESS:
-       Uprintf( "\nFile transferred.\n");
-       break;
+  Uprintf( "\n%d MB, card bus at %d MHz\n", megabytes, SD_GetClock() / 1000);
+  Uprintf( "Write %d KB/sec, read %d KB/sec\n",
+    (uint32_t) ((uint64_t) megabytes * 1024 * 1000000 / (writeTime + 1)),
+    (uint32_t) ((uint64_t) megabytes * 1024 * 1000000 / (readTime + 1)));
+  return;
+} // SDBench
 
-    default:
-      Uprintf( "\nUnknown error!\n");
+//*	UsbDisk - Let the host have the card as a USB disk.
+//	---------------------------------------------------
+//
+//	FatFs lets go of the card and the USB device comes back with a
+//	mass storage interface (the console drops and returns while it
+//	does, so the terminal may need reconnecting).  The card is the
+//	host's until it ejects it, or ESC is typed here between
+//	commands; then the device goes back to how it was and the card
+//	is mounted again, since the host may have changed anything on
+//	it.  TapeBuffer holds the data on its way.
+//
+
+void UsbDisk( char *args[])
+{
+
+  LBA_t
+    sectors;
+  bool
+    ok;
+
+  (void) args;
+
+  if ( disk_ioctl( 0, GET_SECTOR_COUNT, &sectors) != RES_OK || !sectors)
+  {
+    Uprintf( "\nSD card not present\n");
+    return;
+  }
+
+  Uprintf( "\nThe card is a USB disk until the host ejects it or ESC"
+    " is hit.\n");
+  f_mount( 0, "", 0);
+  disk_claim( TapeBuffer, TAPE_BUFFER_SIZE);	// card may still own it
+  MscStart( TapeBuffer, TAPE_BUFFER_SIZE, sectors);
+  if ( !USDiskMode( true))
+  {
+    Uprintf( "\nNo USB disk on this console.\n");
+    MountSD( args);
+    return;
+  }
+
+  while ( !MscEjected())
+  {
+    MscService();
+    USDiskPoll();
+    if ( MscIdle() && Ucharavail() && Ugetchar() == '\e')
       break;
-  
-  } // case on result of send
-  
+  } // until the host's done
+
+  ok = MscStop();
+  USDiskMode( false);
+  if ( !ok)
+    Uprintf( "\nERROR writing the card.\n");
+  MountSD( args);
+  Uprintf( "\nThe card is back.\n");
   return;
-} // SendFile
+} // UsbDisk
@@ -0,0 +1,142 @@
+//*	Hot-path timing probes.
+//	-----------------------
+//
+//	The probes in the tape driver, the disk layer and the console
+//	(see hotstats.h) land here.  Each keeps a count, a total, the
+//	least and greatest times and a histogram by powers of two; the
+//	STATS command (tapeutil.c) takes them and starts over.
+//
+
+#ifdef HOT_STATS
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "license.h"
+
+#include "hotstats.h"
+
+#ifdef HOST
+#include "pertsim.h"
+#else
+#include <libopencm3/cm3/dwt.h>
+#endif
+
+static STAT_ENTRY
+  Stats[ STAT_PROBES];
+
+const char * const
+  StatNames[ STAT_PROBES] =
+{
+  "GO to IFBY",
+  "IFBY to IDBY",
+  "Tape byte",
+  "Tape motion",
+  "TapeRead",
+  "TapeWrite",
+  "Card read",
+  "Card write",
+  "SD commit",
+  "Console"
+};
+
+//	Prototypes.
+
+static void StatClear( void);
+
+//*	StatInit - Start the cycle counter.
+//	-----------------------------------
+//
+
+void StatInit( void)
+{
+
+#ifndef HOST
+  dwt_enable_cycle_counter();
+#endif
+  StatClear();
+  return;
+} // StatInit
+
+//*	StatCycles - Read the cycle counter.
+//	------------------------------------
+//
+//	It wraps every 25 seconds or so; the differences don't care.
+//
+
+uint32_t StatCycles( void)
+{
+
+#ifdef HOST
+  return (uint32_t) SimTime();
+#else
+  return dwt_read_cycle_counter();
+#endif
+} // StatCycles
+
+//*	StatAdd - Record a sample.
+//	--------------------------
+//
+//	Cycles spent on Units units of work; min, max and histogram
+//	go by the time per unit.
+//
+
+void StatAdd( STAT_PROBE Probe, uint32_t Cycles, uint32_t Units)
+{
+
+  STAT_ENTRY
+    *s;
+  uint32_t
+    each;			// time per unit
+  int
+    bucket;
+
+  if ( Units == 0)
+    return;
+  s = &Stats[ Probe];
+  each = Cycles / Units;
+  s->Count++;
+  s->Cycles += Cycles;
+  s->Units += Units;
+  if ( each < s->Min)
+    s->Min = each;
+  if ( each > s->Max)
+    s->Max = each;
+  bucket = each ? 32 - __builtin_clz( each) : 0;
+  s->Hist[ bucket < STAT_BUCKETS ? bucket : STAT_BUCKETS - 1]++;
+  return;
+} // StatAdd
+
+//*	StatTake - Copy the figures out and start over.
+//	-----------------------------------------------
+//
+//	Copy has room for STAT_PROBES entries.  Taking them first keeps
+//	the printing of them out of them.
+//
+
+void StatTake( STAT_ENTRY *Copy)
+{
+
+  memcpy( Copy, Stats, sizeof( Stats));
+  StatClear();
+  return;
+} // StatTake
+
+//	StatClear - Start over.
+//	-----------------------
+//
+
+static void StatClear( void)
+{
+
+  int
+    i;
+
+  memset( Stats, 0, sizeof( Stats));
+  for ( i = 0; i < STAT_PROBES; i++)
+    Stats[ i].Min = UINT32_MAX;
+  return;
+} // StatClear
+
+#endif
@@ -21,6 +21,7 @@
 #include "tapedriver.h"
 #include "filedef.h"
 #include "dbserial.h"
+#include "hotstats.h"
 
 // Private function prototypes
 
@@ -114,6 +115,12 @@ static void Init( void)
   
   Uprintf( "\nTape I/O initialized.\n"); 
 
+//  Start the cycle counter if the timing probes are built in.
+
+#ifdef HOT_STATS
+  StatInit();
+#endif
+
 //  Initialize the UART if serial debugging..
 
 #ifdef SERIAL_DEBUG
@@ -150,6 +150,28 @@ void sys_tick_handler( void)
   }
 } // sys_tick_handler
 
+//  Microseconds - Time since boot, in microseconds.
+//  ------------------------------------------------
+//
+//  The millisecond count plus however far SysTick has counted down
+//  since.  Wraps after about 71 minutes; good for intervals only.
+//
+
+uint32_t Microseconds( void)
+{
+
+  uint32_t
+    ms,
+    ticks;
+
+  do
+  {
+    ms = Milliseconds;
+    ticks = systick_get_value();
+  } while ( ms != Milliseconds);	// tick in between; again
+  return ms * 1000 + (168000 - ticks) / 168;
+} // Microseconds
+
 //	SetupSysTick - Configure System Timer.
 //	---------------------------------------
 //
@@ -0,0 +1,945 @@
+//*	USB mass storage: bulk-only transport and SCSI commands.
+//	--------------------------------------------------------
+//
+//	Presents the SD card to the host as a disk, one LUN, through
+//	the disk I/O layer FatFs uses, so transfers get the same
+//	multi-sector DMA and the same write stream.  See mscbot.h for
+//	how the transport drives it.
+//
+//	The buffer given to MscStart is split into two chunks of whole
+//	sectors.  For a READ, the foreground fills one chunk from the
+//	card while the transport sends the other; when the command's
+//	sectors have all been read, the sectors after them are read
+//	into the free chunk, so that a host reading straight through
+//	gets its next command's first chunk at once.  For a WRITE, the
+//	transport fills one chunk while the other goes to the card.
+//
+//	Writes are write-behind, as they are for FatFs: a chunk is the
+//	card's until the next command claims it back, and a write that
+//	fails is reported by the command after.  MODE SENSE says so by
+//	reporting a write cache, so the host sends SYNCHRONIZE CACHE
+//	before it lets go of the disk, and that waits for the card.
+//
+//	Only the handful of commands hosts actually use are done; the
+//	rest get ILLEGAL REQUEST.
+//
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "license.h"
+
+#include "ff.h"
+#include "diskio.h"
+#include "mscbot.h"
+
+//  Command and status wrappers.
+
+#define CBW_SIGNATURE	0x43425355	// "USBC"
+#define CSW_SIGNATURE	0x53425355	// "USBS"
+#define CBW_LENGTH	31
+#define CSW_LENGTH	13
+#define CBW_DIR_IN	0x80		// bmCBWFlags: data to the host
+#define CBW_CB		15		// command block within the CBW
+
+#define CSW_PASSED	0
+#define CSW_FAILED	1
+#define CSW_PHASE_ERROR	2
+
+//  SCSI operation codes.
+
+#define SCSI_TEST_UNIT_READY	0x00
+#define SCSI_REQUEST_SENSE	0x03
+#define SCSI_INQUIRY		0x12
+#define SCSI_MODE_SENSE_6	0x1A
+#define SCSI_START_STOP_UNIT	0x1B
+#define SCSI_PREVENT_ALLOW	0x1E
+#define SCSI_READ_FORMAT_CAPS	0x23
+#define SCSI_READ_CAPACITY_10	0x25
+#define SCSI_READ_10		0x28
+#define SCSI_WRITE_10		0x2A
+#define SCSI_VERIFY_10		0x2F
+#define SCSI_SYNC_CACHE_10	0x35
+#define SCSI_MODE_SENSE_10	0x5A
+
+//  Sense keys and additional sense codes.
+
+#define SENSE_NONE		0x00
+#define SENSE_NOT_READY		0x02
+#define SENSE_MEDIUM_ERROR	0x03
+#define SENSE_ILLEGAL_REQUEST	0x05
+
+#define ASC_NONE		0x00
+#define ASC_WRITE_ERROR		0x0C
+#define ASC_READ_ERROR		0x11
+#define ASC_INVALID_COMMAND	0x20
+#define ASC_LBA_OUT_OF_RANGE	0x21
+#define ASC_MEDIUM_NOT_PRESENT	0x3A
+
+#define MODE_PAGE_CACHING	0x08
+#define MODE_PAGE_ALL		0x3F
+#define CACHING_PAGE_LENGTH	20
+#define CACHING_WCE		0x04	// write cache enabled
+
+//  Where the transport is.
+
+typedef enum
+{
+  PHASE_CBW,				// waiting for a command
+  PHASE_COMMAND,			// have one; foreground's turn
+  PHASE_DATA_IN,			// data to the host
+  PHASE_DATA_OUT,			// data from the host
+  PHASE_CSW				// status waiting to go
+} MSC_PHASE;
+
+//  What a chunk holds.  A free chunk may also hold the read-ahead.
+
+typedef enum
+{
+  CHUNK_FREE,
+  CHUNK_FULL,				// data for the other side
+  CHUNK_WRITING				// the card's until claimed
+} CHUNK_STATE;
+
+static uint8_t
+  *Chunk[ 2];
+static uint32_t
+  ChunkSize;				// bytes, whole sectors
+static volatile uint32_t
+  ChunkLength[ 2];			// bytes in a full chunk
+static volatile CHUNK_STATE
+  ChunkState[ 2];
+
+//  The transport's side: the chunk it's sending or filling, and
+//  where in it.  The foreground's side: the chunk the card fills or
+//  empties next.  Both sides take the chunks in turn, so between
+//  commands they point at the same one.
+
+static int
+  UsbChunk,
+  CardChunk,
+  Pending;				// chunk the card's writing, or -1
+static uint32_t
+  UsbOffset;
+
+static volatile MSC_PHASE
+  Phase;
+static volatile bool
+  ResetRequest,				// host reset; foreground to do
+  ZlpDue,				// end a short IN with a ZLP
+  Discard;				// OUT data isn't wanted
+static volatile uint32_t
+  DataLeft;				// data phase bytes yet to move
+static volatile uint8_t
+  Status;				// for the CSW
+
+static uint8_t
+  Cbw[ CBW_LENGTH],
+  Csw[ CSW_LENGTH];
+static uint32_t
+  Tag,					// host's, from the CBW
+  Expected,				// host's data length
+  Moved;				// what we meant to move
+
+static uint32_t
+  Sectors,				// card size
+  Lba,					// next sector for the card
+  Blocks;				// sectors left for the card
+
+static bool
+  AheadWanted,				// read ahead when a chunk's free
+  AheadValid;				// CardChunk holds the read-ahead
+static uint32_t
+  AheadLba,
+  AheadCount;
+
+static uint8_t
+  SenseKey,
+  SenseCode;
+static bool
+  Ejected;
+
+//  Prototypes.
+
+static void Command( void);
+static void NoData( void);
+static void Fail( uint8_t Key, uint8_t Code);
+static void SetSense( uint8_t Key, uint8_t Code);
+static uint8_t *ReplyBuffer( void);
+static void Reply( uint32_t Length, uint32_t Allocation);
+static uint32_t ModeSense( uint8_t *Buf, uint8_t Page, uint32_t Header);
+static void Transfer( bool In, uint32_t Start, uint32_t Count);
+static void ReadChunk( void);
+static void ReadAhead( void);
+static void WriteChunk( void);
+static void ClaimPending( void);
+static void Finish( void);
+static void DoReset( void);
+static uint32_t GetLE32( const uint8_t *Where);
+static void PutLE32( uint8_t *Where, uint32_t What);
+static uint32_t GetBE32( const uint8_t *Where);
+static uint32_t GetBE16( const uint8_t *Where);
+static void PutBE32( uint8_t *Where, uint32_t What);
+
+//*	MscStart - Get ready to serve the card.
+//	---------------------------------------
+//
+//	Buffer (Size bytes, word-aligned for the DMA) is ours until
+//	MscStop; the card has Count sectors.
+//
+
+void MscStart( uint8_t *Buffer, uint32_t Size, uint32_t Count)
+{
+
+  ChunkSize = (Size / 2) & ~(uint32_t) (MSC_SECTOR_SIZE - 1);
+  Chunk[ 0] = Buffer;
+  Chunk[ 1] = Buffer + ChunkSize;
+  Sectors = Count;
+  Ejected = false;
+  SetSense( SENSE_NONE, ASC_NONE);
+  Pending = -1;
+  ResetRequest = true;
+  DoReset();
+  return;
+} // MscStart
+
+//*	MscStop - Finish with the card.
+//	-------------------------------
+//
+//	Waits for any write in progress and closes the write stream.
+//	Returns false if the card reports a write that failed.
+//
+
+bool MscStop( void)
+{
+
+  ClaimPending();
+  return disk_ioctl( 0, CTRL_SYNC, NULL) == RES_OK;
+} // MscStop
+
+//*	MscReset - Bulk-only mass storage reset.
+//	----------------------------------------
+//
+//	From the control request; the foreground drops whatever
+//	command was in progress and goes back to waiting for a CBW.
+//	Nothing moves until it has.
+//
+
+void MscReset( void)
+{
+
+  ResetRequest = true;
+  return;
+} // MscReset
+
+//*	MscReceive - Take an OUT packet.
+//	--------------------------------
+//
+//	Either a CBW or data for a WRITE.  A CBW that isn't one is
+//	ignored.
+//
+
+void MscReceive( const uint8_t *Packet, int Length)
+{
+
+  uint32_t
+    count;
+
+  if ( ResetRequest || Length <= 0)
+    return;
+
+  switch( Phase)
+  {
+    case PHASE_CBW:
+      if ( Length == CBW_LENGTH && GetLE32( Packet) == CBW_SIGNATURE)
+      {
+        memcpy( Cbw, Packet, CBW_LENGTH);
+        Phase = PHASE_COMMAND;
+      }
+      break;
+
+    case PHASE_DATA_OUT:
+      count = (uint32_t) Length;
+      if ( count > DataLeft)
+        count = DataLeft;
+      if ( !Discard)
+      {
+        memcpy( Chunk[ UsbChunk] + UsbOffset, Packet, count);
+        UsbOffset += count;
+        if ( UsbOffset == ChunkSize || count == DataLeft)
+        {
+          ChunkLength[ UsbChunk] = UsbOffset;
+          ChunkState[ UsbChunk] = CHUNK_FULL;
+          UsbChunk ^= 1;
+          UsbOffset = 0;
+        }
+      } // if keeping it
+      DataLeft -= count;
+      if ( Discard && DataLeft == 0)
+        Finish();
+      break;
+
+    default:
+      break;			// not expecting anything
+  } // switch
+  return;
+} // MscReceive
+
+//*	MscCanReceive - Is there room for another OUT packet?
+//	-----------------------------------------------------
+//
+
+bool MscCanReceive( void)
+{
+
+  if ( ResetRequest)
+    return false;
+  if ( Phase == PHASE_CBW)
+    return true;
+  return Phase == PHASE_DATA_OUT &&
+    (Discard || ChunkState[ UsbChunk] == CHUNK_FREE);
+} // MscCanReceive
+
+//*	MscTransmit - Next IN packet.
+//	-----------------------------
+//
+//	Fills Packet (MSC_PACKET_SIZE bytes) and returns its length,
+//	which may be zero, or returns -1 if there's nothing to send yet.
+//
+
+int MscTransmit( uint8_t *Packet)
+{
+
+  uint32_t
+    count;
+
+  if ( ResetRequest)
+    return -1;
+
+  if ( Phase == PHASE_CSW)
+  {
+    memcpy( Packet, Csw, CSW_LENGTH);
+    Phase = PHASE_CBW;		// the next CBW may beat the completion
+    return CSW_LENGTH;
+  }
+  if ( Phase != PHASE_DATA_IN)
+    return -1;
+
+  if ( ZlpDue)
+  {
+    ZlpDue = false;
+    Finish();
+    return 0;
+  }
+  if ( ChunkState[ UsbChunk] != CHUNK_FULL)
+    return -1;			// card's still at it
+
+  count = ChunkLength[ UsbChunk] - UsbOffset;
+  if ( count > MSC_PACKET_SIZE)
+    count = MSC_PACKET_SIZE;
+  memcpy( Packet, Chunk[ UsbChunk] + UsbOffset, count);
+  UsbOffset += count;
+  if ( UsbOffset == ChunkLength[ UsbChunk])
+  {
+    ChunkState[ UsbChunk] = CHUNK_FREE;
+    UsbChunk ^= 1;
+    UsbOffset = 0;
+  }
+  DataLeft -= count;
+
+//  Less than the host asked for, ending on a full packet, needs a
+//  zero-length packet to tell it so.
+
+  if ( DataLeft == 0)
+  {
+    if ( Moved < Expected && count == MSC_PACKET_SIZE)
+      ZlpDue = true;
+    else
+      Finish();
+  }
+  return (int) count;
+} // MscTransmit
+
+//*	MscService - Foreground work.
+//	-----------------------------
+//
+//	Call as often as possible: runs commands and keeps the card
+//	busy.
+//
+
+void MscService( void)
+{
+
+  if ( ResetRequest)
+    DoReset();
+
+  switch( Phase)
+  {
+    case PHASE_COMMAND:
+      Command();
+      break;
+
+    case PHASE_DATA_IN:
+      if ( Blocks)
+        ReadChunk();
+      else
+        ReadAhead();
+      break;
+
+    case PHASE_DATA_OUT:
+      if ( !Discard)
+        WriteChunk();
+      break;
+
+    default:
+      ReadAhead();
+      break;
+  } // switch
+  return;
+} // MscService
+
+//*	MscIdle - Between commands?
+//	---------------------------
+//
+
+bool MscIdle( void)
+{
+
+  return Phase == PHASE_CBW && !ResetRequest;
+} // MscIdle
+
+//*	MscEjected - Has the host ejected the disk?
+//	-------------------------------------------
+//
+
+bool MscEjected( void)
+{
+
+  return Ejected;
+} // MscEjected
+
+//	Command - Carry out a CBW.
+//	--------------------------
+//
+
+static void Command( void)
+{
+
+  const uint8_t
+    *cb;
+  uint8_t
+    *buf;
+  uint32_t
+    length;
+
+  ClaimPending();
+  AheadWanted = false;
+  cb = Cbw + CBW_CB;
+  Tag = GetLE32( Cbw + 4);
+  Expected = GetLE32( Cbw + 8);
+  Moved = 0;
+  Status = CSW_PASSED;
+  Discard = false;
+  ZlpDue = false;
+
+  if ( cb[0] != SCSI_REQUEST_SENSE)
+    SetSense( SENSE_NONE, ASC_NONE);
+  if ( Ejected && cb[0] != SCSI_REQUEST_SENSE && cb[0] != SCSI_INQUIRY)
+  {
+    Fail( SENSE_NOT_READY, ASC_MEDIUM_NOT_PRESENT);
+    return;
+  }
+
+  switch( cb[0])
+  {
+    case SCSI_TEST_UNIT_READY:
+    case SCSI_PREVENT_ALLOW:
+    case SCSI_VERIFY_10:
+      NoData();
+      break;
+
+    case SCSI_REQUEST_SENSE:
+      buf = ReplyBuffer();
+      memset( buf, 0, 18);
+      buf[0] = 0x70;			// current error, fixed format
+      buf[2] = SenseKey;
+      buf[7] = 10;			// additional length
+      buf[12] = SenseCode;
+      SetSense( SENSE_NONE, ASC_NONE);
+      Reply( 18, cb[4]);
+      break;
+
+    case SCSI_INQUIRY:
+      buf = ReplyBuffer();
+      memset( buf, 0, 36);
+      buf[1] = 0x80;			// removable
+      buf[2] = 0x02;			// SPC-2
+      buf[3] = 0x02;			// response format
+      buf[4] = 36 - 5;			// additional length
+      memcpy( buf + 8, "Pertec  ", 8);
+      memcpy( buf + 16, "Tape Ctlr SD    ", 16);
+      memcpy( buf + 32, "1.0 ", 4);
+      Reply( 36, GetBE16( cb + 3));
+      break;
+
+    case SCSI_MODE_SENSE_6:
+      buf = ReplyBuffer();
+      length = ModeSense( buf, cb[2] & 0x3F, 4);
+      buf[0] = (uint8_t) (length - 1);
+      Reply( length, cb[4]);
+      break;
+
+    case SCSI_MODE_SENSE_10:
+      buf = ReplyBuffer();
+      length = ModeSense( buf, cb[2] & 0x3F, 8);
+      buf[1] = (uint8_t) (length - 2);
+      Reply( length, GetBE16( cb + 7));
+      break;
+
+    case SCSI_START_STOP_UNIT:
+      if ( (cb[4] & 0x03) == 0x02)	// LoEj set, Start clear
+      {
+        if ( disk_ioctl( 0, CTRL_SYNC, NULL) != RES_OK)
+        {
+          Fail( SENSE_MEDIUM_ERROR, ASC_WRITE_ERROR);
+          break;
+        }
+        Ejected = true;
+      }
+      NoData();
+      break;
+
+    case SCSI_READ_FORMAT_CAPS:
+      buf = ReplyBuffer();
+      memset( buf, 0, 12);
+      buf[3] = 8;			// capacity list length
+      PutBE32( buf + 4, Sectors);
+      buf[8] = 0x02;			// formatted media
+      buf[10] = MSC_SECTOR_SIZE >> 8;
+      Reply( 12, GetBE16( cb + 7));
+      break;
+
+    case SCSI_READ_CAPACITY_10:
+      buf = ReplyBuffer();
+      PutBE32( buf, Sectors - 1);	// last sector
+      PutBE32( buf + 4, MSC_SECTOR_SIZE);
+      Reply( 8, 8);
+      break;
+
+    case SCSI_READ_10:
+    case SCSI_WRITE_10:
+      Transfer( cb[0] == SCSI_READ_10, GetBE32( cb + 2), GetBE16( cb + 7));
+      break;
+
+    case SCSI_SYNC_CACHE_10:
+      if ( disk_ioctl( 0, CTRL_SYNC, NULL) != RES_OK)
+        Fail( SENSE_MEDIUM_ERROR, ASC_WRITE_ERROR);
+      else
+        NoData();
+      break;
+
+    default:
+      Fail( SENSE_ILLEGAL_REQUEST, ASC_INVALID_COMMAND);
+      break;
+  } // switch
+  return;
+} // Command
+
+//	NoData - End a command that moves no data.
+//	------------------------------------------
+//
+//	If the host expected some anyway, a zero-length packet ends an
+//	IN transfer and OUT data is taken and thrown away; the CSW's
+//	residue tells it nothing moved.
+//
+
+static void NoData( void)
+{
+
+  if ( Expected == 0)
+    Finish();
+  else if ( Cbw[12] & CBW_DIR_IN)
+  {
+    DataLeft = 0;
+    ZlpDue = true;
+    Phase = PHASE_DATA_IN;
+  }
+  else
+  {
+    DataLeft = Expected;
+    Discard = true;
+    Phase = PHASE_DATA_OUT;
+  }
+  return;
+} // NoData
+
+//	Fail - End a command with CHECK CONDITION.
+//	------------------------------------------
+//
+
+static void Fail( uint8_t Key, uint8_t Code)
+{
+
+  SetSense( Key, Code);
+  Status = CSW_FAILED;
+  NoData();
+  return;
+} // Fail
+
+//	SetSense - Set what the next REQUEST SENSE reports.
+//	---------------------------------------------------
+//
+
+static void SetSense( uint8_t Key, uint8_t Code)
+{
+
+  SenseKey = Key;
+  SenseCode = Code;
+  return;
+} // SetSense
+
+//	ReplyBuffer - Where to build a short reply.
+//	-------------------------------------------
+//
+//	The chunk the transport sends next; any read-ahead in it goes.
+//
+
+static uint8_t *ReplyBuffer( void)
+{
+
+  AheadValid = false;
+  return Chunk[ CardChunk];
+} // ReplyBuffer
+
+//	Reply - Send a reply built in ReplyBuffer.
+//	------------------------------------------
+//
+//	No more than the host's allocation length, or its transfer
+//	length, whichever is less.  If the host means to send data
+//	instead, that's a phase error.
+//
+
+static void Reply( uint32_t Length, uint32_t Allocation)
+{
+
+  if ( Length > Allocation)
+    Length = Allocation;
+  if ( Length > Expected)
+    Length = Expected;
+
+  if ( Expected && !(Cbw[12] & CBW_DIR_IN))
+  {
+    Status = CSW_PHASE_ERROR;
+    Length = 0;
+  }
+  if ( Length == 0)
+  {
+    NoData();
+    return;
+  }
+
+  ChunkLength[ CardChunk] = Length;
+  ChunkState[ CardChunk] = CHUNK_FULL;
+  CardChunk ^= 1;
+  Moved = DataLeft = Length;
+  Phase = PHASE_DATA_IN;
+  return;
+} // Reply
+
+//	ModeSense - Build MODE SENSE data.
+//	----------------------------------
+//
+//	Header bytes of Header, no block descriptors, and the caching
+//	page if it's asked for.  Returns the length; the caller sets the
+//	mode data length.
+//
+
+static uint32_t ModeSense( uint8_t *Buf, uint8_t Page, uint32_t Header)
+{
+
+  uint8_t
+    *page;
+
+  memset( Buf, 0, Header + CACHING_PAGE_LENGTH);
+  if ( Page != MODE_PAGE_CACHING && Page != MODE_PAGE_ALL)
+    return Header;
+
+  page = Buf + Header;
+  page[0] = MODE_PAGE_CACHING;
+  page[1] = CACHING_PAGE_LENGTH - 2;
+  page[2] = CACHING_WCE;
+  return Header + CACHING_PAGE_LENGTH;
+} // ModeSense
+
+//	Transfer - Start a READ or WRITE.
+//	---------------------------------
+//
+//	The host's transfer length and direction have to agree with the
+//	command's; if they don't, it's a phase error and nothing moves.
+//
+
+static void Transfer( bool In, uint32_t Start, uint32_t Count)
+{
+
+  uint32_t
+    count;
+
+  if ( Start >= Sectors || Count > Sectors - Start)
+  {
+    Fail( SENSE_ILLEGAL_REQUEST, ASC_LBA_OUT_OF_RANGE);
+    return;
+  }
+  if ( Expected != Count * MSC_SECTOR_SIZE ||
+    (Expected && In != ((Cbw[12] & CBW_DIR_IN) != 0)))
+  {
+    Status = CSW_PHASE_ERROR;
+    NoData();
+    return;
+  }
+  if ( Count == 0)
+  {
+    Finish();
+    return;
+  }
+
+  Lba = Start;
+  Blocks = Count;
+  Moved = DataLeft = Expected;
+
+  if ( !In)
+  {
+    AheadValid = false;
+    Phase = PHASE_DATA_OUT;
+    return;
+  }
+
+//  A read picking up where the last left off has its first chunk
+//  already.
+
+  if ( AheadValid && AheadLba == Start)
+  {
+    count = (AheadCount < Count) ? AheadCount : Count;
+    ChunkLength[ CardChunk] = count * MSC_SECTOR_SIZE;
+    ChunkState[ CardChunk] = CHUNK_FULL;
+    CardChunk ^= 1;
+    Lba += count;
+    Blocks -= count;
+  }
+  AheadValid = false;
+  Phase = PHASE_DATA_IN;
+  ReadChunk();
+  return;
+} // Transfer
+
+//	ReadChunk - Read the next chunk of a READ from the card.
+//	--------------------------------------------------------
+//
+//	If the card fails, the host gets zeros and a failed status.
+//
+
+static void ReadChunk( void)
+{
+
+  uint32_t
+    count;
+  uint8_t
+    *buf;
+
+  if ( !Blocks || ChunkState[ CardChunk] != CHUNK_FREE)
+    return;
+
+  count = ChunkSize / MSC_SECTOR_SIZE;
+  if ( count > Blocks)
+    count = Blocks;
+  buf = Chunk[ CardChunk];
+  if ( disk_read( 0, buf, Lba, count) != RES_OK)
+  {
+    memset( buf, 0, count * MSC_SECTOR_SIZE);
+    if ( Status == CSW_PASSED)
+    {
+      SetSense( SENSE_MEDIUM_ERROR, ASC_READ_ERROR);
+      Status = CSW_FAILED;
+    }
+  }
+  Lba += count;
+  Blocks -= count;
+  ChunkLength[ CardChunk] = count * MSC_SECTOR_SIZE;
+  ChunkState[ CardChunk] = CHUNK_FULL;
+  CardChunk ^= 1;
+  if ( !Blocks)
+    AheadWanted = true;
+  return;
+} // ReadChunk
+
+//	ReadAhead - Read past the end of the last READ.
+//	-----------------------------------------------
+//
+//	Once the chunk is free--the transport has sent what was in it.
+//	It stays free, as far as the transport's concerned; the next
+//	READ takes it if it starts in the right place.
+//
+
+static void ReadAhead( void)
+{
+
+  uint32_t
+    count;
+
+  if ( !AheadWanted || ChunkState[ CardChunk] != CHUNK_FREE)
+    return;
+
+  AheadWanted = false;
+  if ( Lba >= Sectors)
+    return;
+  count = ChunkSize / MSC_SECTOR_SIZE;
+  if ( count > Sectors - Lba)
+    count = Sectors - Lba;
+  if ( disk_read( 0, Chunk[ CardChunk], Lba, count) != RES_OK)
+    return;
+  AheadLba = Lba;
+  AheadCount = count;
+  AheadValid = true;
+  return;
+} // ReadAhead
+
+//	WriteChunk - Send a full chunk of a WRITE to the card.
+//	------------------------------------------------------
+//
+//	The write is started and left going; the chunk before it is
+//	claimed back for the transport.  The CSW goes as soon as the
+//	last chunk is started.  After a failure the rest of the data
+//	is taken but not written.
+//
+
+static void WriteChunk( void)
+{
+
+  uint32_t
+    count;
+
+  if ( ChunkState[ CardChunk] != CHUNK_FULL)
+    return;
+
+  count = ChunkLength[ CardChunk] / MSC_SECTOR_SIZE;
+  if ( Status == CSW_PASSED)
+  {
+    if ( disk_write( 0, Chunk[ CardChunk], Lba, count) == RES_OK)
+    {
+      ClaimPending();
+      Pending = CardChunk;
+      ChunkState[ CardChunk] = CHUNK_WRITING;
+    }
+    else
+    {
+      SetSense( SENSE_MEDIUM_ERROR, ASC_WRITE_ERROR);
+      Status = CSW_FAILED;
+    }
+  } // if all's well so far
+  if ( ChunkState[ CardChunk] == CHUNK_FULL)
+    ChunkState[ CardChunk] = CHUNK_FREE;
+  Lba += count;
+  Blocks -= count;
+  CardChunk ^= 1;
+  if ( !Blocks)
+    Finish();
+  return;
+} // WriteChunk
+
+//	ClaimPending - Take back the chunk the card's writing from.
+//	-----------------------------------------------------------
+//
+
+static void ClaimPending( void)
+{
+
+  if ( Pending < 0)
+    return;
+  disk_claim( Chunk[ Pending], ChunkSize);
+  ChunkState[ Pending] = CHUNK_FREE;
+  Pending = -1;
+  return;
+} // ClaimPending
+
+//	Finish - Queue the CSW.
+//	-----------------------
+//
+//	The residue is whatever of the host's length we didn't mean to
+//	move.
+//
+
+static void Finish( void)
+{
+
+  PutLE32( Csw, CSW_SIGNATURE);
+  PutLE32( Csw + 4, Tag);
+  PutLE32( Csw + 8, Expected - Moved);
+  Csw[12] = Status;
+  Phase = PHASE_CSW;
+  return;
+} // Finish
+
+//	DoReset - Back to waiting for a CBW.
+//	------------------------------------
+//
+
+static void DoReset( void)
+{
+
+  ClaimPending();
+  ChunkState[0] = ChunkState[1] = CHUNK_FREE;
+  UsbChunk = CardChunk = 0;
+  UsbOffset = 0;
+  Blocks = 0;
+  DataLeft = 0;
+  ZlpDue = Discard = false;
+  AheadWanted = AheadValid = false;
+  Phase = PHASE_CBW;
+  ResetRequest = false;
+  return;
+} // DoReset
+
+//	Byte order helpers.  The wrappers are little-endian, SCSI is
+//	big-endian.
+//	------------------------------------------------------------
+//
+
+static uint32_t GetLE32( const uint8_t *Where)
+{
+
+  return Where[0] | (Where[1] << 8) | (Where[2] << 16) |
+    ((uint32_t) Where[3] << 24);
+} // GetLE32
+
+static void PutLE32( uint8_t *Where, uint32_t What)
+{
+
+  Where[0] = (uint8_t) What;
+  Where[1] = (uint8_t) (What >> 8);
+  Where[2] = (uint8_t) (What >> 16);
+  Where[3] = (uint8_t) (What >> 24);
+  return;
+} // PutLE32
+
+static uint32_t GetBE32( const uint8_t *Where)
+{
+
+  return ((uint32_t) Where[0] << 24) | (Where[1] << 16) |
+    (Where[2] << 8) | Where[3];
+} // GetBE32
+
+static uint32_t GetBE16( const uint8_t *Where)
+{
+
+  return (Where[0] << 8) | Where[1];
+} // GetBE16
+
+static void PutBE32( uint8_t *Where, uint32_t What)
+{
+
+  Where[0] = (uint8_t) (What >> 24);
+  Where[1] = (uint8_t) (What >> 16);
+  Where[2] = (uint8_t) (What >> 8);
+  Where[3] = (uint8_t) What;
+  return;
+} // PutBE32
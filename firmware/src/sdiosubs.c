@@ -8,6 +8,7 @@
 #include "comm.h"
 #include "sdiosubs.h"
 #include "sdcard.h"
+#include "hotstats.h"
 
 //*	Routines for STM32F4 SDIO Support
 //	----------------------------------
@@ -28,6 +29,23 @@
 #define DATA_READ_TIMEOUT  (24000*5)
 #define DATA_WRITE_TIMEOUT (24000*250)
 
+//  SDIO clock, KHz: 24 MHz is SDIOCLK/2 for default speed; in High
+//  Speed mode, the divider is bypassed for the full 48 MHz.  The
+//  data timer runs off this clock, so it's set for 500 msec of it.
+
+#define CLOCK_DEFAULT_KHZ   24000
+#define CLOCK_HIGH_KHZ      48000
+#define DATA_TIMER_MSEC     500
+
+//  CMD6 (SWITCH_FUNC) arguments: check or set function group 1 to
+//  High Speed, leaving the other groups alone.  The card answers with
+//  a 64-byte status block; byte 13 bit 1 says High Speed is supported
+//  and the low 4 bits of byte 16 are the function now selected.
+
+#define SWITCH_CHECK_HS     0x00FFFFF1
+#define SWITCH_SET_HS       0x80FFFFF1
+#define SWITCH_STATUS_SIZE  64
+
 //  The following macro is a no-op currently, but should eventually
 //  be a timeout check.
 
@@ -101,15 +119,29 @@ static uint32_t
 static bool
   GPIOInitialized = false;  // used to check if SD_LowLevel_Init has been called
 
+static bool
+  HighSpeed = false;        // card switched to High Speed, bus at 48 MHz
+static uint32_t
+  DataTimeout = CLOCK_DEFAULT_KHZ * DATA_TIMER_MSEC;  // data timer, clocks
+
 static enum 
 {
   XFER_INACTIVE = 0,        // no transfer
   XFER_READING_SINGLE,      // read single block
   XFER_READING_MULTI,       // read multiple block
   XFER_WRITING_SINGLE,      // write single block
-  XFER_WRITING_MULTI        // write multiple block
+  XFER_WRITING_MULTI,       // write multiple block
+  XFER_WRITING_STREAM       // write a chunk of an open stream
 } TransferPending;
 
+//  Write stream state.  While a stream is open, the card is still in
+//  the CMD25 issued to open it, waiting for sector StreamNext.
+
+static bool
+  StreamOpen = false;       // open-ended CMD25 in progress
+static uint32_t
+  StreamNext;               // next sector the stream will write
+
 //  Prototypes.
 
 static SD_ERROR TestSDStatus( void);
@@ -117,6 +149,9 @@ static void SD_GPIO_Init(void);
 static int SD_Command( uint8_t Command, uint32_t Arg);
 static void SD_BeginTransfer(void *Buf, uint32_t Count, DMA_DIRECTION Dir);
 static void SD_StopMultiWrite( void); 
+static void SD_CloseStream( void);
+static bool SD_SwitchFunction( uint32_t Arg, uint8_t *Status);
+static bool SD_SetHighSpeed( void);
 
 //  TestSDStatus - Preliminary check for SD Status.
 //  -----------------------------------------------
@@ -158,12 +193,13 @@ static void SD_GPIO_Init(void)
   rcc_periph_clock_enable( RCC_SDIO);
   
 //  Setup GPIO pins.  Note that PC8-PC11 are DIO 0-3, PC12 = SD clock
-//  PD2 is command.
+//  PD2 is command.  At 48 MHz in High Speed mode the pins need the
+//  50 MHz drive; 25 MHz edges are too slow for that clock.
 
   rcc_periph_clock_enable( RCC_GPIOC);
 
-  gpio_set_output_options (GPIOC, GPIO_OTYPE_PP, GPIO_OSPEED_25MHZ, GPIO12);
-  gpio_set_output_options (GPIOC, GPIO_OTYPE_PP, GPIO_OSPEED_25MHZ,
+  gpio_set_output_options (GPIOC, GPIO_OTYPE_PP, GPIO_OSPEED_50MHZ, GPIO12);
+  gpio_set_output_options (GPIOC, GPIO_OTYPE_PP, GPIO_OSPEED_50MHZ,
                            GPIO8 | GPIO9 | GPIO10 | GPIO11);
   gpio_mode_setup (GPIOC, GPIO_MODE_AF, GPIO_PUPD_PULLUP,
                    GPIO8 | GPIO9 | GPIO10 | GPIO11);
@@ -171,7 +207,7 @@ static void SD_GPIO_Init(void)
   gpio_set_af (GPIOC, GPIO_AF12, GPIO8 | GPIO9 | GPIO10 | GPIO11 | GPIO12);
   gpio_set_af (GPIOD, GPIO_AF12, GPIO2);
 
-  gpio_set_output_options (GPIOD, GPIO_OTYPE_PP, GPIO_OSPEED_25MHZ, GPIO2);
+  gpio_set_output_options (GPIOD, GPIO_OTYPE_PP, GPIO_OSPEED_50MHZ, GPIO2);
   gpio_mode_setup (GPIOD, GPIO_MODE_AF, GPIO_PUPD_PULLUP, GPIO2);
   GPIOInitialized = true;     // say we did it
   TransferPending = false;    // kill any pending transfer
@@ -196,6 +232,9 @@ void SD_Reset(bool Power)
   rcc_peripheral_reset(&RCC_APB2RSTR, RCC_APB2RSTR_SDIORST);
   rcc_peripheral_clear_reset(&RCC_APB2RSTR, RCC_APB2RSTR_SDIORST);
   TransferPending = XFER_INACTIVE;     // cancel any transfers not finished
+  StreamOpen = false;                  // and any open write stream
+  HighSpeed = false;                   // card's back to default speed
+  DataTimeout = CLOCK_DEFAULT_KHZ * DATA_TIMER_MSEC;
 
 //  We re-apply power to the card only if requested.
 
@@ -286,7 +325,8 @@ static int SD_Command( uint8_t Command, uint32_t Arg)
 //  SD_Init - Initialize card
 //  -------------------------
 //
-//  When we complete, we'll have a 4 bit, 25MHz clock set up.
+//  When we complete, we'll have a 4 bit bus at 48 MHz if the card
+//  will do High Speed, otherwise at 24 MHz.
 //  Returns status value.
 //
 
@@ -302,6 +342,10 @@ SD_ERROR SD_Init(void)
 
   if ( !GPIOInitialized)
     SD_GPIO_Init();
+
+//  Let a write still in progress finish first.
+
+  SD_StreamClose();
   CardSize = 0;                         // say card is uninitialized
 
 //  Initialize the SDIO (with ~400Khz clock in 1 b-t mode) (48MHz / 120)
@@ -430,6 +474,17 @@ SD_ERROR SD_Init(void)
 //  Set the SDIO controller to 24 MHz (as close as we can get to 25).
  
      SDIO_CLKCR = (SDIO_CLKCR_WIDBUS_4 | SDIO_CLKCR_CLKEN);  // 4 bit Bus Width;
+
+//  If the card will switch to High Speed, bypass the clock divider
+//  for 48 MHz (as close as we can get to 50).  If not, we stay put.
+
+    if ( SD_SetHighSpeed())
+    {
+      HighSpeed = true;
+      DataTimeout = CLOCK_HIGH_KHZ * DATA_TIMER_MSEC;
+      SDIO_CLKCR = (SDIO_CLKCR_WIDBUS_4 | SDIO_CLKCR_BYPASS | 
+                    SDIO_CLKCR_CLKEN);
+    } // if High Speed
   }
   END
 
@@ -455,6 +510,100 @@ uint32_t SD_GetCardSize( void)
 
 } // SD_GetCardSize
 
+//  SD_GetClock - Return the bus clock.
+//  -----------------------------------
+//
+//    Returns the SDIO clock in KHz, or 0 if there's no card.
+//
+
+uint32_t SD_GetClock( void)
+{
+
+  if ( !CardSize)
+    return 0;
+  return HighSpeed ? CLOCK_HIGH_KHZ : CLOCK_DEFAULT_KHZ;
+} // SD_GetClock
+
+//  SD_SetHighSpeed - Switch the card to High Speed.
+//  ------------------------------------------------
+//
+//    Checks that the card supports it, then asks for it.  Returns
+//    true if the card has switched; it takes effect by the end of
+//    the status block, so the caller can speed up the clock at once.
+//
+
+static bool SD_SetHighSpeed( void)
+{
+
+  uint32_t
+    status[ SWITCH_STATUS_SIZE / 4];    // aligned for the FIFO
+  uint8_t
+    *bytes;
+
+  bytes = (uint8_t *) status;
+  if ( !SD_SwitchFunction( SWITCH_CHECK_HS, bytes) || !(bytes[13] & 0x02))
+    return false;                       // no High Speed here
+  if ( !SD_SwitchFunction( SWITCH_SET_HS, bytes))
+    return false;
+  return (bytes[16] & 0x0F) == 1;       // function 1 selected?
+} // SD_SetHighSpeed
+
+//  SD_SwitchFunction - Issue CMD6 and read the status block.
+//  ---------------------------------------------------------
+//
+//    The 64 bytes are read from the FIFO by hand--it's short and
+//    only done at initialization.  Returns false if the command or
+//    the data fails.
+//
+
+static bool SD_SwitchFunction( uint32_t Arg, uint8_t *Status)
+{
+
+  uint32_t
+    *words,
+    sta;
+  int
+    count;
+
+  SDIO_MASK = 0;                        // no interrupts for this
+  SDIO_ICR = SDIO_STA_MASK;
+  SDIO_DTIMER = DataTimeout;
+  SDIO_DLEN = SWITCH_STATUS_SIZE;
+  SDIO_DCTRL = SDIO_DCTRL_DBLOCKSIZE_6 |  // one 64 byte block
+               SDIO_DCTRL_DTEN |
+               SDIO_DCTRL_DTDIR;          // card to us
+
+  if ( SD_Command( SD_CMD_SWITCH_FUNC, Arg))
+  {
+    SDIO_DCTRL = 0;
+    return false;
+  }
+
+  words = (uint32_t *) Status;
+  count = 0;
+  while ( true)
+  {
+    sta = SDIO_STA;
+    if ( sta & (SDIO_STA_DCRCFAIL | SDIO_STA_DTIMEOUT | 
+                SDIO_STA_RXOVERR | SDIO_STA_STBITERR))
+    {
+      SDIO_ICR = SDIO_STA_MASK;
+      return false;
+    }
+    if ( sta & SDIO_STA_RXDAVL)
+    {
+      if ( count < SWITCH_STATUS_SIZE / 4)
+        words[ count++] = SDIO_FIFO;
+      else
+        (void) SDIO_FIFO;               // shouldn't be any more
+    }
+    else if ( sta & SDIO_STA_DATAEND)
+      break;
+  } // while reading the block
+  SDIO_ICR = SDIO_STA_MASK;
+  return count == SWITCH_STATUS_SIZE / 4;
+} // SD_SwitchFunction
+
 //  SD_WriteBlocks - Write blocks to SD.
 //  ------------------------------------
 //
@@ -482,10 +631,9 @@ SD_ERROR SD_WriteBlocks( void *Buf, uint32_t Sector, uint32_t Count)
   if (SDType != SD_TYPE_HIGH_CAPACITY)
     Sector *= SD_SECTOR_SIZE;   // V1 cards use byte offset
 
-//  If we have a transfer pending, clear it.
+//  If we have a transfer pending or a stream open, clear it.
 
-  if (TransferPending != XFER_INACTIVE)
-    SD_WaitComplete();
+  SD_StreamClose();
 
 //  Set block length.
 
@@ -537,10 +685,9 @@ SD_ERROR SD_ReadBlocks( void *Buf, uint32_t Sector, uint32_t Count)
   if (SDType != SD_TYPE_HIGH_CAPACITY)
     Sector *= SD_SECTOR_SIZE;   // convert everything to byte offset
 
-//  If we have a transfer pending, clear it.
+//  If we have a transfer pending or a stream open, clear it.
 
-  if (TransferPending)
-    SD_WaitComplete();
+  SD_StreamClose();
 
 //  Inform the card of our sector size.
 
@@ -559,6 +706,79 @@ SD_ERROR SD_ReadBlocks( void *Buf, uint32_t Sector, uint32_t Count)
   return SD_ERR_SUCCESS;
  
 } //  SD_ReadBlocks
+
+//  SD_StreamWrite - Write blocks as part of a sequential stream.
+//  -------------------------------------------------------------
+//
+//  Like SD_WriteBlocks, but the CMD25 is left open-ended (no ACMD23
+//  block count) and is not stopped when the data is done.  If the next
+//  call picks up at the sector where this one left off, its data just
+//  follows on under the same command--all it costs is setting up the
+//  DMA and the data path again.  Any other sector closes the stream
+//  (CMD12 and a wait for the card to finish programming) and opens a
+//  new one there.
+//
+//  Reads, SD_WriteBlocks and SD_Init close the stream themselves;
+//  otherwise, call SD_StreamClose when the data must be safely on the
+//  card.  As with SD_WriteBlocks, the caller must wait for the data
+//  with SD_WaitComplete before touching the buffer.
+//
+
+SD_ERROR SD_StreamWrite( void *Buf, uint32_t Sector, uint32_t Count)
+{
+
+  SD_ERROR
+    errStat;              // error status
+
+  if ( (errStat = TestSDStatus()) != SD_ERR_SUCCESS)
+    return errStat;       // if not ready for transfer
+
+  if ( IS_MISALIGNED( Buf))
+    return SD_ERR_MISALIGNED;   // whoops, misaligned buffer.
+
+  if ( Count == 0)
+    return SD_ERR_SUCCESS;      // write nothing always succeeds
+
+  if ( Count > MAX_TRANSFER_SIZE)
+    return SD_ERR_PARAMETER;    // argument out of range
+
+//  Let the last chunk's data finish.  An error there closes the
+//  stream, so we'll start a new one below.
+
+  if (TransferPending != XFER_INACTIVE)
+    SD_WaitComplete();
+
+  if ( !StreamOpen || Sector != StreamNext)
+  { // open a new stream
+    SD_StreamClose();
+    SD_Command( SD_CMD_BLKLEN, SD_SECTOR_SIZE);
+    if ( SD_Command( SD_CMD_WRITE_MULTI,
+                      (SDType != SD_TYPE_HIGH_CAPACITY) ?
+                        Sector * SD_SECTOR_SIZE : Sector))
+      return SD_ERR_NO_CARD;
+    StreamOpen = true;
+  } // new stream
+
+  SD_BeginTransfer(Buf, Count, DMA_MEMORY_TO_SD);
+  TransferPending = XFER_WRITING_STREAM;
+  StreamNext = Sector + Count;
+  return SD_ERR_SUCCESS;
+} // SD_StreamWrite
+
+//  SD_StreamClose - Close any open write stream.
+//  ---------------------------------------------
+//
+//  Waits for any transfer in progress, then stops an open stream and
+//  waits for the card to finish programming.
+//
+
+void SD_StreamClose( void)
+{
+
+  if (TransferPending != XFER_INACTIVE)
+    SD_WaitComplete();
+  SD_CloseStream();
+} // SD_StreamClose
  
 //  SD_BeginTransfer - Set up DMA transfer.
 //  ---------------------------------------
@@ -632,7 +852,7 @@ static void SD_BeginTransfer(void *Buf, uint32_t Count, DMA_DIRECTION Dir)
 
 // Set the timer to 500 msec..
 
-  SDIO_DTIMER = 12000000;    
+  SDIO_DTIMER = DataTimeout;
     
 //  Set the total number of bytes to be moved.
 
@@ -686,8 +906,11 @@ static void SD_BeginTransfer(void *Buf, uint32_t Count, DMA_DIRECTION Dir)
 SD_ERROR SD_WaitComplete( void)
 {
 
+  STAT_TIMER( start);
+
   if ( TransferPending == XFER_INACTIVE)
     return SD_ERR_SUCCESS;		// if nothing happening just quti
+  STAT_MARK( start);
 
 //  Wait for the transfer to be complete.
 
@@ -697,6 +920,19 @@ SD_ERROR SD_WaitComplete( void)
 
   while( ErrorStatus == SD_ERR_BUSY) NULLOP;
 
+//  A stream stays open for the next chunk unless this one failed.
+//  DATAEND comes only after the card has released its busy signal on
+//  the last block, so the data path is free to be set up again.
+
+  if (TransferPending == XFER_WRITING_STREAM)
+  {
+    TransferPending = XFER_INACTIVE;
+    if ( ErrorStatus != SD_ERR_SUCCESS)
+      SD_CloseStream();
+    STAT_SINCE( STAT_SD_COMMIT, start);
+    return ErrorStatus;
+  } // stream chunk done
+
 // and then wait for the card to idle.
 
   if (TransferPending == XFER_WRITING_MULTI)
@@ -704,6 +940,7 @@ SD_ERROR SD_WaitComplete( void)
   else
     SD_Command( SD_CMD_STOP_TRANS, 0);
   TransferPending = XFER_INACTIVE;
+  STAT_SINCE( STAT_SD_COMMIT, start);
   return ErrorStatus;
 } // SD_WaitComplete
 
@@ -724,12 +961,30 @@ static void SD_StopMultiWrite( void)
   while (!((SDIO_RESP1 >> 8) & SD_R1_IDLE) ) 
   { // wait for things to settle down.
 
-//  Issue SEND_STATUS
+//  Issue SEND_STATUS; give up if the card's gone (a stream can be
+//  left open across a card change).
 
-     SD_Command(SD_CMD_SEND_STATUS, RCA << 16);
+     if ( SD_Command(SD_CMD_SEND_STATUS, RCA << 16))
+       break;
   }  // Wait for a response
 } // SD_StopMultiWrite
 
+//*	SD_CloseStream - End an open write stream.
+//	------------------------------------------
+//
+//	No data may be moving.
+//
+
+static void SD_CloseStream( void)
+{
+
+  if ( StreamOpen)
+  {
+    StreamOpen = false;
+    SD_StopMultiWrite();
+  }
+} // SD_CloseStream
+
 //**	SD and DMA Interrupt Servicing.
 //	===============================
 
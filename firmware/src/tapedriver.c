@@ -7,35 +7,137 @@
 #include <ctype.h>
 #include <string.h>
 
-// MCU-specific definitions.
-
-#include <libopencm3/stm32/rcc.h>
-#include <libopencm3/stm32/gpio.h>
-#include <libopencm3/cm3/systick.h>
-#include <libopencm3/cm3/nvic.h>
-#include <libopencm3/stm32/timer.h>
-
 #include "license.h"
 
 // Local definitions.
 
 #include "comm.h"
-#include "gpiodef.h"
-#include "miscsubs.h"
+#include "pertport.h"
 #include "globals.h"
 #include "tapedriver.h"
 #include "pertbits.h"
 #include "filedef.h"
+#include "tapexfer.h"
+#include "hotstats.h"
+
+//  Deadlines for the states of an operation, in msec.
+
+#define TAPE_GO_MSEC	1000		// GO to formatter busy
+#define TAPE_BLOCK_MSEC	30000		// a block, or blank tape
+#define TAPE_SPACE_MSEC	1800000		// a file; a reel is 20 min at 25 ips
+#define TAPE_REWIND_MSEC 600000		// rewinding a reel
+
+//  The status shadow: the last status TapeStatus read, and when.
+//  TapeStatusRecent answers from it while it's younger than
+//  STATUS_FRESH_CYCLES, no command has gone out since and no
+//  operation is under way.  Changes in the bits under STATUS_EDGE_MASK
+//  go in the change log as TapeStatus finds them; the strobes and
+//  parity come and go with every byte.
+
+#define STATUS_FRESH_CYCLES (168 * 500)	// half a millisecond at 168 MHz
+#define STATUS_EDGE_MASK \
+  ((uint16_t) ~(PS0_IRP | PS0_RDAVAIL | PS0_WREMPTY))
+
+//  SPEED_AUTO reads at high speed while the reads come back to back:
+//  the last one ended no more than SPEED_STREAM_MSEC before this one
+//  starts.  A streaming drive at high speed only has the gap to wait
+//  for the next command before it has to back up; a read that comes
+//  later is start/stop work, which low speed does without
+//  repositioning--unless the blocks are long.  From SPEED_LONG_BLOCK
+//  up, even at 1600 bpi, what high speed saves on the block pays for
+//  a reposition.
+
+#define SPEED_STREAM_MSEC 2
+#define SPEED_LONG_BLOCK 16384
+
+//  What the operation in progress is.
+
+typedef enum
+{
+  OP_READ,
+  OP_WRITE,
+  OP_MOTION,			// skip or space
+  OP_REWIND
+} TAPE_OP;
 
 //  Static variables used here.
 
 uint16_t
   LastCommand;			// last written contents of command register.
 
+static uint8_t
+  *ReadBuf;			// read in progress: buffer
+static int
+  ReadBuflen;			// ... and its length
+static uint8_t
+  *WriteBuf;			// write in progress: buffer
+static int
+  WriteBuflen;			// ... and its length
+static TAPE_TIMING
+  BlockTiming;			// how the polled engine kept up
+static TAPE_SPEED
+  OpSpeed;			// what speed the operation asked and got
+static uint32_t
+  ReadEndMsec;			// when the last read ended
+static int
+  ReadEndCount;			// ... and how long its block was
+static bool
+  ReadLast;			// ... and nothing has been done since
+static TAPE_STATE
+  OpState;			// operation in progress: how far along
+static TAPE_OP
+  OpKind;			// ... what it is
+static unsigned int
+  OpStatus;			// ... and, once done, how it went
+static int
+  OpCount;			// bytes read
+static uint32_t
+  OpDeadline,			// PertMsec by which this state must end
+  OpLimit;			// ... and how long a state may take
+static bool
+  OpSeen,			// interrupt write: data phase seen
+  OpFed,			// ... every byte handed over
+  OpStalled;			// polled data phase overran the deadline
+static uint16_t
+  StatusShadow;			// last status read
+static uint32_t
+  ShadowCycles;			// ... when
+static bool
+  ShadowGood;			// ... and nothing sent since
+static TAPE_EDGE
+  Edges[ TAPE_EDGE_LOG];	// status changes, a ring
+static int
+  EdgeNext,			// ... where the next one goes
+  EdgeCount;			// ... and how many it holds
+#ifdef HOT_STATS
+static uint32_t
+  PhaseStart;			// timing probes: when this phase began
+#endif
+
 //  Prototypes.
 
-static unsigned int TapeMotion( uint16_t Command);
+static void StartOp( TAPE_OP Kind, uint32_t Limit);
+static void SetState( TAPE_STATE State);
+static bool Overdue( void);
+static void EndOp( unsigned int Status);
+static void Abandon( void);
+static unsigned int StartMotion( uint16_t Command, uint32_t Limit);
+static void PollMotion( void);
+static void PollRead( void);
+static bool ReadDataBegun( void);
+static bool ReadGone( void);
+static void EndRead( int Count, uint8_t Stat);
+static void PollWrite( void);
 static void AckTapeTransfer( void);
+static int ReadBlockPolled( uint8_t *Buf, int Buflen, uint8_t *Stat);
+static bool ReadBlockDMA( uint8_t *Buf, int *Count, uint8_t *Stat);
+static void WriteBlockPolled( uint8_t *Buf, int Buflen);
+static bool WriteBlockIRQ( int Buflen);
+static void AssertLastWord( void);
+static void InvertBuffer( uint8_t *Buf, int Count);
+static void SetTiming( uint32_t Worst, uint32_t Span, int Count);
+static void NoteEdge( uint16_t Status);
+static uint16_t SpeedSelect( TAPE_OP Kind);
 
 //	TapeStatus - Read 16 bit status.
 //	--------------------------------
@@ -43,7 +145,8 @@ static void AckTapeTransfer( void);
 //	Status 1 in bits 15-8
 //	Status 0 in bits 7-0
 //
-//	Returns the positive tape status;
+//	Returns the positive tape status; it's kept as the status shadow,
+//	and any change logged.
 //
 
 uint16_t TapeStatus( void)
@@ -51,23 +154,75 @@ uint16_t TapeStatus( void)
 
   uint16_t res;		// result
   uint8_t ss0, ss1;
+  uint32_t now;
 
 //  Do things twice here to delay a bit.
 
-  gpio_clear( PCTRL_GPIO, PCTRL_SSEL);
-  gpio_clear( PCTRL_GPIO, PCTRL_SSEL);
-  ss0 = (gpio_port_read( PSTAT_GPIO) >> 8);
-  ss0 = (gpio_port_read( PSTAT_GPIO) >> 8);
-  gpio_set( PCTRL_GPIO, PCTRL_SSEL); 
-  gpio_set( PCTRL_GPIO, PCTRL_SSEL); 
-  ss1 = (gpio_port_read( PSTAT_GPIO) >> 8);
-  ss1 = (gpio_port_read( PSTAT_GPIO) >> 8);
-
-  res = ss0 | (ss1 << 8);
-   
-  return res ^ 0xffff;
+  PertCtrlClear( PCTRL_SSEL);
+  PertCtrlClear( PCTRL_SSEL);
+  ss0 = PertStatus();
+  ss0 = PertStatus();
+  PertCtrlSet( PCTRL_SSEL); 
+  PertCtrlSet( PCTRL_SSEL); 
+  ss1 = PertStatus();
+  ss1 = PertStatus();
+
+  res = (ss0 | (ss1 << 8)) ^ 0xffff;
+  now = PertCycles();
+  if ( (res ^ StatusShadow) & STATUS_EDGE_MASK)
+    NoteEdge( res);
+  StatusShadow = res;
+  ShadowCycles = now;
+  ShadowGood = true;
+  return res;
 } // TapeStatus
 
+//	TapeStatusRecent - Tape status, from the shadow if it's fresh.
+//	--------------------------------------------------------------
+//
+//	For the status tests between operations, which would otherwise
+//	each take a full status cycle.  While an operation is under way,
+//	or once a command has been sent, it reads the status afresh.
+//
+//	This is only a cache, not a status kept current in the
+//	background.  Only TapeStatus refreshes it, and it's trusted for
+//	STATUS_FRESH_CYCLES, so all it saves is the repeat reads of a
+//	burst of tests, such as IsTapeOnline then IsTapeProtected before
+//	a write.  A change of status goes unseen for no longer than that.
+//
+
+uint16_t TapeStatusRecent( void)
+{
+
+  if ( ShadowGood && (OpState == TAPE_IDLE || OpState == TAPE_DONE) &&
+    PertCycles() - ShadowCycles < STATUS_FRESH_CYCLES)
+    return StatusShadow;
+  return TapeStatus();
+} // TapeStatusRecent
+
+//	TapeEdges - Copy out the status changes and start over.
+//	-------------------------------------------------------
+//
+//	Copy has room for TAPE_EDGE_LOG; they come oldest first.  Returns
+//	how many there were.  Each is stamped with the status read that
+//	found it, which may be long after the line changed: nothing reads
+//	the status between operations.
+//
+
+int TapeEdges( TAPE_EDGE *Copy)
+{
+
+  int
+    i,
+    count;
+
+  count = EdgeCount;
+  for ( i = 0; i < count; i++)
+    Copy[ i] = Edges[ (EdgeNext - count + i + TAPE_EDGE_LOG) % TAPE_EDGE_LOG];
+  EdgeCount = 0;
+  return count;
+} // TapeEdges
+
 //	Initialzie tape interface.
 //	---------------------------
 //
@@ -77,59 +232,255 @@ void TapeInit( void)
 
 // issue a transfer acknowledge
 
-  gpio_clear( PCTRL_GPIO, PCTRL_TACK);
-  Delay(1);
-  gpio_set( PCTRL_GPIO, PCTRL_TACK);            // ack the transfer
+  PertCtrlClear( PCTRL_TACK);
+  PertDelay(1);
+  PertCtrlSet( PCTRL_TACK);            // ack the transfer
   TapeAddress = 0;				// default address
   StopTapemarks = 2;				// default tape mark stop
   StopAfterError = false;			// if stop after error
+  TapeXferMode = XFER_DMA;			// hardware transfers
+  TapeSpeed = SPEED_AUTO;			// pick by operation
+  ReadLast = false;				// no read to follow
+  XferInit();
+  PertCyclesStart();		// the polled engine times itself
   
 //  Set the command bits high.
 
-  gpio_set( PCMD_GPIO, PCMD_BIT);	// set all bits to one
-  gpio_clear( PCTRL_GPIO, PCTRL_CSEL0);
-  Delay(1);
-  gpio_set( PCTRL_GPIO, PCTRL_CSEL0);	// latch it in
-  Delay(1);  
-  gpio_clear( PCTRL_GPIO, PCTRL_CSEL1);
-  Delay(1);
-  gpio_set( PCTRL_GPIO, PCTRL_CSEL1);	// latch it in
+  PertCmdSet( PCMD_BIT);	// set all bits to one
+  PertCtrlClear( PCTRL_CSEL0);
+  PertDelay(1);
+  PertCtrlSet( PCTRL_CSEL0);	// latch it in
+  PertDelay(1);  
+  PertCtrlClear( PCTRL_CSEL1);
+  PertDelay(1);
+  PertCtrlSet( PCTRL_CSEL1);	// latch it in
   LastCommand = 0;			// remember this
 
 //  Now enable the command output.
 
-  gpio_clear( PCTRL_GPIO, PCTRL_ENA);	// and there we go...
+  PertCtrlClear( PCTRL_ENA);	// and there we go...
 
 } // TapeInit
 
+//*	Operations in progress.
+//	=======================
+//
+//	Every tape operation is begun by one of the TapeStart routines and
+//	moved along by TapePoll, which looks at the formatter, takes any
+//	step that's due and says where things stand.  Once it says
+//	TAPE_DONE, TapeResult has the status.  Between calls the caller
+//	is free to get on with something else--the card, the host, the
+//	console.  With the DMA engine that goes for the data phase too;
+//	with the polled engine the CPU is the data path, so the call
+//	that finds the data phase runs all of it.
+//
+//	Each state has a deadline.  It's checked only after the formatter
+//	has been looked at, so a caller that was away a long time doesn't
+//	time out something that finished meanwhile.  Past it, the command
+//	is dropped, the engine stopped and the result is TSTAT_TIMEOUT.
+//
+//	TapeRead, TapeRewind and the rest are a start and TapeWait.
+
+//	StartOp - Set up for an operation.
+//	----------------------------------
+//
+//	Limit is how long any state after the first may take.  The GO
+//	itself is the caller's, right after this.
+//
+
+static void StartOp( TAPE_OP Kind, uint32_t Limit)
+{
+
+  OpKind = Kind;
+  OpLimit = Limit;
+  OpStatus = TSTAT_NOERR;
+  OpCount = 0;
+  OpSeen = OpFed = OpStalled = false;
+  STAT_MARK( PhaseStart);
+  SetState( TAPE_GO);
+  return;
+} // StartOp
+
+//	SetState - Move to a new state, with a new deadline.
+//	----------------------------------------------------
+//
+
+static void SetState( TAPE_STATE State)
+{
+
+  OpState = State;
+  OpDeadline = PertMsec() + (State == TAPE_GO ? TAPE_GO_MSEC : OpLimit);
+  return;
+} // SetState
+
+//	Overdue - Has the current state run past its deadline?
+//	------------------------------------------------------
+//
+
+static bool Overdue( void)
+{
+  return (int32_t) (PertMsec() - OpDeadline) > 0;
+} // Overdue
+
+//	EndOp - Finish an operation with Status.
+//	----------------------------------------
+//
+
+static void EndOp( unsigned int Status)
+{
+
+  OpStatus = Status;
+  OpState = TAPE_DONE;
+  return;
+} // EndOp
+
+//	Abandon - Give up on an operation that's past its deadline.
+//	-----------------------------------------------------------
+//
+//	Stops the engine, if it's running, and drops the command.
+//
+
+static void Abandon( void)
+{
+
+  if ( TapeXferMode == XFER_DMA)
+  {
+    if ( OpKind == OP_READ)
+      XferReadStop();
+    else if ( OpKind == OP_WRITE)
+      XferWriteStop();
+  } // if DMA
+  IssueTapeCommand( 0);
+  EndOp( TSTAT_TIMEOUT);
+  return;
+} // Abandon
+
+//*	TapePoll - Move the operation in progress along.
+//	------------------------------------------------
+//
+//	Returns its state; TAPE_DONE means TapeResult has the outcome.
+//
+
+TAPE_STATE TapePoll( void)
+{
+
+  if ( OpState == TAPE_IDLE || OpState == TAPE_DONE)
+    return OpState;
+
+  switch( OpKind)
+  {
+    case OP_READ:
+      PollRead();
+      break;
+
+    case OP_WRITE:
+      PollWrite();
+      break;
+
+    case OP_MOTION:
+      PollMotion();
+      break;
+
+    case OP_REWIND:
+      if ( !(TapeStatus() & PS1_IRWD))
+        EndOp( TSTAT_NOERR);		// rewound
+      break;
+  } // switch
+
+  if ( OpState != TAPE_DONE && Overdue())
+    Abandon();
+  return OpState;
+} // TapePoll
+
+//*	TapeResult - Status of the finished operation.
+//	----------------------------------------------
+//
+//	Call once TapePoll has said TAPE_DONE; returns the TSTAT status
+//	and, for a read, the count in *BytesRead (if BytesRead isn't
+//	NULL), and leaves the driver idle.  Before then, there's nothing
+//	to report: the result is TSTAT_NOERR and a zero count.
+//
+
+unsigned int TapeResult( int *BytesRead)
+{
+
+  unsigned int
+    status;
+
+  if ( BytesRead)
+    *BytesRead = 0;
+  if ( OpState != TAPE_DONE)
+    return TSTAT_NOERR;
+
+  if ( BytesRead)
+    *BytesRead = OpCount;
+  status = OpStatus;
+  OpState = TAPE_IDLE;
+  return status;
+} // TapeResult
+
+//*	TapeWait - Poll the operation in progress to the end.
+//	-----------------------------------------------------
+//
+//	Returns TapeResult's status and count; with nothing in progress,
+//	TSTAT_NOERR.
+//
+
+unsigned int TapeWait( int *BytesRead)
+{
+
+  while( OpState != TAPE_IDLE && TapePoll() != TAPE_DONE)
+    ;
+  return TapeResult( BytesRead);
+} // TapeWait
+
 //*	Rewind and Unload - No data phase.
 //	==================================
 
-//	TapeRewind - Rewind tape.
-//	------------------------
+//	TapeStartRewind - Start a rewind.
+//	---------------------------------
+//
+//	At load point already, it's done at once.
 //
 
-unsigned int TapeRewind( void)
+unsigned int TapeStartRewind( void)
 {
 
   uint16_t
     stat;
 
-  
-  if (!IsTapeOnline())
+  stat = TapeStatusRecent();
+  if ( !(stat & PS1_IRDY))
     return TSTAT_OFFLINE;		// not online
 
-  stat = TapeStatus();		// See what gives
+  StartOp( OP_REWIND, TAPE_REWIND_MSEC);
   if ( stat & PS1_ILDP)
-    return TSTAT_NOERR;			// already at loadpoint
+  {
+    EndOp( TSTAT_NOERR);		// already at loadpoint
+    return TSTAT_NOERR;
+  }
 
 //	Issue rewind command.
 
   IssueTapeCommand( PC_IREW);		// assert rewind
   IssueTapeCommand( 0);			// null commnad
-  
-  while( TapeStatus() & PS1_IRWD);	// let tape rewind
+  SetState( TAPE_REWINDING);
   return TSTAT_NOERR;
+} // TapeStartRewind
+
+//	TapeRewind - Rewind tape.
+//	------------------------
+//
+
+unsigned int TapeRewind( void)
+{
+
+  unsigned int
+    status;
+
+  if ( (status = TapeStartRewind()) != TSTAT_NOERR)
+    return status;
+  return TapeWait( NULL);			// let tape rewind
 } // TapeRewind
 
 //*	TapeUnload - Unload tape.
@@ -138,7 +489,7 @@ unsigned int TapeRewind( void)
 
 unsigned int TapeUnload( void)
 {
-  
+
   if (!IsTapeOnline())
     return TSTAT_OFFLINE;		// not online
 
@@ -146,65 +497,100 @@ unsigned int TapeUnload( void)
 
   IssueTapeCommand( PC_IRWU);		// assert rewind
   IssueTapeCommand( 0);			// null commnad
-  
+
   return TSTAT_NOERR;
 } // TapeUnload
 
 //**	Motion functions--no data transfer.
 //	===================================
 
+//	StartMotion - Issue a motion command.
+//	-------------------------------------
+//
+//	Limit is how long any one state may last.  Returns once the
+//	formatter has gone busy, which it does within microseconds of
+//	GO: a short motion could otherwise start and finish before the
+//	first poll, and look like a formatter that never answered.
+//
 
-static unsigned int TapeMotion( uint16_t Command)
+static unsigned int StartMotion( uint16_t Command, uint32_t Limit)
 {
 
-  unsigned int
-    retStatus;
-  uint16_t  
-    status;
-
   if ( !IsTapeOnline())
     return TSTAT_OFFLINE;	// return if offline
 
+  StartOp( OP_MOTION, Limit);
+  Command |= SpeedSelect( OP_MOTION);
   IssueTapeCommand( PC_IGO | Command);	// assert go+command
-  Delay(2);
+  PertDelay(2);
   IssueTapeCommand( Command);		// release it
+  while ( TapePoll() == TAPE_GO)
+    ;
+  return TSTAT_NOERR;
+} // StartMotion
 
-//  Wait for IFBY to go active, then active IDBY.
+//	PollMotion - One step of a motion command.
+//	------------------------------------------
+//
+//	Formatter busy, then data busy while the tape moves, then both
+//	drop.  Once the formatter has gone busy, its dropping busy is
+//	the end, whatever we saw in between: the caller may have been
+//	away for the whole data phase.  How it went comes from the
+//	status then--tapemark, hard error, EOT--and a drive that's no
+//	longer ready means it went offline on the way.  The states in
+//	between only time the phases.
+//
 
-  while( true)
-  {
-    status = TapeStatus();
-    if ( status & PS1_IFBY)
-      break;
-  }  // wait for formatter busy
+static void PollMotion( void)
+{
 
-//	Okay, we have the formatter acknowledging the command, now wait
-//	for the data phase.  If formatter busy drope while waiting, we
-//	bombed.
-  
-  do
-  {
-    status = TapeStatus();
-    if ( !(status & PS1_IFBY))
-    {
-      return TSTAT_OFFLINE;		// tape dropped ready
-    }
+  unsigned int
+    retStatus;
+  uint16_t
+    status;
 
-  } while( (status & PS0_IDBY) == 0);	// wait for data phase
+  status = TapeStatus();
+  switch( OpState)
+  {
+    case TAPE_GO:
+      if ( status & PS1_IFBY)
+      {
+        OpSpeed.Ran = (status & PS0_ISPEED) != 0;
+        STAT_SINCE( STAT_GO_IFBY, PhaseStart);
+        STAT_MARK( PhaseStart);
+        SetState( TAPE_WAIT_DATA);
+      }
+      return;
+
+    case TAPE_WAIT_DATA:
+      if ( !(status & PS1_IFBY))
+        break;				// over, data phase seen or not
+      if ( status & PS0_IDBY)
+      {
+        STAT_SINCE( STAT_IFBY_IDBY, PhaseStart);
+        SetState( TAPE_DATA);
+      }
+      return;
 
-//	Kill time while data busy is set.  
+//	Kill time while data busy is set.
 
-  do
-  {
-    status = TapeStatus();
-  } while ( status & PS0_IDBY);
+    case TAPE_DATA:
+      if ( !(status & PS1_IFBY))
+        break;				// over
+      if ( !(status & PS0_IDBY))
+        SetState( TAPE_WAIT_END);
+      return;
 
 //	Wait for formatter busy to drop.
 
-  do
-  {
-    status = TapeStatus();
-  } while ( status & PS1_IFBY);
+    case TAPE_WAIT_END:
+      if ( status & PS1_IFBY)
+        return;
+      break;
+
+    default:
+      return;
+  } // switch
 
   retStatus = TSTAT_NOERR;
 
@@ -213,12 +599,34 @@ static unsigned int TapeMotion( uint16_t Command)
 
   if ( (status & PS0_IHER))
     retStatus |= TSTAT_HARDERR;		// signal hard error
-  
+
   if ( status & PS1_EOT)
     retStatus |= TSTAT_EOT;		// say end of tape
-    
-  return retStatus;			// all done  
-} // TapeMotion
+
+  if ( !(status & PS1_IRDY))
+    retStatus |= TSTAT_OFFLINE;		// tape dropped ready
+
+  EndOp( retStatus);			// all done
+  return;
+} // PollMotion
+
+//*	TapeStartSkip - Start skipping a block forward or backward.
+//	-----------------------------------------------------------
+//
+//	Sign of argument determines direction.
+//
+
+unsigned int TapeStartSkip( int Dir)
+{
+
+  uint16_t  			// tape status
+    tCommand;			// command we're sending
+
+  tCommand = PC_IERASE;
+  if ( Dir < 0)
+    tCommand |= PC_IREV;
+  return StartMotion( tCommand, TAPE_BLOCK_MSEC);
+} // TapeStartSkip
 
 //*	SkipBlock - Skip one block forward or backward.
 //	-----------------------------------------------
@@ -233,17 +641,32 @@ unsigned int SkipBlock( int Dir)
 
   unsigned int
     status;
-  uint16_t  			// tape status
-    tCommand;			// command we're sending
+  STAT_TIMER( start);
 
-  tCommand = PC_IERASE;
-  if ( Dir < 0)
-    tCommand |= PC_IREV;
-    
-  status = TapeMotion( tCommand);	// issue it
+  STAT_MARK( start);
+  if ( (status = TapeStartSkip( Dir)) == TSTAT_NOERR)
+    status = TapeWait( NULL);
+  STAT_SINCE( STAT_MOTION, start);
   return status;			// all done--successful
 } // SkipBlock
 
+//*	TapeStartSpace - Start spacing a file forward or backward.
+//	----------------------------------------------------------
+//
+//	The argument is + for forward, - for backward.
+//
+
+unsigned int TapeStartSpace( int Dir)
+{
+
+  uint16_t
+    tCommand;			// command we're sending
+
+  tCommand = PC_IWFM;		// space with data
+  if ( Dir < 0)
+    tCommand |= PC_IREV;
+  return StartMotion( tCommand, TAPE_SPACE_MSEC);
+} // TapeStartSpace
 
 //*	SpaceFile - Space filemarks forware or backward.
 //	------------------------------------------------
@@ -256,15 +679,12 @@ unsigned int SpaceFile( int Dir)
 
   unsigned int
     status;
+  STAT_TIMER( start);
 
-  uint16_t
-    tCommand;			// command we're sending
-
-  tCommand = PC_IWFM;		// space with data
-  if ( Dir < 0)
-    tCommand |= PC_IREV;
-    
-  status = TapeMotion( tCommand);	// issue it
+  STAT_MARK( start);
+  if ( (status = TapeStartSpace( Dir)) == TSTAT_NOERR)
+    status = TapeWait( NULL);
+  STAT_SINCE( STAT_MOTION, start);
   return status;			// all done
 } // SpaceFile
 
@@ -279,6 +699,7 @@ unsigned int SpaceFile( int Dir)
 //	Returns the size of the block read and the status.
 //
 //	Status can be a combination of any of these:
+//		TSTAT_TIMEOUT	- Formatter stopped answering
 //		TSTAT_OFFLINE 	- Drive is offline
 //		TSTAT_HARDERR 	- Formatter detected a hard error
 //		TSTAT_CORRERR 	- Formatter corrected an error
@@ -296,118 +717,356 @@ unsigned int TapeRead( uint8_t *Buf, int Buflen, int *BytesRead)
 {
 
   unsigned int
-    retStatus;			// cumulative return status
-  uint8_t 
-    *bptr;			// buffer pointer
-  uint16_t 
-    status;			// 16 bit status registers
-  int
-    bcount;			// current byte count
-  uint8_t
-    stat;			// SR0 value
+    retStatus;			// start status
+  STAT_TIMER( start);
 
+  STAT_MARK( start);
   *BytesRead = 0;		// say nothing yet
-  retStatus = 0;		// clear return status  
+  if ( (retStatus = TapeStartRead( Buf, Buflen)) == TSTAT_NOERR)
+    retStatus = TapeWait( BytesRead);
+  STAT_SINCE( STAT_TAPE_READ, start);
+  return retStatus;
+} // TapeRead
+
+//*	TapeStartRead - Start reading a tape block.
+//	-------------------------------------------
+//
+//	Issues the read and waits for the formatter to take it, so the
+//	DMA engine is live before the first byte.  The block then comes
+//	in on its own, and the caller is free to do something else (such
+//	as write the last block to the SD card) in between calls to
+//	TapePoll; TapeResult returns the status and count just as
+//	TapeRead does.  With the polled engine, nothing moves until
+//	TapePoll, so go straight on to it, or to TapeWait.
+//
+//	Returns TSTAT_OFFLINE if the drive isn't ready, else TSTAT_NOERR;
+//	a formatter that doesn't take the command ends the read with
+//	TSTAT_TIMEOUT.
+//
+
+unsigned int TapeStartRead( uint8_t *Buf, int Buflen)
+{
+
+  uint16_t
+    speed;			// PC_IHSP or not
 
   if ( !IsTapeOnline())
     return TSTAT_OFFLINE;	// return if offline
-    
-  bcount = Buflen;		// byte count
-  bptr = Buf;			// where we store things
 
-  G_INPUT( PDATA);		// enforce input mode on data
-  gpio_clear( PCTRL_GPIO, PCTRL_DDIR);	// set direction
+  PertDataIn();		// enforce input mode on data
+  PertCtrlClear( PCTRL_DDIR);	// set direction
+
+  if ( TapeXferMode == XFER_DMA)
+  {
+    if ( Buflen > XFER_MAX_COUNT)
+      Buflen = XFER_MAX_COUNT;		// DMA count is 16 bits
+    XferReadSetup( Buf, Buflen);	// streams ready, trigger off
+  }
+  ReadBuf = Buf;
+  ReadBuflen = Buflen;
+  memset( &BlockTiming, 0, sizeof( BlockTiming));
 
   AckTapeTransfer();		// clear transfer flags
-  IssueTapeCommand( PC_IGO);	// assert go
-  Delay(2);
-  IssueTapeCommand( 0);		// release it
+  StartOp( OP_READ, TAPE_BLOCK_MSEC);
+  speed = SpeedSelect( OP_READ);
+  IssueTapeCommand( PC_IGO | speed);	// assert go
+  PertDelay(2);
+  IssueTapeCommand( speed);	// release it
+  while ( TapePoll() == TAPE_GO)
+    ;
+  return TSTAT_NOERR;
+} // TapeStartRead
 
-//  Wait for IFBY to go active, then active IDBY.
+//	PollRead - One step of a read.
+//	------------------------------
+//
 
-  while( true)
-  {
-    status = TapeStatus();
-    if ( status & PS1_IFBY)
-      break;
-  }  // wait for formatter busy
+static void PollRead( void)
+{
 
-//  Uprintf( "Start status = %04x\n", status);
+  int
+    bcount;			// current byte count
+  uint8_t
+    stat;			// SR0 value
+  uint16_t
+    status;			// 16 bit status registers
 
-//	Okay, we have the formatter acknowledging the command, now wait
-//	for the data phase.  If formatter busy drope while waiting, we
-//	bombed.
-  
-  do
+  if ( OpState == TAPE_GO)
   {
     status = TapeStatus();
     if ( !(status & PS1_IFBY))
+      return;				// formatter not busy yet
+    OpSpeed.Ran = (status & PS0_ISPEED) != 0;
+    STAT_SINCE( STAT_GO_IFBY, PhaseStart);
+    STAT_MARK( PhaseStart);
+
+//  The DMA engine must be live before the first character shows up,
+//  and its trigger may be on whenever status 0 is selected.  Leave it
+//  that way until the data phase is over.
+
+    if ( TapeXferMode == XFER_DMA)
     {
-      return TSTAT_OFFLINE;		// tape dropped ready
+      PertCtrlClear( PCTRL_SSEL);
+      XferReadEnable( true);
     }
+    SetState( TAPE_WAIT_DATA);
+    return;
+  } // if waiting for formatter busy
 
-  } while( (status & PS0_IDBY) == 0);	// wait for data phase
+//  With DMA, the caller's time since the start counts as waiting for
+//  the data phase, which may have begun meanwhile.  Once it's begun,
+//  go straight on: the first byte may be waiting.
+
+  if ( OpState == TAPE_WAIT_DATA)
+  {
+    if ( !ReadDataBegun())
+      return;
+    STAT_SINCE( STAT_IFBY_IDBY, PhaseStart);
+    STAT_MARK( PhaseStart);
+    SetState( TAPE_DATA);
+  } // if waiting for the data phase
 
 //	During the duration of the read, we use status register 0.
 //	Note that direct reading of the status is negative-true.
 //	Status reg 1 bits are checked at the conclusion.
 
-  gpio_clear( PCTRL_GPIO, PCTRL_SSEL);	// start with the first status reg
+  PertCtrlClear( PCTRL_SSEL);	// start with the first status reg
+  if ( TapeXferMode == XFER_DMA)
+  {
+    if ( !ReadBlockDMA( ReadBuf, &bcount, &stat))
+      return;				// still coming in
+  }
+  else
+  {
+    bcount = ReadBlockPolled( ReadBuf, ReadBuflen, &stat);
+    if ( OpStalled)
+    {
+      Abandon();
+      return;
+    }
+  } // if polled
+  STAT_SINCE_PER( STAT_BYTE, PhaseStart, bcount);
+  EndRead( bcount, stat);
+  return;
+} // PollRead
 
-//	Read loop.
+//	ReadDataBegun - Has a read's data phase begun?
+//	----------------------------------------------
+//
+//	The formatter has acknowledged the command, now wait for the
+//	data phase.  If formatter busy drops while waiting, we bombed--
+//	unless the block came and went while we were away--and the read
+//	is over.
+//
+//	With DMA, the engine's trigger is on whenever status 0 is
+//	selected, and off while we look at status 1.
+//
 
-  do
-  { // data transfer loop
+static bool ReadDataBegun( void)
+{
 
-    stat = gpio_port_read( PSTAT_GPIO) >> 8;	// normalize status
-    
-    if ( (stat & PS0_RDAVAIL) == 0)		// note negative logic
-    { // read data
-      gpio_clear( PCTRL_GPIO, PCTRL_TACK);	// start transfer ACK
-      *bptr++ = ~gpio_port_read( PDATA_GPIO);	// get a byte
-      gpio_set( PCTRL_GPIO, PCTRL_TACK);        // ack the transfer
-      bcount--;
-      continue;
-    } // if we have a byte
-    else if  (stat & PS0_IDBY)
-     break;				// data busy drops? 
-  } while (bcount);			// while
+  uint16_t
+    status;			// 16 bit status registers
 
-//	If bcount is zero, then the block was longer than our buffer.
+  if ( TapeXferMode == XFER_DMA)
+  {
+    PertCtrlClear( PCTRL_SSEL);
+    XferReadEnable( true);
+    if ( !(PertStatus() & PS0_IDBY))
+      return true;			// data phase (negative logic)
+    XferReadEnable( false);
+  } // if DMA
+
+  status = TapeStatus();
+  if ( !(status & PS1_IFBY))
+  {
+    if ( ReadGone())
+      return true;			// came and went while we were away
+    if ( TapeXferMode == XFER_DMA)
+      XferReadStop();
+    EndOp( TSTAT_OFFLINE);		// tape dropped ready
+    return false;
+  }
+  return (status & PS0_IDBY) != 0;
+} // ReadDataBegun
 
-  if ( bcount == 0)
-    retStatus = TSTAT_LENGTH;		// say we have an overrun
+//	EndRead - Work out how a read went.
+//	-----------------------------------
+//
+//	Count bytes came in, and Stat is the last SR0 value.
+//
 
-// 	Now, figure the amount actually read.
+static void EndRead( int Count, uint8_t Stat)
+{
 
-  bcount = Buflen - bcount;		
+  unsigned int
+    retStatus;			// cumulative return status
+  uint16_t
+    status;			// 16 bit status registers
 
-  if ( (stat & PS0_IFMK) == 0)
+  retStatus = 0;		// clear return status
+
+//	If we filled the buffer, the block was longer than our buffer.
+
+  if ( Count == ReadBuflen)
+    retStatus = TSTAT_LENGTH;		// say we have an overrun
+
+  if ( (Stat & PS0_IFMK) == 0)
   {
     retStatus |= TSTAT_TAPEMARK;	// say we have a tapemark
-    bcount = 0;				// say nothing transferred
+    Count = 0;				// say nothing transferred
   }
 
-  if ( (stat & PS0_IHER) == 0)
+  if ( (Stat & PS0_IHER) == 0)
     retStatus |= TSTAT_HARDERR;		// signal hard error
-  if ( (stat & PS0_ICER) == 0)
+  if ( (Stat & PS0_ICER) == 0)
     retStatus |= TSTAT_CORRERR;		// signal corrected error
-  
+
 // 	Look at full 16-bit status.
 
   status = TapeStatus();		// get all 16 bits of status
   if ( status & PS1_EOT)
     retStatus |= TSTAT_EOT;		// say end of tape
-    
+
 //	If we don't see any data, but haven't thrown an error, we call the
 //	tape blank.
 
-  if ( (bcount == 0) && (retStatus== 0))
+  if ( (Count == 0) && (retStatus== 0))
     retStatus |= TSTAT_BLANK;		// say we have a blank tape
 
-  *BytesRead = bcount;
-  return retStatus;			// all done  
-} // TapeRead
+  OpCount = Count;
+  ReadEndMsec = PertMsec();
+  ReadEndCount = Count;
+  ReadLast = true;			// the next read may stream
+  EndOp( retStatus);			// all done
+  return;
+} // EndRead
+
+//	ReadGone - Has a started read's data phase come and gone?
+//	---------------------------------------------------------
+//
+//	Only the DMA engine can tell without disturbing the read; with
+//	the polled engine, the answer is always false.  A block that's
+//	gone by has left data in memory, or a tapemark or error flag in
+//	status 0, which holds until the next command.
+//
+
+static bool ReadGone( void)
+{
+
+  uint8_t
+    stat;			// SR0 value
+
+  if ( TapeXferMode != XFER_DMA)
+    return false;
+
+  PertCtrlClear( PCTRL_SSEL);
+  stat = PertStatus();
+  if ( !(stat & PS0_IDBY))
+    return false;			// data phase still on
+  return XferReadCount() > 0 || (~stat & (PS0_IFMK | PS0_IHER));
+} // ReadGone
+
+//	ReadBlockPolled - Data phase of a read, one byte at a time.
+//	-----------------------------------------------------------
+//
+//	The CPU watches RDAVAIL and strobes TACK for every byte.
+//	Returns the number of bytes read; the last SR0 value seen is
+//	returned in *Stat.  If the formatter holds IDBY with nothing
+//	coming past the deadline, OpStalled is set.
+//
+//	Every byte shows up after the last look at the status--if that
+//	found nothing, clearly, and if it found a byte, because the next
+//	one can't come until that one's TACK--so the time from that look
+//	to its own TACK is the most it can have waited.  The first byte
+//	may have been there before we started looking, so it doesn't
+//	count.
+//
+
+static int ReadBlockPolled( uint8_t *Buf, int Buflen, uint8_t *Stat)
+{
+
+  uint8_t 
+    *bptr;			// buffer pointer
+  int
+    bcount;			// current byte count
+  uint8_t
+    stat;			// SR0 value
+  uint32_t
+    look,			// when we last looked at the status
+    since,			// no byte was waiting before this
+    now,			// last TACK
+    first,			// ... and the first
+    worst;			// longest a byte may have waited
+
+  bcount = Buflen;		// byte count
+  bptr = Buf;			// where we store things
+  since = first = now = PertCycles();
+  worst = 0;
+
+  do
+  { // data transfer loop
+
+    look = PertCycles();
+    stat = PertStatus();	// normalize status
+    
+    if ( (stat & PS0_RDAVAIL) == 0)		// note negative logic
+    { // read data
+      PertCtrlClear( PCTRL_TACK);	// start transfer ACK
+      *bptr++ = ~PertDataRead();	// get a byte
+      PertCtrlSet( PCTRL_TACK);        // ack the transfer
+      now = PertCycles();
+      if ( bcount == Buflen)
+        first = now;
+      else if ( now - since > worst)
+        worst = now - since;
+      since = look;
+      bcount--;
+      continue;
+    } // if we have a byte
+    else if  (stat & PS0_IDBY)
+     break;				// data busy drops? 
+    if ( Overdue())
+    {
+      OpStalled = true;			// data busy and nothing coming
+      break;
+    }
+    since = look;
+  } while (bcount);			// while
+
+  SetTiming( worst, now - first, Buflen - bcount);
+  *Stat = stat;
+  return Buflen - bcount;
+} // ReadBlockPolled
+
+//	ReadBlockDMA - Data phase of a read, by timer and DMA.
+//	------------------------------------------------------
+//
+//	The engine in tapexfer.c was set up before GO and stores the
+//	bytes and generates TACK; all we do is watch for IDBY to drop.
+//	Returns false while it's still up; once it's down, true, with
+//	the number of bytes stored in *Count and the last SR0 value in
+//	*Stat.  Unlike the polled loop, bytes beyond the end of the
+//	buffer are still acknowledged, so the formatter finishes the
+//	block normally.
+//
+
+static bool ReadBlockDMA( uint8_t *Buf, int *Count, uint8_t *Stat)
+{
+
+  uint8_t
+    stat;			// SR0 value
+
+  XferReadEnable( true);	// if it isn't already
+  stat = PertStatus();		// normalize status
+  if ( !(stat & PS0_IDBY))
+    return false;		// data busy still on
+
+  *Count = XferReadStop();
+  InvertBuffer( Buf, *Count);		// data bus is negative-true
+  *Stat = stat;
+  return true;
+} // ReadBlockDMA
 
 //*	TapeWrite - Write a tape block.
 //	-------------------------------
@@ -415,6 +1074,7 @@ unsigned int TapeRead( uint8_t *Buf, int Buflen, int *BytesRead)
 //	Returns completion status.
 //
 //	Status can be a combination of any of these:
+//		TSTAT_TIMEOUT	- Formatter stopped answering
 //		TSTAT_OFFLINE 	- Drive is offline
 //		TSTAT_HARDERR 	- Formatter detected a hard error
 //		TSTAT_EOT	- End of tape encountered
@@ -438,16 +1098,38 @@ unsigned int TapeWrite( uint8_t *Buf, int Buflen)
 {
 
   unsigned int
-    retStatus;                  // cumulative return status
-  uint8_t 
-    *bptr;                      // buffer pointer
+    retStatus;                  // start status
+  STAT_TIMER( start);
+
+  STAT_MARK( start);
+  if ( (retStatus = TapeStartWrite( Buf, Buflen)) == TSTAT_NOERR)
+    retStatus = TapeWait( NULL);
+  STAT_SINCE( STAT_TAPE_WRITE, start);
+  return retStatus;
+} // TapeWrite
+
+//*	TapeStartWrite - Start writing a tape block.
+//	--------------------------------------------
+//
+//	Issues the write and waits for the formatter to take it.  With
+//	XFER_DMA, the interrupt handler then feeds the block out on its
+//	own, and the caller may do something else (such as read the next
+//	block from the SD card) in between calls to TapePoll, which says
+//	TAPE_DATA until every byte has gone out.  TapeResult returns the
+//	status just as TapeWrite does; the buffer must be left alone
+//	until then.  With the polled engine, nothing moves until
+//	TapePoll, so go straight on to it, or to TapeWait.
+//
+//	Returns TSTAT_OFFLINE or TSTAT_PROTECT if the write can't be
+//	done, else TSTAT_NOERR; a formatter that doesn't take the command
+//	ends the write with TSTAT_TIMEOUT.
+//
+
+unsigned int TapeStartWrite( uint8_t *Buf, int Buflen)
+{
+
   uint16_t 
-    driveCmd,			// drive command
-    status;                     // 16 bit status registers
-  int
-    bcount;                     // current byte count
-  uint8_t
-    stat;                       // SR0 value
+    driveCmd;			// drive command
 
 //	First off, check to make sure the drive is online 
 //	and not write-protected.
@@ -457,111 +1139,406 @@ unsigned int TapeWrite( uint8_t *Buf, int Buflen)
   if ( IsTapeProtected())
      return TSTAT_PROTECT;	// can't write to a write-protected tape
      
-  retStatus = TSTAT_NOERR;	// assume no status
-  bptr = Buf;			// buffer
-  bcount = Buflen;		// set up some locals
+  WriteBuf = Buf;		// set up for the data phase
+  WriteBuflen = Buflen;
+  memset( &BlockTiming, 0, sizeof( BlockTiming));
   
-  G_OUTPUT( PDATA);              // enforce output mode on data
-  gpio_set( PCTRL_GPIO, PCTRL_DDIR | PCTRL_LBUF);  // set direction+strobe
+  PertDataOut();              // enforce output mode on data
+  PertCtrlSet( PCTRL_DDIR | PCTRL_LBUF);  // set direction+strobe
 
-  if (bcount == 0)
+  if (Buflen == 0)
     driveCmd = PC_IWRT + PC_IWFM;	// write file mark
   else
     driveCmd = PC_IWRT;			// write data  
   
+  StartOp( OP_WRITE, TAPE_BLOCK_MSEC);
+  driveCmd |= SpeedSelect( OP_WRITE);
   IssueTapeCommand( PC_IGO + driveCmd);	
-  Delay(2);
+  PertDelay(2);
   IssueTapeCommand( driveCmd);	// issue command
+  while ( TapePoll() == TAPE_GO)
+    ;
+  return TSTAT_NOERR;
+} // TapeStartWrite
 
-//	Formatter will go busy.
+//	PollWrite - One step of a write.
+//	--------------------------------
+//
 
-  do
-  {
-    status = TapeStatus();		// grab current status
-  } while( !(status & PS1_IFBY));   	// wait for formatter finished
+static void PollWrite( void)
+{
 
-//  If writing a filemark, there's no data phase.
-//  If writing data, prime the buffer.
+  unsigned int
+    retStatus;                  // cumulative return status
+  uint16_t 
+    status;                     // 16 bit status registers
 
-  if ( bcount != 0)
+  switch( OpState)
   {
-    gpio_clear( PCTRL_GPIO, PCTRL_TACK | PCTRL_LBUF);      // start transfer ACK
-    gpio_port_write( PDATA_GPIO, ~*bptr++);   // get a byte
-    gpio_set( PCTRL_GPIO, PCTRL_TACK | PCTRL_LBUF);        // ack the transfer
-    bcount--;
 
-//	Okay, at this point we transfer the rest of the buffer
+//	Formatter will go busy.  If writing a filemark, there's no data
+//	phase.  The write interrupt primes the buffer and takes it from here;
+//	status 0 stays selected until it's done.
 
-    do
-    {
+    case TAPE_GO:
       status = TapeStatus();
-    } while( (status & PS0_IDBY) == 0);   // wait for data phase
+      if ( !(status & PS1_IFBY))
+        return;				// formatter not busy yet
+      OpSpeed.Ran = (status & PS0_ISPEED) != 0;
+      STAT_SINCE( STAT_GO_IFBY, PhaseStart);
+      STAT_MARK( PhaseStart);
+      if ( WriteBuflen == 0)
+      {
+        IssueTapeCommand( 0);		// clear it
+        SetState( TAPE_WAIT_END);
+        return;
+      }
+      if ( TapeXferMode == XFER_DMA)
+      {
+        PertCtrlClear( PCTRL_SSEL);	// WREMPTY to PE12
+        XferWriteSetup( WriteBuf, WriteBuflen,
+          (uint8_t) LastCommand | PC_ILWD);
+        XferWriteEnable( true);
+      } // if DMA
+      SetState( TAPE_DATA);
+      return;
+
+//  The polled engine marks the start of the data phase; the
+//  interrupt can't, so its bytes carry the wait for it.
+
+    case TAPE_DATA:
+      if ( TapeXferMode == XFER_DMA)
+      {
+        if ( !WriteBlockIRQ( WriteBuflen))
+          return;			// still going out
+      }
+      else
+      {
+        WriteBlockPolled( WriteBuf, WriteBuflen);
+        if ( OpStalled)
+        {
+          Abandon();
+          return;
+        }
+      } // if polled
+      STAT_SINCE_PER( STAT_BYTE, PhaseStart, WriteBuflen);
+
+//  De-assert commands and wait for "formatter busy" to drop
+
+      IssueTapeCommand( 0);		// clear it
+      SetState( TAPE_WAIT_END);
+      return;
+
+    case TAPE_WAIT_END:
+      status = TapeStatus();		// grab current status
+      if ( status & PS1_IFBY)
+        return;				// formatter not finished
+      retStatus = TSTAT_NOERR;	// assume no status
+      if ( status & PS0_IHER)
+        retStatus |= TSTAT_HARDERR;	// signal hard error
+      if ( status & PS0_ICER)
+        retStatus |= TSTAT_CORRERR;	// signal corrected error
+      EndOp( retStatus);		// done.
+      return;
+
+    default:
+      return;
+  } // switch
+} // PollWrite
+
+//	WriteBlockPolled - Data phase of a write, one byte at a time.
+//	-------------------------------------------------------------
+//
+//	The CPU primes the buffer, then watches WREMPTY and strobes each
+//	following byte.  "Last word" goes up right after the next-to-last
+//	byte is strobed (before the only byte of a 1-byte block).
+//	Returns when IDBY drops, or with OpStalled set if the deadline
+//	passes first.
+//
+//	The strobes are timed as ReadBlockPolled times its TACKs: the
+//	buffer can only go empty after the last look at the status.  If
+//	the formatter gives up on us, the time from that look to now
+//	counts.
+//
+
+static void WriteBlockPolled( uint8_t *Buf, int Buflen)
+{
+
+  uint8_t 
+    *bptr;                      // buffer pointer
+  uint16_t 
+    status;                     // 16 bit status registers
+  int
+    bcount;                     // current byte count
+  uint8_t
+    stat;                       // SR0 value
+  uint32_t
+    look,			// when we last looked at the status
+    since,			// the buffer was full until this
+    now,			// last strobe
+    first,			// ... and the first in the data phase
+    worst;			// longest the empty buffer may have waited
+
+  bptr = Buf;
+  bcount = Buflen;
+
+  if ( bcount == 1)
+    AssertLastWord();		// the only byte is the last one
+
+//  Prime the buffer.
+
+  PertCtrlClear( PCTRL_TACK | PCTRL_LBUF);      // start transfer ACK
+  PertDataWrite( ~*bptr++);   // get a byte
+  PertCtrlSet( PCTRL_TACK | PCTRL_LBUF);        // ack the transfer
+  bcount--;
+  if ( bcount == 1)
+    AssertLastWord();		// 2-byte block
+
+//	Okay, at this point we transfer the rest of the buffer.  If the
+//	formatter is done before we even see IDBY, we were too late.
+
+  do
+  {
+    status = TapeStatus();
+    if ( !(status & PS1_IFBY))
+    { // data phase came and went
+      BlockTiming.Late = bcount != 0;
+      return;
+    }
+    if ( Overdue())
+    {
+      OpStalled = true;			// no data phase
+      return;
+    }
+  } while( (status & PS0_IDBY) == 0);   // wait for data phase
+  STAT_SINCE( STAT_IFBY_IDBY, PhaseStart);
+  STAT_MARK( PhaseStart);
 
 //      During the duration of the write, we use status register 0.
 //      Note that direct reading of the status is negative-true.
 //      Status reg 1 bits are checked at the conclusion.
 
-    gpio_clear( PCTRL_GPIO, PCTRL_SSEL);  // start with the first status reg
+  PertCtrlClear( PCTRL_SSEL);  // start with the first status reg
 
-//	Perform the write transfer.  
+//	Perform the write transfer.  The primed byte went in before the
+//	data phase, so the timing starts with the next one.
 
-    while (bcount)
-    { // data transfer loop
+  since = first = now = PertCycles();
+  worst = 0;
+  while (bcount)
+  { // data transfer loop
 
-      stat = gpio_port_read( PSTAT_GPIO) >> 8;	// normalize status
+    look = PertCycles();
+    stat = PertStatus();	// normalize status
     
-      if ( (stat & PS0_WREMPTY) == 0)		// note negative logic
-      { // need to refill buffer
+    if ( (stat & PS0_WREMPTY) == 0)		// note negative logic
+    { // need to refill buffer
 
  //	Load next byte and ack the empty buffer.
 
-        gpio_clear( PCTRL_GPIO, PCTRL_TACK | PCTRL_LBUF);	// start transfer ACK
-        gpio_port_write( PDATA_GPIO, ~*bptr++);	// load next byte
-        gpio_set( PCTRL_GPIO, PCTRL_TACK | PCTRL_LBUF);  // ack the transfer
-
-//	If we're at the second-to-last word, set "last word" flag.  
-
-        if (bcount == 2)
-        {
-          gpio_set( PCMD_GPIO, PCMD_BIT);	// set all bits to one
-          gpio_clear( PCMD_GPIO, PC_ILWD);       // assert last word
-          gpio_clear( PCTRL_GPIO, PCTRL_CSEL1);  // latch it in
-          gpio_set( PCTRL_GPIO, PCTRL_CSEL1);   // strobe to latch bits
-        } // if last word
-        bcount--;      
-      } else
+      PertCtrlClear( PCTRL_TACK | PCTRL_LBUF);	// start transfer ACK
+      PertDataWrite( ~*bptr++);	// load next byte
+      PertCtrlSet( PCTRL_TACK | PCTRL_LBUF);  // ack the transfer
+      now = PertCycles();
+      if ( bcount == Buflen - 1)
+        first = now;
+      else if ( now - since > worst)
+        worst = now - since;
+      since = look;
+      bcount--;      
+
+//	If we just sent the second-to-last word, set "last word" flag.  
+
+      if (bcount == 1)
+        AssertLastWord();
+    } else
+    {
+      if( (stat & PS0_IDBY))		// if IDBY has dropped prematurely
+      { // the formatter gave up waiting for a byte
+        look = PertCycles();
+        if ( look - since > worst)
+          worst = look - since;
+        break;
+      }
+      if ( Overdue())
       {
-        if( (stat & PS0_IDBY))		// if IDBY has dropped prematurely
-          break;
-      } // if not buffer empty
-    };	// while data to transfer
+        OpStalled = true;		// data busy and not taking any
+        return;
+      }
+      since = look;
+    } // if not buffer empty
+  };	// while data to transfer
+  SetTiming( worst, now - first, Buflen - 1 - bcount);
 
 //	Wait for IDBY to drop
 
-    do
+  do
+  {
+    stat = PertStatus();	// normalize status
+    if ( Overdue())
     {
-      stat = gpio_port_read( PSTAT_GPIO) >> 8;	// normalize status
-    } while (!(stat & PS0_IDBY));	// wait for IDBY to drop
-  } // if transferring data  
+      OpStalled = true;
+      return;
+    }
+  } while (!(stat & PS0_IDBY));	// wait for IDBY to drop
+  return;
+} // WriteBlockPolled
 
-//  De-assert commands and wait for "formatter busy" to drop
+//	WriteBlockIRQ - Data phase of a write, by interrupt.
+//	----------------------------------------------------
+//
+//	The engine in tapexfer.c was set up when the formatter went busy;
+//	it primes the buffer, then loads a byte on every WREMPTY and
+//	flags the last word itself.  Status 0 stays selected until every
+//	byte has been handed over, so no WREMPTY edge can be missed.
+//	After that, we can look at both status registers again, so even
+//	a data phase too short to catch won't hang us.  Returns false
+//	until IDBY has dropped, then true.
+//
+//	The caller may have been away for a while, so IDBY can already
+//	be over.  Only the primed byte is taken before the data phase, so
+//	a count past that with IDBY gone means the formatter cut it short.
+//
 
-  IssueTapeCommand( 0);			// clear it
+static bool WriteBlockIRQ( int Buflen)
+{
 
-  do
+  uint16_t
+    status;                     // 16 bit status registers
+  uint8_t
+    stat;                       // SR0 value
+  int
+    count;			// bytes handed over
+
+  if ( !OpFed)
+  {
+    if ( (count = XferWriteCount()) < Buflen)
+    {
+      stat = PertStatus();	// normalize status
+      if ( !(stat & PS0_IDBY))
+      {
+        OpSeen = true;			// data phase (negative logic)
+        return false;
+      }
+      if ( !OpSeen && count <= 1)
+        return false;			// not started yet
+    } // if the engine is busy; else the formatter cut it short
+
+    XferWriteStop();
+    LastCommand |= PC_ILWD;		// the engine latched it
+    OpFed = true;
+  } // if feeding
+
+  status = TapeStatus();
+  if ( status & PS0_IDBY)
+    OpSeen = true;
+  return !(status & PS1_IFBY) || (OpSeen && !(status & PS0_IDBY));
+} // WriteBlockIRQ
+
+//	TapeBlockTiming - How the CPU kept up with the last block.
+//	----------------------------------------------------------
+//
+//	See TAPE_TIMING in tapedriver.h.
+//
+
+void TapeBlockTiming( TAPE_TIMING *Timing)
+{
+
+  *Timing = BlockTiming;
+  return;
+} // TapeBlockTiming
+
+//	SetTiming - Record how the CPU kept up with a block.
+//	----------------------------------------------------
+//
+//	Worst is the longest wait; Count bytes were handed over in Span
+//	cycles, first to last.
+//
+
+static void SetTiming( uint32_t Worst, uint32_t Span, int Count)
+{
+
+  BlockTiming.WorstWait = Worst;
+  BlockTiming.CharTime = Count > 1 ? Span / (Count - 1) : 0;
+  BlockTiming.Late = BlockTiming.CharTime &&
+    (uint64_t) Worst * 100 >
+      (uint64_t) BlockTiming.CharTime * (100 - TIMING_MARGIN_PCT);
+  return;
+} // SetTiming
+
+//	NoteEdge - Log a change of status.
+//	----------------------------------
+//
+//	The ring keeps the newest TAPE_EDGE_LOG.
+//
+
+static void NoteEdge( uint16_t Status)
+{
+
+  TAPE_EDGE
+    *e;
+
+  e = &Edges[ EdgeNext];
+  e->Msec = PertMsec();
+  e->Was = StatusShadow;
+  e->Now = Status;
+  EdgeNext = (EdgeNext + 1) % TAPE_EDGE_LOG;
+  if ( EdgeCount < TAPE_EDGE_LOG)
+    EdgeCount++;
+  return;
+} // NoteEdge
+
+//	TapeOpSpeed - What speed the last operation asked for and got.
+//	--------------------------------------------------------------
+//
+
+void TapeOpSpeed( TAPE_SPEED *Speed)
+{
+
+  *Speed = OpSpeed;
+  return;
+} // TapeOpSpeed
+
+//	SpeedSelect - Pick the speed for an operation.
+//	----------------------------------------------
+//
+//	Returns PC_IHSP for high speed, else 0, to go in with the command.
+//	With SPEED_AUTO, spacing goes at high speed, as do reads that
+//	stream or follow a long block (see SPEED_STREAM_MSEC); writes,
+//	which wait on the card, go at low speed.
+//
+
+static uint16_t SpeedSelect( TAPE_OP Kind)
+{
+
+  bool
+    high;
+
+  switch( TapeSpeed)
   {
-    status = TapeStatus();		// grab current status
-  } while( (status & PS1_IFBY));   	// wait for formatter finished
+    case SPEED_HIGH:
+      high = true;
+      break;
 
-  if ( status & PS0_IHER)
-    retStatus |= TSTAT_HARDERR;		// signal hard error
-  if ( status & PS0_ICER)
-    retStatus |= TSTAT_CORRERR;		// signal corrected error
-  
-//  Check completion status.
+    case SPEED_AUTO:
+      if ( Kind == OP_MOTION)
+        high = true;
+      else if ( Kind == OP_READ)
+        high = ReadLast && (ReadEndCount >= SPEED_LONG_BLOCK ||
+          PertMsec() - ReadEndMsec <= SPEED_STREAM_MSEC);
+      else
+        high = false;
+      break;
 
-  return retStatus;			// done.  
-} // TapeWrite
+    default:
+      high = false;
+      break;
+  } // switch
+  ReadLast = false;			// until this one ends
+  OpSpeed.Asked = high;
+  OpSpeed.Ran = false;
+  return high ? PC_IHSP : 0;
+} // SpeedSelect
 
 //*	Status Testing Routines.
 //	========================
@@ -578,7 +1555,7 @@ bool IsTapeOnline( void)
 
   uint16_t stat;
 
-  stat = TapeStatus();
+  stat = TapeStatusRecent();
   
   if ( stat & PS1_IRDY)
     return true;
@@ -597,7 +1574,7 @@ bool IsTapeEOT( void)
 
   uint16_t stat;
 
-  stat = TapeStatus();
+  stat = TapeStatusRecent();
   
   if ( stat & PS1_EOT)
     return true;
@@ -616,7 +1593,7 @@ bool IsTapeProtected( void)
 
   uint16_t stat;
 
-  stat = TapeStatus();
+  stat = TapeStatusRecent();
   
   if ( stat & PS1_IFPT)
     return true;
@@ -646,6 +1623,7 @@ void IssueTapeCommand( uint16_t What)
     cmd1,			// lower command bits
     cmd2;			// upper command bits
 
+  ShadowGood = false;		// the status will answer to this
   What |= TapeAddress;		// insert address
   cmd1 = What & 0xff;		// get low byte
   cmd2 = What >> 8;		// get high byte
@@ -656,13 +1634,13 @@ void IssueTapeCommand( uint16_t What)
   if ( cmd2 != (uint8_t) (LastCommand >>8))
   { // need to set high order  
 
-    gpio_set( PCTRL_GPIO, PCTRL_ENA);	// float the command register
-    gpio_set( PCMD_GPIO, PCMD_BIT);	// set all bits to one
+    PertCtrlSet( PCTRL_ENA);	// float the command register
+    PertCmdSet( PCMD_BIT);	// set all bits to one
     if ( cmd2)
-      gpio_clear( PCMD_GPIO, cmd2);	// assert the ones
-    gpio_clear( PCTRL_GPIO, PCTRL_CSEL0);
-    Delay(1);
-    gpio_set( PCTRL_GPIO, PCTRL_CSEL0);	// latch it in
+      PertCmdClear( cmd2);	// assert the ones
+    PertCtrlClear( PCTRL_CSEL0);
+    PertDelay(1);
+    PertCtrlSet( PCTRL_CSEL0);	// latch it in
   } // high order bits
 
   if ( cmd1 != (uint8_t) LastCommand)
@@ -670,19 +1648,36 @@ void IssueTapeCommand( uint16_t What)
 
 //	cmd1 has the IGO status.
     
-    gpio_set( PCMD_GPIO, PCMD_BIT);	// set all bits to one
+    PertCmdSet( PCMD_BIT);	// set all bits to one
     if ( cmd1)
-      gpio_clear( PCMD_GPIO, cmd1);	// assert the ones
+      PertCmdClear( cmd1);	// assert the ones
   
-    gpio_clear( PCTRL_GPIO, PCTRL_CSEL1);
-    Delay(1);				// let the latch settle in
-    gpio_set( PCTRL_GPIO, PCTRL_CSEL1);	// strobe to latch bits
+    PertCtrlClear( PCTRL_CSEL1);
+    PertDelay(1);				// let the latch settle in
+    PertCtrlSet( PCTRL_CSEL1);	// strobe to latch bits
   } // low-order bits
-  gpio_clear( PCTRL_GPIO, PCTRL_ENA);	// enable command register
+  PertCtrlClear( PCTRL_ENA);	// enable command register
   LastCommand = What;			// remember it
   return;
 } // IssueTapeCommand
 
+//	AssertLastWord - Set "last word" in command register 0.
+//	-------------------------------------------------------
+//
+//	The rest of the current command (IWRT, in particular) stays put.
+//
+
+static void AssertLastWord( void)
+{
+
+  PertCmdSet( PCMD_BIT);	// set all bits to one
+  PertCmdClear( (uint8_t) LastCommand | PC_ILWD);  // assert ones
+  PertCtrlClear( PCTRL_CSEL1);	// latch it in
+  PertCtrlSet( PCTRL_CSEL1);	// strobe to latch bits
+  LastCommand |= PC_ILWD;
+  return;
+} // AssertLastWord
+
 //	AckTapeTransfer - Reset the data latch status.
 //	----------------------------------------------
 //
@@ -690,11 +1685,38 @@ void IssueTapeCommand( uint16_t What)
 static void AckTapeTransfer( void)
 {
 
-  gpio_clear( PCTRL_GPIO, PCTRL_TACK);
-  gpio_set( PCTRL_GPIO, PCTRL_TACK);            // ack the transfer
+  PertCtrlClear( PCTRL_TACK);
+  PertCtrlSet( PCTRL_TACK);            // ack the transfer
 
 } // AckTapeTransfer
 
+//	InvertBuffer - Complement a buffer in place.
+//	--------------------------------------------
+//
+//	A word at a time, once we're aligned.
+//
+
+static void InvertBuffer( uint8_t *Buf, int Count)
+{
+
+  uint32_t
+    *wp;
+
+  while ( Count && ((uintptr_t) Buf & 3))
+  {
+    *Buf = ~*Buf;
+    Buf++;
+    Count--;
+  } // get to a word boundary
+
+  for ( wp = (uint32_t *) Buf; Count >= 4; Count -= 4, wp++)
+    *wp = ~*wp;
+
+  for ( Buf = (uint8_t *) wp; Count; Count--, Buf++)
+    *Buf = ~*Buf;
+  return;
+} // InvertBuffer
+
 //  SetTapeAddress - Set drive/formatter address.
 //  ---------------------------------------------
 //
@@ -724,7 +1746,7 @@ void Set1600( void)
 {
 
   IssueTapeCommand( PC_IEDIT | PC_IWFM | PC_IERASE);
-  Delay(4);
+  PertDelay(4);
   IssueTapeCommand( 0);
   return;  
 } // Set1600
@@ -739,7 +1761,7 @@ void Set6250( void)
 {
 
   IssueTapeCommand( PC_IEDIT | PC_IWFM | PC_IERASE | PC_IREV);
-  Delay(4);
+  PertDelay(4);
   IssueTapeCommand( 0);
   return;  
 } // Set6250
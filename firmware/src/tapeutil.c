@@ -10,15 +10,6 @@
 #include <ctype.h>
 #include <string.h>
 
-// MCU-specific definitions.
-
-#include <libopencm3/stm32/rcc.h>
-#include <libopencm3/stm32/gpio.h>
-#include <libopencm3/cm3/systick.h>
-#include <libopencm3/cm3/nvic.h>
-#include <libopencm3/stm32/timer.h>
-#include <libopencm3/stm32/dma.h>
-
 #include "license.h"
 
 // Local definitions.
@@ -29,10 +20,15 @@
 #include "rtcsubs.h"
 #include "globals.h"
 #include "filedef.h"
+#include "diskio.h"
 #include "tapeutil.h"
 #include "tapedriver.h"
+#include "pertport.h"
 #include "pertbits.h"
 #include "tap.h"
+#include "tapestream.h"
+#include "usbserial.h"
+#include "hotstats.h"
 
 //  Local variables.
 
@@ -42,11 +38,148 @@ static uint32_t
   TapePosition,
   BytesCopied;                        // number of bytes copies   
 
+//  Read-ahead for CmdWriteImage: records from the image waiting for
+//  the tape, each in its own slot of TapeBuffer, oldest first.
+
+#define IMAGE_QUEUE 16			// most records read ahead
+
+typedef struct _image_record
+{
+  int Slot;			// offset in TapeBuffer
+  int Count;			// data length
+  uint32_t Header;		// .TAP header
+} IMAGE_RECORD;
+
+//  GetImageRecord results.
+
+#define IMAGE_OK	0		// record queued
+#define IMAGE_FULL	1		// no room for it yet
+#define IMAGE_END	2		// EOM or end of file
+#define IMAGE_CORRUPT	3		// bad length or trailer
+#define IMAGE_ERROR	4		// file read error
+#define IMAGE_WAIT	5		// host hasn't sent it all yet
+#define IMAGE_STALLED	6		// ... and has gone quiet; see WaitImageRecord
+#define IMAGE_ABORT	7		// ESC while waiting for it
+
+static IMAGE_RECORD
+  ImageQueue[ IMAGE_QUEUE];
+static int
+  QueueHead,			// oldest record
+  QueueCount,			// records queued
+  QueueEnd;			// where the next slot would start
+static uint32_t
+  NextHeader;			// header read, record not yet queued
+static bool
+  HaveHeader;
+
+//  STREAMW: a record from the host may come in over several calls.
+
+static uint32_t
+  NextTrailer;			// trailer, once it's in
+static int
+  PartSlot,			// slot of a record partly in, or -1
+  HostGot;			// bytes of the current piece so far
+static uint32_t
+  HostHeard;			// PertMsec when the host last sent
+
+//  How long the host may go without sending anything, in msec, before
+//  STREAMW takes it to be gone.
+
+#define HOST_IDLE_MSEC 30000
+static bool
+  HaveData;			// data in, waiting on the trailer
+
+//  Image files made by CmdCreateImage are preallocated as one
+//  contiguous extent, and while the data stays inside it, it goes to
+//  the card by sector number rather than through f_write--no FAT or
+//  bitmap updates.  Past the extent, it's f_write.  Either way,
+//  records are packed into a pair of staging buffers so that only
+//  whole, aligned sectors are written.
+
+#define IMAGE_DEFAULT_MB 192		// preallocation with no estimate
+#define IMAGE_STAGE_SIZE 4096		// bytes per staging buffer
+
+static uint8_t __attribute__ ((aligned(4)))
+  ImageStage[ 2][ IMAGE_STAGE_SIZE];
+static bool
+  ImageRaw;			// writing the extent by sector
+static int
+  StageSide,			// staging buffer being filled
+  StageFill;			// ... and how much is in it
+static LBA_t
+  RawSector,			// next sector of the extent
+  RawLimit;			// sector past its end
+static FSIZE_t
+  ImageBytes;			// bytes written to the image
+static FRESULT
+  ImageError;			// first write error, if any
+static bool
+  ImageToHost,			// STREAM: the image goes to the host
+  HostOnData,			// host image on the USB data interface
+  HostGone,			// ... and the host stopped taking it
+  ConsoleQuiet;			// ... or on the console, so no text
+
+#define CYCLES_PER_USEC 168		// CPU clock, MHz
+#define STAT_SHOW_MAX 999999999		// Uprintf's widest number
+
+//  READ and TUNE: how the polled engine's byte timing went, block by
+//  block (see TapeBlockTiming).  The DMA engine's is the hardware's.
+
+#define LATE_LIST 8			// late blocks listed by number
+#define TUNE_BLOCKS 20			// TUNE's default sample
+#define TUNE_FILE "TUNING.TXT"		// where TUNE keeps its findings
+
+static uint32_t
+  TimedBlocks,			// blocks with a byte timing
+  LateBlocks,			// ... short of margin
+  WorstWait,			// longest wait for a byte, cycles
+  LeastCharTime,		// shortest character time, cycles
+  LateAt[ LATE_LIST];		// the first few late blocks
+
+//  READ: the speeds the blocks went at (see TapeOpSpeed).
+
+static uint32_t
+  SpeedBlocks,			// blocks tallied
+  HighBlocks,			// ... that the drive read at high speed
+  SpeedMisses;			// ... not at the speed asked for
+
+//  STATS: the timing probes' figures, taken before they're shown.
+
+#ifdef HOT_STATS
+static STAT_ENTRY
+  StatShown[ STAT_PROBES];
+#endif
+
+//  EDGES: the status changes, likewise taken before they're shown.
+
+static TAPE_EDGE
+  EdgesShown[ TAPE_EDGE_LOG];
+
 // Local prototypes.
 
 static void GetComment( char *Filename);
 static void AddRecordCount( uint32_t RecordLength);
 static void FlushRecordCount( void);
+static void PutImageRecord( FIL *File, uint32_t Header, uint8_t *Buf,
+  int Count);
+static int GetImageRecord( FIL *File);
+static int WaitImageRecord( FIL *File);
+static int FindImageSlot( int Count);
+static bool GetFromHost( void *Buf, int Count);
+static void SendWriteStatus( uint16_t Status);
+static void WriteTapeImage( char *Name, bool NoRewind);
+static void HostSend( const void *Buf, int Count);
+static int HostTake( void *Buf, int Count);
+static FRESULT OpenImageFile( FIL *File, char *Name, uint32_t Megabytes);
+static void WriteImage( FIL *File, const void *Buf, UINT Count);
+static void FlushStage( FIL *File);
+static FRESULT CloseImageFile( FIL *File);
+static void MakeImage( char *Name, bool NoRewind, uint32_t Estimate);
+static uint32_t Showable( uint64_t What);
+static void ClearTiming( void);
+static void TallyTiming( void);
+static void LogTiming( char *Name);
+static uint32_t Nsec( uint32_t Cycles);
 static char *TranslateError( uint16_t Status);
 static bool CheckForEscape( void);
 
@@ -79,6 +212,7 @@ static DRIVE_STATUS_TEXT DriveStatusTable[] =
   {PS1_IRWD, "Rewinding"},
   {PS1_ILDP, "Load point"},
   {PS1_IRDY, "Ready"},
+  {PS1_IFBY, "Formatter busy"},
   {0,0}
 };
 
@@ -96,10 +230,12 @@ static char *TranslateError( uint16_t Status)
 //  The three parallel static structures.
 
   static const uint16_t  errFlag[] =
-    { TSTAT_OFFLINE, TSTAT_HARDERR, TSTAT_CORRERR, TSTAT_TAPEMARK,
-      TSTAT_EOT, TSTAT_BLANK, TSTAT_LENGTH, TSTAT_PROTECT, TSTAT_NOERR};
+    { TSTAT_TIMEOUT, TSTAT_OFFLINE, TSTAT_HARDERR, TSTAT_CORRERR,
+      TSTAT_TAPEMARK, TSTAT_EOT, TSTAT_BLANK, TSTAT_LENGTH, TSTAT_PROTECT,
+      TSTAT_NOERR};
   static const char *errMsg[] =
-    { "Drive is offline",
+    { "Formatter not answering",
+      "Drive is offline",
       "Unrecoverable data error",
       "Corrected data error",
       "Tape mark hit",
@@ -169,7 +305,7 @@ void ShowBriefStatus(void)
     
 //  Mask out the ones we want to show.
 
-  stat = TapeStatus();		// fetch tape status 
+  stat = TapeStatusRecent();	// fetch tape status 
   stat &= (PS1_IONL | PS1_ILDP | PS1_EOT | PS1_IRDY | PS1_IFPT);
   if ( stat & PS1_ILDP)
     TapePosition = 0;			// if at loadpoint
@@ -399,7 +535,7 @@ void CmdSkip( char *args[])
   while( skCount--)
   {
     status = SkipBlock( skDir);
-    if ( TapeStatus() & PS1_ILDP)
+    if ( TapeStatusRecent() & PS1_ILDP)
     {
       TapePosition = 0;
       break;				// doesn't matter, if LP hit, quit
@@ -494,11 +630,83 @@ void CmdTapeDebug( char *args[])
 //*	CmdCreateImage - Read tape and write an image file.
 //	------------------------------------------------
 //
-//	Currently, the only required argument is the image file name.
-//	We may add others later.
+//	The only required argument is the image file name.  It may be
+//	followed by N (don't rewind) and an estimate of the image size
+//	in megabytes, in either order; the estimate sets how much of the
+//	card is set aside for the image up front.
 //
 
 void CmdCreateImage( char *args[])
+{
+
+  bool
+    noRewind;		// if true, skip rewinding
+
+  uint32_t
+    estimate;		// image size estimate, MB
+
+  int
+    argn;		// argument index
+
+  if ( !args[0])
+  {
+    Uprintf( "This command requires an image file name!\n");
+    return;
+  } // if no arguments
+  
+  noRewind = false;			// rewind assumed
+  estimate = IMAGE_DEFAULT_MB;
+  for ( argn = 1; argn < 3 && args[ argn]; argn++)
+  {
+    if ( toupper( *args[ argn]) == 'N')
+      noRewind = true;			// don't rewind before or after
+    else if ( isdigit( (unsigned char) *args[ argn]))
+      estimate = atoi( args[ argn]);
+  } // see if no rewinding or an estimate
+  MakeImage( args[0], noRewind, estimate);
+  return;
+} // CmdCreateImage
+
+//*	CmdStreamImage - Read tape and send the image to the host.
+//	----------------------------------------------------------
+//
+//	Just like READ, but the image goes over the console link as it's
+//	read instead of to the card; see tapestream.h for the framing.
+//	The host takes it at its own pace--when it falls behind, output
+//	backs up and the drive waits between blocks.  [N] = no rewind.
+//
+
+void CmdStreamImage( char *args[])
+{
+
+  bool
+    noRewind;		// if true, skip rewinding
+
+  noRewind = args[0] && toupper( *args[0]) == 'N';
+  MakeImage( NULL, noRewind, 0);
+  return;
+} // CmdStreamImage
+
+//  Why MakeImage stopped short of an operator abort, told once the
+//  image has been closed off.
+
+#define STOP_NONE	0
+#define STOP_ERROR	1		// hard error, StopAfterError set
+#define STOP_TIMEOUT	2		// formatter stopped answering
+#define STOP_BLANK	3		// blank tape or EOT
+#define STOP_TAPEMARKS	4		// StopTapemarks in a row
+#define STOP_HOST	5		// host stopped taking the image
+
+//	MakeImage - Read tape into an image.
+//	------------------------------------
+//
+//	The image goes to file Name, or to the host if Name is NULL.
+//	While it's going to the host on the console, nothing else may be
+//	written there, so progress messages are held back or skipped; on
+//	the USB data interface, the console carries on as usual.
+//
+
+static void MakeImage( char *Name, bool NoRewind, uint32_t Estimate)
 {
 
   FRESULT
@@ -508,33 +716,31 @@ void CmdCreateImage( char *args[])
     tf;                 // our file structure
 
   bool
-    noRewind,		// if true, skip rewinding
     abort;              // flag that we have to stop 
 
   int
+    stopped,		// why we stopped (STOP_), told at the end
     fileCount,          // how many files?
     tapeMarkSeen;       // how many tape marks in a row?
 
   uint32_t
-    tapeHeader;		// record header/trailer    
+    tapeHeader,		// record header/trailer    
+    pendHeader;		// ... of the block waiting for the card
 
-  UINT 
-    wc;                 // write count (returned)
+  bool
+    overlap,		// true if reads run during card writes
+    pending;		// true if a block is waiting for the card
 
-  if ( !args[0])
-  {
-    Uprintf( "This command requires an image file name!\n");
-    return;
-  } // if no arguments
-  
-  noRewind = false;			// rewind assumed
-  if ( args[1])
-  {
-    if ( toupper( *args[1]) == 'N')
-      noRewind = true;			// don't rewind before or after
-  } // see if no rewinding
-  
-//  Rewind the tape if necessary.  If offline, quit.
+  int
+    slot,		// where in TapeBuffer the next block goes
+    room,		// ... and how much room there is
+    largest,		// longest block so far
+    pendSlot,		// block waiting for the card
+    pendCount,
+    stalls,		// blocks the drive waited for the card
+    rereads;		// blocks that didn't fit in their slot
+
+//  If offline, quit.
 
   if ( !IsTapeOnline())
   {
@@ -542,19 +748,31 @@ void CmdCreateImage( char *args[])
     return;
   } // tape isn't online
     
-  if ( !noRewind)
-    TapeRewind();
-
 // Note that if not rewinding, our block count is relative to the last
 // known position of the tape.
-
-//  Open the file for writing.
-
-  if ( (fres = f_open( &tf, args[0], FA_CREATE_ALWAYS | FA_WRITE)) != FR_OK)
+//
+//  Open the file for writing while the tape rewinds; making room for
+//  a big image can take a while.
+
+  if ( !NoRewind)
+    TapeStartRewind();
+  ImageToHost = (Name == NULL);
+  HostOnData = ImageToHost && USDataAttached();
+  HostGone = false;
+  ConsoleQuiet = ImageToHost && !HostOnData;
+  if ( !ImageToHost)
   {
-    Uprintf( "\nError in creating file. Error = %d\n", fres);
-    return;
-  } // if open error         
+    if ( (fres = OpenImageFile( &tf, Name, Estimate)) != FR_OK)
+    {
+      TapeWait( NULL);
+      Uprintf( "\nError in creating file. Error = %d\n", fres);
+      return;
+    } // if open error         
+    if ( ImageRaw)
+      Uprintf( "%d KB of the card set aside for the image.\n",
+        (int) (f_size( &tf) / 1024));
+  } // if to a file
+  TapeWait( NULL);
 
 //  Now copy things.
 
@@ -565,7 +783,22 @@ void CmdCreateImage( char *args[])
   fileCount = 0;
   abort = false;
 
+//  With the DMA engine, TapeBuffer is a ring of slots: each block is
+//  read while the one before it goes to the card.  The polled engine
+//  needs the CPU for the read, so there it's one block at a time.
+
+  overlap = (TapeXferMode == XFER_DMA);
+  pending = false;
+  pendSlot = pendCount = 0;
+  pendHeader = 0;
+  largest = 0;
+  stalls = rereads = 0;
+  stopped = STOP_NONE;
+  ClearTiming();
+
   ShowRTCTime();
+  if ( ImageToHost)
+    HostSend( STREAM_START, STREAM_START_LEN);
 
   while( true)
   { // read until done or abort
@@ -577,10 +810,66 @@ void CmdCreateImage( char *args[])
      
     if ( (abort = CheckForEscape()) )  // Check for ESC key
       break;
+    if ( HostGone)
+    {
+      stopped = STOP_HOST;
+      break;
+    }
+
+//  Pick a slot: whichever side of the waiting block is bigger, kept
+//  word-aligned for SDIO DMA.  If the longest block yet won't fit,
+//  the pipeline is full and the card has to catch up first.
 
-//      Read forward.
+    slot = 0;
+    room = TAPE_BUFFER_SIZE;
+    if ( pending)
+    {
+      slot = (pendSlot + pendCount + 3) & ~3;
+      room = TAPE_BUFFER_SIZE - slot;
+      if ( pendSlot > room)
+      {
+        slot = 0;
+        room = pendSlot;
+      }
 
-    readStat = TapeRead( TapeBuffer, TAPE_BUFFER_SIZE, &readCount);
+      if ( !overlap || room < largest)
+      {
+        if ( overlap)
+          stalls++;
+        PutImageRecord( &tf, pendHeader, TapeBuffer + pendSlot, pendCount);
+        pending = false;
+        slot = 0;
+        room = TAPE_BUFFER_SIZE;
+      }
+    } // if a block is waiting
+
+//      Read forward, writing out the last block meanwhile.
+
+    readCount = 0;
+    disk_claim( TapeBuffer + slot, room);	// card may still be reading it
+    readStat = TapeStartRead( TapeBuffer + slot, room);
+    if ( pending)
+    {
+      PutImageRecord( &tf, pendHeader, TapeBuffer + pendSlot, pendCount);
+      pending = false;
+      if ( TapePoll() == TAPE_DONE)
+        stalls++;		// card took longer than the block
+    }
+    if ( readStat == TSTAT_NOERR)
+      readStat = TapeWait( &readCount);
+
+//  A block too long for its slot gets backspaced over and read again
+//  into the whole buffer.
+
+    if ( (readStat & TSTAT_LENGTH) && room < TAPE_BUFFER_SIZE)
+    {
+      SkipBlock( -1);
+      rereads++;
+      continue;
+    }
+    TallyTiming();
+    if ( readCount > largest)
+      largest = readCount;
     tapeHeader = readCount;	// save the record count
 
 //	Have a look at the returned status.
@@ -588,13 +877,19 @@ void CmdCreateImage( char *args[])
     if ( StopAfterError && 
       (readStat & TSTAT_HARDERR))
     {
-      Uprintf( "Stopping at error or blank.\n");
+      stopped = STOP_ERROR;
+      break;
+    }
+
+    if ( readStat & TSTAT_TIMEOUT)
+    {
+      stopped = STOP_TIMEOUT;
       break;
     }
 
     if ( (readStat & TSTAT_BLANK) || (readStat & TSTAT_EOT))
     { // hit a blank; quit
-      Uprintf( "Blank/Erased tape or EOT hit\n");
+      stopped = STOP_BLANK;
       break;
     }
 
@@ -611,98 +906,575 @@ void CmdCreateImage( char *args[])
      
 //  Simply note corrected errors     
      
-     if ( readStat & TSTAT_CORRERR)
+     if ( (readStat & TSTAT_CORRERR) && !ConsoleQuiet)
        Uprintf( "At block %d, an error was auto-corrected.\n", TapePosition); 
       
 //  Also note length error; set error flag.
 
     if( readStat & TSTAT_LENGTH)
     {
-      Uprintf( "Block too long at %d; truncated and flagged.\n", TapePosition);
+      if ( !ConsoleQuiet)
+        Uprintf( "Block too long at %d; truncated and flagged.\n", 
+          TapePosition);
       tapeHeader |= TAP_ERROR_FLAG;
     }
     
     if ( readStat & TSTAT_HARDERR)
     {
-      Uprintf( "At block %d, an un-corrected error was hit.\n", TapePosition);
+      if ( !ConsoleQuiet)
+        Uprintf( "At block %d, an un-corrected error was hit.\n", 
+          TapePosition);
       tapeHeader |= TAP_ERROR_FLAG;
     }
     TapePosition++;
     
-//  Finally, it's time to write out a record.
+//  Finally, the record goes to the card, during the next read.
 
-    f_write( &tf, &tapeHeader, sizeof( tapeHeader), &wc);          
-
-//  If it's a filemark or other 0-length error, don't write the trailer.
-
-    if ( readCount)
-    {
-      f_write( &tf, TapeBuffer, readCount, &wc);
-      f_write( &tf, &tapeHeader, sizeof( tapeHeader), &wc);          
-    }
+    pending = true;
+    pendSlot = slot;
+    pendCount = readCount;
+    pendHeader = tapeHeader;
     
-    AddRecordCount( readCount);
+    if ( ConsoleQuiet)
+      BytesCopied += readCount;
+    else
+      AddRecordCount( readCount);
     if ( tapeMarkSeen == StopTapemarks)  
     {
       fileCount -= (StopTapemarks -1);
-      Uprintf( "%d consecutive tape marks--ending.\n", StopTapemarks);
+      stopped = STOP_TAPEMARKS;
       break;
     } // if tapemark hit
   } // read the tape
   
-// Write an EOM record, rewind and close.
+// Write the last block and an EOM record, rewind and close.
+
+  if ( pending)
+    PutImageRecord( &tf, pendHeader, TapeBuffer + pendSlot, pendCount);
+  PutImageRecord( &tf, TAP_EOM, NULL, 0);
+  switch( stopped)
+  {
+    case STOP_ERROR:
+      Uprintf( "Stopping at error or blank.\n");
+      break;
+
+    case STOP_TIMEOUT:
+      Uprintf( "Formatter not answering--ending.\n");
+      break;
 
-  tapeHeader = TAP_EOM;
-  f_write( &tf, &tapeHeader, sizeof( tapeHeader), &wc);          
+    case STOP_BLANK:
+      Uprintf( "Blank/Erased tape or EOT hit\n");
+      break;
+
+    case STOP_TAPEMARKS:
+      Uprintf( "%d consecutive tape marks--ending.\n", StopTapemarks);
+      break;
+
+    case STOP_HOST:
+      Uprintf( "Host stopped taking the image--ending.\n");
+      break;
+
+    default:
+      break;
+  } // switch
   if ( abort)
   {
     Uprintf( "Operation terminated by operator.\n");
   }
-  f_close( &tf);
-
-  FlushRecordCount();
-  Uprintf( "\nFile %s written.\n", args[0]);
+  if ( ImageToHost)
+  {
+    ImageToHost = false;
+    if ( !HostGone)
+      Uprintf( "\nImage sent.\n");
+  }
+  else
+  {
+    if ( (fres = CloseImageFile( &tf)) != FR_OK)
+      Uprintf( "\nError writing file. Error = %d\n", fres);
+    FlushRecordCount();
+    Uprintf( "\nFile %s written.\n", Name);
+  } // if to a file
   Uprintf( "\n%d blocks read.\n", TapePosition);
   Uprintf( "%d files; %d bytes copied.\n", fileCount, BytesCopied);
-  if (!abort)
-    GetComment( args[0]);		// get a comment
-  if ( !noRewind)
+  if ( overlap)
+    Uprintf( "%d pipeline stalls, %d blocks re-read.\n", stalls, rereads);
+  if ( !NoRewind)
   {
     Uprintf( "Rewinding...\n");
-    TapeRewind();
-    TapePosition = 0;		// we rewound the tape
+    TapeStartRewind();		// while the comment's typed
   } // rewind if requested
+  if ( !abort && Name)
+    GetComment( Name);		// get a comment
+  LogTiming( abort ? NULL : Name);	// and the byte timing after it
+  if ( !NoRewind)
+  {
+    TapeWait( NULL);
+    TapePosition = 0;		// we rewound the tape
+  }
   ShowRTCTime();
   return;
-} // CmdCreateImage
+} // MakeImage
 
-//*	CmdWriteImage - Read tape and write an image file.
-//	------------------------------------------------
+//	PutImageRecord - Write one record to a .TAP image.
+//	---------------------------------------------------
 //
-//	Currently, the only required argument is the image file name.
-//	We may add others later.
+//	Header, data and trailer; a zero-length record (tapemark) is
+//	just the header.
 //
 
-void CmdWriteImage( char *args[])
+static void PutImageRecord( FIL *File, uint32_t Header, uint8_t *Buf,
+  int Count)
+{
+
+  WriteImage( File, &Header, sizeof( Header));
+  if ( Count)
+  {
+    WriteImage( File, Buf, Count);
+    WriteImage( File, &Header, sizeof( Header));
+  }
+  return;
+} // PutImageRecord
+
+//	OpenImageFile - Create an image file and set aside its extent.
+//	--------------------------------------------------------------
+//
+//	Asks for Megabytes of contiguous space, trimmed to what's free
+//	and halved until the card can find it.  If it can't find even a
+//	megabyte, the image is written the ordinary way.  Any other
+//	error from the card closes the file and is returned.
+//
+
+static FRESULT OpenImageFile( FIL *File, char *Name, uint32_t Megabytes)
+{
+
+  FRESULT
+    fres;
+  FATFS
+    *fs;
+  DWORD
+    freeClusters;
+  FSIZE_t
+    size,			// extent to ask for
+    limit;			// free space
+
+  ImageRaw = false;
+  ImageBytes = 0;
+  ImageError = FR_OK;
+  StageSide = StageFill = 0;
+  if ( (fres = f_open( File, Name, FA_CREATE_ALWAYS | FA_WRITE)) != FR_OK)
+    return fres;
+
+  size = (FSIZE_t) Megabytes << 20;
+  if ( f_getfree( "", &freeClusters, &fs) == FR_OK)
+  {
+    limit = (FSIZE_t) freeClusters * fs->csize * BLOCK_SIZE;
+    if ( size > limit)
+      size = limit;
+  }
+
+  while ( size >= ((FSIZE_t) 1 << 20))
+  {
+    if ( (fres = f_expand( File, size, 1)) == FR_OK)
+    {
+      fs = File->obj.fs;
+      RawSector = fs->database + (LBA_t) fs->csize * (File->obj.sclust - 2);
+      RawLimit = RawSector + (LBA_t) (size / BLOCK_SIZE);
+      ImageRaw = true;
+      break;
+    }
+    if ( fres != FR_DENIED)
+    {
+      f_close( File);		// something worse than no room
+      return fres;
+    }
+    size /= 2;
+  } // look for an extent
+  return FR_OK;
+} // OpenImageFile
+
+//	WriteImage - Write to the image file.
+//	-------------------------------------
+//
+//	Everything is packed into the staging buffers, so that what goes
+//	out is always whole, word-aligned sectors at a sector boundary
+//	of the file: straight to the card inside the extent, through
+//	f_write past it--where FatFs can then hand the buffer to the
+//	card as is, with no read-modify-write of a partial sector.
+//
+
+static void WriteImage( FIL *File, const void *Buf, UINT Count)
+{
+
+  UINT
+    size,			// where this buffer must go out
+    room;
+  const uint8_t
+    *from;
+
+  if ( ImageToHost)
+  {
+    HostSend( Buf, Count);
+    return;
+  } // if streaming
+
+  from = (const uint8_t *) Buf;
+  while ( Count)
+  {
+    size = IMAGE_STAGE_SIZE;
+    if ( ImageRaw && (RawLimit - RawSector) * BLOCK_SIZE < size)
+      size = (RawLimit - RawSector) * BLOCK_SIZE;
+    room = size - StageFill;
+    if ( room > Count)
+      room = Count;
+
+    memcpy( ImageStage[ StageSide] + StageFill, from, room);
+    StageFill += room;
+    ImageBytes += room;
+    from += room;
+    Count -= room;
+    if ( StageFill == (int) size)
+      FlushStage( File);
+  } // while there's data
+  return;
+} // WriteImage
+
+//	FlushStage - Send the staging buffer out.
+//	-----------------------------------------
+//
+//	Inside the extent, a partial last sector goes out whole;
+//	CloseImageFile trims the file to size.  When the extent is full,
+//	the file pointer moves to its end for f_write to carry on.  The
+//	write is left in progress.
+//
+
+static void FlushStage( FIL *File)
+{
+
+  UINT
+    sectors,
+    wc;
+
+  if ( !StageFill)
+    return;
+  if ( ImageRaw)
+  {
+    sectors = (StageFill + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    if ( disk_write( File->obj.fs->pdrv, ImageStage[ StageSide], RawSector,
+      sectors) != RES_OK && ImageError == FR_OK)
+      ImageError = FR_DISK_ERR;
+    RawSector += sectors;
+    if ( RawSector == RawLimit)
+    { // extent full; carry on the ordinary way
+      ImageRaw = false;
+      if ( f_lseek( File, f_size( File)) != FR_OK && ImageError == FR_OK)
+        ImageError = FR_DISK_ERR;
+    }
+  } // if in the extent
+  else if ( (f_write( File, ImageStage[ StageSide], StageFill, &wc) != FR_OK ||
+    wc != (UINT) StageFill) && ImageError == FR_OK)
+    ImageError = FR_DISK_ERR;
+
+  StageSide ^= 1;
+  StageFill = 0;
+  disk_claim( ImageStage[ StageSide], IMAGE_STAGE_SIZE);
+  return;
+} // FlushStage
+
+//	CloseImageFile - Finish the image and trim it to size.
+//	------------------------------------------------------
+//
+//	Returns the first error seen writing it.
+//
+
+static FRESULT CloseImageFile( FIL *File)
+{
+
+  FRESULT
+    fres;
+  bool
+    raw;
+
+  raw = ImageRaw;
+  FlushStage( File);
+  if ( raw && (fres = f_lseek( File, ImageBytes)) != FR_OK &&
+    ImageError == FR_OK)
+    ImageError = fres;
+  ImageRaw = false;
+  if ( (fres = f_truncate( File)) != FR_OK && ImageError == FR_OK)
+    ImageError = fres;
+  if ( (fres = f_close( File)) != FR_OK && ImageError == FR_OK)
+    ImageError = fres;
+  return ImageError;
+} // CloseImageFile
+
+//	GetImageRecord - Read the next .TAP record into the queue.
+//	----------------------------------------------------------
+//
+//	The record gets a word-aligned slot after the newest data in the
+//	queue, wrapping to the start of TapeBuffer if it won't fit at
+//	the end, and checks the trailer against the header.  If there's
+//	no slot big enough yet, the header is kept for next time.
+//
+//	With File NULL, the record comes from the host (STREAMW).  That
+//	never waits: whatever has arrived is taken, and IMAGE_WAIT says
+//	to call again for the rest.  A record that's partly in keeps its
+//	slot until it's complete.
+//
+
+static int GetImageRecord( FIL *File)
 {
 
   FRESULT
     fres;               // file result codes
+  UINT
+    bytesRead;		// how many bytes read
+  uint32_t
+    trailer;		// trailing header
+  int
+    count,		// record length
+    slot;		// where this one goes
+  IMAGE_RECORD
+    *rec;
 
-  FIL 
-    tf;                 // our file structure
+  if ( QueueCount == IMAGE_QUEUE)
+    return IMAGE_FULL;
+
+  if ( !HaveHeader)
+  {
+    if ( !File)
+    {
+      if ( !GetFromHost( &NextHeader, sizeof( NextHeader)))
+        return IMAGE_WAIT;
+    }
+    else
+    {
+      fres = f_read( File, &NextHeader, sizeof( NextHeader), &bytesRead);
+      if ( (bytesRead == 0) && (fres == FR_OK))
+        return IMAGE_END;		// we hit eof
+      if ( (fres != FR_OK) || (bytesRead != sizeof( NextHeader)) )
+        return IMAGE_ERROR;
+    } // if from a file
+    HaveHeader = true;
+  } // if no header in hand
+
+//	Check out the header--if zero, it's a file mark. If it's EOM, we're done.
+//	Otherwise, the lower 24 bits has the record length; make sure that it's
+//	less than our buffer size.
+
+  if ( NextHeader == TAP_EOM)
+    return IMAGE_END;
+  count = (int) (NextHeader & TAP_LENGTH_MASK);
+  if ( count >= TAPE_BUFFER_SIZE)
+    return IMAGE_CORRUPT;
+
+  slot = (PartSlot >= 0) ? PartSlot : FindImageSlot( count);
+  if ( slot < 0)
+    return IMAGE_FULL;			// wait for the tape to catch up
+
+//  Read up the record, read the trailer and compare it to the header--
+//  they should be the same.  A tapemark has no trailer.
+
+  if ( NextHeader != 0)
+  {
+    if ( !File)
+    {
+      PartSlot = slot;
+      if ( !HaveData)
+      {
+        if ( !GetFromHost( TapeBuffer + slot, count))
+          return IMAGE_WAIT;
+        HaveData = true;
+      }
+      if ( !GetFromHost( &NextTrailer, sizeof( NextTrailer)))
+        return IMAGE_WAIT;
+      PartSlot = -1;
+      HaveData = false;
+      trailer = NextTrailer;
+    }
+    else
+    {
+      fres = f_read( File, TapeBuffer + slot, count, &bytesRead);
+      if ( (fres != FR_OK) || (bytesRead != (UINT) count))
+        return IMAGE_CORRUPT;
+      fres = f_read( File, &trailer, sizeof( trailer), &bytesRead);
+      if ( (fres != FR_OK) || (bytesRead != sizeof( trailer)))
+        return IMAGE_CORRUPT;
+    } // if from a file
+    if ( trailer != NextHeader)
+      return IMAGE_CORRUPT;
+  } // if not tapemark
+
+  rec = &ImageQueue[ (QueueHead + QueueCount) % IMAGE_QUEUE];
+  rec->Slot = slot;
+  rec->Count = count;
+  rec->Header = NextHeader;
+  QueueCount++;
+  if ( count)
+    QueueEnd = (slot + count + 3) & ~3;
+  HaveHeader = false;
+  return IMAGE_OK;
+} // GetImageRecord
+
+//	FindImageSlot - Find room in TapeBuffer for a record.
+//	-----------------------------------------------------
+//
+//	Returns the slot, or -1 if there's no room yet.  Tapemarks don't
+//	need one, and don't count in working out where the data in the
+//	queue is.
+//
+
+static int FindImageSlot( int Count)
+{
 
   int
-    fileCount;          // how many files?
+    first,		// slot of the oldest data
+    last,		// ... and the newest
+    slot,
+    i;
+  IMAGE_RECORD
+    *rec;
 
-  unsigned int
-    status;		// tape driver return status
+  first = last = -1;
+  for ( i = 0; i < QueueCount; i++)
+  {
+    rec = &ImageQueue[ (QueueHead + i) % IMAGE_QUEUE];
+    if ( rec->Count)
+    {
+      if ( first < 0)
+        first = rec->Slot;		// oldest data
+      last = rec->Slot;			// newest
+    }
+  } // for each record queued
 
-  bool
-    noRewind,		// nonzero if skip rewind
-    abort;		// nonzero if ESC hit
+  slot = 0;
+  if ( Count && first >= 0)
+  {
+    slot = QueueEnd;
+    if ( last >= first)
+    { // not wrapped: free space at the end and at the start
+      if ( slot + Count > TAPE_BUFFER_SIZE)
+      {
+        slot = 0;
+        if ( Count > first)
+          return -1;
+      }
+    }
+    else if ( slot + Count > first)
+      return -1;
+  } // if others are queued
+  return slot;
+} // FindImageSlot
+
+//	WaitImageRecord - Read the next record, waiting for the host.
+//	-------------------------------------------------------------
+//
+//	GetImageRecord, but IMAGE_WAIT is retried until the record's in.
+//	Not for ever, though: if the host sends nothing for
+//	HOST_IDLE_MSEC, it's taken to be gone (HostGone is set) and
+//	IMAGE_STALLED is returned.  While the console is free, ESC
+//	returns IMAGE_ABORT.
+//
+
+static int WaitImageRecord( FIL *File)
+{
+
+  int
+    fill;
+
+  while ( (fill = GetImageRecord( File)) == IMAGE_WAIT)
+  {
+    if ( !ConsoleQuiet && CheckForEscape())
+      return IMAGE_ABORT;
+    if ( PertMsec() - HostHeard > HOST_IDLE_MSEC)
+    {
+      HostGone = true;
+      return IMAGE_STALLED;
+    }
+  } // while the host's still sending it
+  return fill;
+} // WaitImageRecord
+
+//	GetFromHost - Collect Count bytes of host input into Buf.
+//	---------------------------------------------------------
+//
+//	Takes what's there and returns false until all of it is in;
+//	call again with the same Buf and Count for the rest.
+//
+
+static bool GetFromHost( void *Buf, int Count)
+{
+
+  int
+    got;
+
+  got = HostTake( (uint8_t *) Buf + HostGot, Count - HostGot);
+  if ( got > 0)
+    HostHeard = PertMsec();
+  HostGot += got;
+  if ( HostGot < Count)
+    return false;
+  HostGot = 0;
+  return true;
+} // GetFromHost
+
+//	SendWriteStatus - Tell the host how a record went.
+//	--------------------------------------------------
+//
 
-  noRewind = false;	// assume rewinding
+static void SendWriteStatus( uint16_t Status)
+{
+
+  uint8_t
+    word[ 2];
+
+  word[ 0] = (uint8_t) Status;
+  word[ 1] = (uint8_t) (Status >> 8);
+  HostSend( word, sizeof( word));
+  return;
+} // SendWriteStatus
+
+//	HostSend, HostTake - Image traffic with the host.
+//	-------------------------------------------------
+//
+//	On the USB data interface if the host has attached it, else on
+//	the console.  HostTake doesn't wait; it returns what it got.
+//	A short write on the data interface means the host has gone
+//	away; HostGone is set, and nothing more is sent.
+//
+
+static void HostSend( const void *Buf, int Count)
+{
+
+  if ( HostOnData)
+  {
+    if ( !HostGone && USDataWrite( (uint8_t *) Buf, Count) < Count)
+      HostGone = true;
+  }
+  else
+    USWriteBlock( (uint8_t *) Buf, Count);
+  return;
+} // HostSend
+
+static int HostTake( void *Buf, int Count)
+{
+
+  if ( HostOnData)
+    return USDataRead( (uint8_t *) Buf, Count);
+  return USReadBlock( (uint8_t *) Buf, Count);
+} // HostTake
+
+//*	CmdWriteImage - Write tape from an image file.
+//	----------------------------------------------
+//
+//	The only required argument is the image file name; N after it
+//	means don't rewind.
+//
+
+void CmdWriteImage( char *args[])
+{
+
+  bool
+    noRewind;		// if true, skip rewinding
 
   if ( !args[0])
   {
@@ -710,31 +1482,103 @@ void CmdWriteImage( char *args[])
     return;
   } // if no arguments
   
-  if ( args[1])
-  {
-    if ( toupper( *args[1]) == 'N')
-      noRewind = true;			// don't rewind before or after
-  } // see if no rewinding
-  
+  noRewind = args[1] && toupper( *args[1]) == 'N';
+  WriteTapeImage( args[0], noRewind);
+  return;
+} // CmdWriteImage
+
+//*	CmdStreamWrite - Write tape from an image sent by the host.
+//	-----------------------------------------------------------
+//
+//	Like WRITE, but the image comes over the console link and goes
+//	straight to tape; see tapestream.h for the framing.  The host
+//	is held off while the buffer's full, so it can send as fast as
+//	it likes.  [N] = no rewind.
+//
+
+void CmdStreamWrite( char *args[])
+{
+
+  bool
+    noRewind;		// if true, skip rewinding
+
+  noRewind = args[0] && toupper( *args[0]) == 'N';
+  WriteTapeImage( NULL, noRewind);
+  return;
+} // CmdStreamWrite
+
+//	WriteTapeImage - Write an image to tape.
+//	----------------------------------------
+//
+//	The image comes from file Name, or from the host if Name is NULL.
+//	Each record from the host is answered with its status, and after
+//	a failure the rest are read and answered STREAM_SKIPPED up to the
+//	EOM.  With the image on the console, ESC can't be seen, and the
+//	host ends early by sending the EOM; on the USB data interface,
+//	ESC works and counts as a failure.  A host that sends nothing
+//	for HOST_IDLE_MSEC ends the write, with an error.
+//
+
+static void WriteTapeImage( char *Name, bool NoRewind)
+{
+
+  FRESULT
+    fres;               // file result codes
+
+  FIL 
+    tf,                 // our file structure
+    *file;		// ... or NULL for the host
+
+  int
+    fileCount,          // how many files?
+    fill,		// GetImageRecord result
+    stalls;		// blocks the drive waited for the card
+
+  unsigned int
+    status;		// tape driver return status
+
+  uint32_t
+    gap,		// time from one block's end to the next GO
+    gapTotal,
+    gapMax,
+    gapCount,
+    blockEnd;		// when the last block ended
+
+  bool
+    abort,		// nonzero if ESC hit
+    failed,		// a write to tape failed
+    overlap,		// true if card reads run during tape writes
+    more;		// true if there's more in the image
+
+  IMAGE_RECORD
+    *rec;		// record going to tape
+
 //  Open the file for reading.
 
-  if ( (fres = f_open( &tf, args[0], FA_READ)) != FR_OK)
+  file = NULL;
+  if ( Name)
   {
-    Uprintf( "\nCan't find file %s. Error = %d\n", args[0], fres);
-    return;
-  } // if open error         
+    if ( (fres = f_open( &tf, Name, FA_READ)) != FR_OK)
+    {
+      Uprintf( "\nCan't find file %s. Error = %d\n", Name, fres);
+      return;
+    } // if open error         
+    file = &tf;
+  } // if from a file
+  HostOnData = !file && USDataAttached();
+  HostGone = false;
+  ConsoleQuiet = !file && !HostOnData;
  
-//  Rewind the tape if necessary.  If offline, quit.
+//  If offline, quit.
 
   if ( !IsTapeOnline())
   {
     Uprintf( "\nTape is offline.\n");
+    if ( file)
+      f_close( file);
     return;
   } // tape isn't online
     
-  if ( !noRewind)
-    TapeRewind();
-
 // Note that if not rewinding, our block count is relative to the last
 // known position of the tape.
 //
@@ -743,93 +1587,166 @@ void CmdWriteImage( char *args[])
   if (IsTapeProtected())
   {
     Uprintf( "\nTape is protected (no ring, no write).\n");
+    if ( file)
+      f_close( file);
     return;
   }  // if tape write protected
 
+//  Rewind if necessary; the read-ahead gets going meanwhile.
+
+  if ( !NoRewind)
+    TapeStartRewind();
+
 //  Now copy things.
 
-  abort = 0;
+  abort = failed = false;
   LastRecordCount = 0;	// how many records of the same size
   TapePosition = 0;	// block counter
   BytesCopied = 0;	// data counter
   fileCount = 0;	// file count
   status = TSTAT_NOERR;	// assume no tape errors yet
 
+//  With the DMA engine, the records after the one on the tape are
+//  read ahead into the queue while it goes out.  The polled engine
+//  needs the CPU for the write, so there it's one record at a time.
+
+  overlap = (TapeXferMode == XFER_DMA);
+  QueueHead = QueueCount = QueueEnd = 0;
+  HaveHeader = HaveData = false;
+  PartSlot = -1;
+  HostGot = 0;
+  HostHeard = PertMsec();
+  fill = IMAGE_OK;
+  more = true;
+  stalls = 0;
+  gapTotal = gapMax = gapCount = 0;
+  blockEnd = 0;
+
+  if ( !file)
+    HostSend( STREAM_WRITE, STREAM_WRITE_LEN);
+
+//  Read ahead while the tape rewinds.
+
+  while ( more && TapePoll() == TAPE_REWINDING)
+  {
+    fill = GetImageRecord( file);
+    if ( fill == IMAGE_FULL)
+      break;
+    if ( fill == IMAGE_WAIT)
+      continue;
+    more = (fill == IMAGE_OK);
+  } // while rewinding
+  TapeWait( NULL);
+
   while( true)
   {
-  
-    uint32_t
-      header1,		// leading header
-      header2;		// trailing header
 
-    UINT 
-      bcount;
+//  If nothing's been read ahead, the drive has to wait for the card
+//  (or the host).
 
-    UINT
-      bytesRead;	// how many bytes read
-    
-    fres = f_read( &tf, &header1, sizeof(header1), &bytesRead);
-    if ((bytesRead == 0) && (fres == FR_OK))
-      break;			// we hit eof
-      
-//	See if something's wrong      
-      
-    if ( (fres != FR_OK) || (bytesRead != sizeof(header1)) )
+    if ( !QueueCount)
     {
-      Uprintf( "File read error--aborted\n");
-      break;
-    } // read error
-    
-//	Check out the header--if zero, it's a file mark. If it's EOM, we're done.
-//	Otherwise, the lower 24 bits has the record length; make sure that it's
-//	less than our buffer size.  If it checks out, read up the record, read
-//	the trailer and compare it to the header--they should be the same.
-
-    if ( (abort = CheckForEscape()) )  // Check for ESC key
+      if ( !more)
+        break;
+      fill = WaitImageRecord( file);
+      if ( fill == IMAGE_ABORT)
+      {
+        abort = true;
+        failed = !file;			// the host hears it as a failure
+        break;
+      }
+      if ( fill != IMAGE_OK)
+        break;
+      if ( TapePosition)
+        stalls++;
+    } // if the queue ran dry
+
+    if ( !ConsoleQuiet && (abort = CheckForEscape()) )  // Check for ESC key
+    {
+      failed = !file;			// the host hears it as a failure
       break;
-    if ( header1 == TAP_EOM)
-      break;			// finished
+    }
+    rec = &ImageQueue[ QueueHead];
     TapePosition++;			// bump block number
-    
-    if ( header1 != 0)
-    { // if not tapemark
-      
-      bool corrupt;
-      
-      corrupt = true;			// assume things will go south
-      
-      bcount = header1 & TAP_LENGTH_MASK;
-      if (bcount < TAPE_BUFFER_SIZE)
-      { // block size is in range
-        fres = f_read( &tf, TapeBuffer, bcount, &bytesRead);
-        if ((bytesRead == bcount) && (fres == FR_OK))
-        { // file read is okay
-          fres = f_read( &tf, &header2, sizeof(header2), &bytesRead);
-          if ((bytesRead == sizeof(header2)) && (fres == FR_OK))
-          {
-            if ( header1 == header2)
-            {
-              corrupt = false;		// say the record looks good
-              status = TapeWrite( TapeBuffer, bcount);
-            } // header and trailer check out
-          } // read of trailer looks good
-        } // if read of data looks good
-      } // block size is in range      
-      if ( corrupt)
+
+    if ( TapePosition > 1)
+    {
+      gap = Microseconds() - blockEnd;
+      gapTotal += gap;
+      gapCount++;
+      if ( gap > gapMax)
+        gapMax = gap;
+    } // if there was a block before
+
+//  Start the write and read ahead while it goes out.  The host may
+//  not have sent the next record yet, so keep taking what it has
+//  until the write's done.
+
+    status = TapeStartWrite( TapeBuffer + rec->Slot, rec->Count);
+    if ( status == TSTAT_NOERR)
+    {
+      while ( overlap && more && TapePoll() == TAPE_DATA)
       {
-        Uprintf( "\nImage file corrupt at block %d.\n", TapePosition);
-        break;                               
-      }  // show corruption
-    } // appears to be a data block
-    else 
-    { // we have a tapemark 
-      bcount = 0;
-      status = TapeWrite( TapeBuffer, 0);
-      fileCount++;
-    } // write a tapemark
-    AddRecordCount( bcount);		// sum it up
+        fill = GetImageRecord( file);
+        if ( fill == IMAGE_FULL)
+          break;
+        if ( fill == IMAGE_WAIT)
+          continue;
+        more = (fill == IMAGE_OK);
+      } // while reading ahead
+      status = TapeWait( NULL);
+      blockEnd = Microseconds();
+    } // if the write started
+
+    if ( rec->Header == 0)
+      fileCount++;			// we wrote a tapemark
+    if ( !ConsoleQuiet)
+      AddRecordCount( rec->Count);	// sum it up
+    else
+      BytesCopied += rec->Count;	// no text while the host's sending
+    QueueHead = (QueueHead + 1) % IMAGE_QUEUE;
+    QueueCount--;
+
+    if ( !file)
+    {
+      SendWriteStatus( (uint16_t) status);
+      if ( HostGone)
+        break;				// no one to answer
+      if ( (failed = (status & ~TSTAT_CORRERR) != 0) )
+        break;
+    } // if to the host
+    if ( status & TSTAT_TIMEOUT)
+      break;				// no use going on
   } // while  we have data
-  
+
+//  After a failure, the host still sends up to the EOM; answer the
+//  rest without writing them.
+
+  if ( failed)
+  {
+    for ( ; QueueCount; QueueCount--)
+      SendWriteStatus( STREAM_SKIPPED);
+    QueueHead = QueueEnd = 0;
+    while ( more && !HostGone)
+    {
+      fill = WaitImageRecord( file);
+      if ( fill != IMAGE_OK)
+        break;				// EOM, gone quiet or ESC
+      SendWriteStatus( STREAM_SKIPPED);
+      QueueHead = QueueCount = QueueEnd = 0;
+    } // while the host's still sending
+  } // if a write failed
+
+  if ( !file)
+    SendWriteStatus( STREAM_END);
+  if ( HostGone)
+    Uprintf( "\nHost stopped answering--ending.\n");
+
+  if ( fill == IMAGE_CORRUPT)
+    Uprintf( "\nImage file corrupt at block %d.\n", TapePosition + 1);
+  else if ( fill == IMAGE_ERROR)
+    Uprintf( "File read error--aborted\n");
+
   if ( status != TSTAT_NOERR)
   { // diagnose any media errors
     Uprintf( "Tape error - %s\n", TranslateError( status));  
@@ -837,7 +1754,8 @@ void CmdWriteImage( char *args[])
   
 // close up and give a summary.
 
-  f_close(&tf);
+  if ( file)
+    f_close( file);
 
   if ( abort)
   {
@@ -845,11 +1763,17 @@ void CmdWriteImage( char *args[])
   }
 
   FlushRecordCount();
-  Uprintf( "\nFile %s written to tape.\n", args[0]);
+  if ( file)
+    Uprintf( "\nFile %s written to tape.\n", Name);
+  else
+    Uprintf( "\nImage from host written to tape.\n");
   Uprintf( "\n%d blocks read.\n", TapePosition);
   Uprintf( "%d files; %d bytes copied.\n", fileCount, BytesCopied);
+  if ( gapCount)
+    Uprintf( "Gap between blocks %d usec average, %d longest; "
+      "%d pipeline stalls.\n", gapTotal / gapCount, gapMax, stalls);
 
-  if ( !noRewind)
+  if ( !NoRewind)
   {
     Uprintf( "Rewinding...\n");
     TapeRewind();
@@ -857,7 +1781,7 @@ void CmdWriteImage( char *args[])
   } // rewind if requested
 
   return;
-} // CmdWriteImage
+} // WriteTapeImage
 
 //  CmdSet6250 - Set 6250 GCR density.
 //  ----------------------------------
@@ -897,9 +1821,440 @@ void CmdSet1600( char *args[])
 } // CmdSet1600
 
 
+//*	CmdSetSpeed - Select the tape speed.
+//	------------------------------------
+//
+//	L = low speed throughout, H = high speed throughout, A = high
+//	speed for spacing and streaming reads, low for the rest.  Also
+//	says what the last operation asked for and what the drive
+//	reported running at.
+//
+
+void CmdSetSpeed( char *args[])
+{
+
+  TAPE_SPEED
+    speed;
+
+  if ( args[0])
+  {
+    switch( toupper( *args[0]))
+    {
+      case 'L':
+        TapeSpeed = SPEED_LOW;
+        break;
+
+      case 'H':
+        TapeSpeed = SPEED_HIGH;
+        break;
+
+      case 'A':
+        TapeSpeed = SPEED_AUTO;
+        break;
+
+      default:
+        Uprintf( "Specify L (low), H (high) or A (auto)\n");
+        break;
+    } // switch
+  } // if present
+  Uprintf( "Tape speed is %s\n",
+    (TapeSpeed == SPEED_AUTO) ? "auto: high for spacing and streaming reads" :
+    (TapeSpeed == SPEED_HIGH) ? "high" : "low");
+  TapeOpSpeed( &speed);
+  Uprintf( "Last operation asked for %s speed; the drive ran at %s.\n",
+    speed.Asked ? "high" : "low", speed.Ran ? "high" : "low");
+  return;
+} // CmdSetSpeed
+
+
+//*	CmdSetXfer - Select the data transfer engine.
+//	---------------------------------------------
+//
+//	P = polled, the CPU strobes every byte.  D = timer/DMA, the
+//	CPU is involved only at the start and end of a block.
+//
+
+void CmdSetXfer( char *args[])
+{
+
+  if ( args[0])
+  {
+    switch( toupper( *args[0]))
+    {
+      case 'P':
+        TapeXferMode = XFER_POLLED;
+        break;
+
+      case 'D':
+        TapeXferMode = XFER_DMA;
+        break;
+
+      default:
+        Uprintf( "Specify P (polled) or D (DMA)\n");
+        break;
+    } // switch
+  } // if present
+  Uprintf( "Tape data transfers are %s\n",
+    (TapeXferMode == XFER_DMA) ? "timer/DMA" : "polled");
+  return;
+} // CmdSetXfer
+
+//*	CmdTune - See which drives polled reads can keep up with.
+//	---------------------------------------------------------
+//
+//	Reads up to n blocks (default TUNE_BLOCKS), or to a tapemark,
+//	with the polled engine and takes the worst wait for a byte.
+//	Set against the character time of each standard speed and
+//	density, that says what polled reads can sustain: "yes" with
+//	TIMING_MARGIN_PCT to spare, "marginal" without, "no" at all.
+//	The findings are appended to TUNE_FILE.  The table is only
+//	advice: transfers are switched to DMA only if some of the blocks
+//	just read were late (TIMING_MARGIN_PCT not met), since TUNE can't
+//	tell which row of the table the drive on hand is.
+//
+
+void CmdTune( char *args[])
+{
+
+  static const uint16_t
+    speeds[] = { 25, 45, 50, 75, 100, 125, 200},	// ips
+    densities[] = { 800, 1600, 3200, 6250};		// bpi
+
+  unsigned int
+    status;
+  int
+    blocks,		// how many to read
+    bytesRead,
+    saveMode,		// transfer engine before
+    i,
+    j;
+  uint32_t
+    charTime;		// cycles per character
+  char
+    *verdict;
+  FIL
+    tf;
+  bool
+    logged;		// TUNE_FILE is open
+
+  if ( !IsTapeOnline())
+  {
+    Uprintf( "Error - tape drive is offline.\n");
+    return;
+  }
+  blocks = args[0] ? atoi( args[0]) : 0;
+  if ( blocks <= 0)
+    blocks = TUNE_BLOCKS;
+
+  saveMode = TapeXferMode;
+  TapeXferMode = XFER_POLLED;
+  ClearTiming();
+  while ( blocks--)
+  {
+    status = TapeRead( TapeBuffer, TAPE_BUFFER_SIZE, &bytesRead);
+    TallyTiming();
+    TapePosition++;
+    if ( status & (TSTAT_TAPEMARK | TSTAT_BLANK | TSTAT_EOT | TSTAT_OFFLINE |
+      TSTAT_TIMEOUT))
+      break;
+  } // read the sample
+  TapeXferMode = saveMode;
+  if ( TimedBlocks == 0)
+  {
+    Uprintf( "No data blocks read; nothing to go on.\n");
+    return;
+  }
+
+  Uprintf( "%d blocks read; worst wait %d nsec, character time here"
+    " %d nsec.\n\n", TimedBlocks, Nsec( WorstWait), Nsec( LeastCharTime));
+  logged = f_open( &tf, TUNE_FILE, FA_OPEN_APPEND | FA_WRITE) == FR_OK;
+  if ( logged)
+    f_printf( &tf, "Polled reads: worst wait %u nsec over %u blocks,"
+      " %u%% margin.\n", (unsigned) Nsec( WorstWait),
+      (unsigned) TimedBlocks, TIMING_MARGIN_PCT);
+
+  for ( i = 0; i < (int) (sizeof( speeds) / sizeof( speeds[0])); i++)
+  {
+    Uprintf( "%3d ips ", speeds[ i]);
+    if ( logged)
+      f_printf( &tf, "%3u ips ", speeds[ i]);
+    for ( j = 0; j < (int) (sizeof( densities) / sizeof( densities[0])); j++)
+    {
+      charTime = CYCLES_PER_USEC * 1000000 / (speeds[ i] * densities[ j]);
+      if ( (uint64_t) WorstWait * 100 <=
+        (uint64_t) charTime * (100 - TIMING_MARGIN_PCT))
+        verdict = "yes";
+      else if ( WorstWait < charTime)
+        verdict = "marginal";
+      else
+        verdict = "no";
+      Uprintf( " %4d bpi %9s", densities[ j], verdict);
+      if ( logged)
+        f_printf( &tf, " %4u bpi %-9s", densities[ j], verdict);
+    }
+    Uprintf( "\n");
+    if ( logged)
+      f_printf( &tf, "\n");
+  } // for each speed
+  if ( logged)
+    f_close( &tf);
+  else
+    Uprintf( "Couldn't write %s.\n", TUNE_FILE);
+
+  if ( LateBlocks)
+  {
+    TapeXferMode = XFER_DMA;
+    Uprintf( "\n%d blocks late here; tape data transfers are now"
+      " timer/DMA.\n", LateBlocks);
+  }
+  else
+    Uprintf( "\nPolled reads keep up with this drive.\n");
+  return;
+} // CmdTune
+
+//*	CmdShowStats - Show the timing probes' figures and start over.
+//	--------------------------------------------------------------
+//
+//	Averages are per unit--per byte for the data phase, per call
+//	for the rest--in cycles and, roughly, microseconds.  The
+//	histogram counts times of under 2^n cycles.  Only a build with
+//	HOT_STATS has any.
+//
+
+void CmdShowStats( char *args[])
+{
+
+#ifdef HOT_STATS
+  STAT_ENTRY
+    *s;
+  uint32_t
+    average;
+  int
+    i,
+    bucket;
+#endif
+
+  (void) args;
+
+#ifdef HOT_STATS
+  StatTake( StatShown);
+  Uprintf( "\nProbe              Count   Average    (usec)       Min"
+    "       Max\n");
+  for ( i = 0; i < STAT_PROBES; i++)
+  {
+    s = &StatShown[ i];
+    if ( s->Count == 0)
+      continue;
+    average = Showable( s->Cycles / s->Units);
+    Uprintf( "%14s %9d %9d %9d %9d %9d\n", (char *) StatNames[ i],
+      Showable( s->Count), average, average / CYCLES_PER_USEC,
+      Showable( s->Min), Showable( s->Max));
+    Uprintf( "  ");
+    for ( bucket = 0; bucket < STAT_BUCKETS; bucket++)
+      if ( s->Hist[ bucket])
+        Uprintf( " 2^%d:%d", bucket, s->Hist[ bucket]);
+    Uprintf( "\n");
+  } // for each probe
+#else
+  Uprintf( "\nNot built with the timing probes (make STATS=1).\n");
+#endif
+  return;
+} // CmdShowStats
+
+//*	CmdEdges - Show the recent changes in tape status and start over.
+//	-----------------------------------------------------------------
+//
+//	The driver logs each change it finds when it reads the status, so
+//	this shows what states a drive went through in the last few
+//	operations.  The times are when each change was found, not when
+//	it happened: between operations nothing reads the status, so a
+//	drive going offline, say, shows up at the next command.
+//
+
+void CmdEdges( char *args[])
+{
+
+  TAPE_EDGE
+    *e;
+  uint16_t
+    changed;
+  int
+    i,
+    j,
+    count;
+
+  (void) args;
+  count = TapeEdges( EdgesShown);
+  if ( count == 0)
+  {
+    Uprintf( "\nNo status changes seen.\n");
+    return;
+  }
+  Uprintf( "\nSeen msec  Status  Changes\n");
+  for ( i = 0; i < count; i++)
+  {
+    e = &EdgesShown[ i];
+    Uprintf( "%9d    %04x  ", Showable( e->Msec), e->Now);
+    changed = e->Was ^ e->Now;
+    for ( j = 0; DriveStatusTable[ j].SetTxt; j++)
+      if ( changed & DriveStatusTable[ j].BitVal)
+        Uprintf( "%c%s ", (e->Now & DriveStatusTable[ j].BitVal) ? '+' : '-',
+          DriveStatusTable[ j].SetTxt);
+    Uprintf( "\n");
+  } // for each change
+  return;
+} // CmdEdges
+
 //*	Local utility routines.
 //	=======================
 
+//	Showable - Clip a figure to what Uprintf can print.
+//	---------------------------------------------------
+//
+
+static uint32_t Showable( uint64_t What)
+{
+  return What > STAT_SHOW_MAX ? STAT_SHOW_MAX : (uint32_t) What;
+} // Showable
+
+//	Nsec - Cycles to nanoseconds, clipped for Uprintf.
+//	--------------------------------------------------
+//
+
+static uint32_t Nsec( uint32_t Cycles)
+{
+  return Showable( (uint64_t) Cycles * 1000 / CYCLES_PER_USEC);
+} // Nsec
+
+//	ClearTiming - Start a new byte timing tally.
+//	--------------------------------------------
+//
+
+static void ClearTiming( void)
+{
+
+  TimedBlocks = LateBlocks = 0;
+  WorstWait = LeastCharTime = 0;
+  SpeedBlocks = HighBlocks = SpeedMisses = 0;
+  return;
+} // ClearTiming
+
+//	TallyTiming - Add the block just read to the byte timing tally.
+//	---------------------------------------------------------------
+//
+//	Blocks with no character time--DMA reads, tapemarks, one-byte
+//	blocks--don't count.  Call before TapePosition moves on.  The
+//	block's speed is tallied too.
+//
+
+static void TallyTiming( void)
+{
+
+  TAPE_TIMING
+    timing;
+  TAPE_SPEED
+    speed;
+
+  TapeOpSpeed( &speed);
+  SpeedBlocks++;
+  if ( speed.Ran)
+    HighBlocks++;
+  if ( speed.Ran != speed.Asked)
+    SpeedMisses++;
+
+  TapeBlockTiming( &timing);
+  if ( timing.CharTime == 0)
+    return;
+  TimedBlocks++;
+  if ( timing.WorstWait > WorstWait)
+    WorstWait = timing.WorstWait;
+  if ( LeastCharTime == 0 || timing.CharTime < LeastCharTime)
+    LeastCharTime = timing.CharTime;
+  if ( timing.Late)
+  {
+    if ( LateBlocks < LATE_LIST)
+      LateAt[ LateBlocks] = TapePosition;
+    LateBlocks++;
+  }
+  return;
+} // TallyTiming
+
+//	LogTiming - Report the byte timing tally.
+//	-----------------------------------------
+//
+//	On the console and, for an image file, appended to its
+//	companion Name.txt (the comment file), which is made if need be.
+//
+
+static void LogTiming( char *Name)
+{
+
+  char
+    *noteFile;		// companion file name
+  FIL
+    tf;
+  FRESULT
+    fres;
+  uint32_t
+    i;
+
+  if ( TimedBlocks)
+  {
+    Uprintf( "Byte timing: worst wait %d nsec, character time %d nsec;"
+      " %d of %d blocks late.\n", Nsec( WorstWait), Nsec( LeastCharTime),
+      LateBlocks, TimedBlocks);
+    if ( LateBlocks)
+    {
+      Uprintf( "Late at block");
+      for ( i = 0; i < LateBlocks && i < LATE_LIST; i++)
+        Uprintf( " %d", LateAt[ i]);
+      Uprintf( LateBlocks > LATE_LIST ? " ...\n" : "\n");
+    }
+  } // if any timed
+  if ( SpeedBlocks)
+  {
+    Uprintf( "Speed: %d of %d blocks at high speed.\n", HighBlocks,
+      SpeedBlocks);
+    if ( SpeedMisses)
+      Uprintf( "The drive didn't take the speed asked for on %d blocks.\n",
+        SpeedMisses);
+  } // if any read
+  if ( !Name)
+    return;
+
+  noteFile = (char *) TapeBuffer;
+  strcpy( noteFile, Name);
+  strcat( noteFile, ".txt");
+  if ( (fres = f_open( &tf, noteFile, FA_OPEN_APPEND | FA_WRITE)) != FR_OK)
+  {
+    Uprintf( "\nError in creating file. Error = %d\n", fres);
+    return;
+  } // if open error
+  if ( TapeXferMode == XFER_DMA)
+    f_printf( &tf, "Byte timing: DMA engine, paced by the formatter;"
+      " not measured.\n");
+  else if ( TimedBlocks)
+  {
+    f_printf( &tf, "Byte timing (polled): worst wait %u nsec, character"
+      " time %u nsec; %u of %u blocks late, %u%% margin.\n",
+      (unsigned) Nsec( WorstWait), (unsigned) Nsec( LeastCharTime),
+      (unsigned) LateBlocks, (unsigned) TimedBlocks, TIMING_MARGIN_PCT);
+    if ( LateBlocks)
+    {
+      f_printf( &tf, "Late at block");
+      for ( i = 0; i < LateBlocks && i < LATE_LIST; i++)
+        f_printf( &tf, " %u", (unsigned) LateAt[ i]);
+      f_printf( &tf, LateBlocks > LATE_LIST ? " ...\n" : "\n");
+    }
+  }
+  if ( SpeedBlocks)
+    f_printf( &tf, "Speed: %u of %u blocks at high speed, %u not at the"
+      " speed asked for.\n", (unsigned) HighBlocks, (unsigned) SpeedBlocks,
+      (unsigned) SpeedMisses);
+  f_close( &tf);
+  return;
+} // LogTiming
+
 //*	GetComment - Get a one line comment and create a file with it.
 //
 //	We append a ".txt" to the base file name and put the
@@ -0,0 +1,409 @@
+//*	Pertec data transfer engines.
+//	-----------------------------
+//
+//	The read engine moves bytes from the Pertec data register into
+//	memory without any help from the CPU.  RDAVAIL (status 0, bit 3)
+//	is wired to PE11, which happens to be TIM1 channel 2.  A falling
+//	edge on RDAVAIL starts a one-pulse cycle of TIM1, and three
+//	compare events within that cycle each fire a DMA2 request:
+//
+//	  CC3 - PCTRL_TACK into the reset half of GPIOD BSRR (TACK low)
+//	  CC1 - low byte of GPIOE IDR into the next buffer location
+//	  CC4 - PCTRL_TACK into the set half of GPIOD BSRR (TACK high)
+//
+//	That's the same clear-read-set sequence that the polled loop in
+//	tapedriver.c performs, just done in hardware.  The CPU is needed
+//	only to arm the engine and to collect the count at block end.
+//
+//	Setting up the streams takes longer than a character time at
+//	GCR rates, so that's done before GO is issued.  The trigger
+//	itself can only be enabled while SSEL is low--with SSEL high,
+//	PE11 carries a status 1 bit and every SSEL change would look
+//	like an edge--so it's switched on and off around status 1 reads.
+//
+//	DMA1 can't reach the GPIO ports, so all of this is on DMA2,
+//	channel 6.  SDIO owns DMA2 stream 3; we leave it alone.
+//
+//	Data comes off the bus negative-true and is stored that way;
+//	the caller inverts the buffer once the block is complete.
+//
+//	The write engine can't be done the same way.  WREMPTY (status 0,
+//	bit 4) is on PE12, and the only timer function there is TIM1_CH3N,
+//	an output.  So WREMPTY is taken as EXTI line 12 instead, and a
+//	short interrupt handler loads each byte and strobes LBUF/TACK.
+//	It runs at the highest priority, so USB and SDIO activity can't
+//	make it late.  The handler also latches "last word" into command
+//	register 0 right after strobing the next-to-last byte, so that
+//	ILWD is set up well before the last strobe.
+//
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// MCU-specific definitions.
+
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/timer.h>
+#include <libopencm3/stm32/dma.h>
+#include <libopencm3/stm32/exti.h>
+#include <libopencm3/cm3/nvic.h>
+
+#include "license.h"
+
+// Local definitions.
+
+#include "gpiodef.h"
+#include "tapexfer.h"
+
+//  DMA2 streams, all on channel 6 (TIM1 requests).
+
+#define XFER_DMA		DMA2
+#define XFER_DMA_CHANNEL	DMA_SxCR_CHSEL_6
+#define XFER_DATA_STREAM	DMA_STREAM1	// TIM1_CH1 - data byte
+#define XFER_TACKLO_STREAM	DMA_STREAM6	// TIM1_CH3 - TACK low
+#define XFER_TACKHI_STREAM	DMA_STREAM4	// TIM1_CH4 - TACK high
+
+//  Slave mode control when the trigger is enabled.
+
+#define XFER_SMCR	(TIM_SMCR_TS_TI2FP2 | TIM_SMCR_SMS_TM)
+
+//  Cycle timing, in TIM1 ticks (168 MHz, so about 6 nsec each).
+//  TACK is released on the last tick of the cycle; the formatter
+//  can't present another byte until it sees TACK go high, so the
+//  next RDAVAIL edge always finds the timer idle.
+
+#define XFER_TACK_ASSERT	2	// TACK low 12 nsec after RDAVAIL
+#define XFER_DATA_SAMPLE	16	// sample data ~95 nsec in
+#define XFER_CYCLE		40	// TACK high at ~240 nsec; cycle ends
+
+//  Words that the TACK streams copy to the BSRR.
+
+static uint32_t
+  TackAssert = (PCTRL_TACK << 16),	// reset half: drive low
+  TackRelease = PCTRL_TACK;		// set half: drive high
+
+static int
+  XferLength;				// length of armed transfer
+
+//  Write engine state, shared with the interrupt handler.
+
+static uint8_t
+  * volatile WritePtr;			// next byte to go
+static volatile int
+  WriteLeft;				// bytes not yet strobed
+static int
+  WriteLength;				// length of the block
+static uint32_t
+  LastWordBSRR;				// command 0 with ILWD, as a BSRR word
+
+//  Prototypes.
+
+static void SetupStream( uint8_t Stream, volatile void *Periph,
+                         void *Mem, int Count, bool Reading);
+static void WriteNext( void);
+static void LatchLastWord( void);
+
+//	XferInit - Set up the timer for the transfer engines.
+//	------------------------------------------------------
+//
+//	Called once from TapeInit.  Leaves TIM1 configured but not
+//	triggered; nothing happens until XferReadEnable.
+//
+
+void XferInit( void)
+{
+
+  rcc_periph_clock_enable( RCC_TIM1);
+  rcc_periph_clock_enable( RCC_DMA2);
+
+//  Route RDAVAIL to TIM1_CH2.  The IDR still reflects the pin in
+//  alternate function mode, so status reads are unaffected.
+
+  gpio_mode_setup( PRDAV_GPIO, GPIO_MODE_AF, GPIO_PUPD_NONE, PRDAV_BIT);
+  gpio_set_af( PRDAV_GPIO, PRDAV_AF, PRDAV_BIT);
+
+//  One-pulse mode, no prescaler.  Channel 2 is an input (TI2) with a
+//  short filter to reject glitches; channels 1, 3 and 4 are frozen
+//  output compares that drive nothing but their DMA requests.
+//  RDAVAIL is low-active, so trigger on the falling edge.
+
+  TIM_CR1( TIM1) = TIM_CR1_OPM;
+  TIM_SMCR( TIM1) = 0;
+  TIM_DIER( TIM1) = 0;
+  TIM_PSC( TIM1) = 0;
+  TIM_ARR( TIM1) = XFER_CYCLE;
+  TIM_CCMR1( TIM1) = TIM_CCMR1_CC2S_IN_TI2 | TIM_CCMR1_IC2F_CK_INT_N_4;
+  TIM_CCMR2( TIM1) = 0;
+  TIM_CCER( TIM1) = TIM_CCER_CC2P;
+  TIM_CCR1( TIM1) = XFER_DATA_SAMPLE;
+  TIM_CCR3( TIM1) = XFER_TACK_ASSERT;
+  TIM_CCR4( TIM1) = XFER_CYCLE;
+  TIM_EGR( TIM1) = TIM_EGR_UG;		// load the prescaler
+  TIM_SR( TIM1) = 0;
+
+//  WREMPTY is low-active, so interrupt on the falling edge.  The line
+//  stays masked until a write is under way.
+
+  rcc_periph_clock_enable( RCC_SYSCFG);
+  exti_select_source( PWREM_EXTI, PWREM_GPIO);
+  exti_set_trigger( PWREM_EXTI, EXTI_TRIGGER_FALLING);
+  exti_disable_request( PWREM_EXTI);
+  nvic_set_priority( NVIC_EXTI15_10_IRQ, 0);
+  nvic_enable_irq( NVIC_EXTI15_10_IRQ);
+  return;
+} // XferInit
+
+//	XferReadSetup - Get the read engine ready.
+//	------------------------------------------
+//
+//	Programs the DMA streams for a block of up to Buflen bytes.
+//	Call before GO; the trigger stays off until XferReadEnable.
+//
+
+void XferReadSetup( uint8_t *Buf, int Buflen)
+{
+
+  if ( Buflen > XFER_MAX_COUNT)
+    Buflen = XFER_MAX_COUNT;		// DMA count is 16 bits
+  XferLength = Buflen;
+
+  TIM_SMCR( TIM1) = 0;
+  TIM_DIER( TIM1) = 0;
+  TIM_SR( TIM1) = 0;
+
+  SetupStream( XFER_DATA_STREAM, &GPIO_IDR( PDATA_GPIO), Buf, Buflen, true);
+  SetupStream( XFER_TACKLO_STREAM, &GPIO_BSRR( PCTRL_GPIO),
+    &TackAssert, 1, false);
+  SetupStream( XFER_TACKHI_STREAM, &GPIO_BSRR( PCTRL_GPIO),
+    &TackRelease, 1, false);
+
+  TIM_DIER( TIM1) = TIM_DIER_CC1DE | TIM_DIER_CC3DE | TIM_DIER_CC4DE;
+  return;
+} // XferReadSetup
+
+//	XferReadEnable - Turn the RDAVAIL trigger on or off.
+//	----------------------------------------------------
+//
+//	SSEL must be low to turn it on.  From then on, TACK is
+//	generated in hardware.
+//
+
+void XferReadEnable( bool On)
+{
+
+  if ( !On)
+  {
+    TIM_SMCR( TIM1) = 0;		// a cycle under way still finishes
+    return;
+  }
+
+  TIM_SMCR( TIM1) = XFER_SMCR;
+
+//  If a byte was already waiting, there was no edge to trigger on.
+//  Run one cycle by hand to pick it up.
+
+  if ( !gpio_get( PRDAV_GPIO, PRDAV_BIT) &&
+       !(TIM_CR1( TIM1) & TIM_CR1_CEN))
+    TIM_CR1( TIM1) |= TIM_CR1_CEN;
+  return;
+} // XferReadEnable
+
+//	XferReadCount - Bytes transferred so far.
+//	-----------------------------------------
+//
+
+int XferReadCount( void)
+{
+  return XferLength - dma_get_number_of_data( XFER_DMA, XFER_DATA_STREAM);
+} // XferReadCount
+
+//	XferReadStop - Disarm the read engine.
+//	--------------------------------------
+//
+//	Called after IDBY drops, or to abandon a read that never got to
+//	its data phase.  Lets any cycle in progress finish, puts TACK
+//	back under software control and returns the number of bytes
+//	stored.  If that equals the buffer length, the block
+//	may have been longer than the buffer.
+//
+
+int XferReadStop( void)
+{
+
+  int
+    count;
+
+  while( TIM_CR1( TIM1) & TIM_CR1_CEN);	// let the last cycle finish
+  TIM_SMCR( TIM1) = 0;			// no more triggers
+  TIM_DIER( TIM1) = 0;
+
+  count = XferReadCount();
+  dma_disable_stream( XFER_DMA, XFER_DATA_STREAM);
+  dma_disable_stream( XFER_DMA, XFER_TACKLO_STREAM);
+  dma_disable_stream( XFER_DMA, XFER_TACKHI_STREAM);
+  gpio_set( PCTRL_GPIO, PCTRL_TACK);	// make sure TACK is released
+  return count;
+} // XferReadStop
+
+//	XferWriteSetup - Get the write engine ready and prime it.
+//	---------------------------------------------------------
+//
+//	LastWordCmd is what command register 0 should hold once the
+//	last word is flagged--the current command plus PC_ILWD.  The
+//	first byte is strobed here, so the data direction must already
+//	be set and the formatter busy.
+//
+
+void XferWriteSetup( uint8_t *Buf, int Buflen, uint8_t LastWordCmd)
+{
+
+  exti_disable_request( PWREM_EXTI);
+  WritePtr = Buf;
+  WriteLength = WriteLeft = Buflen;
+  LastWordBSRR = ((uint32_t) LastWordCmd << 16) | (uint8_t) ~LastWordCmd;
+
+  if ( Buflen == 1)
+    LatchLastWord();			// the only byte is the last
+  WriteNext();				// prime the buffer
+  return;
+} // XferWriteSetup
+
+//	XferWriteEnable - Turn the WREMPTY interrupt on or off.
+//	-------------------------------------------------------
+//
+//	SSEL must be low to turn it on, so that WREMPTY is on PE12.  If
+//	the buffer is already empty there won't be an edge, so we post
+//	the interrupt ourselves; the handler checks the pin anyway.
+//
+
+void XferWriteEnable( bool On)
+{
+
+  if ( !On)
+  {
+    exti_disable_request( PWREM_EXTI);
+    return;
+  }
+
+  exti_reset_request( PWREM_EXTI);
+  exti_enable_request( PWREM_EXTI);
+  if ( !gpio_get( PWREM_GPIO, PWREM_BIT))
+    EXTI_SWIER = PWREM_EXTI;
+  return;
+} // XferWriteEnable
+
+//	XferWriteCount - Bytes strobed so far.
+//	--------------------------------------
+//
+
+int XferWriteCount( void)
+{
+  return WriteLength - WriteLeft;
+} // XferWriteCount
+
+//	XferWriteStop - Disarm the write engine.
+//	----------------------------------------
+//
+//	Returns the number of bytes handed to the formatter.
+//
+
+int XferWriteStop( void)
+{
+
+  exti_disable_request( PWREM_EXTI);
+  exti_reset_request( PWREM_EXTI);
+  gpio_set( PCTRL_GPIO, PCTRL_TACK | PCTRL_LBUF);
+  return XferWriteCount();
+} // XferWriteStop
+
+//	exti15_10_isr - WREMPTY interrupt.
+//	----------------------------------
+//
+
+void exti15_10_isr( void)
+{
+
+  exti_reset_request( PWREM_EXTI);
+  if ( !(GPIO_IDR( PWREM_GPIO) & PWREM_BIT))	// negative logic
+    WriteNext();
+  return;
+} // exti15_10_isr
+
+//*	Local utility routines.
+//	=======================
+
+//	WriteNext - Load and strobe the next byte.
+//	------------------------------------------
+//
+//	Same sequence as the polled loop in tapedriver.c, but straight to
+//	the registers.  When only one byte is left afterwards, flag it as
+//	the last word.
+//
+
+static void WriteNext( void)
+{
+
+  if ( WriteLeft == 0)
+    return;
+
+  GPIO_BSRR( PCTRL_GPIO) = (PCTRL_TACK | PCTRL_LBUF) << 16;
+  GPIO_ODR( PDATA_GPIO) = (uint8_t) ~*WritePtr++;
+  GPIO_BSRR( PCTRL_GPIO) = PCTRL_TACK | PCTRL_LBUF;	// strobe it
+
+  if ( --WriteLeft == 1)
+    LatchLastWord();
+  return;
+} // WriteNext
+
+//	LatchLastWord - Put ILWD into command register 0.
+//	-------------------------------------------------
+//
+//	A single BSRR write changes all eight command lines at once.
+//
+
+static void LatchLastWord( void)
+{
+
+  GPIO_BSRR( PCMD_GPIO) = LastWordBSRR;
+  GPIO_BSRR( PCTRL_GPIO) = PCTRL_CSEL1 << 16;
+  GPIO_BSRR( PCTRL_GPIO) = PCTRL_CSEL1;		// latch it in
+  return;
+} // LatchLastWord
+
+//	SetupStream - Program a DMA2 stream for TIM1 requests.
+//	-------------------------------------------------------
+//
+//	Reading streams move bytes from the peripheral to an incrementing
+//	memory address.  Otherwise, the same memory word is written to the
+//	peripheral on every request, forever (circular mode).
+//
+
+static void SetupStream( uint8_t Stream, volatile void *Periph,
+                         void *Mem, int Count, bool Reading)
+{
+
+  dma_stream_reset( XFER_DMA, Stream);
+  dma_channel_select( XFER_DMA, Stream, XFER_DMA_CHANNEL);
+  dma_set_priority( XFER_DMA, Stream, DMA_SxCR_PL_VERY_HIGH);
+  dma_set_peripheral_address( XFER_DMA, Stream, (uint32_t) Periph);
+  dma_set_memory_address( XFER_DMA, Stream, (uint32_t) Mem);
+  dma_set_number_of_data( XFER_DMA, Stream, Count);
+
+  if ( Reading)
+  {
+    dma_set_transfer_mode( XFER_DMA, Stream, DMA_SxCR_DIR_PERIPHERAL_TO_MEM);
+    dma_set_peripheral_size( XFER_DMA, Stream, DMA_SxCR_PSIZE_8BIT);
+    dma_set_memory_size( XFER_DMA, Stream, DMA_SxCR_MSIZE_8BIT);
+    dma_enable_memory_increment_mode( XFER_DMA, Stream);
+  }
+  else
+  {
+    dma_set_transfer_mode( XFER_DMA, Stream, DMA_SxCR_DIR_MEM_TO_PERIPHERAL);
+    dma_set_peripheral_size( XFER_DMA, Stream, DMA_SxCR_PSIZE_32BIT);
+    dma_set_memory_size( XFER_DMA, Stream, DMA_SxCR_MSIZE_32BIT);
+    dma_enable_circular_mode( XFER_DMA, Stream);
+  }
+  dma_enable_stream( XFER_DMA, Stream);
+  return;
+} // SetupStream
@@ -14,6 +14,7 @@
 #include <libopencm3/stm32/usart.h>
 #include <miscsubs.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include <string.h>
 #include <ctype.h>
 #include <stdarg.h>
@@ -25,6 +26,13 @@
 #define USART_SPEED 115200    // bit/baud rate of connection.
 #define UART_PORT   USART1    // what port
 
+//  A character USPeekInput has shown but nobody's taken yet.
+
+static uint8_t
+  Held;
+static bool
+  HaveHeld;
+
 int _write( int Fd, char *What, int Count);
 
 //  Initialize UART
@@ -89,6 +97,11 @@ void USClear( void)
 int USGetchar( void)
 {
 
+  if ( HaveHeld)
+  {
+    HaveHeld = false;
+    return Held;
+  }
   while ((USART_SR(UART_PORT) & USART_SR_RXNE) == 0);
   
   return usart_recv(UART_PORT);
@@ -103,9 +116,50 @@ int USGetchar( void)
 int USCharReady( void)
 {
 
-  return ((USART_SR(UART_PORT) & USART_SR_RXNE) != 0);
+  return HaveHeld || ((USART_SR(UART_PORT) & USART_SR_RXNE) != 0);
 } // USCharReady
 
+//  USReadBlock - Take whatever input is waiting, up to Count bytes.
+//  ----------------------------------------------------------------
+//
+//  The UART holds one character, so that's the most there can be.
+//
+
+int USReadBlock( uint8_t *What, int Count)
+{
+
+  if ( Count <= 0 || !USCharReady())
+    return 0;
+  *What = (uint8_t) USGetchar();
+  return 1;
+} // USReadBlock
+
+//  USPeekInput - Look at waiting input without taking it.
+//  ------------------------------------------------------
+//
+//  Again, a character at most.  USSkipInput takes it.
+//
+
+int USPeekInput( uint8_t **Where)
+{
+
+  if ( !HaveHeld && USCharReady())
+  {
+    Held = (uint8_t) usart_recv(UART_PORT);
+    HaveHeld = true;
+  }
+  *Where = &Held;
+  return HaveHeld ? 1 : 0;
+} // USPeekInput
+
+void USSkipInput( int Count)
+{
+
+  if ( Count > 0)
+    HaveHeld = false;
+  return;
+} // USSkipInput
+
 
 //* USPutchar - Write a single character to output.
 //  ----------------------------------------------
@@ -123,6 +177,18 @@ int USPutchar( char What)
   return What;
 } // USPutchar
 
+//* USFlush - Start queued output.
+//  -------------------------------
+//
+//	Nothing's queued here; every character waits for the UART.
+//
+
+void USFlush( void)
+{
+
+  return;
+} // USFlush
+
 //* USWritechar - Write "raw" character with no lf filtering.
 //  ---------------------------------------------------------
 //
@@ -176,6 +242,43 @@ int USWriteBlock( uint8_t *What, int Count)
 
 } // USWriteBlock
 
+//*  Data interface.
+//   ---------------
+//
+//  There's only the one link on a UART, so the host never attaches
+//  and these are never used.
+//
+
+bool USDataAttached( void)
+{
+  return false;
+} // USDataAttached
+
+int USDataWrite( uint8_t *What, int Count)
+{
+  (void) What;
+  return Count;
+} // USDataWrite
+
+int USDataRead( uint8_t *What, int Count)
+{
+  (void) What;
+  (void) Count;
+  return 0;
+} // USDataRead
+
+//  Nor can a UART be a disk.
+
+bool USDiskMode( bool On)
+{
+  (void) On;
+  return false;
+} // USDiskMode
+
+void USDiskPoll( void)
+{
+} // USDiskPoll
+
 //*  Write hooked to stdio routines.
 //   ------------------------------
 //
@@ -7,6 +7,17 @@
 //	On Linux systems, this will be assigned as /dev/ttyACMx, where 
 //	x is (0,1...).   Windows systems may be different.
 //
+//	Alongside it is a vendor-specific interface with its own pair of
+//	bulk endpoints, for tape images: the host claims it and sends
+//	DATA_REQ_ATTACH, and then STREAM and STREAMW move the image over
+//	it while the console carries only text.
+//
+//	For USBDISK the device drops off the bus and comes back with a
+//	mass storage interface (mscbot.c) on the data interface's
+//	number and endpoints, so the host can mount the SD card; the
+//	console comes back with it, for ESC.  At the end it's done
+//	again, the other way.
+//
 //	If the symbol USE_UART is defined at compilation, this code is
 //	replaced by UART (serial) interface code.	
 //
@@ -23,10 +34,15 @@
 #include <libopencm3/usb/cdc.h>
 #include <libopencm3/cm3/scb.h>
 #include "comm.h"
+#include "globals.h"
 
 #include "license.h"
 
 #include "usbserial.h"
+#include "tapestream.h"
+#include "mscbot.h"
+#include "miscsubs.h"
+#include "hotstats.h"
 
 //  This is the pointer to the device that we'll be using.
 
@@ -36,16 +52,93 @@ static usbd_device
 static int
   Usbd_registered = 0;      // set to 1 once we're registered
 
-#define INPUT_QUEUE_SIZE 1024+64	// size of input queue
+#define INPUT_QUEUE_SIZE 4096+64	// size of input queue
+#define OUTPUT_QUEUE_SIZE 1024		// size of output queue
+#define DATA_QUEUE_SIZE 4096		// each way, data interface
 #define MAX_PACKET_SIZE 64		// largest packet to send
+#define DISCONNECT_DELAY 40000		// half-usec off the bus, to re-enumerate
+#define DATA_STALL_MSEC 10000		// data host took nothing this long: gone
+
+//  Endpoints.  The OTG FS core has three besides 0 in each direction.
+
+#define CONSOLE_OUT_EP	0x01
+#define CONSOLE_IN_EP	0x82
+#define NOTIFY_EP	0x83
+
+//  DATA_OUT_EP, DATA_IN_EP, DATA_INTERFACE and DATA_REQ_ATTACH, for
+//  the data interface, are in tapestream.h with the rest of what the
+//  host needs to know.
+
+//  USB interrupt priority: below the tape and SD interrupts (which
+//  are left at 0), so console traffic never holds them up.
+
+#define USB_IRQ_PRIORITY 0xC0
+
+//  Each bulk pair--console and data--has its own queues.
+//
+//  Output goes into OutputQueue and is sent a packet at a time from
+//  the IN-complete callback, so whatever piles up while one packet
+//  is in flight goes in the next, up to a full 64 bytes.  A transfer
+//  that ends on a full packet is closed with a zero-length one, or
+//  the host would sit on it waiting for more.
+//
+//  Input is held off rather than dropped: when the queue hasn't room
+//  for another packet, the OUT endpoint NAKs until the foreground
+//  has taken enough out.  The host just retries.
+
+typedef struct _usb_channel
+{
+  uint8_t OutEp;			// host-to-device endpoint
+  uint8_t InEp;				// device-to-host endpoint
+  char *InputQueue;			// where we queue input up
+  int InputSize;
+  char *OutputQueue;			// and output waiting for the host
+  int OutputSize;
+  volatile int InQIn, InQOut;		// input queue in/out
+  volatile int OutQIn, OutQOut;		// output queue in/out
+  volatile bool TxBusy;			// a packet is in flight
+  volatile bool NeedZLP;		// last one was full
+  volatile bool RxHeld;			// OUT endpoint NAKing
+} USB_CHANNEL;
 
 static char
   ReceiveBuffer[ 65],             	// Where characters come in
-  InputQueue[ INPUT_QUEUE_SIZE];	// where we queue input up 
-
-static volatile int
-  InQIn,
-  InQOut;				// input queue in/out
+  ConsoleInput[ INPUT_QUEUE_SIZE],
+  ConsoleOutput[ OUTPUT_QUEUE_SIZE],
+  DataInput[ DATA_QUEUE_SIZE + MAX_PACKET_SIZE],
+  DataOutput[ DATA_QUEUE_SIZE];
+
+static USB_CHANNEL
+  Console = { CONSOLE_OUT_EP, CONSOLE_IN_EP,
+    ConsoleInput, sizeof( ConsoleInput),
+    ConsoleOutput, sizeof( ConsoleOutput), 0, 0, 0, 0, 0, 0, 0},
+  Data = { DATA_OUT_EP, DATA_IN_EP,
+    DataInput, sizeof( DataInput),
+    DataOutput, sizeof( DataOutput), 0, 0, 0, 0, 0, 0, 0};
+
+static volatile bool
+  DataAttached,				// host has the data interface
+  DiskMode,				// it's a mass storage interface
+  DiskBusy,				// ... with an IN packet in flight
+  DiskHeld;				// ... and OUT NAKing
+
+static uint8_t
+  DiskPacket[ MAX_PACKET_SIZE];		// IN packet for the disk
+static int
+  DiskLength = -1;			// ... its length, or -1 if none
+
+static void ReceivePacket( usbd_device *usbd_dev, USB_CHANNEL *Ch);
+static void StartOutput( USB_CHANNEL *Ch);
+static void KickOutput( USB_CHANNEL *Ch);
+static void QueueOutput( USB_CHANNEL *Ch, char What);
+static bool OutputFull( USB_CHANNEL *Ch);
+static int TakeInput( USB_CHANNEL *Ch, uint8_t *What, int Count);
+static void ClearChannel( USB_CHANNEL *Ch);
+static void PollUSB( void);
+static int InputRoom( USB_CHANNEL *Ch);
+static void ReleaseInput( USB_CHANNEL *Ch);
+static void DiskReceive( usbd_device *usbd_dev);
+static void DiskSend( void);
 
 int _write( int Fd, char *What, int Count);
 
@@ -60,9 +153,9 @@ static const struct usb_device_descriptor dev = {
   .bLength = USB_DT_DEVICE_SIZE,
   .bDescriptorType = USB_DT_DEVICE,
   .bcdUSB = 0x0200,
-  .bDeviceClass = USB_CLASS_CDC,
-  .bDeviceSubClass = 0,
-  .bDeviceProtocol = 0,
+  .bDeviceClass = 0xEF,        // miscellaneous: functions are
+  .bDeviceSubClass = 2,       // ... described by interface
+  .bDeviceProtocol = 1,       // ... association descriptors
   .bMaxPacketSize0 = 64,      // standard for full-speed devices
   .idVendor = 0x0483,         // ST Microelectronics
   .idProduct = 0x5740,        // STM32F407--the easiest one we can use
@@ -82,7 +175,7 @@ static const struct usb_endpoint_descriptor comm_endp[] =
   {
     .bLength = USB_DT_ENDPOINT_SIZE,
     .bDescriptorType = USB_DT_ENDPOINT,
-    .bEndpointAddress = 0x83,
+    .bEndpointAddress = NOTIFY_EP,
     .bmAttributes = USB_ENDPOINT_ATTR_INTERRUPT,
     .wMaxPacketSize = 16,
     .bInterval = 255,
@@ -94,7 +187,7 @@ static const struct usb_endpoint_descriptor data_endp[] =
   {
     .bLength = USB_DT_ENDPOINT_SIZE,
     .bDescriptorType = USB_DT_ENDPOINT,
-    .bEndpointAddress = 0x01,
+    .bEndpointAddress = CONSOLE_OUT_EP,
     .bmAttributes = USB_ENDPOINT_ATTR_BULK,
     .wMaxPacketSize = 64,
     .bInterval = 1,
@@ -102,7 +195,7 @@ static const struct usb_endpoint_descriptor data_endp[] =
   {
     .bLength = USB_DT_ENDPOINT_SIZE,
     .bDescriptorType = USB_DT_ENDPOINT,
-    .bEndpointAddress = 0x82,
+    .bEndpointAddress = CONSOLE_IN_EP,
     .bmAttributes = USB_ENDPOINT_ATTR_BULK,
     .wMaxPacketSize = 64,
     .bInterval = 1,
@@ -184,15 +277,93 @@ static const struct usb_interface_descriptor data_iface[] =
   }
 };
 
-static const struct usb_interface ifaces[] = 
+//  The image data interface: vendor-specific, one bulk pair.
+
+static const struct usb_endpoint_descriptor image_endp[] = 
+{
+  {
+    .bLength = USB_DT_ENDPOINT_SIZE,
+    .bDescriptorType = USB_DT_ENDPOINT,
+    .bEndpointAddress = DATA_OUT_EP,
+    .bmAttributes = USB_ENDPOINT_ATTR_BULK,
+    .wMaxPacketSize = 64,
+    .bInterval = 1,
+  },
+  {
+    .bLength = USB_DT_ENDPOINT_SIZE,
+    .bDescriptorType = USB_DT_ENDPOINT,
+    .bEndpointAddress = DATA_IN_EP,
+    .bmAttributes = USB_ENDPOINT_ATTR_BULK,
+    .wMaxPacketSize = 64,
+    .bInterval = 1,
+  }
+};
+
+static const struct usb_interface_descriptor image_iface[] = 
+{
+  {
+    .bLength = USB_DT_INTERFACE_SIZE,
+    .bDescriptorType = USB_DT_INTERFACE,
+    .bInterfaceNumber = DATA_INTERFACE,
+    .bAlternateSetting = 0,
+    .bNumEndpoints = 2,
+    .bInterfaceClass = 0xFF,		// vendor-specific
+    .bInterfaceSubClass = 0,
+    .bInterfaceProtocol = 0,
+    .iInterface = 4,
+    .endpoint = image_endp,
+  }
+};
+
+//  The same, as a mass storage interface, for USBDISK.
+
+static const struct usb_interface_descriptor disk_iface[] = 
+{
+  {
+    .bLength = USB_DT_INTERFACE_SIZE,
+    .bDescriptorType = USB_DT_INTERFACE,
+    .bInterfaceNumber = DATA_INTERFACE,
+    .bAlternateSetting = 0,
+    .bNumEndpoints = 2,
+    .bInterfaceClass = MSC_CLASS,
+    .bInterfaceSubClass = MSC_SUBCLASS,
+    .bInterfaceProtocol = MSC_PROTOCOL,
+    .iInterface = 5,
+    .endpoint = image_endp,
+  }
+};
+
+//  With another interface, the CDC pair needs an association
+//  descriptor so that the host gives both to its ACM driver.
+
+static const struct usb_iface_assoc_descriptor cdc_assoc = 
+{
+  .bLength = USB_DT_INTERFACE_ASSOCIATION_SIZE,
+  .bDescriptorType = USB_DT_INTERFACE_ASSOCIATION,
+  .bFirstInterface = 0,
+  .bInterfaceCount = 2,
+  .bFunctionClass = USB_CLASS_CDC,
+  .bFunctionSubClass = USB_CDC_SUBCLASS_ACM,
+  .bFunctionProtocol = 0,
+  .iFunction = 0,
+};
+
+//  Not const: USDiskMode changes what the data interface is.
+
+static struct usb_interface ifaces[] = 
 {
   {
     .num_altsetting = 1,
+    .iface_assoc = &cdc_assoc,
     .altsetting = comm_iface,
   },
   {
     .num_altsetting = 1,
     .altsetting = data_iface,
+  },
+  {
+    .num_altsetting = 1,
+    .altsetting = image_iface,
   }
 };
 
@@ -201,7 +372,7 @@ static const struct usb_config_descriptor config =
   .bLength = USB_DT_CONFIGURATION_SIZE,
   .bDescriptorType = USB_DT_CONFIGURATION,
   .wTotalLength = 0,
-  .bNumInterfaces = 2,
+  .bNumInterfaces = 3,
   .bConfigurationValue = 1,
   .iConfiguration = 0,
   .bmAttributes = 0x80,
@@ -214,6 +385,8 @@ static const char *usb_strings[] =
   "Pertec Tape Controller",
   "USB command interface",
   "Dec2022",
+  "Tape image data",
+  "Tape controller SD card",
 };
 
 uint8_t 
@@ -225,6 +398,10 @@ void usb_fs_wkup_isr(void) {
   usbd_poll(Usbd_dev);
 } // usb_wakeup
 
+void otg_fs_isr(void) {
+  usbd_poll(Usbd_dev);
+} // otg_fs_isr
+
 
 //  Process CDC_ACM Control request.
 //  --------------------------------
@@ -244,6 +421,9 @@ static enum usbd_request_return_codes
   (void) buf;
   (void) usbd_dev;
 
+  if ( req->wIndex == DATA_INTERFACE)
+    return USBD_REQ_NEXT_CALLBACK;	// mass storage's
+
   switch(req->bRequest) 
   {
     case USB_CDC_REQ_SET_CONTROL_LINE_STATE: 
@@ -268,6 +448,68 @@ static enum usbd_request_return_codes
   return 0;
 } //  cdcacm_control_request
 
+//  Vendor control request for the data interface.
+//  -----------------------------------------------
+//
+//  DATA_REQ_ATTACH says whether the host has the interface open.
+//  Either way, both of its queues start out empty.
+//
+
+static enum usbd_request_return_codes 
+          data_control_request(usbd_device *usbd_dev,
+				  struct usb_setup_data *req,
+				  uint8_t **buf,
+				  uint16_t *len,
+				  void (**complete)(usbd_device *usbd_dev,
+						    struct usb_setup_data *req))
+{
+  (void) complete;
+  (void) buf;
+  (void) len;
+  (void) usbd_dev;
+
+  if ( req->wIndex != DATA_INTERFACE || req->bRequest != DATA_REQ_ATTACH ||
+    DiskMode)
+    return USBD_REQ_NEXT_CALLBACK;
+  ClearChannel( &Data);
+  DataAttached = (req->wValue != 0);
+  return USBD_REQ_HANDLED;
+} //  data_control_request
+
+//  Mass storage class requests.
+//  -----------------------------
+//
+//  Reset and Get Max LUN, for the data interface in disk mode.
+//
+
+static enum usbd_request_return_codes 
+          disk_control_request(usbd_device *usbd_dev,
+				  struct usb_setup_data *req,
+				  uint8_t **buf,
+				  uint16_t *len,
+				  void (**complete)(usbd_device *usbd_dev,
+						    struct usb_setup_data *req))
+{
+  (void) complete;
+  (void) usbd_dev;
+
+  if ( req->wIndex != DATA_INTERFACE || !DiskMode)
+    return USBD_REQ_NEXT_CALLBACK;
+
+  switch( req->bRequest)
+  {
+    case MSC_REQ_RESET:
+      MscReset();
+      return USBD_REQ_HANDLED;
+
+    case MSC_REQ_MAX_LUN:
+      (*buf)[0] = 0;			// just the one
+      *len = 1;
+      return USBD_REQ_HANDLED;
+  } // switch
+  return USBD_REQ_NOTSUPP;
+} //  disk_control_request
+
 //  CDC_ACM Received data request.
 //  ------------------------------
 //
@@ -276,27 +518,58 @@ static enum usbd_request_return_codes
 
 static void cdcacm_data_rx_cb(usbd_device *usbd_dev, uint8_t ep)
 {
-  int 
-    len,
-    i;
 
   (void)ep;
 
-  len = usbd_ep_read_packet(usbd_dev, 0x01, ReceiveBuffer, 64);
+  ReceivePacket( usbd_dev, &Console);
+} // cdcacm_data_rx_cb
 
-  for ( i = 0; i < len; i++)
+//  CDC_ACM Transmit complete.
+//  --------------------------
+//
+//  The host has taken the last packet; send the next.
+//
+
+static void cdcacm_data_tx_cb(usbd_device *usbd_dev, uint8_t ep)
+{
+
+  (void) usbd_dev;
+  (void) ep;
+
+  Console.TxBusy = false;
+  StartOutput( &Console);
+} // cdcacm_data_tx_cb
+
+//  Data interface packet received, and transmit complete.
+//  ------------------------------------------------------
+//
+
+static void data_rx_cb(usbd_device *usbd_dev, uint8_t ep)
+{
+
+  (void)ep;
+
+  if ( DiskMode)
+    DiskReceive( usbd_dev);
+  else
+    ReceivePacket( usbd_dev, &Data);
+} // data_rx_cb
+
+static void data_tx_cb(usbd_device *usbd_dev, uint8_t ep)
+{
+
+  (void) usbd_dev;
+  (void) ep;
+
+  if ( DiskMode)
   {
-    int iq;
-    iq = InQIn+1;
-    if ( iq >= INPUT_QUEUE_SIZE)
-      iq = 0;
-    if ( iq != InQOut)
-    {  
-      InputQueue[InQIn] = ReceiveBuffer[i];
-      InQIn = iq;		// next in
-    }
-  } // for each received character
-} // cdcacm_data_rx_cb
+    DiskBusy = false;
+    DiskSend();
+    return;
+  }
+  Data.TxBusy = false;
+  StartOutput( &Data);
+} // data_tx_cb
 
 
 //  CDC ACM Set configuration.
@@ -310,14 +583,28 @@ static void cdcacm_set_config(usbd_device *usbd_dev, uint16_t wValue)
   
   (void) wValue;
   
-  usbd_ep_setup(usbd_dev, 0x01, USB_ENDPOINT_ATTR_BULK, 64, cdcacm_data_rx_cb);
-  usbd_ep_setup(usbd_dev, 0x82, USB_ENDPOINT_ATTR_BULK, 64, NULL);
-  usbd_ep_setup(usbd_dev, 0x83, USB_ENDPOINT_ATTR_INTERRUPT, 16, NULL);
+  usbd_ep_setup(usbd_dev, CONSOLE_OUT_EP, USB_ENDPOINT_ATTR_BULK, 64,
+    cdcacm_data_rx_cb);
+  usbd_ep_setup(usbd_dev, CONSOLE_IN_EP, USB_ENDPOINT_ATTR_BULK, 64,
+    cdcacm_data_tx_cb);
+  usbd_ep_setup(usbd_dev, NOTIFY_EP, USB_ENDPOINT_ATTR_INTERRUPT, 16, NULL);
+  usbd_ep_setup(usbd_dev, DATA_OUT_EP, USB_ENDPOINT_ATTR_BULK, 64,
+    data_rx_cb);
+  usbd_ep_setup(usbd_dev, DATA_IN_EP, USB_ENDPOINT_ATTR_BULK, 64,
+    data_tx_cb);
 
   usbd_register_control_callback(usbd_dev,
 		USB_REQ_TYPE_CLASS | USB_REQ_TYPE_INTERFACE,
 		USB_REQ_TYPE_TYPE | USB_REQ_TYPE_RECIPIENT,
 		cdcacm_control_request);
+  usbd_register_control_callback(usbd_dev,
+		USB_REQ_TYPE_VENDOR | USB_REQ_TYPE_INTERFACE,
+		USB_REQ_TYPE_TYPE | USB_REQ_TYPE_RECIPIENT,
+		data_control_request);
+  usbd_register_control_callback(usbd_dev,
+		USB_REQ_TYPE_CLASS | USB_REQ_TYPE_INTERFACE,
+		USB_REQ_TYPE_TYPE | USB_REQ_TYPE_RECIPIENT,
+		disk_control_request);
 	
 	Usbd_registered = 1;        // say we've got it
 } // cdcacm_set_config
@@ -349,7 +636,7 @@ int USInit(  void)
 		                   &dev,
 		                   &config,
 		                   usb_strings,
-		                   3,
+		                   5,
 		                   usbd_control_buffer,
                        sizeof(usbd_control_buffer));
 
@@ -360,7 +647,10 @@ int USInit(  void)
   while( !Usbd_registered)
     usbd_poll(Usbd_dev);
 
+  nvic_set_priority(NVIC_USB_FS_WKUP_IRQ, USB_IRQ_PRIORITY);
   nvic_enable_irq(NVIC_USB_FS_WKUP_IRQ);
+  nvic_set_priority(NVIC_OTG_FS_IRQ, USB_IRQ_PRIORITY);
+  nvic_enable_irq(NVIC_OTG_FS_IRQ);
 
   return 0;
 } // USInit
@@ -374,37 +664,97 @@ int USInit(  void)
 void USClear( void)
 {
 
-  InQIn = 0;		
-  InQOut = 0;		// empty the input buffer
+  Console.InQIn = 0;		
+  Console.InQOut = 0;		// empty the input buffer
+  ReleaseInput( &Console);
 } // USClear
 
 //  USGetchar - Get a character from input.
 //  ---------------------------------------
 //
-//    Not the most efficient.  We ignore any buffer overflow.
+//    Not the most efficient; USPeekInput is the way to take a lot.
 //
 
 int USGetchar( void)
 {
 
-  char
+  uint8_t
     retChar;
 
   if ( !Usbd_dev)
     USInit();             // if not initialized, do it.
-  while (InQIn == InQOut)
+  KickOutput( &Console);	// a prompt or echo may be waiting
+  while ( !TakeInput( &Console, &retChar, 1))
   {
-    usbd_poll( Usbd_dev);    	// wait for input
+    PollUSB();    		// wait for input
   } // get a character if there's none
-  
-//  At this point we know that there's something in the buffer.  
-  
-  retChar = InputQueue[ InQOut++];	// get the character
-  if ( InQOut >= INPUT_QUEUE_SIZE)
-    InQOut = 0;				// wrap around to the start
-  return (unsigned char) retChar;
+  return retChar;
 } // USGetchar
 
+//* USReadBlock - Take whatever input is waiting, up to Count bytes.
+//  ----------------------------------------------------------------
+//
+//  Doesn't wait.  Returns the number of bytes taken.
+//
+
+int USReadBlock( uint8_t *What, int Count)
+{
+
+  if ( !Usbd_dev)
+    USInit();             // if not initialized, do it.
+
+  if ( Console.InQIn == Console.InQOut)
+    PollUSB();
+  return TakeInput( &Console, What, Count);
+} // USReadBlock
+
+//* USPeekInput - Look at waiting input where it lies.
+//  ---------------------------------------------------
+//
+//  Sets *Where to the oldest waiting byte in the input queue and
+//  returns how many follow it without a wrap (0 if none); doesn't
+//  wait.  Nothing's taken until USSkipInput says how much was used,
+//  so a protocol can copy a packet straight to where it's going.
+//
+
+int USPeekInput( uint8_t **Where)
+{
+
+  int
+    in,
+    out;
+
+  if ( !Usbd_dev)
+    USInit();             // if not initialized, do it.
+
+  if ( Console.InQIn == Console.InQOut)
+    PollUSB();
+  in = Console.InQIn;
+  out = Console.InQOut;
+  *Where = (uint8_t *) Console.InputQueue + out;
+  return (in >= out) ? in - out : Console.InputSize - out;
+} // USPeekInput
+
+//* USSkipInput - Take Count bytes found by USPeekInput.
+//  ----------------------------------------------------
+//
+//  The host may send again once there's room for a packet.
+//
+
+void USSkipInput( int Count)
+{
+
+  int
+    out;
+
+  out = Console.InQOut + Count;
+  if ( out >= Console.InputSize)
+    out -= Console.InputSize;
+  Console.InQOut = out;
+  ReleaseInput( &Console);
+  return;
+} // USSkipInput
+
 //* USCharReady - See if a character is waiting.
 //  --------------------------------------------
 //
@@ -416,50 +766,33 @@ int USCharReady( void)
   if ( !Usbd_dev)
     USInit();             // if not initialized, do it.
 
-  usbd_poll(Usbd_dev);    // poll
-  return ( InQIn == InQOut) ? 0 : 1;
+  PollUSB();    		// poll
+  return ( Console.InQIn == Console.InQOut) ? 0 : 1;
 } // USCharReady
 
 //* USPuts - Put a character string to output.
 //  ------------------------------------------
 //
-//  Uses packet-mode transfer, so is somewhat faster.
+//  Queued as a whole, then sent.
 //
 
 void USPuts( char *What)
 {
  
-  char
-    localBuf[64];
-  char 
-    *p;
-  int
-    i;
+  STAT_TIMER( start);
 
-   
+  STAT_MARK( start);
   if ( !Usbd_dev)
     USInit();             // if not initialized, do it.
 
   while (*What)
   {
-    p = localBuf;
-    for (  i = 0; i < 62; i++)
-    {
-      if ( *What == 0)
-        break;
-      if ( *What == '\n')
-      {
-        *p++ = '\r';        // make sure of cr-lf  
-        i++;
-      } // convert LF to CR-LF  
-      *p++ = *What++;
-    } // for
-    if ( i)
-    {  // if we have anything to write
-      while( usbd_ep_write_packet(Usbd_dev, 0x82, localBuf, i) == 0);
-    }
-    usbd_poll(Usbd_dev);    // poll
+    if ( *What == '\n')
+      QueueOutput( &Console, '\r');	// make sure of cr-lf
+    QueueOutput( &Console, *What++);
   } // until we've reached the end.
+  KickOutput( &Console);
+  STAT_SINCE( STAT_CONSOLE, start);
   return;
 } // USPuts
 
@@ -467,28 +800,40 @@ void USPuts( char *What)
 //* USPutchar - Put a single character to output.
 //  ---------------------------------------------
 //
-//    If you've got a string, use USPuts(); it's faster.
+//    Just queues it; it goes with whatever else is waiting.  Only a
+//    newline starts it moving: Uprintf and Uputs call USFlush when
+//    they're done, and the IN-complete callback sends the rest, so a
+//    formatted line costs one kick rather than one per character.
 //
 
 int USPutchar( char What)
 {
 
-  const char *crlf="\r\n";
-
   if ( !Usbd_dev)
     USInit();             // if not initialized, do it.
   if ( What == '\n')
-  {
-    while( usbd_ep_write_packet(Usbd_dev, 0x82, crlf, 2) == 0);
-  }
-  else  
-  {
-    while( usbd_ep_write_packet(Usbd_dev, 0x82, &What, 1) == 0);
-  }
-  usbd_poll(Usbd_dev);    // poll
+    QueueOutput( &Console, '\r');
+  QueueOutput( &Console, What);
+  if ( What == '\n')
+    KickOutput( &Console);
   return What;
 } // USPutchar
 
+//* USFlush - Start whatever console output is queued.
+//  --------------------------------------------------
+//
+//    Doesn't wait for it to go.
+//
+
+void USFlush( void)
+{
+
+  if ( !Usbd_dev)
+    USInit();             // if not initialized, do it.
+  KickOutput( &Console);
+  return;
+} // USFlush
+
 //* USWritechar - Write a single character without "cooking"
 //  --------------------------------------------------------
 //
@@ -501,8 +846,8 @@ int USWritechar( char What)
   if ( !Usbd_dev)
     USInit();             // if not initialized, do it.
 
-  while( usbd_ep_write_packet(Usbd_dev, 0x82, &What, 1) == 0);
-  usbd_poll(Usbd_dev);    // poll
+  QueueOutput( &Console, What);
+  KickOutput( &Console);
   return What;
 } // USWritechar
 
@@ -510,7 +855,7 @@ int USWritechar( char What)
 //*  USWriteBlock - Write a block of characters without "cooking"
 //   ------------------------------------------------------------
 //
-//	This is a bit more efficient than single-character writes.
+//	Goes out in full packets.
 //
 //	Always returns zero.
 //
@@ -518,21 +863,414 @@ int USWritechar( char What)
 int USWriteBlock( uint8_t *What, int Count)
 {
 
+  if ( !Usbd_dev)
+    USInit();             // if not initialized, do it.
+
+  while ( Count-- > 0)
+    QueueOutput( &Console, *What++);
+  KickOutput( &Console);
+  return 0;
+
+} //  USWriteBlock
+
+//*	Data interface.
+//	===============
+
+//* USDataAttached - See if the host is using the data interface.
+//  -------------------------------------------------------------
+//
+
+bool USDataAttached( void)
+{
+
+  if ( !Usbd_dev)
+    USInit();             // if not initialized, do it.
+
+  PollUSB();
+  return DataAttached;
+} // USDataAttached
+
+//* USDataWrite - Send a block on the data interface.
+//  -------------------------------------------------
+//
+//  Waits for room in the queue, so the host sets the pace.  But if
+//  the host lets go of the interface, or takes nothing for
+//  DATA_STALL_MSEC, it's gone: we stop there and return how many
+//  bytes were queued, short of Count.
+//
+
+int USDataWrite( uint8_t *What, int Count)
+{
+
+  int
+    i;
+  uint32_t
+    waitStart;			// when the queue filled
+
+  for ( i = 0; i < Count; i++)
+  {
+    if ( OutputFull( &Data))
+    {
+      waitStart = Milliseconds;
+      do
+      {
+        KickOutput( &Data);
+        if ( !DataAttached || Milliseconds - waitStart > DATA_STALL_MSEC)
+          return i;		// host's gone
+      } while ( OutputFull( &Data));
+    } // if no room
+    QueueOutput( &Data, (char) What[ i]);
+  } // for each byte
+  KickOutput( &Data);
+  return Count;
+} // USDataWrite
+
+//* USDataRead - Take data interface input, up to Count bytes.
+//  ----------------------------------------------------------
+//
+//  Doesn't wait.  Returns the number of bytes taken.
+//
+
+int USDataRead( uint8_t *What, int Count)
+{
+
+  if ( Data.InQIn == Data.InQOut)
+    PollUSB();
+  return TakeInput( &Data, What, Count);
+} // USDataRead
+
+//*	Disk mode.
+//	==========
+
+//* USDiskMode - Make the data interface a disk, or not.
+//  ----------------------------------------------------
+//
+//  Drops off the bus long enough for the host to notice, and comes
+//  back as the other kind of device; the host enumerates it again.
+//  Anything queued for the console waits until it has.  Returns
+//  true: there's always a disk on USB.
+//
+
+bool USDiskMode( bool On)
+{
+
+  if ( !Usbd_dev)
+    USInit();             // if not initialized, do it.
+
+  nvic_disable_irq( NVIC_OTG_FS_IRQ);
+  usbd_disconnect( Usbd_dev, true);
+  Usbd_registered = 0;
+  DiskMode = On;
+  DiskBusy = DiskHeld = false;
+  DiskLength = -1;
+  DataAttached = false;
+  ClearChannel( &Data);
+  Data.TxBusy = false;
+  Console.TxBusy = false;
+  ifaces[ DATA_INTERFACE].altsetting = On ? disk_iface : image_iface;
+  nvic_enable_irq( NVIC_OTG_FS_IRQ);
+
+  Delay( DISCONNECT_DELAY);
+  usbd_disconnect( Usbd_dev, false);
+  return true;
+} // USDiskMode
+
+//* USDiskPoll - Keep the disk moving from the foreground.
+//  ------------------------------------------------------
+//
+//  Call after MscService: sends what it's made ready and lets the
+//  host send again if there's room now.
+//
+
+void USDiskPoll( void)
+{
+
+  nvic_disable_irq( NVIC_OTG_FS_IRQ);
+  usbd_poll( Usbd_dev);
+  DiskSend();
+  if ( DiskHeld && MscCanReceive())
+  {
+    DiskHeld = false;
+    usbd_ep_nak_set( Usbd_dev, DATA_OUT_EP, 0);
+  }
+  nvic_enable_irq( NVIC_OTG_FS_IRQ);
+  return;
+} // USDiskPoll
+
+//  DiskReceive - Hand an OUT packet to the disk.
+//  ---------------------------------------------
+//
+//  NAK until it can take another.
+//
+
+static void DiskReceive( usbd_device *usbd_dev)
+{
+
+  uint8_t
+    packet[ MAX_PACKET_SIZE];
+  int
+    len;
+
+  len = usbd_ep_read_packet( usbd_dev, DATA_OUT_EP, packet, sizeof( packet));
+  MscReceive( packet, len);
+  if ( !MscCanReceive())
+  {
+    usbd_ep_nak_set( usbd_dev, DATA_OUT_EP, 1);
+    DiskHeld = true;
+  }
+  return;
+} // DiskReceive
+
+//  DiskSend - Send the disk's next IN packet, if it has one.
+//  ---------------------------------------------------------
+//
+//  Called from the transmit callback, or with the interrupt off.
+//  A packet the endpoint won't take yet is kept for next time.
+//
+
+static void DiskSend( void)
+{
+
+  if ( DiskBusy || !Usbd_registered)
+    return;
+  if ( DiskLength < 0 && (DiskLength = MscTransmit( DiskPacket)) < 0)
+    return;
+  if ( usbd_ep_write_packet( Usbd_dev, DATA_IN_EP, DiskPacket,
+    (uint16_t) DiskLength) == 0 && DiskLength > 0)
+    return;			// endpoint not ready; try again later
+  DiskLength = -1;
+  DiskBusy = true;
+  return;
+} // DiskSend
+
+//*	Output queue.
+//	=============
+
+//  QueueOutput - Add a character to a channel's output queue.
+//  ----------------------------------------------------------
+//
+//  If it's full, waits for the host to make room.
+//
+
+static void QueueOutput( USB_CHANNEL *Ch, char What)
+{
+
+  int
+    next;
+
+  next = Ch->OutQIn + 1;
+  if ( next >= Ch->OutputSize)
+    next = 0;
+  while ( next == Ch->OutQOut)
+    KickOutput( Ch);		// full; wait for room
+  Ch->OutputQueue[ Ch->OutQIn] = What;
+  Ch->OutQIn = next;
+  return;
+} // QueueOutput
+
+//  OutputFull - See if a channel's output queue is full.
+//  -----------------------------------------------------
+//
+
+static bool OutputFull( USB_CHANNEL *Ch)
+{
+
+  int
+    next;
+
+  next = Ch->OutQIn + 1;
+  if ( next >= Ch->OutputSize)
+    next = 0;
+  return next == Ch->OutQOut;
+} // OutputFull
+
+//  StartOutput - Send the next packet if the endpoint's free.
+//  ----------------------------------------------------------
+//
+//  Called from the transmit callback, or with the USB interrupt
+//  off.  Up to a full packet is taken from the queue; if there's
+//  nothing and the last packet was full, a zero-length packet ends
+//  the transfer.
+//
+
+static void StartOutput( USB_CHANNEL *Ch)
+{
+
+  char
+    packet[ MAX_PACKET_SIZE];
+  int
+    count,
+    out;
+
+  if ( Ch->TxBusy || !Usbd_registered)
+    return;
+
+  count = 0;
+  out = Ch->OutQOut;
+  while ( out != Ch->OutQIn && count < MAX_PACKET_SIZE)
+  {
+    packet[ count++] = Ch->OutputQueue[ out++];
+    if ( out >= Ch->OutputSize)
+      out = 0;
+  } // fill the packet
+  if ( count == 0 && !Ch->NeedZLP)
+    return;			// nothing to send
+
+  if ( usbd_ep_write_packet( Usbd_dev, Ch->InEp, packet, count) == 0)
+    return;			// endpoint not ready; try again later
+  Ch->OutQOut = out;
+  Ch->NeedZLP = (count == MAX_PACKET_SIZE);
+  Ch->TxBusy = true;
+  return;
+} // StartOutput
+
+//  KickOutput - Get output moving from the foreground.
+//  ---------------------------------------------------
+//
+//  Picks up any completion the interrupt hasn't seen yet, then
+//  starts a packet if none is in flight.
+//
+
+static void KickOutput( USB_CHANNEL *Ch)
+{
+
+  nvic_disable_irq( NVIC_OTG_FS_IRQ);
+  if ( Ch->TxBusy)
+    usbd_poll( Usbd_dev);
+  StartOutput( Ch);
+  nvic_enable_irq( NVIC_OTG_FS_IRQ);
+  return;
+} // KickOutput
+
+//  PollUSB - Poll the USB device from the foreground.
+//  --------------------------------------------------
+//
+//  The interrupt polls too, so keep it out while we do.
+//
+
+static void PollUSB( void)
+{
+
+  nvic_disable_irq( NVIC_OTG_FS_IRQ);
+  usbd_poll( Usbd_dev);
+  nvic_enable_irq( NVIC_OTG_FS_IRQ);
+  return;
+} // PollUSB
+
+//  ClearChannel - Empty both of a channel's queues.
+//  ------------------------------------------------
+//
+//  Called from the control callback, so the interrupt's already out.
+//
+
+static void ClearChannel( USB_CHANNEL *Ch)
+{
+
+  Ch->InQIn = Ch->InQOut = 0;
+  Ch->OutQIn = Ch->OutQOut = 0;
+  Ch->NeedZLP = false;
+  if ( Ch->RxHeld)
+  {
+    Ch->RxHeld = false;
+    usbd_ep_nak_set( Usbd_dev, Ch->OutEp, 0);
+  }
+  return;
+} // ClearChannel
+
+//*	Input queue.
+//	============
+
+//  ReceivePacket - Queue a packet from the host.
+//  ---------------------------------------------
+//
+//  If that leaves no room for another, NAK until there is.  So the
+//  queue never overflows and nothing's dropped; a host sending
+//  faster than we take it is just held off.
+//
+
+static void ReceivePacket( usbd_device *usbd_dev, USB_CHANNEL *Ch)
+{
   int 
-    thisPass;
+    len,
+    i,
+    iq;
+
+  len = usbd_ep_read_packet(usbd_dev, Ch->OutEp, ReceiveBuffer, 64);
+
+  for ( i = 0; i < len; i++)
+  {
+    iq = Ch->InQIn+1;
+    if ( iq >= Ch->InputSize)
+      iq = 0;
+    if ( iq != Ch->InQOut)
+    {  
+      Ch->InputQueue[Ch->InQIn] = ReceiveBuffer[i];
+      Ch->InQIn = iq;		// next in
+    }
+  } // for each received character
 
-  while ( Count != 0)
+  if ( InputRoom( Ch) < MAX_PACKET_SIZE)
   {
-      thisPass = ( Count >= MAX_PACKET_SIZE) ? MAX_PACKET_SIZE-1 : Count;
-      
-      while( usbd_ep_write_packet(Usbd_dev, 0x82, What, thisPass) == 0)
-        usbd_poll(Usbd_dev);    // poll
-      What += thisPass;		// advance buffer
-      Count -= thisPass;
+    usbd_ep_nak_set( usbd_dev, Ch->OutEp, 1);	// no room for another
+    Ch->RxHeld = true;
   }
-  return 0;
+} // ReceivePacket
 
-} //  USWriteBlock
+//  TakeInput - Take up to Count bytes from a channel's input queue.
+//  ----------------------------------------------------------------
+//
+//  Returns the number taken.
+//
+
+static int TakeInput( USB_CHANNEL *Ch, uint8_t *What, int Count)
+{
+
+  int
+    taken;
+
+  taken = 0;
+  while ( taken < Count && Ch->InQIn != Ch->InQOut)
+  {
+    What[ taken++] = (uint8_t) Ch->InputQueue[ Ch->InQOut++];
+    if ( Ch->InQOut >= Ch->InputSize)
+      Ch->InQOut = 0;			// wrap around to the start
+  } // while there's input
+  if ( taken)
+    ReleaseInput( Ch);
+  return taken;
+} // TakeInput
+
+//  InputRoom - How much more a channel's input queue can take.
+//  -----------------------------------------------------------
+//
+
+static int InputRoom( USB_CHANNEL *Ch)
+{
+
+  int
+    used;
+
+  used = Ch->InQIn - Ch->InQOut;
+  if ( used < 0)
+    used += Ch->InputSize;
+  return Ch->InputSize - 1 - used;
+} // InputRoom
+
+//  ReleaseInput - Let the host send again once there's room.
+//  ---------------------------------------------------------
+//
+
+static void ReleaseInput( USB_CHANNEL *Ch)
+{
+
+  if ( !Ch->RxHeld || InputRoom( Ch) < MAX_PACKET_SIZE)
+    return;
+  nvic_disable_irq( NVIC_OTG_FS_IRQ);
+  Ch->RxHeld = false;
+  usbd_ep_nak_set( Usbd_dev, Ch->OutEp, 0);
+  nvic_enable_irq( NVIC_OTG_FS_IRQ);
+  return;
+} // ReleaseInput
 
 int _write( int Fd, char *What, int Count)
 {
@@ -3,10 +3,13 @@
 //
 //	For interface details, see Chuck Forsberg's document on the web
 //	entitled "XMODEM/YMODEM Protocol Reference".   Some shortcuts
-//	have been taken--CRC16 is generated on sending, but not checked
-//	on receiving.  There is little transfer retry cdoe here, as it's
+//	have been taken.  There is little transfer retry cdoe here, as it's
 //	expected that a hard-wired connection to the host will be used.
 //
+//	Over USB, waiting for an ACK after every block costs more than
+//	sending it, so YMODEM-g (no ACKs; the link is trusted to be
+//	error-free) is used whenever the other end offers it.
+//
 
 #include <stdint.h>
 #include <stdbool.h>
@@ -17,6 +20,7 @@
 #include "license.h"
 
 #include "filedef.h"
+#include "diskio.h"
 #include "comm.h"
 #include "globals.h"
 #include "usbserial.h"
@@ -34,6 +38,7 @@
 #define ASCII_EOT 0x04
 #define ASCII_CAN 0x18
 #define ASCII_C   0x43
+#define ASCII_G   0x47
 
 //	Timeout in milliseconds for a response.
 
@@ -44,21 +49,45 @@
 #define POLL_TIMEOUT 5000
 #define POLL_RETRIES 5
 
+//	Asking for YMODEM-g first: a sender that knows it answers at once.
+
+#define G_POLL_TIMEOUT 1000
+#define G_POLL_RETRIES 3
+
+//	Sends of a block NAKed before giving up.
+
+#define SEND_RETRIES 10
+
 //	Data payload sizes.
 
 #define LARGE_BLOCK 1024
 #define SMALL_BLOCK 128
 #define MAX_PACKET_SIZE LARGE_BLOCK	// size of the largest packet
 
-//	How much space allocated for the file list?
+//	The sender reads the file this much at a time, into two halves
+//	so that the card fills one while the other goes out; the file
+//	list gets the rest of the buffer.  The receiver keeps each block
+//	in its own slot.
+
+#define SEND_CHUNK (16 * LARGE_BLOCK)
+#define NAME_BUF_SIZE (TAPE_BUFFER_SIZE - 2 * SEND_CHUNK)
+#define RECEIVE_SLOTS (TAPE_BUFFER_SIZE / LARGE_BLOCK)
+
+//	Entries in the sender's map of a file's clusters.
+
+#define LINK_MAP_SIZE 64
 
-#define NAME_BUF_SIZE (TAPE_BUFFER_SIZE - MAX_PACKET_SIZE)
+static DWORD
+  LinkMap[ LINK_MAP_SIZE];
 
 //	Prototypes.
 
-static int BuildFileList( char *Pattern, uint8_t *RetBuf, int RetSize);
+static XERR_CODE SendBody( FIL *File, bool Streaming);
+static FRESULT StartChunk( FIL *File, FSIZE_t Pos, uint8_t *Buf, UINT *Len);
 static int SendPacket( uint8_t BlockNo, bool BigBlock, uint8_t *Payload);
 static int GetByte( uint32_t TimeOut);
+static int GetBlock( uint8_t *Buf, int Count, uint32_t TimeOut,
+  uint16_t *Crc);
 static int WaitChar( uint32_t TimeOut);
 static void PutBlock( uint8_t *What, int Count);
 static void PutChar( uint8_t What);
@@ -70,6 +99,11 @@ static char *IntToString (uint32_t What);
 //	Just takes the file name.  Uses FATFS to mount and read the file.
 //	Returns an XERR_ code (see definitions in ymodem.h).  
 //
+//	The receiver picks the protocol with its go-ahead: 'C' for
+//	YMODEM, where each block waits for an ACK, or 'G' for YMODEM-g,
+//	where the blocks are sent back-to-back and nothing comes back
+//	unless the receiver gives up.
+//
         
 XERR_CODE SendYmodem( char *FileSpec)
 {
@@ -80,22 +114,24 @@ XERR_CODE SendYmodem( char *FileSpec)
     fHandle;            // our file structure
   FSIZE_t 
     fLength;            // file length
-    
-  uint16_t
-    blockNo;            // block number
-  UINT
-    bytesRead;          // how many bytes read
+  XERR_CODE
+    xerr;
 
   char
     *fileName;		// the file we're working on
 
   int 
-    ch; 
+    ch,
+    nameLength; 
+
+  bool
+    streaming,		// YMODEM-g
+    goAhead;		// already have the receiver's go-ahead
     
   uint8_t
     *buffer = TapeBuffer;     	// data buffer
   uint8_t
-     *nameBuf = TapeBuffer+MAX_PACKET_SIZE;
+     *nameBuf = TapeBuffer+2*SEND_CHUNK;
   
 //	Build list of files to transfer.  If none, exit.     
 
@@ -103,6 +139,8 @@ XERR_CODE SendYmodem( char *FileSpec)
     return XERR_NO_FILE;		// say file not found  
   
   fileName = (char *) nameBuf;		// first name
+  streaming = false;
+  goAhead = false;
 
   while (true)
   {  // transfer a file at a time.
@@ -112,25 +150,28 @@ XERR_CODE SendYmodem( char *FileSpec)
   
     fLength = f_size( &fHandle);          // get length
 
-//  Wait for a 'C' from the recevier.  If nothing, exit.
+//  Wait for a 'G' or 'C' from the receiver, unless the last file's
+//  end brought one.  If nothing, exit.
 
-    while (true)
+    while ( !goAhead)
     {
       if ( (ch = GetByte(RECEIVE_TIMEOUT)) < 0)
         return XERR_ABORT;
-      else
+      if ( ch == ASCII_G || ch == ASCII_C)
       {
-        if ( ch == 'C')
-          break;			// we got a go-ahead; discard others
+        streaming = ch == ASCII_G;
+        goAhead = true;			// we got a go-ahead; discard others
       }
     } // wait for receiver
+    goAhead = false;
 
-//  We have a C from the receiver, so construct a 128-byte packet.  Since we 
-//  allocate 128 bytes total and our file length can be 10 characters, the
-//  file name can't be more than 100 or so characters long.
+//  We have a go-ahead from the receiver, so construct a 128-byte packet.
+//  Since we allocate 128 bytes total and our file length can be 10
+//  characters, the file name can't be more than 100 or so characters long.
 
     memset( buffer, 0, SMALL_BLOCK);		// clear garbage out
-    strncpy( (char *) buffer, fileName, 100);	// copy in the file name
+    nameLength = (int) strlen( fileName);
+    memcpy( buffer, fileName, nameLength < 100 ? nameLength : 100);
 
 //	Add the file length after a null.  
   
@@ -140,56 +181,52 @@ XERR_CODE SendYmodem( char *FileSpec)
 
     SendPacket( 0, false, buffer);		
 
-//	The receiver will acknowledge with an ACK, then a C.
+//	The receiver will acknowledge with an ACK, then a C; with
+//	YMODEM-g, just another G.
 
-    ch = GetByte( RECEIVE_TIMEOUT);
-
-    if (ch < 0)
-      return XERR_TIMEOUT;	// no good
-    if ( ch != ASCII_ACK)  
-      return XERR_ABORT;  	// didn't get what we wanted
-    
-//	Now, we get in a "C" loop as we send packets.
-
-    blockNo = 1;			// we start here
-    while ( true)
+    if ( !streaming)
     {
       ch = GetByte( RECEIVE_TIMEOUT);
+      if (ch < 0)
+        return XERR_TIMEOUT;	// no good
+      if ( ch != ASCII_ACK)  
+        return XERR_ABORT;  	// didn't get what we wanted
+    }
+    ch = GetByte( RECEIVE_TIMEOUT);
+    if ( ch < 0)
+      return XERR_TIMEOUT;
+    if ( ch != (streaming ? ASCII_G : ASCII_C))
+      return XERR_ABORT;
+    
+//	Now send the file.
 
-      if ( ch < 0)
-        return XERR_TIMEOUT;		// dead receiver
-      if ( ch != ASCII_ACK)
-      {  // should be an ACK, but could be a "C" at the start
-        if ( ch != 'C')
-          return XERR_ABORT;		// got the wrong response
-      }
-      bytesRead = 0;
-      fres = f_read( &fHandle, buffer, LARGE_BLOCK, &bytesRead);
-      if ( bytesRead == 0)
-        break;				// call it eof
-      if ( bytesRead < LARGE_BLOCK)
-         memset( buffer+bytesRead, 0, LARGE_BLOCK-bytesRead); // fill with zero
-
-//	okay, send the packet.     
-       
-      SendPacket( blockNo, true, buffer);
-      blockNo++;                  // advance
-    } // keep going
+    xerr = SendBody( &fHandle, streaming);
+    f_close( &fHandle);
+    if ( xerr != XERR_SUCCESS)
+      return xerr;
   
-//	At end of file here.   Send some EOTs.
+//	At end of file here.   Send some EOTs.  The first gets a NAK,
+//	the second an ACK; with YMODEM-g, the first gets the ACK.
 
     PutChar(ASCII_EOT);				// signal EOF
-  
-//	We'll get a NAK.
-
-    ch = GetByte( RECEIVE_TIMEOUT);		// we expect NAK
-    PutChar( ASCII_EOT);
+    if ( !streaming)
+    {
+      ch = GetByte( RECEIVE_TIMEOUT);		// we expect NAK
+      PutChar( ASCII_EOT);
+    }
     ch = GetByte( RECEIVE_TIMEOUT);		// shouild be an ACK
+    if ( ch == ASCII_CAN)
+      return XERR_ABORT;
+
+//	The receiver asks for the next file as it did for this one.
+
     ch = GetByte( RECEIVE_TIMEOUT);
-    if ( ch != ASCII_C)
+    if ( ch != ASCII_C && ch != ASCII_G)
     {
       break;
     }
+    streaming = ch == ASCII_G;
+    goAhead = true;
     fileName = fileName + strlen(fileName)+1;	// to next file 
     if ( !*fileName)				// if end of list
       break;
@@ -197,12 +234,164 @@ XERR_CODE SendYmodem( char *FileSpec)
 
   memset( buffer, 0, LARGE_BLOCK);		// clear the buffer
   SendPacket( 0, false, buffer);		// send a null filename
-  f_close( &fHandle);
   PutChar (ASCII_CAN);
   PutChar (ASCII_CAN);
   return XERR_SUCCESS;
 } // YmodemSend
 
+//	SendBody - Send the data blocks of a file.
+//	------------------------------------------
+//
+//	The file goes out a chunk at a time from alternate halves of the
+//	buffer; while one half is on the wire, the card is filling the
+//	other with the next chunk.  Nothing is left in flight on return.
+//
+
+static XERR_CODE SendBody( FIL *File, bool Streaming)
+{
+
+  uint8_t
+    *half[2];		// the two halves of the buffer
+  UINT
+    length[2],		// bytes of the file in each
+    chunkPos;		// next block to send from the current half
+  FSIZE_t
+    nextPos;		// where the next chunk starts
+  XERR_CODE
+    xerr;
+  uint16_t
+    blockNo;            // block number
+  int
+    ch,
+    cur,		// half being sent
+    tries;		// sends of a block left
+
+//  A map of the file's clusters, if it isn't too fragmented for one,
+//  lets whole chunks be read by sector number.
+
+  File->cltbl = LinkMap;
+  LinkMap[0] = LINK_MAP_SIZE;
+  if ( f_lseek( File, CREATE_LINKMAP) != FR_OK)
+    File->cltbl = NULL;
+
+  half[0] = TapeBuffer;
+  half[1] = TapeBuffer + SEND_CHUNK;
+  cur = 0;
+  xerr = XERR_SUCCESS;
+  if ( StartChunk( File, 0, half[0], &length[0]) != FR_OK)
+    xerr = XERR_READ;
+  nextPos = length[0];
+  blockNo = 1;				// we start here
+
+  while ( xerr == XERR_SUCCESS && length[ cur])
+  {
+    if ( disk_claim( half[ cur], SEND_CHUNK) != RES_OK)
+    {
+      xerr = XERR_READ;
+      break;
+    }
+
+//  Start on the next chunk before sending this one.
+
+    if ( StartChunk( File, nextPos, half[ cur ^ 1], &length[ cur ^ 1]) != FR_OK)
+    {
+      xerr = XERR_READ;
+      break;
+    }
+    nextPos += length[ cur ^ 1];
+
+    if ( length[ cur] % LARGE_BLOCK)
+    { // fill the last block with zero
+      memset( half[ cur] + length[ cur], 0,
+        LARGE_BLOCK - length[ cur] % LARGE_BLOCK);
+      length[ cur] += LARGE_BLOCK - length[ cur] % LARGE_BLOCK;
+    }
+
+//	okay, send the packets.  Without streaming, a NAK sends one again.
+
+    for ( chunkPos = 0; chunkPos < length[ cur] && xerr == XERR_SUCCESS;
+      chunkPos += LARGE_BLOCK)
+    {
+      tries = SEND_RETRIES;
+      do
+      {
+        SendPacket( blockNo, true, half[ cur] + chunkPos);
+        if ( Streaming)
+        { // nothing comes back but a cancel
+          ch = ASCII_ACK;
+          if ( USCharReady() && GetByte( 0) == ASCII_CAN)
+            ch = ASCII_CAN;
+          break;
+        }
+        if ( (ch = GetByte( RECEIVE_TIMEOUT)) < 0)
+          break;			// dead receiver
+      } while ( ch == ASCII_NAK && --tries);
+      if ( ch < 0)
+        xerr = XERR_TIMEOUT;
+      else if ( ch != ASCII_ACK)
+        xerr = XERR_ABORT;		// got the wrong response
+      blockNo++;                  // advance
+    } // for each block
+    cur ^= 1;
+  } // for each chunk
+
+  disk_claim( TapeBuffer, 2 * SEND_CHUNK);	// card may still own a half
+  File->cltbl = NULL;
+  return xerr;
+} // SendBody
+
+//	StartChunk - Start reading a chunk of the file.
+//	-----------------------------------------------
+//
+//	Up to SEND_CHUNK bytes at Pos, which is a multiple of SEND_CHUNK,
+//	into Buf; *Len says how many there are.  If the chunk lies in one
+//	run of clusters, it's read by sector number with a single
+//	multi-sector transfer that's only started here--f_read would
+//	stop at every cluster, and wait.  Otherwise f_read does it now.
+//
+
+static FRESULT StartChunk( FIL *File, FSIZE_t Pos, uint8_t *Buf, UINT *Len)
+{
+
+  FATFS
+    *fs;
+  DWORD
+    *tbl,
+    cluster,		// cluster of the file Pos is in
+    run,		// clusters in the fragment holding it
+    clusterBytes;
+  FSIZE_t
+    left;
+
+  *Len = 0;
+  left = f_size( File) > Pos ? f_size( File) - Pos : 0;
+  if ( left == 0)
+    return FR_OK;				// at eof
+  *Len = left < SEND_CHUNK ? (UINT) left : SEND_CHUNK;
+
+  fs = File->obj.fs;
+  if ( File->cltbl)
+  {
+    clusterBytes = (DWORD) fs->csize * BLOCK_SIZE;
+    cluster = (DWORD) (Pos / clusterBytes);
+    tbl = File->cltbl + 1;
+    while ( (run = *tbl++) != 0 && cluster >= run)
+    {
+      cluster -= run;
+      tbl++;
+    }
+    if ( run && (run - cluster) * clusterBytes - Pos % clusterBytes >= *Len)
+      return disk_read_start( fs->pdrv, Buf,
+        fs->database + (LBA_t) fs->csize * (*tbl + cluster - 2) +
+          (LBA_t) (Pos % clusterBytes / BLOCK_SIZE),
+        (*Len + BLOCK_SIZE - 1) / BLOCK_SIZE) == RES_OK ? FR_OK : FR_DISK_ERR;
+  } // if mapped
+
+  if ( f_lseek( File, Pos) != FR_OK)
+    return FR_DISK_ERR;
+  return f_read( File, Buf, *Len, Len);
+} // StartChunk
+
 //*    	SendPacket--Send Ymodem Payload.
 //	--------------------------------
 //
@@ -252,6 +441,14 @@ static int SendPacket( uint8_t BlockNo, bool BigBlock, uint8_t *Payload)
 //
 //	Creates or overwrites a file whose name is sent in the zero block.
 //
+//	Asks for YMODEM-g first; a sender that doesn't know it won't
+//	answer, and we go on to ask for YMODEM.  With YMODEM-g nothing
+//	is acknowledged, so a bad block ends the transfer rather than
+//	being sent again.
+//
+//	Each block lands in its own slot of the tape buffer, so that one
+//	can come in while the card is still writing the last.
+//
 
 XERR_CODE ReceiveYmodem( void)
 {
@@ -273,6 +470,9 @@ XERR_CODE ReceiveYmodem( void)
     blockno[2],			// block and complement block
     crcval[2];			// crc bytes
 
+  uint16_t
+    blockCrc;			// CRC of the block as it came in
+
   uint32_t
     bytesWritten,		// how many bytes written
     fileSize;			// file size as read in header
@@ -282,16 +482,17 @@ XERR_CODE ReceiveYmodem( void)
     i,				// general index
     rerror,			// error flag
     currChar,			// current character
-    dPos,			// position in buffer
     blockLength;		// block length
 
+  bool
+    streaming,			// YMODEM-g
+    fileOpen;			// tf is open
   
   typedef enum   
   {
     GET_TYPE,
     GET_FIRST_BLOCK,
     GET_SECOND_BLOCK,
-    GET_DATA,
     GET_CRC1,
     GET_CRC2,
     GET_EOT1,
@@ -304,20 +505,35 @@ XERR_CODE ReceiveYmodem( void)
 
   rerror = XERR_SUCCESS;
   bytesWritten = 0;			// initialize counters
+  fileSize = 0;
   nextBlock = 0;			// keep count
+  blockLength = LARGE_BLOCK;
+  fileOpen = false;
   
 //	First, flush any characters lying around.
 
   while( Ucharavail() )
     Ugetchar();
     
-  for ( i = POLL_RETRIES; i; i--)
+  streaming = true;
+  for ( i = G_POLL_RETRIES; i; i--)
   {
-    PutChar( ASCII_C);		// put out a C
+    PutChar( ASCII_G);		// put out a G
 
-    if ( WaitChar( POLL_TIMEOUT) > 0)
+    if ( WaitChar( G_POLL_TIMEOUT) > 0)
       break;  
-  } // wait for a response
+  } // wait for a YMODEM-g sender
+  if ( i == 0)
+  {
+    streaming = false;
+    for ( i = POLL_RETRIES; i; i--)
+    {
+      PutChar( ASCII_C);		// put out a C
+
+      if ( WaitChar( POLL_TIMEOUT) > 0)
+        break;  
+    } // wait for a response
+  } // if no YMODEM-g
   if ( i == 0)
     return XERR_TIMEOUT;    
   state = GET_TYPE;		// start here.
@@ -350,12 +566,29 @@ XERR_CODE ReceiveYmodem( void)
           blockLength = LARGE_BLOCK;			// long block
         else if ( currChar == ASCII_SOH)
           blockLength = SMALL_BLOCK;			// short block
+        else if ( currChar == ASCII_CAN)
+          rerror = XERR_ABORT;			// sender gave up
         else if ( currChar == ASCII_EOT)
         {
-          if ( bytesWritten)
+          if ( fileOpen)
             f_close( &tf);
-          PutChar( ASCII_NAK);			// ready for next file.
-          state = GET_EOT2;		// here we go...
+          fileOpen = false;
+
+//	YMODEM-g takes one EOT and goes on to the next file; YMODEM
+//	wants to see it twice.
+
+          if ( streaming)
+          {
+            PutChar( ASCII_ACK);
+            PutChar( ASCII_G);
+            nextBlock = 0;			// get ready for next file
+            state = GET_TYPE;
+          }
+          else
+          {
+            PutChar( ASCII_NAK);		// ready for next file.
+            state = GET_EOT2;		// here we go...
+          }
         }  // got an EOT
         break;
 
@@ -373,16 +606,18 @@ XERR_CODE ReceiveYmodem( void)
           rerror = XERR_CORRUPT;		// bad block
           break;
         }
-        dPos  = 0;				// set the counter
-        state = GET_DATA;
-        break;
 
-//	Read the block in.
+//	Read the block into its slot, straight from the input queue.
 
-      case GET_DATA:				// fill the block buffer
-        buffer[ dPos++] = (uint8_t) currChar;	// store the character	
-        if ( dPos >= blockLength)
-          state = GET_CRC1;			// got our buffer, CRC1 next
+        buffer = TapeBuffer + (nextBlock % RECEIVE_SLOTS) * LARGE_BLOCK;
+        disk_claim( buffer, blockLength);	// slot still being written?
+        blockCrc = 0;
+        if ( GetBlock( buffer, blockLength, RECEIVE_TIMEOUT, &blockCrc) < 0)
+        {
+          rerror = XERR_TIMEOUT;
+          break;
+        }
+        state = GET_CRC1;			// got our buffer, CRC1 next
         break;
 
 //	Get 2 bytes of CRC
@@ -394,7 +629,28 @@ XERR_CODE ReceiveYmodem( void)
       
       case GET_CRC2:
         crcval[1] = (uint8_t) currChar;		// second byte of CRC
-        (void) crcval;				// gets rid of warning
+        state = GET_TYPE;
+
+//	Check the block.  Without streaming, a bad one is asked for
+//	again and one we've had already (our ACK got lost) is
+//	acknowledged again; with it, there's no asking.
+
+        if ( blockCrc != (uint16_t) ((crcval[0] << 8) | crcval[1]))
+        {
+          if ( streaming)
+            rerror = XERR_CORRUPT;
+          else
+            PutChar( ASCII_NAK);
+          break;
+        } // if bad CRC
+        if ( blockno[0] != (uint8_t) nextBlock)
+        {
+          if ( !streaming && blockno[0] == (uint8_t) (nextBlock-1))
+            PutChar( ASCII_ACK);
+          else
+            rerror = XERR_CORRUPT;		// lost one
+          break;
+        } // if out of sequence
 
 //	Block 0 is a special case.  It has the file name and length.
 
@@ -407,8 +663,10 @@ XERR_CODE ReceiveYmodem( void)
             rerror = XERR_ENDFILE;	// say we're done
             break;			// no more             
           }
-          strcpy(filename, (char *)buffer);	// get the file name
-          fileSize = strtoul( (char *) buffer+strlen(filename)+1, NULL, 0);
+          strncpy( filename, (char *) buffer, sizeof( filename) - 1);
+          filename[ sizeof( filename) - 1] = 0;	// get the file name
+          fileSize = strtoul( (char *) buffer+strlen((char *) buffer)+1,
+            NULL, 0);
           if ( fileSize == 0)
             fileSize = 0x40000000;	// upper limit of 1GB
 
@@ -420,6 +678,7 @@ XERR_CODE ReceiveYmodem( void)
            rerror = XERR_NO_FILE;
            break;				// couldn't create 
           } // if open error   
+          fileOpen = true;
 
         } // if block zero
         else
@@ -434,13 +693,14 @@ XERR_CODE ReceiveYmodem( void)
           bytesWritten += thisPass;	// bump the write
         } // we're dumping a block
 
-//	Respond with an ACK or ACK-C if block 0.
+//	Respond with an ACK or ACK-C if block 0.  YMODEM-g answers
+//	block 0 with a G and the rest with nothing.
 
-        PutChar( ASCII_ACK);
+        if ( !streaming)
+          PutChar( ASCII_ACK);
         rerror = XERR_SUCCESS;		// still good
         if ( nextBlock == 0)
-          PutChar( ASCII_C);
-        state = GET_TYPE;
+          PutChar( streaming ? ASCII_G : ASCII_C);
         nextBlock++;
         break;
 
@@ -466,7 +726,11 @@ XERR_CODE ReceiveYmodem( void)
 
     if ( rerror != XERR_SUCCESS)
     {
-      PutChar( ASCII_CAN);		// abort the transfer
+      if ( rerror != XERR_ENDFILE)
+      {
+        PutChar( ASCII_CAN);		// abort the transfer
+        PutChar( ASCII_CAN);
+      }
       break;
     }
   }; // while
@@ -474,7 +738,7 @@ XERR_CODE ReceiveYmodem( void)
   if  ( rerror == XERR_ENDFILE)
     rerror = XERR_SUCCESS;		// if we came to the end gracefully
 
-  if ( bytesWritten)
+  if ( fileOpen)
   {
     f_close( &tf);
   }
@@ -487,10 +751,10 @@ XERR_CODE ReceiveYmodem( void)
 //	Creates a list of null-terminated file names according to
 //	the search criterion in "Pattern".   Returns the number of
 //	matches found, as well as filling the buffer.  Last name
-//	is terminated by a double-null.
+//	is terminated by a double-null.  ZMODEM uses it too.
 //
 
-static int BuildFileList( char *Pattern, uint8_t *RetBuf, int RetSize)
+int BuildFileList( char *Pattern, uint8_t *RetBuf, int RetSize)
 {
 
   int 
@@ -543,20 +807,57 @@ static int BuildFileList( char *Pattern, uint8_t *RetBuf, int RetSize)
 static int GetByte( uint32_t TimeOut)
 {
 
+  uint8_t
+    ch;
+
+  if ( GetBlock( &ch, 1, TimeOut, NULL) < 0)
+    return -1;                  // say we're timed out  
+  return ch;
+} // GetByte
+
+//  	GetBlock - Timed get of Count bytes.
+//  	------------------------------------
+//
+//      Copies them out of the input queue a run at a time, rather
+//      than a character at a time.  If Crc isn't NULL, each run is
+//      added to it as it comes, while the rest is still on the way,
+//      so the block's CRC is ready when its last byte is.  The
+//      timeout (milliseconds) is for each wait for more.  Returns 0,
+//      or -1 if timed out.
+//
+
+static int GetBlock( uint8_t *Buf, int Count, uint32_t TimeOut,
+  uint16_t *Crc)
+{
+
+  uint8_t
+    *in;
   uint32_t 
     start;
+  int
+    n;
 
   start = Milliseconds;            // get starting time
-  do
+  while ( Count > 0)
   {
-    if ( USCharReady())
-    { // if input waiting
-      return USGetchar();        // return input read
+    if ( (n = USPeekInput( &in)) == 0)
+    {
+      if ( (Milliseconds - start) > TimeOut)
+        return -1;
+      continue;
     }
-  }
-  while ( (Milliseconds - start) <= (uint32_t) TimeOut);
-  return -1;                    // say we're timed out  
-} // GetByte
+    if ( n > Count)
+      n = Count;
+    memcpy( Buf, in, n);
+    USSkipInput( n);
+    if ( Crc)
+      *Crc = CRC16Add( *Crc, Buf, (uint16_t) n);
+    Buf += n;
+    Count -= n;
+    start = Milliseconds;
+  } // while there's more to get
+  return 0;
+} // GetBlock
 
 //*  	WaitChar - Timed wait for input.
 //  	---------------------------------
@@ -0,0 +1,1402 @@
+//*	ZMODEM file transfer.
+//	---------------------
+//
+//	After Chuck Forsberg's "The ZMODEM Inter-Application File
+//	Transfer Protocol".  File data goes out as a stream of
+//	subpackets that aren't acknowledged one by one; the receiver
+//	speaks up when one is bad, with a ZRPOS giving the offset to go
+//	on from, and the sender seeks back there.  The same ZRPOS
+//	resumes a transfer that was cut off: a receiver that already has
+//	the first part of a file asks for the rest.
+//
+//	The sender asks for a ZACK every so often and never gets more
+//	than a window ahead of the last one, so that a bad subpacket
+//	costs at most a window's worth of resending.  32-bit CRCs are
+//	used when the other end can do them.  Not here: compression,
+//	encryption, remote commands and file management other than
+//	resuming.
+//
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "license.h"
+
+#include "filedef.h"
+#include "diskio.h"
+#include "comm.h"
+#include "globals.h"
+#include "usbserial.h"
+
+#include "crc16.h"
+#include "crc32.h"
+#include "zmodem.h"
+
+//	Framing characters.
+
+#define ZPAD	'*'		// pad; starts a header
+#define ZDLE	0x18		// escape; also CAN
+#define ZBIN	'A'		// binary header, 16-bit CRC
+#define ZHEX	'B'		// hex header
+#define ZBIN32	'C'		// binary header, 32-bit CRC
+#define XON	0x11
+#define XOFF	0x13
+
+//	Frame types.
+
+#define ZRQINIT	0		// request receive init
+#define ZRINIT	1		// receive init
+#define ZSINIT	2		// send init
+#define ZACK	3		// acknowledge
+#define ZFILE	4		// file name and length
+#define ZSKIP	5		// skip this file
+#define ZNAK	6		// last header was garbled
+#define ZABORT	7		// abort the batch
+#define ZFIN	8		// finish the session
+#define ZRPOS	9		// resume data at this position
+#define ZDATA	10		// data subpackets follow
+#define ZEOF	11		// end of file at this position
+#define ZFERR	12		// fatal file error
+#define ZCRC	13		// file CRC request
+#define ZCOMMAND 18		// remote command
+
+//	What ends a data subpacket, after a ZDLE.
+
+#define ZCRCE	'h'		// end of frame, header follows
+#define ZCRCG	'i'		// frame goes on, nothing expected
+#define ZCRCQ	'j'		// frame goes on, ZACK expected
+#define ZCRCW	'k'		// end of frame, ZACK expected
+#define ZRUB0	'l'		// 0x7f
+#define ZRUB1	'm'		// 0xff
+
+//	Header bytes: position low byte first, or flags high byte first.
+
+#define ZP0	0
+#define ZP1	1
+#define ZP2	2
+#define ZP3	3
+#define ZF1	2
+#define ZF0	3
+
+//	ZRINIT capabilities (ZF0).
+
+#define CANFDX	0x01		// full duplex
+#define CANOVIO	0x02		// receives while writing the disk
+#define CANFC32	0x20		// 32-bit CRCs
+
+//	ZFILE conversion (ZF0): carry on from what the receiver has.
+
+#define ZCBIN	1
+#define ZCRESUM	3
+
+//	Results from reading, besides characters and frame types.
+
+#define ZM_TIMEOUT	(-1)
+#define ZM_ERROR	(-2)		// garbled
+#define ZM_CANCEL	(-3)		// five CANs
+#define ZM_NONE		(-4)		// nothing waiting
+#define ZM_FRAME	0x100		// or'd with the subpacket end
+
+//	Timeouts (milliseconds) and retries.
+
+#define HEADER_TIMEOUT	10000		// for a header or data
+#define INIT_TIMEOUT	2000		// between ZRINITs or ZRQINITs
+#define INIT_RETRIES	10
+#define MAX_ERRORS	10		// in a row, before giving up
+#define GARBAGE_LIMIT	(64 * 1024)	// looking for a header
+
+//	Sizes.  The sender reads the file a chunk at a time and sends
+//	it in 1K subpackets, asking for a ZACK every ACK_INTERVAL and
+//	going no more than WINDOW past the last.  The receiver takes
+//	subpackets up to 8K into one half of the tape buffer while the
+//	card writes the other.
+
+#define SUBPACKET	1024
+#define MAX_SUBPACKET	8192
+#define SEND_CHUNK	(32 * 1024)
+#define NAME_BUF_SIZE	(TAPE_BUFFER_SIZE - SEND_CHUNK)
+#define ACK_INTERVAL	(8 * 1024)
+#define WINDOW		(32 * 1024)
+#define RECEIVE_HALF	(TAPE_BUFFER_SIZE / 2)
+#define OUT_SIZE	512		// escaped output staged
+
+//	Fast-seek map: room for this many fragments of a file being
+//	sent, so that a ZRPOS doesn't walk the FAT.
+
+#define LINK_MAP_SIZE	64
+
+//	SendOne's answer when the receiver doesn't want the file.
+
+#define XERR_SKIP	((XERR_CODE) -1)
+
+static bool
+  TxCrc32,			// send 32-bit CRCs
+  RxCrc32,			// last header came with one, so its data does
+  FileOpen;			// receiver: ZFile is open
+static uint8_t
+  Out[ OUT_SIZE];		// escaped output
+static int
+  OutLen,
+  RxHalf,			// receiver: half of TapeBuffer being filled
+  RxFill;			// ... and how far
+static uint32_t
+  RxPos,			// receiver: file position after good data
+  RxCluster,			// ... and the card's cluster size
+  SegSize;			// sender: receiver takes this much at once
+static FIL
+  ZFile;			// the file being sent or received
+static DWORD
+  LinkMap[ LINK_MAP_SIZE];
+
+//	Prototypes.
+
+static XERR_CODE SendOne( char *Name, bool Resume);
+static XERR_CODE SendData( uint32_t Pos, uint32_t Size);
+static XERR_CODE Seek( uint32_t Pos);
+static bool OpenReceived( char *Info, int Length, bool Resume);
+static bool FlushReceived( bool All);
+static void CloseReceived( void);
+static int GetHeader( uint8_t *Hdr, uint32_t TimeOut);
+static int PollHeader( uint8_t *Hdr);
+static int GetHexByte( uint32_t TimeOut);
+static int GetData( uint8_t *Buf, int Max, int *Length);
+static int GetEscaped( uint32_t TimeOut);
+static int GetRaw( uint32_t TimeOut);
+static void PutHexHeader( int Type, const uint8_t *Hdr);
+static void PutBinHeader( int Type, const uint8_t *Hdr);
+static void PutPos( int Type, uint32_t Pos, bool Hex);
+static void PutData( const uint8_t *Buf, int Length, int FrameEnd);
+static void PutEscaped( uint8_t What);
+static void PutOut( uint8_t What);
+static void FlushOut( void);
+static void SetPos( uint8_t *Hdr, uint32_t Pos);
+static uint32_t GetPos( const uint8_t *Hdr);
+static void Cancel( void);
+
+//*	SendZmodem - Send files by ZMODEM.
+//	----------------------------------
+//
+//	FileSpec may have wildcards.  Resume asks the receiver to carry
+//	on from what it has of each file.  Returns an XERR_ code.
+//
+
+XERR_CODE SendZmodem( char *FileSpec, bool Resume)
+{
+
+  uint8_t
+    hdr[4],
+    *nameBuf = TapeBuffer+SEND_CHUNK;
+  char
+    *fileName;
+  int
+    type,
+    tries;
+  XERR_CODE
+    xerr;
+
+  if ( BuildFileList( FileSpec, nameBuf, NAME_BUF_SIZE) == 0)
+    return XERR_NO_FILE;
+
+//  Wake the receiver up and find out what it can do.
+
+  for ( tries = INIT_RETRIES; tries; tries--)
+  {
+    memset( hdr, 0, sizeof( hdr));
+    USWriteBlock( (uint8_t *) "rz\r", 3);
+    PutHexHeader( ZRQINIT, hdr);
+    type = GetHeader( hdr, INIT_TIMEOUT);
+    if ( type == ZRINIT)
+      break;
+    if ( type == ZM_CANCEL || type == ZABORT)
+      return XERR_ABORT;
+  } // until the receiver answers
+  if ( tries == 0)
+    return XERR_TIMEOUT;
+
+//  A receiver that can't take a stream says how much it can buffer;
+//  one that can't receive while it writes gets a subpacket at a time.
+
+  TxCrc32 = (hdr[ZF0] & CANFC32) != 0;
+  SegSize = (uint32_t) hdr[ZP0] | ((uint32_t) hdr[ZP1] << 8);
+  if ( SegSize == 0 && !(hdr[ZF0] & CANOVIO))
+    SegSize = SUBPACKET;
+
+//  Send each file.
+
+  xerr = XERR_SUCCESS;
+  for ( fileName = (char *) nameBuf; *fileName;
+    fileName += strlen( fileName) + 1)
+  {
+    xerr = SendOne( fileName, Resume);
+    if ( xerr == XERR_SKIP)
+      xerr = XERR_SUCCESS;
+    if ( xerr != XERR_SUCCESS)
+      break;
+  } // for each file
+
+  if ( xerr != XERR_SUCCESS)
+  {
+    Cancel();
+    return xerr;
+  }
+
+//  Say we're done; the receiver says so too, and we say "over and
+//  out."
+
+  for ( tries = INIT_RETRIES; tries; tries--)
+  {
+    memset( hdr, 0, sizeof( hdr));
+    PutHexHeader( ZFIN, hdr);
+    type = GetHeader( hdr, INIT_TIMEOUT);
+    if ( type == ZFIN)
+      break;
+  }
+  USWriteBlock( (uint8_t *) "OO", 2);
+  return XERR_SUCCESS;
+} // SendZmodem
+
+//	SendOne - Send a file.
+//	----------------------
+//
+//	Returns an XERR_ code, or XERR_SKIP if the receiver didn't want
+//	it.
+//
+
+static XERR_CODE SendOne( char *Name, bool Resume)
+{
+
+  uint8_t
+    hdr[4],
+    *info = TapeBuffer;
+  char
+    digits[11];
+  uint32_t
+    size,
+    v;
+  int
+    type,
+    tries,
+    infoLen,
+    n;
+  XERR_CODE
+    xerr;
+
+  if ( f_open( &ZFile, Name, FA_READ) != FR_OK)
+    return XERR_NO_FILE;
+  size = (uint32_t) f_size( &ZFile);
+
+//  A map of the file's clusters, if it isn't too fragmented for one.
+
+  ZFile.cltbl = LinkMap;
+  LinkMap[0] = LINK_MAP_SIZE;
+  if ( f_lseek( &ZFile, CREATE_LINKMAP) != FR_OK)
+    ZFile.cltbl = NULL;
+
+//  ZFILE: the name, then the length in decimal.  The receiver
+//  answers with where to start, or a ZSKIP.
+
+  n = sizeof( digits) - 1;
+  digits[n] = 0;
+  v = size;
+  do
+  {
+    digits[--n] = (char) ('0' + v % 10);
+    v /= 10;
+  } while ( v);
+  infoLen = (int) strlen( Name) + 1;
+  memcpy( info, Name, infoLen);
+  strcpy( (char *) info + infoLen, digits + n);
+  infoLen += (int) sizeof( digits) - n;
+
+  xerr = XERR_TIMEOUT;
+  for ( tries = INIT_RETRIES; tries; tries--)
+  {
+    memset( hdr, 0, sizeof( hdr));
+    hdr[ZF0] = Resume ? ZCRESUM : ZCBIN;
+    PutBinHeader( ZFILE, hdr);
+    PutData( info, infoLen, ZCRCW);
+
+    do
+      type = GetHeader( hdr, HEADER_TIMEOUT);
+    while ( type == ZRINIT || type == ZACK);	// old news
+    if ( type == ZRPOS)
+    {
+      xerr = SendData( GetPos( hdr), size);
+      break;
+    }
+    if ( type == ZSKIP)
+    {
+      xerr = XERR_SKIP;
+      break;
+    }
+    if ( type == ZM_CANCEL || type == ZABORT || type == ZFERR)
+    {
+      xerr = XERR_ABORT;
+      break;
+    }
+  } // until the receiver answers
+
+  f_close( &ZFile);
+  return xerr;
+} // SendOne
+
+//	SendData - Send a file's data from Pos on.
+//	------------------------------------------
+//
+//	A subpacket every 1K, with a ZCRCQ every ACK_INTERVAL to get a
+//	ZACK back; we wait for one if we're a WINDOW ahead.  A ZRPOS
+//	from the receiver sends us back.  If SegSize isn't 0, the
+//	receiver can take only that much at once, so each piece ends
+//	with a ZCRCW and waits.  Ends with ZEOF, answered with ZRINIT.
+//
+
+static XERR_CODE SendData( uint32_t Pos, uint32_t Size)
+{
+
+  uint8_t
+    hdr[4],
+    *buffer = TapeBuffer;
+  uint32_t
+    chunkPos,			// file position of the buffer
+    ackPos,			// receiver has all before this
+    askPos,			// last ZACK asked for
+    segPos;			// start of this segment
+  UINT
+    chunkLen;
+  int
+    len,
+    end,
+    type,
+    errors;
+  bool
+    header;			// ZDATA header due
+  XERR_CODE
+    xerr;
+
+  if ( (xerr = Seek( Pos)) != XERR_SUCCESS)
+    return xerr;
+  chunkPos = Pos;
+  chunkLen = 0;
+  ackPos = askPos = segPos = Pos;
+  errors = 0;
+  header = true;
+
+  while ( true)
+  {
+    if ( header)
+    { // (re)start a frame here
+      PutPos( ZDATA, Pos, false);
+      header = false;
+      segPos = Pos;
+    }
+
+//  Get more of the file if we're past what's in the buffer.
+
+    if ( Pos >= chunkPos + chunkLen && Pos < Size)
+    {
+      chunkPos = Pos;
+      chunkLen = 0;
+      if ( f_read( &ZFile, buffer, SEND_CHUNK, &chunkLen) != FR_OK ||
+        chunkLen == 0)
+        return XERR_NO_FILE;		// card trouble
+    } // if reading
+
+//  Send a subpacket; what ends it depends on what comes next.
+
+    len = (int) (chunkPos + chunkLen - Pos);
+    if ( len > SUBPACKET)
+      len = SUBPACKET;
+    if ( Pos >= Size)
+      len = 0;
+    if ( Pos + len >= Size)
+      end = ZCRCE;
+    else if ( SegSize && Pos + len - segPos >= SegSize)
+      end = ZCRCW;
+    else if ( Pos + len - askPos >= ACK_INTERVAL)
+      end = ZCRCQ;
+    else
+      end = ZCRCG;
+    PutData( buffer + (Pos - chunkPos), len, end);
+    Pos += len;
+    if ( end == ZCRCQ)
+      askPos = Pos;
+
+//  See what the receiver has to say, waiting if it has to say
+//  something before we go on: a ZACK at the end of a segment, an
+//  answer to ZEOF, or a ZACK to move the window along.
+
+    if ( end == ZCRCE)
+      PutPos( ZEOF, Pos, false);
+    while ( true)
+    {
+      if ( end == ZCRCE || end == ZCRCW || Pos - ackPos >= WINDOW)
+      {
+        FlushOut();
+        type = GetHeader( hdr, HEADER_TIMEOUT);
+      }
+      else
+        type = PollHeader( hdr);
+
+      if ( type == ZM_NONE)
+        break;				// nothing; carry on
+
+      switch ( type)
+      {
+        case ZACK:
+          if ( GetPos( hdr) <= Pos && GetPos( hdr) > ackPos)
+          { // progress
+            ackPos = GetPos( hdr);
+            errors = 0;
+          }
+          if ( end == ZCRCW && ackPos == Pos)
+          { // segment taken
+            header = true;
+            end = ZCRCG;
+          }
+          continue;
+
+        case ZRPOS:
+          if ( ++errors > MAX_ERRORS)
+            return XERR_CORRUPT;
+          Pos = GetPos( hdr);
+          if ( Pos > Size || (xerr = Seek( Pos)) != XERR_SUCCESS)
+            return XERR_CORRUPT;
+          chunkPos = Pos;		// read it again from there
+          chunkLen = 0;
+          ackPos = askPos = Pos;
+          header = true;
+          end = ZCRCG;
+          break;
+
+        case ZRINIT:
+          if ( end == ZCRCE)
+            return XERR_SUCCESS;	// the file's there
+          continue;
+
+        case ZSKIP:
+          return XERR_SKIP;
+
+        case ZM_TIMEOUT:
+          if ( end != ZCRCE || ++errors > MAX_ERRORS)
+            return XERR_TIMEOUT;
+          PutPos( ZEOF, Pos, false);	// ask again
+          continue;
+
+        case ZM_CANCEL:
+        case ZABORT:
+        case ZFERR:
+        case ZFIN:
+          return XERR_ABORT;
+
+        default:
+          continue;			// garbled; keep listening
+      } // switch
+      break;
+    } // while listening
+
+  } // while sending
+} // SendData
+
+//	Seek - Move the file being sent to Pos.
+//	---------------------------------------
+//
+
+static XERR_CODE Seek( uint32_t Pos)
+{
+
+  if ( f_lseek( &ZFile, Pos) != FR_OK || f_tell( &ZFile) != Pos)
+    return XERR_CORRUPT;
+  return XERR_SUCCESS;
+} // Seek
+
+//*	ReceiveZmodem - Receive files by ZMODEM.
+//	----------------------------------------
+//
+//	Creates or overwrites each file named in a ZFILE.  If the sender
+//	asks to resume, or Resume is set, a file we already have part of
+//	is carried on from where it ends.  A transfer that fails leaves
+//	what arrived intact on the card, ready to be resumed.
+//
+
+XERR_CODE ReceiveZmodem( bool Resume)
+{
+
+  uint8_t
+    hdr[4],
+    *buffer;
+  int
+    type,
+    len,
+    end,
+    errors,
+    tries;
+  bool
+    data;			// taking data subpackets
+  XERR_CODE
+    xerr;
+
+//	First, flush any characters lying around.
+
+  while( Ucharavail() )
+    Ugetchar();
+
+  FileOpen = false;
+  errors = 0;
+  tries = INIT_RETRIES;
+  xerr = XERR_SUCCESS;
+
+  memset( hdr, 0, sizeof( hdr));
+  hdr[ZF0] = CANFDX | CANOVIO | CANFC32;	// buffer size 0: stream
+  PutHexHeader( ZRINIT, hdr);
+
+  while ( true)
+  {
+    type = GetHeader( hdr, FileOpen ? HEADER_TIMEOUT : INIT_TIMEOUT);
+    switch ( type)
+    {
+      case ZRQINIT:
+        memset( hdr, 0, sizeof( hdr));
+        hdr[ZF0] = CANFDX | CANOVIO | CANFC32;
+        PutHexHeader( ZRINIT, hdr);
+        continue;
+
+      case ZSINIT:			// attention string; not needed
+        disk_claim( TapeBuffer, MAX_SUBPACKET + 1);
+        if ( GetData( TapeBuffer, MAX_SUBPACKET, &len) < 0)
+          continue;
+        PutPos( ZACK, 0, true);
+        continue;
+
+      case ZFILE:
+        CloseReceived();
+        disk_claim( TapeBuffer, MAX_SUBPACKET + 1);
+        end = GetData( TapeBuffer, MAX_SUBPACKET, &len);
+        if ( end < 0)
+        { // garbled; ask again
+          memset( hdr, 0, sizeof( hdr));
+          PutHexHeader( ZNAK, hdr);
+          continue;
+        }
+        if ( !OpenReceived( (char *) TapeBuffer, len,
+          Resume || hdr[ZF0] == ZCRESUM))
+        {
+          memset( hdr, 0, sizeof( hdr));
+          PutHexHeader( ZSKIP, hdr);
+          continue;
+        }
+        errors = 0;
+        PutPos( ZRPOS, RxPos, true);
+        continue;
+
+      case ZDATA:
+        if ( !FileOpen)
+          continue;
+        if ( GetPos( hdr) != RxPos)
+        { // not where we are; again from where we are
+          if ( ++errors > MAX_ERRORS)
+            break;
+          PutPos( ZRPOS, RxPos, true);
+          continue;
+        }
+
+//  The subpackets, straight into the buffer.
+
+        data = true;
+        while ( data)
+        {
+          if ( (RECEIVE_HALF - RxFill < MAX_SUBPACKET + 1 ||
+            (RxPos - RxFill) / RxCluster != RxPos / RxCluster) &&
+            !FlushReceived( false))
+          {
+            xerr = XERR_WRITE;
+            break;
+          }
+          buffer = TapeBuffer + RxHalf * RECEIVE_HALF + RxFill;
+          end = GetData( buffer, MAX_SUBPACKET, &len);
+          if ( end == ZM_CANCEL)
+          {
+            xerr = XERR_ABORT;
+            break;
+          }
+          if ( end < 0)
+          { // bad or missing; again from the last good one
+            if ( ++errors > MAX_ERRORS)
+            {
+              xerr = XERR_CORRUPT;
+              break;
+            }
+            PutPos( ZRPOS, RxPos, true);
+            break;
+          }
+
+          RxFill += len;
+          RxPos += len;
+          errors = 0;
+          switch ( end)
+          {
+            case ZCRCW:
+              PutPos( ZACK, RxPos, true);
+              data = false;
+              break;
+
+            case ZCRCQ:
+              PutPos( ZACK, RxPos, true);
+              break;
+
+            case ZCRCE:
+              data = false;
+              break;
+
+            default:
+              break;
+          } // switch
+        } // while data
+        if ( xerr != XERR_SUCCESS)
+          break;
+        continue;
+
+      case ZEOF:
+        if ( !FileOpen || GetPos( hdr) != RxPos)
+          continue;			// data's still to come
+        if ( !FlushReceived( true))
+        {
+          xerr = XERR_WRITE;
+          break;
+        }
+        CloseReceived();
+        memset( hdr, 0, sizeof( hdr));
+        hdr[ZF0] = CANFDX | CANOVIO | CANFC32;
+        PutHexHeader( ZRINIT, hdr);
+        continue;
+
+      case ZFIN:
+        CloseReceived();
+        memset( hdr, 0, sizeof( hdr));
+        PutHexHeader( ZFIN, hdr);
+        FlushOut();
+        GetRaw( INIT_TIMEOUT);		// "OO"
+        GetRaw( INIT_TIMEOUT);
+        return XERR_SUCCESS;
+
+      case ZM_CANCEL:
+      case ZABORT:
+        xerr = XERR_ABORT;
+        break;
+
+      case ZM_TIMEOUT:
+      case ZM_ERROR:
+        if ( FileOpen)
+        { // where's the data?
+          if ( ++errors > MAX_ERRORS)
+          {
+            xerr = type == ZM_TIMEOUT ? XERR_TIMEOUT : XERR_CORRUPT;
+            break;
+          }
+          PutPos( ZRPOS, RxPos, true);
+        }
+        else
+        { // nobody's started yet
+          if ( --tries == 0)
+          {
+            xerr = XERR_TIMEOUT;
+            break;
+          }
+          memset( hdr, 0, sizeof( hdr));
+          hdr[ZF0] = CANFDX | CANOVIO | CANFC32;
+          PutHexHeader( ZRINIT, hdr);
+        }
+        continue;
+
+      default:
+        continue;
+    } // switch
+    break;
+  } // while
+
+//  Something went wrong.  Keep what we have, for a resume.
+
+  if ( xerr == XERR_SUCCESS)
+    xerr = XERR_CORRUPT;
+  FlushReceived( true);
+  CloseReceived();
+  if ( xerr != XERR_ABORT)
+    Cancel();
+  return xerr;
+} // ReceiveZmodem
+
+//	OpenReceived - Open the file a ZFILE names.
+//	-------------------------------------------
+//
+//	Info is the ZFILE subpacket: the name, then the length and other
+//	things we don't use.  To resume, we keep what's there, unless
+//	it's more than is coming.  Sets RxPos to where the data starts.
+//	Returns false if the file can't be had.
+//
+
+static bool OpenReceived( char *Info, int Length, bool Resume)
+{
+
+  char
+    name[64];
+  uint32_t
+    size;
+  FSIZE_t
+    have;
+
+  Info[ Length < MAX_SUBPACKET ? Length : MAX_SUBPACKET - 1] = 0;
+  strncpy( name, Info, sizeof( name) - 1);
+  name[ sizeof( name) - 1] = 0;
+  if ( !name[0])
+    return false;
+  size = (uint32_t) strtoul( Info + strlen( Info) + 1, NULL, 10);
+
+  RxPos = 0;
+  RxHalf = RxFill = 0;
+  disk_claim( TapeBuffer, RECEIVE_HALF);
+  if ( Resume)
+  {
+    if ( f_open( &ZFile, name, FA_OPEN_ALWAYS | FA_WRITE) != FR_OK)
+      return false;
+    have = f_size( &ZFile);
+    if ( have <= size && f_lseek( &ZFile, have) == FR_OK)
+      RxPos = (uint32_t) have;
+    else if ( f_lseek( &ZFile, 0) != FR_OK || f_truncate( &ZFile) != FR_OK)
+    {
+      f_close( &ZFile);
+      return false;
+    }
+  } // if resuming
+  else if ( f_open( &ZFile, name, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK)
+    return false;
+
+  RxCluster = (uint32_t) ZFile.obj.fs->csize * BLOCK_SIZE;
+  FileOpen = true;
+  return true;
+} // OpenReceived
+
+//	FlushReceived - Write what's in the buffer to the file.
+//	-------------------------------------------------------
+//
+//	The card writes it behind our back while we fill the other half,
+//	but only if it's a piece FatFs hands over whole: no more than a
+//	cluster.  So unless All is set, what goes ends at a cluster
+//	boundary in the file if there's one, a block boundary if not,
+//	and the rest starts the other half.  Returns false if it
+//	couldn't be written.
+//
+
+static bool FlushReceived( bool All)
+{
+
+  uint8_t
+    *half;
+  uint32_t
+    start,
+    edge;
+  UINT
+    count,
+    wc;
+  bool
+    ok;
+
+  ok = true;
+  count = (UINT) RxFill;
+  if ( !All)
+  {
+    start = RxPos - RxFill;
+    edge = RxPos - RxPos % RxCluster;
+    if ( edge <= start)
+      edge = RxPos - RxPos % BLOCK_SIZE;
+    count = edge - start;
+  }
+  if ( FileOpen && count)
+  {
+    half = TapeBuffer + RxHalf * RECEIVE_HALF;
+    ok = f_write( &ZFile, half, count, &wc) == FR_OK && wc == count;
+    RxHalf ^= 1;
+    disk_claim( TapeBuffer + RxHalf * RECEIVE_HALF, RECEIVE_HALF);
+    memcpy( TapeBuffer + RxHalf * RECEIVE_HALF, half + count,
+      RxFill - count);
+  }
+  RxFill -= (int) count;
+  return ok;
+} // FlushReceived
+
+//	CloseReceived - Close the file being received, if it's open.
+//	------------------------------------------------------------
+//
+
+static void CloseReceived( void)
+{
+
+  if ( FileOpen)
+    f_close( &ZFile);
+  FileOpen = false;
+  return;
+} // CloseReceived
+
+//*	Headers.
+//	========
+
+//	GetHeader - Wait for a header.
+//	------------------------------
+//
+//	Skips anything that isn't one.  Returns the frame type with the
+//	four header bytes in Hdr, or a ZM_ code.
+//
+
+static int GetHeader( uint8_t *Hdr, uint32_t TimeOut)
+{
+
+  uint8_t
+    buf[9];
+  int
+    garbage,
+    cans,
+    type,
+    c,
+    i,
+    n;
+  uint32_t
+    crc;
+
+  garbage = cans = 0;
+  while ( true)
+  {
+    if ( (c = GetRaw( TimeOut)) < 0)
+      return c;
+    if ( c == ZDLE)
+    {
+      if ( ++cans >= 5)
+        return ZM_CANCEL;
+      continue;
+    }
+    cans = 0;
+    if ( c != ZPAD)
+    {
+      if ( ++garbage > GARBAGE_LIMIT)
+        return ZM_ERROR;
+      continue;
+    }
+
+    while ( (c = GetRaw( TimeOut)) == ZPAD)
+      ;
+    if ( c < 0)
+      return c;
+    if ( c != ZDLE)
+      continue;
+
+//  "*", ZDLE turns up in data now and then; only a header type
+//  makes it a header.
+
+    if ( (type = GetRaw( TimeOut)) < 0)
+      return type;
+    if ( type == ZHEX || type == ZBIN || type == ZBIN32)
+      break;
+    if ( (garbage += 3) > GARBAGE_LIMIT)
+      return ZM_ERROR;
+  } // while looking
+
+  switch ( type)
+  {
+    case ZHEX:
+      for ( i = 0; i < 7; i++)
+      {
+        if ( (c = GetHexByte( TimeOut)) < 0)
+          return c;
+        buf[i] = (uint8_t) c;
+      }
+      if ( CRC16Add( 0, buf, 7))
+        return ZM_ERROR;
+      if ( ((c = GetRaw( TimeOut)) & 0x7f) == '\r')
+        GetRaw( TimeOut);		// and LF
+      RxCrc32 = false;
+      break;
+
+    case ZBIN:
+    case ZBIN32:
+      n = type == ZBIN32 ? 9 : 7;
+      for ( i = 0; i < n; i++)
+      {
+        if ( (c = GetEscaped( TimeOut)) < 0)
+          return c;
+        if ( c & ZM_FRAME)
+          return ZM_ERROR;
+        buf[i] = (uint8_t) c;
+      }
+      if ( type == ZBIN32)
+      {
+        crc = (uint32_t) buf[5] | ((uint32_t) buf[6] << 8) |
+          ((uint32_t) buf[7] << 16) | ((uint32_t) buf[8] << 24);
+        if ( CRC32( 0, buf, 5) != crc)
+          return ZM_ERROR;
+      }
+      else if ( CRC16Add( 0, buf, 7))
+        return ZM_ERROR;
+      RxCrc32 = type == ZBIN32;
+      break;
+  } // switch
+
+  memcpy( Hdr, buf + 1, 4);
+  return buf[0];
+} // GetHeader
+
+//	PollHeader - Take a header if one's coming.
+//	-------------------------------------------
+//
+//	Doesn't wait for the start of one, and drops anything that can't
+//	be.  Returns ZM_NONE if there's nothing.
+//
+
+static int PollHeader( uint8_t *Hdr)
+{
+
+  uint8_t
+    *in;
+
+  FlushOut();
+  while ( USCharReady())
+  {
+    USPeekInput( &in);
+    if ( *in == ZPAD || *in == ZDLE)
+      return GetHeader( Hdr, HEADER_TIMEOUT);
+    USSkipInput( 1);
+  }
+  return ZM_NONE;
+} // PollHeader
+
+//	GetHexByte - Two hex digits, as a byte.
+//	---------------------------------------
+//
+
+static int GetHexByte( uint32_t TimeOut)
+{
+
+  int
+    c,
+    i,
+    v;
+
+  v = 0;
+  for ( i = 0; i < 2; i++)
+  {
+    if ( (c = GetRaw( TimeOut)) < 0)
+      return c;
+    c &= 0x7f;
+    if ( c >= '0' && c <= '9')
+      v = (v << 4) | (c - '0');
+    else if ( c >= 'a' && c <= 'f')
+      v = (v << 4) | (c - 'a' + 10);
+    else
+      return ZM_ERROR;
+  }
+  return v;
+} // GetHexByte
+
+//	PutHexHeader - Send a header in hex.
+//	------------------------------------
+//
+//	For the receiver's headers and the sender's ZRQINIT and ZFIN.
+//
+
+static void PutHexHeader( int Type, const uint8_t *Hdr)
+{
+
+  static const char
+    hex[] = "0123456789abcdef";
+  uint8_t
+    buf[5];
+  uint16_t
+    crc;
+  int
+    i;
+
+  buf[0] = (uint8_t) Type;
+  memcpy( buf + 1, Hdr, 4);
+  crc = CRC16Add( 0, buf, 5);
+
+  PutOut( ZPAD);
+  PutOut( ZPAD);
+  PutOut( ZDLE);
+  PutOut( ZHEX);
+  for ( i = 0; i < 7; i++)
+  {
+    uint8_t
+      b;
+
+    b = i < 5 ? buf[i] : (uint8_t) (i == 5 ? crc >> 8 : crc);
+    PutOut( hex[ b >> 4]);
+    PutOut( hex[ b & 15]);
+  }
+  PutOut( '\r');
+  PutOut( '\n' | 0x80);
+  if ( Type != ZFIN && Type != ZACK)
+    PutOut( XON);
+  FlushOut();
+  return;
+} // PutHexHeader
+
+//	PutBinHeader - Send a header in binary.
+//	---------------------------------------
+//
+//	With a 32-bit CRC if the receiver can take one.
+//
+
+static void PutBinHeader( int Type, const uint8_t *Hdr)
+{
+
+  uint8_t
+    buf[5];
+  uint32_t
+    crc;
+  int
+    i;
+
+  buf[0] = (uint8_t) Type;
+  memcpy( buf + 1, Hdr, 4);
+
+  PutOut( ZPAD);
+  PutOut( ZDLE);
+  PutOut( TxCrc32 ? ZBIN32 : ZBIN);
+  for ( i = 0; i < 5; i++)
+    PutEscaped( buf[i]);
+  if ( TxCrc32)
+  {
+    crc = CRC32( 0, buf, 5);
+    for ( i = 0; i < 4; i++, crc >>= 8)
+      PutEscaped( (uint8_t) crc);
+  }
+  else
+  {
+    crc = CRC16Add( 0, buf, 5);
+    PutEscaped( (uint8_t) (crc >> 8));
+    PutEscaped( (uint8_t) crc);
+  }
+  return;
+} // PutBinHeader
+
+//	PutPos - Send a header that carries a file position.
+//	----------------------------------------------------
+//
+
+static void PutPos( int Type, uint32_t Pos, bool Hex)
+{
+
+  uint8_t
+    hdr[4];
+
+  SetPos( hdr, Pos);
+  if ( Hex)
+    PutHexHeader( Type, hdr);
+  else
+    PutBinHeader( Type, hdr);
+  return;
+} // PutPos
+
+//*	Data subpackets.
+//	================
+
+//	GetData - Receive a data subpacket.
+//	-----------------------------------
+//
+//	Into Buf, which has room for Max bytes and one more.  Runs of
+//	plain bytes are copied straight out of the input queue.  Returns
+//	the subpacket end (ZCRCx) with the length in Length, or a ZM_
+//	code if it's bad or doesn't come.
+//
+
+static int GetData( uint8_t *Buf, int Max, int *Length)
+{
+
+  uint8_t
+    *in,
+    crcBuf[4];
+  uint32_t
+    crc;
+  int
+    got,
+    end,
+    c,
+    i,
+    n;
+
+  got = 0;
+  while ( true)
+  {
+    n = USPeekInput( &in);
+    for ( i = 0; i < n && got < Max; i++)
+    {
+      if ( (in[i] & 0x70) == 0x10)
+        break;				// could be ZDLE, XON or XOFF
+      Buf[ got++] = in[i];
+    }
+    USSkipInput( i);
+    if ( i < n || n == 0)
+    { // something special, or nothing yet
+      if ( (c = GetEscaped( HEADER_TIMEOUT)) < 0)
+        return c;
+      if ( c & ZM_FRAME)
+        break;
+      if ( got >= Max)
+        return ZM_ERROR;		// too long
+      Buf[ got++] = (uint8_t) c;
+    }
+  } // while in the subpacket
+
+  end = c & 0xff;
+  n = RxCrc32 ? 4 : 2;
+  for ( i = 0; i < n; i++)
+  {
+    if ( (c = GetEscaped( HEADER_TIMEOUT)) < 0)
+      return c;
+    if ( c & ZM_FRAME)
+      return ZM_ERROR;
+    crcBuf[i] = (uint8_t) c;
+  }
+
+//  The CRC covers the data and the end character.
+
+  Buf[ got] = (uint8_t) end;
+  if ( RxCrc32)
+  {
+    crc = (uint32_t) crcBuf[0] | ((uint32_t) crcBuf[1] << 8) |
+      ((uint32_t) crcBuf[2] << 16) | ((uint32_t) crcBuf[3] << 24);
+    if ( CRC32( 0, Buf, got + 1) != crc)
+      return ZM_ERROR;
+  }
+  else if ( CRC16Add( CRC16Add( 0, Buf, (uint16_t) (got + 1)), crcBuf, 2))
+    return ZM_ERROR;
+
+  *Length = got;
+  return end;
+} // GetData
+
+//	PutData - Send a data subpacket.
+//	--------------------------------
+//
+//	FrameEnd is the ZCRCx that ends it.
+//
+
+static void PutData( const uint8_t *Buf, int Length, int FrameEnd)
+{
+
+  uint8_t
+    end;
+  uint32_t
+    crc;
+  int
+    i;
+
+  end = (uint8_t) FrameEnd;
+  for ( i = 0; i < Length; i++)
+    PutEscaped( Buf[i]);
+  PutOut( ZDLE);
+  PutOut( end);
+
+  if ( TxCrc32)
+  {
+    crc = CRC32( CRC32( 0, Buf, Length), &end, 1);
+    for ( i = 0; i < 4; i++, crc >>= 8)
+      PutEscaped( (uint8_t) crc);
+  }
+  else
+  {
+    crc = CRC16Add( CRC16Add( 0, Buf, (uint16_t) Length), &end, 1);
+    PutEscaped( (uint8_t) (crc >> 8));
+    PutEscaped( (uint8_t) crc);
+  }
+  if ( FrameEnd == ZCRCW)
+    PutOut( XON);
+  if ( FrameEnd != ZCRCG)
+    FlushOut();
+  return;
+} // PutData
+
+//*	Characters.
+//	===========
+
+//	GetEscaped - Next character, with ZDLE escapes undone.
+//	------------------------------------------------------
+//
+//	XON and XOFF are flow control, not data, and are dropped.
+//	Returns the character, ZM_FRAME with the end of a subpacket, or
+//	a ZM_ code.
+//
+
+static int GetEscaped( uint32_t TimeOut)
+{
+
+  int
+    c,
+    cans;
+
+  do
+  {
+    if ( (c = GetRaw( TimeOut)) < 0)
+      return c;
+  } while ( (c & 0x7f) == XON || (c & 0x7f) == XOFF);
+  if ( c != ZDLE)
+    return c;
+
+  cans = 1;
+  while ( true)
+  {
+    if ( (c = GetRaw( TimeOut)) < 0)
+      return c;
+    switch ( c)
+    {
+      case ZDLE:
+        if ( ++cans >= 5)
+          return ZM_CANCEL;
+        continue;
+
+      case XON:
+      case XON | 0x80:
+      case XOFF:
+      case XOFF | 0x80:
+        continue;
+
+      case ZCRCE:
+      case ZCRCG:
+      case ZCRCQ:
+      case ZCRCW:
+        return ZM_FRAME | c;
+
+      case ZRUB0:
+        return 0x7f;
+
+      case ZRUB1:
+        return 0xff;
+
+      default:
+        if ( (c & 0x60) == 0x40)
+          return c ^ 0x40;
+        return ZM_ERROR;
+    } // switch
+  } // while
+} // GetEscaped
+
+//	GetRaw - Next character as it comes.
+//	------------------------------------
+//
+//	TimeOut is in milliseconds.  Returns ZM_TIMEOUT if nothing comes.
+//
+
+static int GetRaw( uint32_t TimeOut)
+{
+
+  uint8_t
+    *in,
+    c;
+  uint32_t
+    start;
+
+  FlushOut();
+  start = Milliseconds;
+  while ( USPeekInput( &in) == 0)
+  {
+    if ( (Milliseconds - start) > TimeOut)
+      return ZM_TIMEOUT;
+  }
+  c = *in;
+  USSkipInput( 1);
+  return c;
+} // GetRaw
+
+//	PutEscaped - Send a character, escaped if it has to be.
+//	-------------------------------------------------------
+//
+//	ZDLE and the flow control characters, with or without the top
+//	bit.
+//
+
+static void PutEscaped( uint8_t What)
+{
+
+  if ( (What & 0x70) == 0x10)
+  {
+    switch ( What & 0x7f)
+    {
+      case ZDLE:
+      case 0x10:			// DLE
+      case XON:
+      case XOFF:
+        PutOut( ZDLE);
+        What ^= 0x40;
+        break;
+
+      default:
+        break;
+    } // switch
+  } // if maybe special
+  PutOut( What);
+  return;
+} // PutEscaped
+
+//	PutOut - Stage a character to send.
+//	-----------------------------------
+//
+
+static void PutOut( uint8_t What)
+{
+
+  Out[ OutLen++] = What;
+  if ( OutLen == OUT_SIZE)
+    FlushOut();
+  return;
+} // PutOut
+
+//	FlushOut - Send what's staged.
+//	------------------------------
+//
+
+static void FlushOut( void)
+{
+
+  if ( OutLen)
+    USWriteBlock( Out, OutLen);
+  OutLen = 0;
+  return;
+} // FlushOut
+
+//	SetPos, GetPos - File position in a header.
+//	-------------------------------------------
+//
+
+static void SetPos( uint8_t *Hdr, uint32_t Pos)
+{
+
+  Hdr[ZP0] = (uint8_t) Pos;
+  Hdr[ZP1] = (uint8_t) (Pos >> 8);
+  Hdr[ZP2] = (uint8_t) (Pos >> 16);
+  Hdr[ZP3] = (uint8_t) (Pos >> 24);
+  return;
+} // SetPos
+
+static uint32_t GetPos( const uint8_t *Hdr)
+{
+  return (uint32_t) Hdr[ZP0] | ((uint32_t) Hdr[ZP1] << 8) |
+    ((uint32_t) Hdr[ZP2] << 16) | ((uint32_t) Hdr[ZP3] << 24);
+} // GetPos
+
+//	Cancel - Tell the other end we're giving up.
+//	--------------------------------------------
+//
+//	Eight CANs, then as many backspaces to clean up after them.
+//
+
+static void Cancel( void)
+{
+
+  int
+    i;
+
+  for ( i = 0; i < 8; i++)
+    PutOut( ZDLE);
+  for ( i = 0; i < 8; i++)
+    PutOut( '\b');
+  FlushOut();
+  return;
+} // Cancel